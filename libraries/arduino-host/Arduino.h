@@ -0,0 +1,75 @@
+#ifndef __HOST_ARDUINO_H__
+#define __HOST_ARDUINO_H__
+
+// Host (Linux) stand-ins for the subset of the Arduino-ESP32 core used by the gateway.
+// Note ARDUINO is deliberately not defined, so code with host fallbacks (eg. rtos.h) uses them.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <array>
+#include <functional>
+
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+#include "IPAddress.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// Time since the program started
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+// ESP32 SNTP/time helpers. The host clock is assumed to be synchronized already.
+bool getLocalTime(struct tm* info, uint32_t ms = 5000);
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char* server1, const char* server2 = nullptr, const char* server3 = nullptr);
+
+// Serial is mapped onto stdout (writes) and stdin (reads)
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long baud) { }
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    int availableForWrite() override { return 4096; }
+    void flush() override;
+    operator bool() const { return true; }
+    using Print::write;
+};
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+    void restart();
+    const char* getChipModel() { return "host"; }
+    const char* getSdkVersion() { return "native"; }
+    uint32_t getFreeHeap() { return 0; }
+    uint32_t getMinFreeHeap() { return 0; }
+    uint32_t getMaxAllocHeap() { return 0; }
+    uint32_t getHeapSize() { return 0; }
+};
+extern EspClass ESP;
+
+inline bool psramFound() { return false; }
+inline void* ps_malloc(size_t size) { return malloc(size); }
+
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+
+#endif /* __HOST_ARDUINO_H__ */
@@ -0,0 +1,16 @@
+#ifndef __HOST_ESPMDNS_H__
+#define __HOST_ESPMDNS_H__
+
+#include "Arduino.h"
+
+// mDNS discovery is not supported on the host, a broker must be configured explicitly
+class MDNSResponder {
+public:
+    int queryService(const char* service, const char* proto) { return 0; }
+    String hostname(int idx) { return String(); }
+    IPAddress IP(int idx) { return IPAddress(); }
+    uint16_t port(int idx) { return 0; }
+};
+extern MDNSResponder MDNS;
+
+#endif /* __HOST_ESPMDNS_H__ */
@@ -0,0 +1,164 @@
+#include "HostClient.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static const int connectTimeoutMs = 5000;
+
+int HostClient::connect(IPAddress ip, uint16_t port)
+{
+    char host[16];
+    snprintf(host, sizeof(host), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+    return connect(host, port);
+}
+
+int HostClient::connect(const char* host, uint16_t port)
+{
+    stop();
+
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(host, service, &hints, &result) != 0)
+        return 0;
+
+    for (struct addrinfo* ai = result; ai != nullptr; ai = ai->ai_next) {
+        int s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (s < 0)
+            continue;
+
+        fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+        int rc = ::connect(s, ai->ai_addr, ai->ai_addrlen);
+        if ((rc < 0) && (errno == EINPROGRESS)) {
+            struct pollfd pfd = { s, POLLOUT, 0 };
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if ((poll(&pfd, 1, connectTimeoutMs) == 1) &&
+                (getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &len) == 0) && (err == 0))
+            {
+                rc = 0;
+            }
+        }
+
+        if (rc == 0) {
+            int one = 1;
+            setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            fd = s;
+            break;
+        }
+        close(s);
+    }
+
+    freeaddrinfo(result);
+    return (fd >= 0) ? 1 : 0;
+}
+
+size_t HostClient::write(const uint8_t* buf, size_t size)
+{
+    if (fd < 0)
+        return 0;
+
+    size_t n = 0;
+    while (n < size) {
+        ssize_t rc = send(fd, buf + n, size - n, MSG_NOSIGNAL);
+        if (rc > 0) {
+            n += rc;
+        }
+        else if ((rc < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            // Socket buffer full, wait briefly for it to drain
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+            if (poll(&pfd, 1, connectTimeoutMs) != 1)
+                break;
+        }
+        else {
+            stop();
+            break;
+        }
+    }
+    written += n;
+    return n;
+}
+
+int HostClient::available()
+{
+    if (fd < 0)
+        return 0;
+
+    int n = 0;
+    if (ioctl(fd, FIONREAD, &n) < 0)
+        return 0;
+    return n + ((peeked >= 0) ? 1 : 0);
+}
+
+int HostClient::read()
+{
+    uint8_t c;
+    return (read(&c, 1) == 1) ? c : -1;
+}
+
+int HostClient::read(uint8_t* buf, size_t size)
+{
+    if ((fd < 0) || (size == 0))
+        return -1;
+
+    size_t n = 0;
+    if (peeked >= 0) {
+        buf[n++] = static_cast<uint8_t>(peeked);
+        peeked = -1;
+    }
+
+    ssize_t rc = recv(fd, buf + n, size - n, 0);
+    if (rc > 0) {
+        n += rc;
+    }
+    else if ((rc == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+        stop(); // Closed by the peer
+    }
+    return (n > 0) ? static_cast<int>(n) : -1;
+}
+
+int HostClient::peek()
+{
+    if (peeked < 0) {
+        uint8_t c;
+        if ((fd >= 0) && (recv(fd, &c, 1, 0) == 1))
+            peeked = c;
+    }
+    return peeked;
+}
+
+void HostClient::stop()
+{
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    peeked = -1;
+}
+
+uint8_t HostClient::connected()
+{
+    if (fd < 0)
+        return 0;
+
+    // Detect a connection closed by the peer
+    uint8_t c;
+    ssize_t rc = recv(fd, &c, 1, MSG_PEEK);
+    if ((rc == 0) || ((rc < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+        stop();
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,36 @@
+#ifndef __HOST_CLIENT_TCP_H__
+#define __HOST_CLIENT_TCP_H__
+
+#include "Client.h"
+
+// Plain TCP client over POSIX sockets, standing in for WiFiClient(Secure).
+// Connecting blocks (with a timeout), reads & writes never block.
+class HostClient : public Client {
+public:
+    HostClient() : fd(-1), peeked(-1) { }
+    ~HostClient() { stop(); }
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char* host, uint16_t port) override;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buf, size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t* buf, size_t size) override;
+    int peek() override;
+    void flush() override { }
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return fd >= 0; }
+    using Print::write;
+
+    // Bytes written since the client was created
+    uint64_t bytesWritten() const { return written; }
+
+protected:
+    int fd;
+    int peeked;
+    uint64_t written = 0;
+};
+
+#endif /* __HOST_CLIENT_TCP_H__ */
@@ -0,0 +1,220 @@
+#ifdef HOST_TLS
+
+#include "HostTlsClient.h"
+
+#include <poll.h>
+#include <signal.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+static const int handshakeTimeoutMs = 5000;
+
+HostTlsClient::~HostTlsClient()
+{
+    stop();
+    if (session != nullptr) {
+        SSL_SESSION_free(session);
+    }
+    if (ctx != nullptr) {
+        SSL_CTX_free(ctx);
+    }
+}
+
+// Wait for the socket after a non-blocking SSL call returned rc.
+// Returns false if the call failed, or the socket did not become ready in time.
+bool HostTlsClient::wait(int rc, int timeout_ms)
+{
+    struct pollfd pfd = { fd, 0, 0 };
+    switch (SSL_get_error(ssl, rc)) {
+        case SSL_ERROR_WANT_READ:   pfd.events = POLLIN; break;
+        case SSL_ERROR_WANT_WRITE:  pfd.events = POLLOUT; break;
+        default:
+            return false;
+    }
+    return poll(&pfd, 1, timeout_ms) == 1;
+}
+
+int HostTlsClient::connect(const char* host, uint16_t port)
+{
+    stop();
+
+    if (ctx == nullptr) {
+        // OpenSSL writes to the socket directly, so a closed connection would raise SIGPIPE
+        signal(SIGPIPE, SIG_IGN);
+
+        ctx = SSL_CTX_new(TLS_client_method());
+        if (ctx == nullptr)
+            return 0;
+
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+        if (ca_file != nullptr) {
+            if (SSL_CTX_load_verify_locations(ctx, ca_file, nullptr) != 1) {
+                fprintf(stderr, "Could not load CA file %s\n", ca_file);
+                return 0;
+            }
+            SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+        }
+    }
+
+    // Fall back to a full handshake if the cached session causes the handshake to fail
+    int rc = handshake(host, port, session != nullptr);
+    if ((rc == 0) && (session != nullptr)) {
+        SSL_SESSION_free(session);
+        session = nullptr;
+        rc = handshake(host, port, false);
+    }
+    return (rc > 0) ? 1 : 0;
+}
+
+// Returns 1 if connected, 0 if the handshake failed, or -1 if the broker couldn't be reached
+
+
+int HostTlsClient::handshake(const char* host, uint16_t port, bool resume)
+{
+    if (!HostClient::connect(host, port))
+        return -1;
+
+    ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, fd);
+    SSL_set_tlsext_host_name(ssl, host);
+    if (ca_file != nullptr) {
+        SSL_set1_host(ssl, host);
+    }
+    if (resume) {
+        SSL_set_session(ssl, session);
+    }
+
+    int rc;
+    while ((rc = SSL_connect(ssl)) != 1) {
+        if (!wait(rc, handshakeTimeoutMs)) {
+            ERR_print_errors_fp(stderr);
+            stop();
+            return 0;
+        }
+    }
+
+    handshakes++;
+    if (SSL_session_reused(ssl)) {
+        resumed++;
+    }
+
+    keepSession();
+    return 1;
+}
+
+// Keep the current session to resume next time, if it can be.
+// With TLS 1.3 the ticket only arrives after the handshake, so this is also done on stop().
+void HostTlsClient::keepSession()
+{
+    SSL_SESSION* current = SSL_get1_session(ssl);
+    if (current == nullptr)
+        return;
+
+    if (SSL_SESSION_is_resumable(current) && (current != session)) {
+        if (session != nullptr) {
+            SSL_SESSION_free(session);
+        }
+        session = current;
+    }
+    else {
+        SSL_SESSION_free(current);
+    }
+}
+
+size_t HostTlsClient::write(const uint8_t* buf, size_t size)
+{
+    if ((ssl == nullptr) || (size == 0))
+        return 0;
+
+    size_t n = 0;
+    while (n < size) {
+        int rc = SSL_write(ssl, buf + n, static_cast<int>(size - n));
+        if (rc > 0) {
+            n += rc;
+            records++;
+        }
+        else if (!wait(rc, handshakeTimeoutMs)) {
+            stop();
+            break;
+        }
+    }
+    return n;
+}
+
+int HostTlsClient::available()
+{
+    if (ssl == nullptr)
+        return 0;
+
+    // SSL_pending() only counts data that has already been decrypted,
+    // so read ahead one byte to find out if a record has arrived.
+    peek();
+    return ((ssl != nullptr) ? SSL_pending(ssl) : 0) + ((peeked >= 0) ? 1 : 0);
+}
+
+int HostTlsClient::read()
+{
+    uint8_t c;
+    return (read(&c, 1) == 1) ? c : -1;
+}
+
+int HostTlsClient::read(uint8_t* buf, size_t size)
+{
+    if ((ssl == nullptr) || (size == 0))
+        return -1;
+
+    size_t n = 0;
+    if (peeked >= 0) {
+        buf[n++] = static_cast<uint8_t>(peeked);
+        peeked = -1;
+    }
+
+    if (n < size) {
+        int rc = SSL_read(ssl, buf + n, static_cast<int>(size - n));
+        if (rc > 0) {
+            n += rc;
+        }
+        else {
+            int err = SSL_get_error(ssl, rc);
+            if ((err != SSL_ERROR_WANT_READ) && (err != SSL_ERROR_WANT_WRITE)) {
+                stop(); // Closed by the peer
+            }
+        }
+    }
+    return (n > 0) ? static_cast<int>(n) : -1;
+}
+
+int HostTlsClient::peek()
+{
+    if ((peeked < 0) && (ssl != nullptr)) {
+        uint8_t c;
+        if (read(&c, 1) == 1)
+            peeked = c;
+    }
+    return peeked;
+}
+
+void HostTlsClient::stop()
+{
+    if (ssl != nullptr) {
+        if (SSL_is_init_finished(ssl)) {
+            keepSession();
+        }
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+        ssl = nullptr;
+    }
+    peeked = -1;
+    HostClient::stop();
+}
+
+uint8_t HostTlsClient::connected()
+{
+    if (ssl == nullptr)
+        return 0;
+    if ((peeked >= 0) || (SSL_pending(ssl) > 0))
+        return 1;
+    return HostClient::connected();
+}
+
+#endif /* HOST_TLS */
@@ -0,0 +1,58 @@
+#ifndef __HOST_CLIENT_TLS_H__
+#define __HOST_CLIENT_TLS_H__
+
+#ifdef HOST_TLS
+
+#include "HostClient.h"
+
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_st SSL;
+typedef struct ssl_session_st SSL_SESSION;
+
+// TLS client using OpenSSL, standing in for the firmware's TlsClient.
+// Like it, the previous session is resumed when reconnecting.
+// Requires -DHOST_TLS, and linking with -lssl -lcrypto.
+class HostTlsClient : public HostClient {
+public:
+    HostTlsClient() : ctx(nullptr), ssl(nullptr), session(nullptr), ca_file(nullptr), peeked(-1), records(0), handshakes(0), resumed(0) { }
+    ~HostTlsClient();
+
+    // PEM file of the CA used to verify the broker. Without one, the certificate is not verified.
+    void setCACertFile(const char* path) { ca_file = path; }
+
+    using HostClient::connect;
+    int connect(const char* host, uint16_t port) override;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buf, size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t* buf, size_t size) override;
+    int peek() override;
+    void stop() override;
+    uint8_t connected() override;
+    using Print::write;
+
+    // TLS records written since the client was created (one per write)
+    uint64_t recordsWritten() const { return records; }
+
+    // Successful handshakes, and how many of them resumed the previous session
+    uint32_t handshakeCount() const { return handshakes; }
+    uint32_t resumedCount() const { return resumed; }
+
+private:
+    bool wait(int rc, int timeout_ms);
+    int handshake(const char* host, uint16_t port, bool resume);
+    void keepSession();
+
+    SSL_CTX* ctx;
+    SSL* ssl;
+    SSL_SESSION* session;
+    const char* ca_file;
+    int peeked;
+    uint64_t records;
+    uint32_t handshakes;
+    uint32_t resumed;
+};
+
+#endif /* HOST_TLS */
+#endif /* __HOST_CLIENT_TLS_H__ */
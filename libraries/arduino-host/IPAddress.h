@@ -0,0 +1,27 @@
+#ifndef __HOST_IPADDRESS_H__
+#define __HOST_IPADDRESS_H__
+
+#include <stdint.h>
+#include "Printable.h"
+
+class IPAddress : public Printable {
+public:
+    IPAddress() : addr(0) { }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+        : addr(static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 8) | (static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24))
+    { }
+    IPAddress(uint32_t addr) : addr(addr) { }
+
+    operator uint32_t() const { return addr; }
+    uint8_t operator[](int i) const { return static_cast<uint8_t>(addr >> (i * 8)); }
+    bool operator==(const IPAddress& rhs) const { return addr == rhs.addr; }
+
+    size_t printTo(Print& p) const override;
+
+private:
+    uint32_t addr;  // Network byte order, as on the ESP32
+};
+
+#define INADDR_NONE IPAddress(0, 0, 0, 0)
+
+#endif /* __HOST_IPADDRESS_H__ */
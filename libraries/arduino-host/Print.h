@@ -0,0 +1,60 @@
+#ifndef __HOST_PRINT_H__
+#define __HOST_PRINT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print;
+
+class Printable {
+public:
+    virtual ~Printable() { }
+    virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+public:
+    virtual ~Print() { }
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* str);
+    size_t write(const char* buffer, size_t size) { return write(reinterpret_cast<const uint8_t*>(buffer), size); }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() { }
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+    size_t print(const String& s);
+    size_t print(const char* s);
+    size_t print(char c);
+    size_t print(unsigned char v, int base = DEC);
+    size_t print(int v, int base = DEC);
+    size_t print(unsigned int v, int base = DEC);
+    size_t print(long v, int base = DEC);
+    size_t print(unsigned long v, int base = DEC);
+    size_t print(long long v, int base = DEC);
+    size_t print(unsigned long long v, int base = DEC);
+    size_t print(double v, int digits = 2);
+    size_t print(const Printable& p);
+    size_t print(const struct tm* timeinfo, const char* format = nullptr);
+
+    size_t println();
+    template <typename T>
+    size_t println(const T& v) { size_t n = print(v); return n + println(); }
+    template <typename T>
+    size_t println(const T& v, int base) { size_t n = print(v, base); return n + println(); }
+    size_t println(const struct tm* timeinfo, const char* format = nullptr) { size_t n = print(timeinfo, format); return n + println(); }
+
+private:
+    size_t printNumber(unsigned long long v, int base, bool negative);
+};
+
+#endif /* __HOST_PRINT_H__ */
@@ -0,0 +1,6 @@
+#ifndef __HOST_PRINTABLE_H__
+#define __HOST_PRINTABLE_H__
+
+#include "Print.h"
+
+#endif /* __HOST_PRINTABLE_H__ */
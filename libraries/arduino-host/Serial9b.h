@@ -0,0 +1,7 @@
+#ifndef __HOST_SERIAL9B_H__
+#define __HOST_SERIAL9B_H__
+
+// The 9-bit serial port is provided by the SoftwareSerial stand-in on the host
+#include "SoftwareSerial.h"
+
+#endif /* __HOST_SERIAL9B_H__ */
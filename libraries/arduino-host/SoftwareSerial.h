@@ -0,0 +1,54 @@
+#ifndef __HOST_SOFTWARESERIAL_H__
+#define __HOST_SOFTWARESERIAL_H__
+
+#include "Arduino.h"
+
+#define SWSERIAL_9N1 (0x0F)
+
+// The other end of a 9-bit serial line, eg. a MATEnet emulator.
+// Words are 9 bits wide, bit 8 being the 9th (address) bit.
+class SerialPeer9b {
+public:
+    virtual ~SerialPeer9b() { }
+
+    // A word sent to the peer
+    virtual void receive(uint16_t word) = 0;
+
+    // Words sent by the peer
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+// Host stand-in for the 9-bit SoftwareSerial, connected to a SerialPeer9b instead of GPIOs.
+// read()/peek() return 9-bit words, as with the ESP32 implementation in 9N1 mode.
+class SoftwareSerial : public Stream {
+public:
+    SoftwareSerial() : peer(nullptr) { }
+
+    void begin(uint32_t baud, int rx_pin, int tx_pin, int config, bool invert) { }
+    void enableRx(bool enable) { }
+    void enableTx(bool enable) { }
+
+    void attach(SerialPeer9b* peer) { this->peer = peer; }
+
+    size_t write(uint8_t c) override { return write9b(c); }
+    size_t write9b(uint16_t word) {
+        if (peer == nullptr)
+            return 0;
+        peer->receive(word & 0x1FF);
+        return 1;
+    }
+    using Print::write;
+
+    int available() override { return (peer != nullptr) ? peer->available() : 0; }
+    int read() override { return (peer != nullptr) ? peer->read() : -1; }
+    int peek() override { return (peer != nullptr) ? peer->peek() : -1; }
+
+    operator bool() const { return peer != nullptr; }
+
+private:
+    SerialPeer9b* peer;
+};
+
+#endif /* __HOST_SOFTWARESERIAL_H__ */
@@ -0,0 +1,47 @@
+#ifndef __HOST_WSTRING_H__
+#define __HOST_WSTRING_H__
+
+#include <string>
+#include <stddef.h>
+
+// Subset of the Arduino String class, backed by std::string
+class String {
+public:
+    String(const char* s = "") : s(s ? s : "") { }
+    String(const std::string& s) : s(s) { }
+    String(char c) : s(1, c) { }
+    explicit String(int v, unsigned char base = 10);
+    explicit String(unsigned int v, unsigned char base = 10);
+    explicit String(long v, unsigned char base = 10);
+    explicit String(unsigned long v, unsigned char base = 10);
+    explicit String(float v, unsigned char decimals = 2);
+    explicit String(double v, unsigned char decimals = 2);
+
+    const char* c_str() const { return s.c_str(); }
+    unsigned int length() const { return static_cast<unsigned int>(s.length()); }
+    char operator[](unsigned int i) const { return s[i]; }
+
+    bool operator==(const String& rhs) const { return s == rhs.s; }
+    bool operator!=(const String& rhs) const { return s != rhs.s; }
+    bool equals(const String& rhs) const { return s == rhs.s; }
+    bool equalsIgnoreCase(const String& rhs) const;
+    bool startsWith(const String& prefix) const { return s.compare(0, prefix.s.length(), prefix.s) == 0; }
+    int indexOf(char c, unsigned int from = 0) const;
+
+    bool concat(const String& rhs) { s += rhs.s; return true; }
+    bool concat(const char* rhs) { s += rhs; return true; }
+    bool concat(char c) { s += c; return true; }
+    String& operator+=(const String& rhs) { s += rhs.s; return *this; }
+    String& operator+=(const char* rhs) { s += rhs; return *this; }
+    String& operator+=(char c) { s += c; return *this; }
+    friend String operator+(const String& lhs, const String& rhs) { return String(lhs.s + rhs.s); }
+    friend String operator+(const String& lhs, const char* rhs) { return String(lhs.s + rhs); }
+
+    // Used by ArduinoJson when serializing into a String
+    size_t write(uint8_t c) { s += static_cast<char>(c); return 1; }
+
+private:
+    std::string s;
+};
+
+#endif /* __HOST_WSTRING_H__ */
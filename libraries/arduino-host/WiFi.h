@@ -0,0 +1,15 @@
+#ifndef __HOST_WIFI_H__
+#define __HOST_WIFI_H__
+
+#include "Arduino.h"
+
+// The host is assumed to always be on the network (MODE_NATIVE)
+class WiFiClass {
+public:
+    String macAddress() { return String("00:00:00:00:00:00"); }
+    uint8_t* macAddress(uint8_t* mac) { memset(mac, 0, 6); return mac; }
+    IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+};
+extern WiFiClass WiFi;
+
+#endif /* __HOST_WIFI_H__ */
@@ -0,0 +1,7 @@
+#ifndef __HOST_WIRE_H__
+#define __HOST_WIRE_H__
+
+// I2C is not used by the gateway, this only satisfies includes
+#include "Arduino.h"
+
+#endif /* __HOST_WIRE_H__ */
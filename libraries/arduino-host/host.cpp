@@ -0,0 +1,261 @@
+#include "Arduino.h"
+#include "WiFi.h"
+#include "ESPmDNS.h"
+
+#include <stdarg.h>
+#include <ctype.h>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <sys/time.h>
+
+HardwareSerial  Serial;
+EspClass        ESP;
+WiFiClass       WiFi;
+MDNSResponder   MDNS;
+
+static const auto tStart = std::chrono::steady_clock::now();
+static std::mt19937 rng(0);
+
+/// Time ///
+
+unsigned long millis()
+{
+    auto elapsed = std::chrono::steady_clock::now() - tStart;
+    return static_cast<unsigned long>(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+}
+
+unsigned long micros()
+{
+    auto elapsed = std::chrono::steady_clock::now() - tStart;
+    return static_cast<unsigned long>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+}
+
+void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield()
+{
+    std::this_thread::yield();
+}
+
+bool getLocalTime(struct tm* info, uint32_t ms)
+{
+    time_t now = time(nullptr);
+    return gmtime_r(&now, info) != nullptr;
+}
+
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char* server1, const char* server2, const char* server3)
+{
+    // The host clock is already synchronized
+}
+
+long random(long max)
+{
+    return (max > 0) ? random(0, max) : 0;
+}
+
+long random(long min, long max)
+{
+    if (max <= min)
+        return min;
+    return std::uniform_int_distribution<long>(min, max - 1)(rng);
+}
+
+void randomSeed(unsigned long seed)
+{
+    rng.seed(seed);
+}
+
+void EspClass::restart()
+{
+    fflush(stdout);
+    exit(1);
+}
+
+/// Serial ///
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size)
+{
+    return fwrite(buffer, 1, size, stdout);
+}
+
+void HardwareSerial::flush()
+{
+    fflush(stdout);
+}
+
+/// String ///
+
+static std::string formatNumber(unsigned long long v, unsigned char base, bool negative)
+{
+    char buf[72];
+    char* p = &buf[sizeof(buf) - 1];
+    *p = '\0';
+    if (base < 2)
+        base = 10;
+    do {
+        unsigned digit = static_cast<unsigned>(v % base);
+        *--p = static_cast<char>((digit < 10) ? ('0' + digit) : ('A' + digit - 10));
+        v /= base;
+    } while (v > 0);
+    if (negative)
+        *--p = '-';
+    return std::string(p);
+}
+
+static std::string formatFloat(double v, unsigned char decimals)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+    return std::string(buf);
+}
+
+String::String(int v, unsigned char base)
+    : s((base == 10) ? formatNumber((v < 0) ? -(long long)v : v, base, v < 0) : formatNumber(static_cast<unsigned int>(v), base, false)) { }
+String::String(unsigned int v, unsigned char base) : s(formatNumber(v, base, false)) { }
+String::String(long v, unsigned char base)
+    : s((base == 10) ? formatNumber((v < 0) ? -(long long)v : v, base, v < 0) : formatNumber(static_cast<unsigned long>(v), base, false)) { }
+String::String(unsigned long v, unsigned char base) : s(formatNumber(v, base, false)) { }
+String::String(float v, unsigned char decimals) : s(formatFloat(v, decimals)) { }
+String::String(double v, unsigned char decimals) : s(formatFloat(v, decimals)) { }
+
+bool String::equalsIgnoreCase(const String& rhs) const
+{
+    if (s.length() != rhs.s.length())
+        return false;
+    for (size_t i = 0; i < s.length(); i++) {
+        if (tolower(static_cast<unsigned char>(s[i])) != tolower(static_cast<unsigned char>(rhs.s[i])))
+            return false;
+    }
+    return true;
+}
+
+int String::indexOf(char c, unsigned int from) const
+{
+    size_t pos = s.find(c, from);
+    return (pos == std::string::npos) ? -1 : static_cast<int>(pos);
+}
+
+/// Print ///
+
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+    size_t n = 0;
+    while (size--) {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::write(const char* str)
+{
+    return (str != nullptr) ? write(reinterpret_cast<const uint8_t*>(str), strlen(str)) : 0;
+}
+
+size_t Print::printf(const char* format, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len < 0)
+        return 0;
+    return write(buf, std::min(static_cast<size_t>(len), sizeof(buf) - 1));
+}
+
+size_t Print::printNumber(unsigned long long v, int base, bool negative)
+{
+    return write(formatNumber(v, static_cast<unsigned char>(base), negative).c_str());
+}
+
+size_t Print::print(const String& s)                    { return write(s.c_str(), s.length()); }
+size_t Print::print(const char* s)                      { return write(s); }
+size_t Print::print(char c)                             { return write(static_cast<uint8_t>(c)); }
+size_t Print::print(unsigned char v, int base)          { return printNumber(v, base, false); }
+size_t Print::print(unsigned int v, int base)           { return printNumber(v, base, false); }
+size_t Print::print(unsigned long v, int base)          { return printNumber(v, base, false); }
+size_t Print::print(unsigned long long v, int base)     { return printNumber(v, base, false); }
+size_t Print::print(int v, int base)                    { return print(static_cast<long long>(v), base); }
+size_t Print::print(long v, int base)                   { return print(static_cast<long long>(v), base); }
+
+size_t Print::print(long long v, int base)
+{
+    if ((base == 10) && (v < 0))
+        return printNumber(-static_cast<unsigned long long>(v), base, true);
+    return printNumber(static_cast<unsigned long long>(v), base, false);
+}
+
+size_t Print::print(double v, int digits)
+{
+    return write(formatFloat(v, static_cast<unsigned char>(digits)).c_str());
+}
+
+size_t Print::print(const Printable& p)
+{
+    return p.printTo(*this);
+}
+
+size_t Print::print(const struct tm* timeinfo, const char* format)
+{
+    char buf[64];
+    size_t len = strftime(buf, sizeof(buf), (format != nullptr) ? format : "%c", timeinfo);
+    return write(buf, len);
+}
+
+size_t Print::println()
+{
+    return write("\r\n");
+}
+
+/// Stream ///
+
+int Stream::timedRead()
+{
+    unsigned long tStart = millis();
+    do {
+        int c = read();
+        if (c >= 0)
+            return c;
+        yield();
+    } while ((millis() - tStart) < _timeout);
+    return -1;
+}
+
+size_t Stream::readBytes(char* buffer, size_t length)
+{
+    size_t n = 0;
+    while (n < length) {
+        int c = timedRead();
+        if (c < 0)
+            break;
+        buffer[n++] = static_cast<char>(c);
+    }
+    return n;
+}
+
+/// IPAddress ///
+
+size_t IPAddress::printTo(Print& p) const
+{
+    size_t n = 0;
+    for (int i = 0; i < 4; i++) {
+        if (i > 0)
+            n += p.print('.');
+        n += p.print((*this)[i], DEC);
+    }
+    return n;
+}
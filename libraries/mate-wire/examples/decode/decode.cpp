@@ -0,0 +1,122 @@
+// Decode a MATE gateway frame (or batch of frames) read from stdin, eg:
+//
+//   g++ -I../.. decode.cpp -o mate-decode
+//   mosquitto_sub -t mate/mx-1/mx-status -C 1 | ./mate-decode
+//   mosquitto_sub -t mate/batch -C 1 | ./mate-decode
+//   mosquitto_sub -t mate/mx-1/rollup-1m -C 1 | ./mate-decode
+//
+#include <stdio.h>
+#include <inttypes.h>
+#include "matewire.h"
+#include "matestatus.h"
+
+static int printFrame(const uint8_t* data, size_t size)
+{
+    MateWire::FrameHeader hdr;
+    const uint8_t* payload = nullptr;
+    MateWire::DecodeResult result = MateWire::decode(data, size, hdr, payload);
+    if (result != MateWire::DecodeResult::Ok) {
+        fprintf(stderr, "Invalid frame: %s\n", MateWire::resultString(result));
+        return 1;
+    }
+
+    printf("type:      %u\n", (unsigned)hdr.type);
+    printf("device:    %u (port %u)\n", hdr.device_type, hdr.port);
+    printf("flags:     0x%02X\n", hdr.flags);
+    printf("seq:       %" PRIu32 " (boot %04X)\n", hdr.seq, hdr.boot);
+    printf("timestamp: %" PRIu64 "\n", hdr.timestamp_ms);
+    printf("payload:   ");
+    for (size_t i = 0; i < hdr.length; i++) {
+        printf("%02X", payload[i]);
+    }
+    printf("\n");
+
+    // Decoded status fields (deltas need reconstructing first, see examples/reconstruct)
+    const MateWire::StatusLayout* layout = MateWire::statusLayout(static_cast<MateWire::DeviceType>(hdr.device_type));
+    float values[MateWire::MAX_STATUS_FIELDS];
+    if ((hdr.type == MateWire::FrameType::Status) && !(hdr.flags & MateWire::FLAG_DELTA) && (layout != nullptr) &&
+        MateWire::decodeStatus(*layout, payload, hdr.length, values))
+    {
+        for (size_t i = 0; i < layout->count; i++) {
+            printf("  %-16s %.1f %s\n", layout->fields[i].name, values[i], MateWire::unitString(layout->fields[i].unit));
+        }
+    }
+
+    if ((hdr.type == MateWire::FrameType::Rollup) && (layout != nullptr) && (hdr.length >= MateWire::ROLLUP_HEADER_SIZE)) {
+        printf("window:    %us (%u samples)\n", MateWire::get_u16(&payload[0]), MateWire::get_u16(&payload[2]));
+        const uint8_t* p = &payload[MateWire::ROLLUP_HEADER_SIZE];
+        for (size_t i = 0; (i < payload[4]) && (i < layout->count) && ((p + MateWire::ROLLUP_FIELD_SIZE) <= (payload + hdr.length)); i++) {
+            MateWire::RollupField field;
+            MateWire::decodeRollupField(p, field);
+            p += MateWire::ROLLUP_FIELD_SIZE;
+
+            printf("  %-16s min=%.1f max=%.1f mean=%.1f %s\n", layout->fields[i].name,
+                field.min / (float)MateWire::ROLLUP_SCALE,
+                field.max / (float)MateWire::ROLLUP_SCALE,
+                field.mean / (float)MateWire::ROLLUP_SCALE,
+                MateWire::unitString(layout->fields[i].unit));
+        }
+    }
+
+    if ((hdr.type == MateWire::FrameType::Diagnostics) && (hdr.length >= MateWire::DIAG_HEADER_SIZE)) {
+        static const char* ops[] = { "read_status", "read_log", "query", "update_time", "update_bat_temp", "begin" };
+
+        printf("bus util:  %u%%\n", payload[0]);
+        const uint8_t* p = &payload[MateWire::DIAG_HEADER_SIZE];
+        for (unsigned i = 0; (i < payload[1]) && ((p + MateWire::DIAG_ENTRY_SIZE) <= (payload + hdr.length)); i++) {
+            MateWire::DiagEntry entry;
+            MateWire::decodeDiagEntry(p, entry);
+            p += MateWire::DIAG_ENTRY_SIZE;
+
+            unsigned op = static_cast<unsigned>(entry.op);
+            printf("  %-16s n=%u fail=%u max=%ums hist=",
+                (op < (sizeof(ops) / sizeof(ops[0]))) ? ops[op] : "?",
+                entry.count, entry.failures, entry.max_ms);
+            for (size_t b = 0; b < MateWire::DIAG_BUCKETS; b++) {
+                printf("%s%u", (b > 0) ? "," : "", entry.buckets[b]);
+            }
+            printf("\n");
+        }
+    }
+    return 0;
+}
+
+int main()
+{
+    uint8_t buf[4096];
+    size_t size = fread(buf, 1, sizeof(buf), stdin);
+
+    if (!MateWire::isBatch(buf, size)) {
+        return printFrame(buf, size);
+    }
+
+    // Compressed batches expand to at most 64KB
+    static uint8_t expanded[0x10000 + MateWire::BATCH_HEADER_SIZE];
+    bool compressed = (buf[2] & MateWire::BATCH_FLAG_COMPRESSED);
+    size_t expanded_size = MateWire::decompressBatch(expanded, sizeof(expanded), buf, size);
+    if (expanded_size == 0) {
+        fprintf(stderr, "Invalid compressed batch\n");
+        return 1;
+    }
+
+    MateWire::BatchReader batch(expanded, expanded_size);
+    if (compressed) {
+        printf("batch:     %u frames (compressed %u -> %u bytes)\n\n", batch.count(), (unsigned)expanded_size, (unsigned)size);
+    }
+    else {
+        printf("batch:     %u frames\n\n", batch.count());
+    }
+
+    int rc = 0;
+    const uint8_t* frame;
+    size_t frame_size;
+    while (batch.next(frame, frame_size)) {
+        rc |= printFrame(frame, frame_size);
+        printf("\n");
+    }
+    if (!batch.ok()) {
+        fprintf(stderr, "Invalid batch\n");
+        return 1;
+    }
+    return rc;
+}
@@ -0,0 +1,64 @@
+// Reconstruct full status from keyframe & delta frames (MATE_STATUS_DELTA), eg:
+//
+//   g++ -I../.. reconstruct.cpp -o mate-reconstruct
+//   mosquitto_sub -t 'mate/+/+-status' -F '%t %x' | ./mate-reconstruct
+//
+// Each input line is a topic followed by the hex-encoded frame.
+// Prints the topic, sequence number and full status (hex) for each frame.
+//
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <map>
+#include <string>
+#include "matewire.h"
+
+static size_t fromHex(const char* hex, uint8_t* out, size_t out_size)
+{
+    size_t n = 0;
+    unsigned int byte;
+    while ((n < out_size) && (sscanf(hex, "%2x", &byte) == 1)) {
+        out[n++] = static_cast<uint8_t>(byte);
+        hex += 2;
+    }
+    return n;
+}
+
+int main()
+{
+    // One reconstructor per device (topic)
+    std::map<std::string, MateWire::StatusReconstructor> devices;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), stdin)) {
+        char topic[256];
+        char hex[1024];
+        if (sscanf(line, "%255s %1023s", topic, hex) != 2)
+            continue;
+
+        uint8_t frame[512];
+        size_t size = fromHex(hex, frame, sizeof(frame));
+
+        MateWire::FrameHeader hdr;
+        const uint8_t* payload = nullptr;
+        MateWire::DecodeResult result = MateWire::decode(frame, size, hdr, payload);
+        if (result != MateWire::DecodeResult::Ok) {
+            fprintf(stderr, "%s: Invalid frame: %s\n", topic, MateWire::resultString(result));
+            continue;
+        }
+
+        uint8_t status[MateWire::StatusReconstructor::MAX_STATUS_SIZE];
+        size_t status_size = 0;
+        if (!devices[topic].update(hdr, payload, status, sizeof(status), status_size)) {
+            fprintf(stderr, "%s: seq %" PRIu32 " could not be reconstructed\n", topic, hdr.seq);
+            continue;
+        }
+
+        printf("%s %" PRIu32 " %s ", topic, hdr.seq, (hdr.flags & MateWire::FLAG_DELTA) ? "delta" : "key");
+        for (size_t i = 0; i < status_size; i++) {
+            printf("%02X", status[i]);
+        }
+        printf("\n");
+    }
+    return 0;
+}
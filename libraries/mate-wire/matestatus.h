@@ -0,0 +1,166 @@
+#ifndef __MATE_STATUS_H__
+#define __MATE_STATUS_H__
+
+// Decoding of MX, FX and FLEXnet DC status payloads (as published in Status frames)
+// into typed values.
+//
+// Each device's status layout is described by a table of field descriptors, so decoding
+// is a single pass over a few bytes with no branching on the device type. Like matewire.h,
+// this is header-only and has no Arduino dependencies, so captured frames can be checked
+// on the host (see examples/decode).
+//
+// Layouts follow pyMATE's status packet decoders. Status bytes are big-endian.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "matewire.h"
+
+namespace MateWire
+{
+    static const size_t MX_STATUS_SIZE = 13;
+    static const size_t FX_STATUS_SIZE = 13;
+    static const size_t DC_STATUS_SIZE = 13 * 6;   // Status pages 0x0A-0x0F
+
+    enum class FieldType : uint8_t {
+        U8,
+        U8Offset128,    // Signed byte + 128 (MX currents)
+        U16,
+        S16,
+    };
+
+    enum class FieldUnit : uint8_t {
+        None,           // Mode/state codes
+        Volts,
+        Amps,
+        Percent,
+    };
+
+    enum FieldFlags : uint8_t {
+        FIELD_NONE      = 0x00,
+        FIELD_TENTHS    = 0x01,     // Add tenths from the low nibble of the byte at tenths_offset
+        FIELD_230V_X2   = 0x02,     // Doubled on 230V models (voltages)
+        FIELD_230V_DIV2 = 0x04,     // Halved on 230V models (currents)
+    };
+
+    struct StatusField {
+        const char* name;           // eg. "bat_voltage"
+        uint8_t     offset;
+        FieldType   type;
+        FieldUnit   unit;
+        float       scale;
+        uint8_t     flags;          // FieldFlags
+        uint8_t     tenths_offset;
+        float       change;         // Smallest change worth polling faster for (0: any change)
+    };
+
+    struct StatusLayout {
+        DeviceType          type;
+        size_t              size;           // Minimum status size
+        const StatusField*  fields;
+        size_t              count;
+        int8_t              model_offset;   // Byte flagging a 230V model, or -1
+        uint8_t             model_230v_mask;
+    };
+
+    static const size_t MAX_STATUS_FIELDS = 8;
+
+    static const StatusField MX_STATUS_FIELDS[] = {
+        // name              offset  type                     unit                scale  flags             tenths   change
+        { "charge_current",  1,      FieldType::U8Offset128,  FieldUnit::Amps,    1.0f,  FIELD_TENTHS,     0,      1.0f },
+        { "pv_current",      2,      FieldType::U8Offset128,  FieldUnit::Amps,    1.0f,  FIELD_NONE,       0,      1.0f },
+        { "errors",          6,      FieldType::U8,           FieldUnit::None,    1.0f,  FIELD_NONE,       0,      0.0f },
+        { "charge_state",    7,      FieldType::U8,           FieldUnit::None,    1.0f,  FIELD_NONE,       0,      0.0f },
+        { "bat_voltage",     9,      FieldType::U16,          FieldUnit::Volts,   0.1f,  FIELD_NONE,       0,      0.2f },
+        { "pv_voltage",      11,     FieldType::U16,          FieldUnit::Volts,   0.1f,  FIELD_NONE,       0,      1.0f },
+    };
+
+    static const StatusField FX_STATUS_FIELDS[] = {
+        // name              offset  type                     unit                scale  flags             tenths   change
+        { "inv_current",     0,      FieldType::U8,           FieldUnit::Amps,    1.0f,  FIELD_230V_DIV2,  0,      1.0f },
+        { "charge_current",  1,      FieldType::U8,           FieldUnit::Amps,    1.0f,  FIELD_230V_DIV2,  0,      1.0f },
+        { "buy_current",     2,      FieldType::U8,           FieldUnit::Amps,    1.0f,  FIELD_230V_DIV2,  0,      1.0f },
+        { "ac_in_voltage",   3,      FieldType::U8,           FieldUnit::Volts,   1.0f,  FIELD_230V_X2,    0,      2.0f },
+        { "ac_out_voltage",  4,      FieldType::U8,           FieldUnit::Volts,   1.0f,  FIELD_230V_X2,    0,      2.0f },
+        { "sell_current",    5,      FieldType::U8,           FieldUnit::Amps,    1.0f,  FIELD_230V_DIV2,  0,      1.0f },
+        { "op_mode",         6,      FieldType::U8,           FieldUnit::None,    1.0f,  FIELD_NONE,       0,      0.0f },
+        { "bat_voltage",     9,      FieldType::U16,          FieldUnit::Volts,   0.1f,  FIELD_NONE,       0,      0.2f },
+    };
+
+    // Page 0x0A: shunt currents, battery voltage & state of charge
+    static const StatusField DC_STATUS_FIELDS[] = {
+        // name              offset  type                     unit                scale  flags             tenths   change
+        { "shunt_a_current", 0,      FieldType::S16,          FieldUnit::Amps,    0.1f,  FIELD_NONE,       0,      1.0f },
+        { "shunt_b_current", 2,      FieldType::S16,          FieldUnit::Amps,    0.1f,  FIELD_NONE,       0,      1.0f },
+        { "shunt_c_current", 4,      FieldType::S16,          FieldUnit::Amps,    0.1f,  FIELD_NONE,       0,      1.0f },
+        { "bat_voltage",     6,      FieldType::U16,          FieldUnit::Volts,   0.1f,  FIELD_NONE,       0,      0.2f },
+        { "soc",             8,      FieldType::U8,           FieldUnit::Percent, 1.0f,  FIELD_NONE,       0,      1.0f },
+    };
+
+    static_assert(sizeof(MX_STATUS_FIELDS) / sizeof(MX_STATUS_FIELDS[0]) <= MAX_STATUS_FIELDS, "Too many MX fields");
+    static_assert(sizeof(FX_STATUS_FIELDS) / sizeof(FX_STATUS_FIELDS[0]) <= MAX_STATUS_FIELDS, "Too many FX fields");
+    static_assert(sizeof(DC_STATUS_FIELDS) / sizeof(DC_STATUS_FIELDS[0]) <= MAX_STATUS_FIELDS, "Too many DC fields");
+
+    static const StatusLayout STATUS_LAYOUTS[] = {
+        { DeviceType::Mx, MX_STATUS_SIZE, MX_STATUS_FIELDS, sizeof(MX_STATUS_FIELDS) / sizeof(MX_STATUS_FIELDS[0]), -1, 0x00 },
+        { DeviceType::Fx, FX_STATUS_SIZE, FX_STATUS_FIELDS, sizeof(FX_STATUS_FIELDS) / sizeof(FX_STATUS_FIELDS[0]), 11, 0x01 },
+        { DeviceType::Dc, DC_STATUS_SIZE, DC_STATUS_FIELDS, sizeof(DC_STATUS_FIELDS) / sizeof(DC_STATUS_FIELDS[0]), -1, 0x00 },
+    };
+
+    // Status layout for a device type (nullptr if it has none)
+    inline const StatusLayout* statusLayout(DeviceType type)
+    {
+        for (const StatusLayout& layout : STATUS_LAYOUTS) {
+            if (layout.type == type)
+                return &layout;
+        }
+        return nullptr;
+    }
+
+    // Decode each field of a status payload into values[layout.count].
+    // Returns false if the status is too short for the layout.
+    inline bool decodeStatus(const StatusLayout& layout, const uint8_t* status, size_t size, float* values)
+    {
+        if (size < layout.size)
+            return false;
+
+        bool model_230v = (layout.model_offset >= 0) && (status[layout.model_offset] & layout.model_230v_mask);
+
+        for (size_t i = 0; i < layout.count; i++) {
+            const StatusField& field = layout.fields[i];
+            const uint8_t* p = &status[field.offset];
+
+            int32_t raw;
+            switch (field.type) {
+                case FieldType::U8:             raw = p[0]; break;
+                case FieldType::U8Offset128:    raw = static_cast<int8_t>(p[0]) + 128; break;
+                case FieldType::U16:            raw = (p[0] << 8) | p[1]; break;
+                case FieldType::S16:            raw = static_cast<int16_t>((p[0] << 8) | p[1]); break;
+                default:                        raw = 0; break;
+            }
+
+            float value = raw * field.scale;
+            if (field.flags & FIELD_TENTHS)
+                value += (status[field.tenths_offset] & 0x0F) * 0.1f;
+            if (model_230v && (field.flags & FIELD_230V_X2))
+                value *= 2.0f;
+            if (model_230v && (field.flags & FIELD_230V_DIV2))
+                value *= 0.5f;
+
+            values[i] = value;
+        }
+        return true;
+    }
+
+    inline const char* unitString(FieldUnit unit)
+    {
+        switch (unit) {
+            case FieldUnit::Volts:      return "V";
+            case FieldUnit::Amps:       return "A";
+            case FieldUnit::Percent:    return "%";
+            default:                    return "";
+        }
+    }
+};
+
+#endif /* __MATE_STATUS_H__ */
@@ -0,0 +1,863 @@
+#ifndef __MATE_WIRE_H__
+#define __MATE_WIRE_H__
+
+// Wire format for frames published by the MATE gateway.
+//
+// Header-only and free of Arduino dependencies, so the same code is used by
+// the firmware to encode frames and by a server (or host tools) to decode them.
+//
+// All fields are little-endian, with no padding:
+//
+//   Offset  Size  Field
+//   0       1     Magic (0x4D, 'M')
+//   1       1     Version (2)
+//   2       1     Frame type (FrameType)
+//   3       1     Device type (DeviceType, same values as uMATE)
+//   4       1     Device port on the MATE hub (0-9)
+//   5       1     Flags (Flags)
+//   6       4     Sequence number (per device, increments every frame)
+//   10      8     Timestamp (ms since Unix epoch, UTC)
+//   18      2     Payload length (N)
+//   20      2     Boot ID (random, chosen each time the gateway starts)
+//   22      N     Payload (raw MATE response bytes)
+//   22+N    2     CRC-16/CCITT-FALSE over bytes [0, 22+N)
+//
+// Sequence numbers restart from 0 when the gateway reboots. Sequence numbers are only
+// comparable between frames with the same boot ID.
+// Version 1 frames (without the boot ID, 20 byte header) are still decoded, with a boot ID of 0.
+//
+// Several frames may be combined into a single batch message:
+//
+//   Offset  Size  Field
+//   0       1     Batch magic (0x42, 'B')
+//   1       1     Batch version (1)
+//   2       1     Batch flags (BatchFlags)
+//   3       2     Number of records
+//   5       ...   Records, each a u16 length followed by a complete frame (as above)
+//
+// With BATCH_FLAG_COMPRESSED, the records are compressed (use decompressBatch()):
+//
+//   Offset  Size  Field
+//   0       5     Batch header (as above)
+//   5       2     Length of the records once decompressed
+//   7       ...   Compressed records (LZSS):
+//                   u8   Control byte, bit n (LSB first) describes item n of the next 8:
+//                   0 -> u8   Literal byte
+//                   1 -> u16  Match: bits 0-11 offset back into the output (1-4096),
+//                             bits 12-15 length (3-18) minus 3
+//
+// A status frame with FLAG_DELTA set carries the changes since an earlier (keyframe)
+// status frame from the same device, instead of the full status:
+//
+//   Offset  Size  Field
+//   0       4     Sequence number of the keyframe
+//   4       ...   Runs, each:
+//                   u8   Number of unchanged bytes to skip
+//                   u8   Run length (L)
+//                   L    Changed bytes, XORed with the keyframe
+//
+// Bytes after the last run are unchanged. Use StatusReconstructor to recover the full status.
+//
+// A diagnostics frame covers the bus transactions made with one device since its previous
+// diagnostics frame (counts are reset each time):
+//
+//   Offset  Size  Field
+//   0       1     Bus utilization (%, all devices) over the last measurement window
+//   1       1     Number of entries
+//   2       ...   Entries (DIAG_ENTRY_SIZE bytes each, see DiagEntry):
+//                   u8   Operation (DiagOp)
+//                   u16  Transactions
+//                   u16  Failures (timeouts / bad responses)
+//                   u16  Max latency (ms)
+//                   u8   Latency histogram [DIAG_BUCKETS], saturating at 255:
+//                        <16, <32, <64, <128, <256, <512, <1024, >=1024 ms
+//
+// A rollup frame summarizes a device's decoded status fields (see matestatus.h) over a
+// fixed window, and is timestamped with the start of the window. Values are in tenths
+// (the finest resolution of any status field), saturating at +/-3276.7:
+//
+//   Offset  Size  Field
+//   0       2     Window length (s)
+//   2       2     Number of status samples in the window
+//   4       1     Number of fields (in status layout order)
+//   5       ...   Fields (ROLLUP_FIELD_SIZE bytes each, see RollupField):
+//                   s16  Min
+//                   s16  Max
+//                   s16  Mean
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace MateWire
+{
+    static const uint8_t MAGIC      = 0x4D;
+    static const uint8_t VERSION    = 2;
+    static const uint8_t VERSION_1  = 1;    // No boot ID
+
+    static const size_t HEADER_SIZE     = 22;
+    static const size_t HEADER_SIZE_V1  = 20;
+    static const size_t CRC_SIZE    = 2;
+    static const size_t OVERHEAD    = HEADER_SIZE + CRC_SIZE;
+
+    enum class FrameType : uint8_t {
+        Status      = 1,    // Device status (MX/FX: 1 page, DC: 6 pages)
+        LogPage     = 2,    // MX daily logpage
+        Diagnostics = 3,    // Bus transaction statistics
+        Rollup      = 4,    // Min/max/mean of the decoded status over a window
+    };
+
+    // Matches uMATE's DeviceType
+    enum class DeviceType : uint8_t {
+        None    = 0,
+        Hub     = 1,
+        Fx      = 2,
+        Mx      = 3,
+        Dc      = 4,
+    };
+
+    enum Flags : uint8_t {
+        FLAG_NONE   = 0x00,
+        FLAG_DELTA  = 0x01,     // Payload is a delta against an earlier keyframe
+    };
+
+    static const uint8_t BATCH_MAGIC            = 0x42;
+    static const uint8_t BATCH_VERSION          = 1;
+    static const size_t  BATCH_HEADER_SIZE      = 5;
+    static const size_t  BATCH_RECORD_OVERHEAD  = 2;
+
+    enum BatchFlags : uint8_t {
+        BATCH_FLAG_NONE         = 0x00,
+        BATCH_FLAG_COMPRESSED   = 0x01,     // Records are LZSS compressed
+    };
+
+    static const size_t  BATCH_COMPRESSED_HEADER_SIZE = BATCH_HEADER_SIZE + 2;
+
+    static const size_t  LZ_WINDOW      = 4096;
+    static const size_t  LZ_MIN_MATCH   = 3;
+    static const size_t  LZ_MAX_MATCH   = 18;
+    static const size_t  LZ_HASH_SIZE   = 256;
+
+    // Bus operations reported in diagnostics frames
+    enum class DiagOp : uint8_t {
+        ReadStatus          = 0,
+        ReadLog             = 1,
+        Query               = 2,
+        UpdateTime          = 3,
+        UpdateBatteryTemp   = 4,
+        Begin               = 5,    // Device detection (incl. port scans) / ping
+    };
+
+    static const size_t DIAG_HEADER_SIZE    = 2;
+    static const size_t DIAG_BUCKETS        = 8;
+    static const size_t DIAG_ENTRY_SIZE     = 7 + DIAG_BUCKETS;
+
+    struct DiagEntry {
+        DiagOp      op;
+        uint16_t    count;
+        uint16_t    failures;
+        uint16_t    max_ms;
+        uint8_t     buckets[DIAG_BUCKETS];
+    };
+
+    static const size_t ROLLUP_HEADER_SIZE  = 5;
+    static const size_t ROLLUP_FIELD_SIZE   = 6;
+    static const int32_t ROLLUP_SCALE       = 10;   // Values are in tenths
+
+    struct RollupField {
+        int16_t     min;
+        int16_t     max;
+        int16_t     mean;
+    };
+
+    static const size_t DELTA_HEADER_SIZE   = 4;
+    static const size_t DELTA_MAX_RUN       = 255;
+
+    struct FrameHeader {
+        uint8_t     version;
+        FrameType   type;
+        uint8_t     device_type;
+        uint8_t     port;
+        uint8_t     flags;
+        uint32_t    seq;
+        uint64_t    timestamp_ms;
+        uint16_t    length;     // Payload length
+        uint16_t    boot;       // Boot ID of the gateway
+    };
+
+    enum class DecodeResult {
+        Ok,
+        TooShort,
+        BadMagic,
+        BadVersion,
+        BadLength,
+        BadCrc,
+    };
+
+    // CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+    inline uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc = 0xFFFF)
+    {
+        while (len--) {
+            crc ^= static_cast<uint16_t>(*data++) << 8;
+            for (int i = 0; i < 8; i++) {
+                crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+            }
+        }
+        return crc;
+    }
+
+    inline void put_u16(uint8_t* p, uint16_t v) {
+        p[0] = static_cast<uint8_t>(v);
+        p[1] = static_cast<uint8_t>(v >> 8);
+    }
+
+    inline void put_u32(uint8_t* p, uint32_t v) {
+        put_u16(p, static_cast<uint16_t>(v));
+        put_u16(p + 2, static_cast<uint16_t>(v >> 16));
+    }
+
+    inline void put_u64(uint8_t* p, uint64_t v) {
+        put_u32(p, static_cast<uint32_t>(v));
+        put_u32(p + 4, static_cast<uint32_t>(v >> 32));
+    }
+
+    inline uint16_t get_u16(const uint8_t* p) {
+        return static_cast<uint16_t>(p[0] | (p[1] << 8));
+    }
+
+    inline uint32_t get_u32(const uint8_t* p) {
+        return static_cast<uint32_t>(get_u16(p)) | (static_cast<uint32_t>(get_u16(p + 2)) << 16);
+    }
+
+    inline uint64_t get_u64(const uint8_t* p) {
+        return static_cast<uint64_t>(get_u32(p)) | (static_cast<uint64_t>(get_u32(p + 4)) << 32);
+    }
+
+    constexpr size_t encodedSize(size_t payload_len) {
+        return OVERHEAD + payload_len;
+    }
+
+    // Encode just the frame header (HEADER_SIZE bytes) for a payload of len bytes.
+    // hdr.length is ignored. For streaming a frame without assembling it in memory:
+    // write the header, the payload, then the CRC from encodeCrc().
+    inline void encodeHeader(uint8_t* out, const FrameHeader& hdr, size_t len)
+    {
+        out[0] = MAGIC;
+        out[1] = VERSION;
+        out[2] = static_cast<uint8_t>(hdr.type);
+        out[3] = hdr.device_type;
+        out[4] = hdr.port;
+        out[5] = hdr.flags;
+        put_u32(&out[6], hdr.seq);
+        put_u64(&out[10], hdr.timestamp_ms);
+        put_u16(&out[18], static_cast<uint16_t>(len));
+        put_u16(&out[20], hdr.boot);
+    }
+
+    // Encode the trailing CRC (CRC_SIZE bytes) for a header from encodeHeader() and its payload
+    inline void encodeCrc(uint8_t* out, const uint8_t* header, const uint8_t* payload, size_t len)
+    {
+        put_u16(out, crc16(payload, len, crc16(header, HEADER_SIZE)));
+    }
+
+    // Encode a frame into out. hdr.length is ignored (taken from len).
+    // Returns the encoded size, or 0 if out is too small.
+    inline size_t encode(uint8_t* out, size_t out_size, const FrameHeader& hdr, const uint8_t* payload, size_t len)
+    {
+        if ((len > 0xFFFF) || (out_size < encodedSize(len)))
+            return 0;
+
+        encodeHeader(out, hdr, len);
+        if (len > 0) {
+            memcpy(&out[HEADER_SIZE], payload, len);
+        }
+        put_u16(&out[HEADER_SIZE + len], crc16(out, HEADER_SIZE + len));
+
+        return encodedSize(len);
+    }
+
+    // Decode and validate a frame.
+    // On success, payload points into the input buffer.
+    inline DecodeResult decode(const uint8_t* in, size_t size, FrameHeader& hdr, const uint8_t*& payload)
+    {
+        if (size < (HEADER_SIZE_V1 + CRC_SIZE))
+            return DecodeResult::TooShort;
+        if (in[0] != MAGIC)
+            return DecodeResult::BadMagic;
+        if ((in[1] != VERSION) && (in[1] != VERSION_1))
+            return DecodeResult::BadVersion;
+
+        size_t header_size = (in[1] == VERSION_1) ? HEADER_SIZE_V1 : HEADER_SIZE;
+        if (size < (header_size + CRC_SIZE))
+            return DecodeResult::TooShort;
+
+        hdr.version         = in[1];
+        hdr.type            = static_cast<FrameType>(in[2]);
+        hdr.device_type     = in[3];
+        hdr.port            = in[4];
+        hdr.flags           = in[5];
+        hdr.seq             = get_u32(&in[6]);
+        hdr.timestamp_ms    = get_u64(&in[10]);
+        hdr.length          = get_u16(&in[18]);
+        hdr.boot            = (in[1] == VERSION_1) ? 0 : get_u16(&in[20]);
+
+        if (size != (header_size + hdr.length + CRC_SIZE))
+            return DecodeResult::BadLength;
+
+        uint16_t crc = get_u16(&in[header_size + hdr.length]);
+        if (crc != crc16(in, header_size + hdr.length))
+            return DecodeResult::BadCrc;
+
+        payload = &in[header_size];
+        return DecodeResult::Ok;
+    }
+
+    inline const char* resultString(DecodeResult result)
+    {
+        switch (result) {
+            case DecodeResult::Ok:          return "ok";
+            case DecodeResult::TooShort:    return "too short";
+            case DecodeResult::BadMagic:    return "bad magic";
+            case DecodeResult::BadVersion:  return "unsupported version";
+            case DecodeResult::BadLength:   return "bad length";
+            case DecodeResult::BadCrc:      return "bad crc";
+            default:                        return "?";
+        }
+    }
+
+    inline size_t encodeBatchHeader(uint8_t* out, size_t out_size, uint16_t count, uint8_t flags = BATCH_FLAG_NONE)
+    {
+        if (out_size < BATCH_HEADER_SIZE)
+            return 0;
+
+        out[0] = BATCH_MAGIC;
+        out[1] = BATCH_VERSION;
+        out[2] = flags;
+        put_u16(&out[3], count);
+        return BATCH_HEADER_SIZE;
+    }
+
+    inline bool isBatch(const uint8_t* in, size_t size)
+    {
+        return (size >= BATCH_HEADER_SIZE) && (in[0] == BATCH_MAGIC);
+    }
+
+    // LZSS compress in into out (format above). Uses ~512 bytes of stack, no heap.
+    // Returns the compressed size, or 0 if it would not fit in out_size
+    // (eg. pass out_size < in_size to only accept output that is smaller).
+    inline size_t compress(uint8_t* out, size_t out_size, const uint8_t* in, size_t in_size)
+    {
+        // Most recent position of each 3-byte hash (+1, 0 = none)
+        uint16_t head[LZ_HASH_SIZE] = {0};
+
+        size_t pos = 0;
+        size_t outPos = 0;
+        size_t ctrlPos = 0;
+        uint8_t bit = 8;
+        while (pos < in_size) {
+            if (bit == 8) {
+                if (outPos >= out_size)
+                    return 0;
+                ctrlPos = outPos++;
+                out[ctrlPos] = 0;
+                bit = 0;
+            }
+
+            size_t best_len = 0;
+            size_t best_off = 0;
+            if ((pos + LZ_MIN_MATCH) <= in_size) {
+                uint8_t h = static_cast<uint8_t>((in[pos] * 33) ^ (in[pos + 1] * 7) ^ in[pos + 2]);
+                size_t candidate = head[h];
+                head[h] = static_cast<uint16_t>(pos + 1);
+
+                if ((candidate > 0) && ((pos - (candidate - 1)) <= LZ_WINDOW)) {
+                    size_t from = candidate - 1;
+                    size_t max = in_size - pos;
+                    if (max > LZ_MAX_MATCH)
+                        max = LZ_MAX_MATCH;
+                    size_t len = 0;
+                    while ((len < max) && (in[from + len] == in[pos + len])) {
+                        len++;
+                    }
+                    if (len >= LZ_MIN_MATCH) {
+                        best_len = len;
+                        best_off = pos - from;
+                    }
+                }
+            }
+
+            if (best_len > 0) {
+                if ((outPos + 2) > out_size)
+                    return 0;
+                uint16_t token = static_cast<uint16_t>((best_off - 1) | ((best_len - LZ_MIN_MATCH) << 12));
+                put_u16(&out[outPos], token);
+                outPos += 2;
+                out[ctrlPos] |= static_cast<uint8_t>(1 << bit);
+
+                // Index the positions covered by the match too, for better matches later
+                for (size_t i = 1; (i < best_len) && ((pos + i + LZ_MIN_MATCH) <= in_size); i++) {
+                    const uint8_t* p = &in[pos + i];
+                    head[static_cast<uint8_t>((p[0] * 33) ^ (p[1] * 7) ^ p[2])] = static_cast<uint16_t>(pos + i + 1);
+                }
+                pos += best_len;
+            }
+            else {
+                if (outPos >= out_size)
+                    return 0;
+                out[outPos++] = in[pos++];
+            }
+            bit++;
+        }
+        return outPos;
+    }
+
+    // Decompress exactly out_size bytes from in.
+    // Returns out_size, or 0 if the input is invalid or truncated.
+    inline size_t decompress(uint8_t* out, size_t out_size, const uint8_t* in, size_t in_size)
+    {
+        size_t pos = 0;
+        size_t outPos = 0;
+        uint8_t ctrl = 0;
+        uint8_t bit = 8;
+        while (outPos < out_size) {
+            if (bit == 8) {
+                if (pos >= in_size)
+                    return 0;
+                ctrl = in[pos++];
+                bit = 0;
+            }
+
+            if (ctrl & (1 << bit)) {
+                if ((pos + 2) > in_size)
+                    return 0;
+                uint16_t token = get_u16(&in[pos]);
+                pos += 2;
+                size_t off = (token & 0x0FFF) + 1;
+                size_t len = (token >> 12) + LZ_MIN_MATCH;
+                if ((off > outPos) || ((outPos + len) > out_size))
+                    return 0;
+                for (size_t i = 0; i < len; i++, outPos++) {
+                    out[outPos] = out[outPos - off];    // May overlap
+                }
+            }
+            else {
+                if (pos >= in_size)
+                    return 0;
+                out[outPos++] = in[pos++];
+            }
+            bit++;
+        }
+        return out_size;
+    }
+
+    // Compress a batch's records (everything after the header) into out, as a complete
+    // compressed batch message. Returns 0 if it doesn't fit in out_size.
+    inline size_t compressBatch(uint8_t* out, size_t out_size, uint16_t count, const uint8_t* records, size_t records_size)
+    {
+        if ((out_size < BATCH_COMPRESSED_HEADER_SIZE) || (records_size > 0xFFFF))
+            return 0;
+
+        size_t packed = compress(&out[BATCH_COMPRESSED_HEADER_SIZE], out_size - BATCH_COMPRESSED_HEADER_SIZE, records, records_size);
+        if (packed == 0)
+            return 0;
+
+        encodeBatchHeader(out, out_size, count, BATCH_FLAG_COMPRESSED);
+        put_u16(&out[BATCH_HEADER_SIZE], static_cast<uint16_t>(records_size));
+        return BATCH_COMPRESSED_HEADER_SIZE + packed;
+    }
+
+    // Expand a compressed batch message into an uncompressed one (that BatchReader can read).
+    // An uncompressed batch is copied as is. Returns the size, or 0 if invalid or out is too small.
+    inline size_t decompressBatch(uint8_t* out, size_t out_size, const uint8_t* in, size_t size)
+    {
+        if (!isBatch(in, size))
+            return 0;
+
+        if (!(in[2] & BATCH_FLAG_COMPRESSED)) {
+            if (size > out_size)
+                return 0;
+            memcpy(out, in, size);
+            return size;
+        }
+
+        if (size < BATCH_COMPRESSED_HEADER_SIZE)
+            return 0;
+        size_t records_size = get_u16(&in[BATCH_HEADER_SIZE]);
+        if ((BATCH_HEADER_SIZE + records_size) > out_size)
+            return 0;
+
+        if (decompress(&out[BATCH_HEADER_SIZE], records_size,
+                       &in[BATCH_COMPRESSED_HEADER_SIZE], size - BATCH_COMPRESSED_HEADER_SIZE) != records_size)
+        {
+            return 0;
+        }
+
+        memcpy(out, in, BATCH_HEADER_SIZE);
+        out[2] &= static_cast<uint8_t>(~BATCH_FLAG_COMPRESSED);
+        return BATCH_HEADER_SIZE + records_size;
+    }
+
+    // Iterates over the frames in an (uncompressed) batch message. Eg.
+    //
+    //   BatchReader batch(data, size);
+    //   const uint8_t* frame; size_t frame_size;
+    //   while (batch.next(frame, frame_size)) {
+    //       MateWire::decode(frame, frame_size, hdr, payload);
+    //   }
+    //   if (!batch.ok()) { ... }
+    class BatchReader {
+    public:
+        BatchReader(const uint8_t* in, size_t size)
+            : in(in)
+            , size(size)
+            , pos(BATCH_HEADER_SIZE)
+            , remaining(0)
+            , valid(false)
+            , flags(0)
+        {
+            // Compressed batches must be expanded with decompressBatch() first
+            if ((size >= BATCH_HEADER_SIZE) && (in[0] == BATCH_MAGIC) && (in[1] == BATCH_VERSION) &&
+                !(in[2] & BATCH_FLAG_COMPRESSED))
+            {
+                flags = in[2];
+                remaining = get_u16(&in[3]);
+                valid = true;
+            }
+        }
+
+        bool next(const uint8_t*& frame, size_t& frame_size) {
+            if (!valid || (remaining == 0))
+                return false;
+
+            if ((pos + BATCH_RECORD_OVERHEAD) > size) {
+                valid = false;
+                return false;
+            }
+            size_t len = get_u16(&in[pos]);
+            pos += BATCH_RECORD_OVERHEAD;
+            if ((pos + len) > size) {
+                valid = false;
+                return false;
+            }
+
+            frame = &in[pos];
+            frame_size = len;
+            pos += len;
+            remaining--;
+            return true;
+        }
+
+        // False if the batch header was invalid or a record was truncated
+        bool ok() const { return valid; }
+        uint16_t count() const { return valid ? get_u16(&in[3]) : 0; }
+        uint8_t batchFlags() const { return flags; }
+
+    private:
+        const uint8_t* in;
+        size_t size;
+        size_t pos;
+        uint16_t remaining;
+        bool valid;
+        uint8_t flags;
+    };
+
+    // Histogram bucket for a latency: <16, <32, ... <1024, >=1024 ms
+    inline size_t diagBucket(uint32_t ms)
+    {
+        size_t bucket = 0;
+        ms >>= 4;
+        while ((ms > 0) && (bucket < (DIAG_BUCKETS - 1))) {
+            ms >>= 1;
+            bucket++;
+        }
+        return bucket;
+    }
+
+    inline size_t encodeDiagEntry(uint8_t* out, size_t out_size, const DiagEntry& entry)
+    {
+        if (out_size < DIAG_ENTRY_SIZE)
+            return 0;
+
+        out[0] = static_cast<uint8_t>(entry.op);
+        put_u16(&out[1], entry.count);
+        put_u16(&out[3], entry.failures);
+        put_u16(&out[5], entry.max_ms);
+        memcpy(&out[7], entry.buckets, DIAG_BUCKETS);
+        return DIAG_ENTRY_SIZE;
+    }
+
+    inline void decodeDiagEntry(const uint8_t* in, DiagEntry& entry)
+    {
+        entry.op        = static_cast<DiagOp>(in[0]);
+        entry.count     = get_u16(&in[1]);
+        entry.failures  = get_u16(&in[3]);
+        entry.max_ms    = get_u16(&in[5]);
+        memcpy(entry.buckets, &in[7], DIAG_BUCKETS);
+    }
+
+    inline size_t encodeRollupHeader(uint8_t* out, size_t out_size, uint16_t period_s, uint16_t samples, uint8_t fields)
+    {
+        if (out_size < ROLLUP_HEADER_SIZE)
+            return 0;
+
+        put_u16(&out[0], period_s);
+        put_u16(&out[2], samples);
+        out[4] = fields;
+        return ROLLUP_HEADER_SIZE;
+    }
+
+    inline size_t encodeRollupField(uint8_t* out, size_t out_size, const RollupField& field)
+    {
+        if (out_size < ROLLUP_FIELD_SIZE)
+            return 0;
+
+        put_u16(&out[0], static_cast<uint16_t>(field.min));
+        put_u16(&out[2], static_cast<uint16_t>(field.max));
+        put_u16(&out[4], static_cast<uint16_t>(field.mean));
+        return ROLLUP_FIELD_SIZE;
+    }
+
+    inline void decodeRollupField(const uint8_t* in, RollupField& field)
+    {
+        field.min   = static_cast<int16_t>(get_u16(&in[0]));
+        field.max   = static_cast<int16_t>(get_u16(&in[2]));
+        field.mean  = static_cast<int16_t>(get_u16(&in[4]));
+    }
+
+    // Encode the difference between a keyframe (base) and the current status (cur), both len bytes.
+    // Returns the delta size, or 0 if it does not fit in out.
+    inline size_t encodeDelta(uint8_t* out, size_t out_size, uint32_t base_seq, const uint8_t* base, const uint8_t* cur, size_t len)
+    {
+        if (out_size < DELTA_HEADER_SIZE)
+            return 0;
+
+        put_u32(out, base_seq);
+        size_t n = DELTA_HEADER_SIZE;
+        size_t i = 0;
+        while (i < len) {
+            size_t skip = 0;
+            while ((i < len) && (base[i] == cur[i]) && (skip < DELTA_MAX_RUN)) {
+                i++;
+                skip++;
+            }
+            if (i >= len)
+                break; // Trailing bytes are unchanged
+
+            size_t start = i;
+            while ((i < len) && ((i - start) < DELTA_MAX_RUN)) {
+                if (base[i] != cur[i]) {
+                    i++;
+                }
+                // A single unchanged byte is cheaper to include than to start a new run
+                else if (((i + 1) < len) && (base[i + 1] != cur[i + 1]) && ((i + 1 - start) < DELTA_MAX_RUN)) {
+                    i += 2;
+                }
+                else {
+                    break;
+                }
+            }
+
+            size_t run = i - start;
+            if ((n + 2 + run) > out_size)
+                return 0;
+
+            out[n++] = static_cast<uint8_t>(skip);
+            out[n++] = static_cast<uint8_t>(run);
+            for (size_t k = 0; k < run; k++) {
+                out[n++] = base[start + k] ^ cur[start + k];
+            }
+        }
+        return n;
+    }
+
+    inline uint32_t deltaBaseSeq(const uint8_t* delta, size_t delta_len)
+    {
+        return (delta_len >= DELTA_HEADER_SIZE) ? get_u32(delta) : 0;
+    }
+
+    // Apply a delta to a copy of its keyframe (out, len bytes).
+    // Returns false if the delta is malformed.
+    inline bool applyDelta(uint8_t* out, size_t len, const uint8_t* delta, size_t delta_len)
+    {
+        if (delta_len < DELTA_HEADER_SIZE)
+            return false;
+
+        size_t pos = 0;
+        size_t n = DELTA_HEADER_SIZE;
+        while (n < delta_len) {
+            if ((n + 2) > delta_len)
+                return false;
+
+            pos += delta[n];
+            size_t run = delta[n + 1];
+            n += 2;
+            if (((pos + run) > len) || ((n + run) > delta_len))
+                return false;
+
+            for (size_t k = 0; k < run; k++) {
+                out[pos + k] ^= delta[n + k];
+            }
+            pos += run;
+            n += run;
+        }
+        return true;
+    }
+
+    // Recovers the full status from the keyframe & delta frames of a single device.
+    // A few recent keyframes are kept, so deltas replayed from the gateway's
+    // outage buffer can still be applied after newer live frames have arrived.
+    // Keyframes are matched on boot ID as well as sequence number, as the sequence
+    // restarts when the gateway reboots (and frames from before it may still be replayed).
+    class StatusReconstructor {
+    public:
+        static const size_t MAX_STATUS_SIZE = 256;
+        static const size_t KEYFRAMES = 4;
+
+        StatusReconstructor()
+            : next(0)
+            , missing(0)
+        {
+            for (size_t i = 0; i < KEYFRAMES; i++) {
+                keyframes[i].valid = false;
+            }
+        }
+
+        // Returns true with the full status in out, or false if the frame
+        // is malformed or its keyframe has not been received.
+        bool update(const FrameHeader& hdr, const uint8_t* payload, uint8_t* out, size_t out_size, size_t& out_len) {
+            if (hdr.type != FrameType::Status)
+                return false;
+
+            if (!(hdr.flags & FLAG_DELTA)) {
+                if ((hdr.length > MAX_STATUS_SIZE) || (hdr.length > out_size))
+                    return false;
+
+                Keyframe& key = keyframes[next];
+                next = (next + 1) % KEYFRAMES;
+                key.boot = hdr.boot;
+                key.seq = hdr.seq;
+                key.length = hdr.length;
+                key.valid = true;
+                memcpy(key.data, payload, hdr.length);
+
+                memcpy(out, payload, hdr.length);
+                out_len = hdr.length;
+                return true;
+            }
+
+            const Keyframe* key = find(hdr.boot, deltaBaseSeq(payload, hdr.length));
+            if ((key == nullptr) || (key->length > out_size)) {
+                missing++;
+                return false;
+            }
+
+            memcpy(out, key->data, key->length);
+            out_len = key->length;
+            return applyDelta(out, key->length, payload, hdr.length);
+        }
+
+        // Deltas discarded because their keyframe was not available
+        uint32_t missingKeyframeCount() const { return missing; }
+
+    private:
+        struct Keyframe {
+            uint16_t boot;
+            uint32_t seq;
+            size_t length;
+            bool valid;
+            uint8_t data[MAX_STATUS_SIZE];
+        };
+
+        const Keyframe* find(uint16_t boot, uint32_t seq) const {
+            for (size_t i = 0; i < KEYFRAMES; i++) {
+                if (keyframes[i].valid && (keyframes[i].boot == boot) && (keyframes[i].seq == seq))
+                    return &keyframes[i];
+            }
+            return nullptr;
+        }
+
+        Keyframe keyframes[KEYFRAMES];
+        size_t next;
+        uint32_t missing;
+    };
+
+    // Tracks sequence numbers from a single device, to detect dropped frames.
+    // Frames replayed from the gateway's outage buffer arrive after newer live
+    // frames; these are counted as recovered rather than lost.
+    //
+    // A new boot ID starts a new sequence. Frames still arriving from the previous boot
+    // (replayed from flash after the gateway restarted) are counted as recovered too.
+    class SequenceTracker {
+    public:
+        // Frames further behind than this are assumed to be from a restarted gateway
+        static const uint32_t REPLAY_WINDOW = 8192;
+
+        SequenceTracker()
+            : expected(0)
+            , boot(0)
+            , prev_boot(0)
+            , valid(false)
+            , have_prev(false)
+            , lost(0)
+            , recovered(0)
+        { }
+
+        uint32_t update(const FrameHeader& hdr) {
+            return update(hdr.boot, hdr.seq);
+        }
+
+        // Returns the number of frames skipped before this one
+        // (0 if in order, late, or the sequence restarted).
+        uint32_t update(uint16_t boot_id, uint32_t seq) {
+            if (valid && (boot_id != boot)) {
+                if (have_prev && (boot_id == prev_boot)) {
+                    // Late frame from before the gateway restarted
+                    recovered++;
+                    if (lost > 0)
+                        lost--;
+                    return 0;
+                }
+
+                // Gateway restarted
+                prev_boot = boot;
+                have_prev = true;
+                valid = false;
+            }
+
+            uint32_t gap = 0;
+            if (valid) {
+                int32_t diff = static_cast<int32_t>(seq - expected);
+                if (diff > 0) {
+                    gap = static_cast<uint32_t>(diff);
+                    lost += gap;
+                }
+                else if ((diff < 0) && (static_cast<uint32_t>(-diff) <= REPLAY_WINDOW)) {
+                    // Late (replayed) frame filling an earlier gap
+                    recovered++;
+                    if (lost > 0)
+                        lost--;
+                    return 0;
+                }
+            }
+            expected = seq + 1;
+            boot = boot_id;
+            valid = true;
+            return gap;
+        }
+
+        // Frames skipped and not (yet) recovered
+        uint32_t lostCount() const { return lost; }
+        uint32_t recoveredCount() const { return recovered; }
+
+    private:
+        uint32_t expected;
+        uint16_t boot;
+        uint16_t prev_boot;
+        bool valid;
+        bool have_prev;
+        uint32_t lost;
+        uint32_t recovered;
+    };
+};
+
+#endif /* __MATE_WIRE_H__ */
@@ -0,0 +1,197 @@
+// Round-trip tests for the batch compression (compress/decompress, compressBatch/decompressBatch), eg:
+//
+//   g++ -std=gnu++11 -g -O1 -fsanitize=address,undefined -I.. compress-test.cpp -o compress-test
+//   ./compress-test
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "matewire.h"
+#include "matestatus.h"
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+enum class Pattern { Random, Periodic, LowEntropy, Zeros };
+
+static void fill(uint8_t* buf, size_t size, Pattern pattern)
+{
+    for (size_t i = 0; i < size; i++) {
+        switch (pattern) {
+            case Pattern::Random:       buf[i] = static_cast<uint8_t>(rand()); break;
+            case Pattern::Periodic:     buf[i] = static_cast<uint8_t>((i % 37) + ((rand() % 8) == 0)); break;
+            case Pattern::LowEntropy:   buf[i] = static_cast<uint8_t>(rand() % 4); break;
+            case Pattern::Zeros:        buf[i] = 0; break;
+        }
+    }
+}
+
+// Every input that compresses must come back out exactly
+static void test_round_trip()
+{
+    static uint8_t in[2 * MateWire::LZ_WINDOW];
+    static uint8_t packed[sizeof(in) + (sizeof(in) / 8) + 1];   // Worst case: all literals
+    static uint8_t out[sizeof(in)];
+
+    const Pattern patterns[] = { Pattern::Random, Pattern::Periodic, Pattern::LowEntropy, Pattern::Zeros };
+    for (int n = 0; n < 5000; n++) {
+        Pattern pattern = patterns[n % 4];
+        size_t size = static_cast<size_t>(rand()) % sizeof(in);
+        fill(in, size, pattern);
+
+        // Always fits when there's room for every byte as a literal
+        size_t len = MateWire::compress(packed, sizeof(packed), in, size);
+        CHECK((size == 0) || (len > 0));
+        CHECK(MateWire::decompress(out, size, packed, len) == size);
+        CHECK(memcmp(out, in, size) == 0);
+
+        if ((pattern != Pattern::Random) && (size > 64)) {
+            CHECK(len < size);
+        }
+    }
+}
+
+// Asking for output smaller than the input rejects incompressible data, rather than overrunning
+static void test_output_too_small()
+{
+    uint8_t in[1000];
+    uint8_t packed[sizeof(in) + 1];
+    fill(in, sizeof(in), Pattern::Random);
+
+    CHECK(MateWire::compress(packed, sizeof(in) - 1, in, sizeof(in)) == 0);
+    for (size_t size = 0; size < 16; size++) {
+        CHECK(MateWire::compress(packed, size, in, sizeof(in)) == 0);
+    }
+
+    fill(in, sizeof(in), Pattern::Zeros);
+    CHECK(MateWire::compress(packed, sizeof(in) - 1, in, sizeof(in)) > 0);
+}
+
+// Truncated or corrupted input fails cleanly (and the sanitizers catch any overrun)
+static void test_bad_input()
+{
+    uint8_t in[500];
+    uint8_t packed[600];
+    uint8_t out[sizeof(in)];
+    fill(in, sizeof(in), Pattern::Periodic);
+
+    size_t len = MateWire::compress(packed, sizeof(packed), in, sizeof(in));
+    CHECK(len > 0);
+    for (size_t size = 0; size < len; size++) {
+        CHECK(MateWire::decompress(out, sizeof(out), packed, size) == 0);
+    }
+
+    // A back-reference before the start of the output
+    const uint8_t before_start[] = { 0x01, 0x00, 0x00 };
+    CHECK(MateWire::decompress(out, 3, before_start, sizeof(before_start)) == 0);
+
+    for (int n = 0; n < 1000; n++) {
+        uint8_t corrupt[sizeof(packed)];
+        memcpy(corrupt, packed, len);
+        corrupt[static_cast<size_t>(rand()) % len] ^= static_cast<uint8_t>(1 + (rand() % 255));
+        MateWire::decompress(out, sizeof(out), corrupt, len);
+    }
+}
+
+// A batch of similar status frames, as the gateway sends them
+static size_t buildRecords(uint8_t* records, size_t size, uint16_t count)
+{
+    size_t len = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        uint8_t status[MateWire::MX_STATUS_SIZE] = { 5, 0x8A, 0x80, 0, 12, 0, 0, 2, 0, 0x02, 0x08, 0, 0 };
+        status[0] = static_cast<uint8_t>(rand() % 10);
+        status[10] = static_cast<uint8_t>(0x08 + (rand() % 3));
+
+        MateWire::FrameHeader hdr = {};
+        hdr.type = MateWire::FrameType::Status;
+        hdr.device_type = static_cast<uint8_t>(MateWire::DeviceType::Mx);
+        hdr.port = 3;
+        hdr.seq = 100 + i;
+        hdr.timestamp_ms = 1700000000000ULL + (i * 2000);
+        hdr.boot = 0x1234;
+
+        size_t frame_size = MateWire::encode(&records[len + MateWire::BATCH_RECORD_OVERHEAD],
+                                             size - len - MateWire::BATCH_RECORD_OVERHEAD, hdr, status, sizeof(status));
+        MateWire::put_u16(&records[len], static_cast<uint16_t>(frame_size));
+        len += MateWire::BATCH_RECORD_OVERHEAD + frame_size;
+    }
+    return len;
+}
+
+static void test_batch_round_trip()
+{
+    const uint16_t count = 8;
+    uint8_t records[1024];
+    size_t records_size = buildRecords(records, sizeof(records), count);
+
+    uint8_t message[1024];
+    size_t len = MateWire::compressBatch(message, sizeof(message), count, records, records_size);
+    CHECK(len > 0);
+    CHECK(len < (MateWire::BATCH_HEADER_SIZE + records_size) * 3 / 4);
+    CHECK(message[2] & MateWire::BATCH_FLAG_COMPRESSED);
+
+    uint8_t expanded[1024];
+    size_t size = MateWire::decompressBatch(expanded, sizeof(expanded), message, len);
+    CHECK(size == MateWire::BATCH_HEADER_SIZE + records_size);
+    CHECK(memcmp(&expanded[MateWire::BATCH_HEADER_SIZE], records, records_size) == 0);
+
+    MateWire::BatchReader batch(expanded, size);
+    const uint8_t* frame;
+    size_t frame_size;
+    uint32_t frames = 0;
+    while (batch.next(frame, frame_size)) {
+        MateWire::FrameHeader hdr;
+        const uint8_t* payload;
+        CHECK(MateWire::decode(frame, frame_size, hdr, payload) == MateWire::DecodeResult::Ok);
+        CHECK(hdr.seq == 100 + frames);
+        frames++;
+    }
+    CHECK(batch.ok());
+    CHECK(frames == count);
+
+    // Too small to expand into
+    CHECK(MateWire::decompressBatch(expanded, size - 1, message, len) == 0);
+
+    // Not enough room to compress into
+    CHECK(MateWire::compressBatch(message, MateWire::BATCH_COMPRESSED_HEADER_SIZE, count, records, records_size) == 0);
+}
+
+static void test_uncompressed_batch_copied()
+{
+    uint8_t message[1024];
+    size_t len = MateWire::encodeBatchHeader(message, sizeof(message), 4);
+    len += buildRecords(&message[len], sizeof(message) - len, 4);
+
+    uint8_t expanded[1024];
+    CHECK(MateWire::decompressBatch(expanded, sizeof(expanded), message, len) == len);
+    CHECK(memcmp(expanded, message, len) == 0);
+    CHECK(MateWire::decompressBatch(expanded, len - 1, message, len) == 0);
+
+    message[0] = 0;
+    CHECK(MateWire::decompressBatch(expanded, sizeof(expanded), message, len) == 0);
+}
+
+int main(int argc, char** argv)
+{
+    srand(1);
+
+    test_round_trip();
+    test_output_too_small();
+    test_bad_input();
+    test_batch_round_trip();
+    test_uncompressed_batch_copied();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
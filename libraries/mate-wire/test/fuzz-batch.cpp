@@ -0,0 +1,112 @@
+// Fuzz harness for decompressBatch() and the compress() round trip.
+//
+// With libFuzzer (clang):
+//
+//   clang++ -std=gnu++11 -g -O1 -fsanitize=fuzzer,address,undefined -DMATE_LIBFUZZER -I.. fuzz-batch.cpp -o fuzz-batch
+//   ./fuzz-batch
+//
+// Or standalone, with random and mutated messages:
+//
+//   g++ -std=gnu++11 -g -O1 -fsanitize=address,undefined -I.. fuzz-batch.cpp -o fuzz-batch
+//   ./fuzz-batch [iterations]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "matewire.h"
+
+// Larger than any batch can expand to (16 bit records size)
+static uint8_t expanded[MateWire::BATCH_HEADER_SIZE + 0x10000];
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    // Whatever is received must be rejected or expanded within bounds, and whatever expands must be readable
+    size_t len = MateWire::decompressBatch(expanded, sizeof(expanded), data, size);
+    if (len > 0) {
+        MateWire::BatchReader batch(expanded, len);
+        const uint8_t* frame;
+        size_t frame_size;
+        while (batch.next(frame, frame_size)) {
+            MateWire::FrameHeader hdr;
+            const uint8_t* payload;
+            MateWire::decode(frame, frame_size, hdr, payload);
+        }
+    }
+
+    // Any input that compresses must round trip
+    static uint8_t packed[0x10000 + (0x10000 / 8) + 1];
+    static uint8_t out[0x10000];
+    if (size <= sizeof(out)) {
+        size_t packed_size = MateWire::compress(packed, sizeof(packed), data, size);
+        if ((size > 0) && (packed_size == 0))
+            abort();
+        if ((MateWire::decompress(out, size, packed, packed_size) != size) || (memcmp(out, data, size) != 0))
+            abort();
+    }
+    return 0;
+}
+
+#ifndef MATE_LIBFUZZER
+
+// A valid compressed batch of similar frames, to mutate
+static size_t seed(uint8_t* out, size_t out_size)
+{
+    uint8_t records[1024];
+    size_t len = 0;
+    uint16_t count = 1 + (rand() % 8);
+    for (uint16_t i = 0; i < count; i++) {
+        uint8_t status[20];
+        for (size_t j = 0; j < sizeof(status); j++) {
+            status[j] = static_cast<uint8_t>((j < 10) ? j : rand());
+        }
+
+        MateWire::FrameHeader hdr = {};
+        hdr.type = MateWire::FrameType::Status;
+        hdr.device_type = static_cast<uint8_t>(MateWire::DeviceType::Mx);
+        hdr.seq = i;
+        size_t frame_size = MateWire::encode(&records[len + MateWire::BATCH_RECORD_OVERHEAD],
+                                             sizeof(records) - len - MateWire::BATCH_RECORD_OVERHEAD, hdr, status, sizeof(status));
+        MateWire::put_u16(&records[len], static_cast<uint16_t>(frame_size));
+        len += MateWire::BATCH_RECORD_OVERHEAD + frame_size;
+    }
+    return MateWire::compressBatch(out, out_size, count, records, len);
+}
+
+int main(int argc, char** argv)
+{
+    long iterations = (argc > 1) ? atol(argv[1]) : 200000;
+    srand(1);
+
+    static uint8_t data[2048];
+    for (long n = 0; n < iterations; n++) {
+        size_t size;
+        if (n & 1) {
+            // Mutate a few bytes of a valid message, or truncate it
+            size = seed(data, sizeof(data));
+            int mutations = 1 + (rand() % 4);
+            for (int i = 0; (i < mutations) && (size > 0); i++) {
+                data[static_cast<size_t>(rand()) % size] = static_cast<uint8_t>(rand());
+            }
+            if ((rand() % 4) == 0) {
+                size = static_cast<size_t>(rand()) % (size + 1);
+            }
+        }
+        else {
+            // Random, behind a header that claims to be a compressed batch
+            size = static_cast<size_t>(rand()) % sizeof(data);
+            for (size_t i = 0; i < size; i++) {
+                data[i] = static_cast<uint8_t>(rand());
+            }
+            if (size >= MateWire::BATCH_HEADER_SIZE) {
+                data[0] = MateWire::BATCH_MAGIC;
+                data[1] = MateWire::BATCH_VERSION;
+                data[2] = MateWire::BATCH_FLAG_COMPRESSED;
+            }
+        }
+        LLVMFuzzerTestOneInput(data, size);
+    }
+    printf("%ld inputs ok\n", iterations);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,216 @@
+#include "matenet-emulator.h"
+
+static const size_t REQUEST_WORDS = 8;
+static const uint16_t BIT8 = 0x100;
+
+MateNetEmulator::MateNetEmulator(uint32_t baud)
+    : m_word_us((11 * 1000000UL) / baud)
+    , m_stats()
+{
+    for (auto& dev : m_devices) {
+        dev.present = false;
+        dev.battery_temp = 25;
+    }
+}
+
+void MateNetEmulator::addDevice(uint8_t port, const DeviceConfig& config)
+{
+    if (port >= MATENET_EMULATOR_PORTS)
+        return;
+
+    Device& dev = m_devices[port];
+    dev.present = true;
+    dev.config = config;
+    dev.status.assign(config.status_size, 0);
+    for (auto& b : dev.status) {
+        b = static_cast<uint8_t>(random(256));
+    }
+}
+
+MateNetEmulator::DeviceConfig* MateNetEmulator::device(uint8_t port)
+{
+    if ((port >= MATENET_EMULATOR_PORTS) || !m_devices[port].present)
+        return nullptr;
+    return &m_devices[port].config;
+}
+
+void MateNetEmulator::receive(uint16_t word)
+{
+    // The 9th bit marks the start of a packet.
+    // Any response not yet read by the controller is discarded (the bus is half-duplex).
+    if (word & BIT8) {
+        m_rx.clear();
+        m_tx.clear();
+    }
+    else if (m_rx.empty()) {
+        return; // Not synchronized yet
+    }
+
+    m_rx.push_back(word);
+    if (m_rx.size() == REQUEST_WORDS) {
+        handlePacket();
+        m_rx.clear();
+    }
+}
+
+int MateNetEmulator::available()
+{
+    uint32_t now = static_cast<uint32_t>(micros());
+    int n = 0;
+    for (auto& tx : m_tx) {
+        if (static_cast<int32_t>(now - tx.ready_us) < 0)
+            break;
+        n++;
+    }
+    return n;
+}
+
+int MateNetEmulator::peek()
+{
+    if (available() == 0)
+        return -1;
+    return m_tx.front().word;
+}
+
+int MateNetEmulator::read()
+{
+    int word = peek();
+    if (word >= 0) {
+        m_tx.pop_front();
+    }
+    return word;
+}
+
+bool MateNetEmulator::chance(uint8_t pct)
+{
+    return (pct > 0) && (random(100) < pct);
+}
+
+void MateNetEmulator::handlePacket()
+{
+    uint8_t port = static_cast<uint8_t>(m_rx[0] & 0xFF);
+    uint8_t type = static_cast<uint8_t>(m_rx[1]);
+    uint16_t addr = static_cast<uint16_t>((m_rx[2] << 8) | m_rx[3]);
+    uint16_t param = static_cast<uint16_t>((m_rx[4] << 8) | m_rx[5]);
+    uint16_t checksum = static_cast<uint16_t>((m_rx[6] << 8) | m_rx[7]);
+
+    m_stats.requests++;
+
+    uint16_t sum = 0;
+    for (size_t i = 1; i < 6; i++) {
+        sum += m_rx[i] & 0xFF;
+    }
+    if ((sum != checksum) || (port >= MATENET_EMULATOR_PORTS) || !m_devices[port].present) {
+        m_stats.bad_requests++;
+        return; // No response, the controller will time out
+    }
+
+    Device& dev = m_devices[port];
+    if (chance(dev.config.timeout_pct)) {
+        m_stats.timeouts++;
+        return;
+    }
+
+    uint8_t payload[256];
+    size_t size = 0;
+
+    switch (type) {
+        case PKT_QUERY: {
+            uint16_t value = queryRegister(dev, addr);
+            payload[size++] = static_cast<uint8_t>(value >> 8);
+            payload[size++] = static_cast<uint8_t>(value);
+            break;
+        }
+
+        case PKT_CONTROL:
+            if (addr == REG_BATTERY_TEMP) {
+                dev.battery_temp = param;
+            }
+            // Fall through
+        case PKT_INC:
+        case PKT_DEC:
+            // Acknowledge with the written value
+            payload[size++] = static_cast<uint8_t>(param >> 8);
+            payload[size++] = static_cast<uint8_t>(param);
+            break;
+
+        case PKT_STATUS:
+            updateStatus(dev);
+            size = std::min(dev.status.size(), sizeof(payload));
+            memcpy(payload, dev.status.data(), size);
+            // DC status pages differ, so include the page number
+            if ((size > 0) && (dev.config.type == MateWire::DeviceType::Dc)) {
+                payload[0] = static_cast<uint8_t>(addr);
+            }
+            break;
+
+        case PKT_LOG:
+            size = std::min(dev.config.log_size, sizeof(payload));
+            for (size_t i = 0; i < size; i++) {
+                payload[i] = static_cast<uint8_t>(param + i);   // param is the day
+            }
+            break;
+
+        default:
+            m_stats.bad_requests++;
+            return;
+    }
+
+    respond(dev, type, payload, size);
+}
+
+void MateNetEmulator::respond(Device& dev, uint8_t type, const uint8_t* payload, size_t size)
+{
+    uint8_t frame[260];
+    size_t n = 0;
+
+    frame[n++] = type;
+    memcpy(&frame[n], payload, size);
+    n += size;
+
+    uint16_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += frame[i];
+    }
+    frame[n++] = static_cast<uint8_t>(sum >> 8);
+    frame[n++] = static_cast<uint8_t>(sum);
+
+    if (chance(dev.config.corrupt_pct)) {
+        frame[1 + random(static_cast<long>(n - 1))] ^= static_cast<uint8_t>(1 << random(8));
+        m_stats.corrupted++;
+    }
+
+    // The request itself takes time to send, then the device takes a while to respond
+    uint32_t t = static_cast<uint32_t>(micros()) + (REQUEST_WORDS * m_word_us) + (dev.config.latency_ms * 1000);
+    for (size_t i = 0; i < n; i++) {
+        t += m_word_us;
+        TxWord tx;
+        tx.word = frame[i] | ((i == 0) ? BIT8 : 0);
+        tx.ready_us = t;
+        m_tx.push_back(tx);
+    }
+
+    m_stats.responses++;
+}
+
+void MateNetEmulator::updateStatus(Device& dev)
+{
+    // Random walk, so consecutive status reads are mostly similar (like real devices)
+    for (auto& b : dev.status) {
+        if (chance(dev.config.change_pct)) {
+            b = static_cast<uint8_t>(b + random(-2, 3));
+        }
+    }
+}
+
+uint16_t MateNetEmulator::queryRegister(Device& dev, uint16_t reg)
+{
+    switch (reg) {
+        case REG_DEVICE_TYPE:   return static_cast<uint16_t>(dev.config.type);
+        case REG_REVISION_A:    return dev.config.revision[0];
+        case REG_REVISION_B:    return dev.config.revision[1];
+        case REG_REVISION_C:    return dev.config.revision[2];
+        case REG_BATTERY_TEMP:  return dev.battery_temp;
+        default:                return 0;
+    }
+}
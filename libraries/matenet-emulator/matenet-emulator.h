@@ -0,0 +1,119 @@
+#ifndef __MATENET_EMULATOR_H__
+#define __MATENET_EMULATOR_H__
+
+// Emulates the devices on a MATEnet bus, at the level of 9-bit words on the wire.
+// Attach it to the (host) SoftwareSerial used by MateControllerProtocol:
+//
+//   MateNetEmulator bus;
+//   bus.addDevice(0, hub);
+//   bus.addDevice(1, mx);
+//   Serial9b.attach(&bus);
+//
+// Packets from the controller (8 words):
+//   [port | 0x100] [type] [addr hi] [addr lo] [param hi] [param lo] [checksum hi] [checksum lo]
+//
+// Responses from a device:
+//   [type | 0x100] [payload ...] [checksum hi] [checksum lo]
+//
+// The checksum is the 16-bit sum of the preceding bytes (excluding the port byte).
+// Responses are delivered at the bus bit rate, after the device's configured latency.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <vector>
+#include <SoftwareSerial.h>
+#include <matewire.h>
+
+#ifndef MATENET_EMULATOR_PORTS
+#define MATENET_EMULATOR_PORTS (10)
+#endif
+
+class MateNetEmulator : public SerialPeer9b {
+public:
+    enum PacketType : uint8_t {
+        PKT_INC     = 1,
+        PKT_DEC     = 2,
+        PKT_QUERY   = 3,
+        PKT_CONTROL = 4,
+        PKT_STATUS  = 5,
+        PKT_LOG     = 0x16,
+    };
+
+    // Registers answered by every device
+    static const uint16_t REG_DEVICE_TYPE   = 0x0000;
+    static const uint16_t REG_REVISION_A    = 0x0002;
+    static const uint16_t REG_REVISION_B    = 0x0003;
+    static const uint16_t REG_REVISION_C    = 0x0004;
+    static const uint16_t REG_BATTERY_TEMP  = 0x4000;
+
+    struct DeviceConfig {
+        MateWire::DeviceType type;
+        uint32_t    latency_ms;     // Delay before the first response word
+        uint8_t     timeout_pct;    // Chance a request goes unanswered
+        uint8_t     corrupt_pct;    // Chance a response has a corrupted byte
+        uint8_t     change_pct;     // Chance each status byte changes between reads
+        size_t      status_size;    // Status response payload size
+        size_t      log_size;       // Logpage response payload size
+        uint16_t    revision[3];
+
+        DeviceConfig(MateWire::DeviceType type = MateWire::DeviceType::None)
+            : type(type)
+            , latency_ms(10)
+            , timeout_pct(0)
+            , corrupt_pct(0)
+            , change_pct(10)
+            , status_size(13)
+            , log_size(13)
+            , revision{1, 2, 3}
+        { }
+    };
+
+    struct Stats {
+        uint32_t requests;
+        uint32_t responses;
+        uint32_t timeouts;      // Injected
+        uint32_t corrupted;     // Injected
+        uint32_t bad_requests;  // Bad checksum / unknown port
+    };
+
+    MateNetEmulator(uint32_t baud = 9600);
+
+    void addDevice(uint8_t port, const DeviceConfig& config);
+    DeviceConfig* device(uint8_t port);
+
+    const Stats& stats() const { return m_stats; }
+
+    // SerialPeer9b
+    void receive(uint16_t word) override;
+    int available() override;
+    int read() override;
+    int peek() override;
+
+private:
+    struct Device {
+        bool present;
+        DeviceConfig config;
+        std::vector<uint8_t> status;
+        uint16_t battery_temp;
+    };
+
+    struct TxWord {
+        uint16_t word;
+        uint32_t ready_us;  // micros() at which the word has been received
+    };
+
+    void handlePacket();
+    void respond(Device& dev, uint8_t type, const uint8_t* payload, size_t size);
+    void updateStatus(Device& dev);
+    uint16_t queryRegister(Device& dev, uint16_t reg);
+    bool chance(uint8_t pct);
+
+    Device m_devices[MATENET_EMULATOR_PORTS];
+    std::vector<uint16_t> m_rx;
+    std::deque<TxWord> m_tx;
+    uint32_t m_word_us;     // Time to transmit one 9-bit word (start + 9 data + stop bits)
+    Stats m_stats;
+};
+
+#endif /* __MATENET_EMULATOR_H__ */
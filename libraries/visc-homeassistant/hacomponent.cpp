@@ -1,8 +1,8 @@
 
 #include "hacomponent.h"
 #include <math.h>
+#include <stdarg.h>
 #include <WiFi.h>
-#include <ArduinoJson.h>
 
 extern Stream& Debug;
 
@@ -21,14 +21,18 @@ template<>              const char* SensorClassString<SensorClass::Humidity>::na
 template<>              const char* SensorClassString<SensorClass::Battery>::name = "battery";
 template<>              const char* SensorClassString<SensorClass::Illuminance>::name = "illuminance";
 template<>              const char* SensorClassString<SensorClass::Pressure>::name = "pressure";
+template<>              const char* SensorClassString<SensorClass::Voltage>::name = "voltage";
+template<>              const char* SensorClassString<SensorClass::Current>::name = "current";
+template<>              const char* SensorClassString<SensorClass::Energy>::name = "energy";
 
 // template<BinarySensorClass c> const char* BinarySensorClass<c>::name = nullptr;
 // template<>                    const char* BinarySensorClass<BinarySensorClass::connectivity>::name = "connectivity";
 // // TODO...
 
 // Static instantiations
-std::vector<HACompItem*>                        HACompItem::m_components;
-std::vector<HAComponent<Component::Switch>*>    HAComponent<Component::Switch>::m_switches;
+HACompItem*                                     HACompItem::m_first = nullptr;
+HACompItem*                                     HACompItem::m_pending = nullptr;
+HAComponent<Component::Switch>*                 HAComponent<Component::Switch>::m_first_switch = nullptr;
 static HAComponent<Component::BinarySensor>*    s_component = nullptr;
 
 // Warning: HomeAssistant is case sensitive! These are the default state values...
@@ -40,27 +44,37 @@ const char*                                     HAAvailabilityComponent::ONLINE
 const char*                                     HAAvailabilityComponent::OFFLINE = "offline";
 
 
-static void getDeviceInfo(JsonObject& json, ComponentContext& context) {
-    auto& deviceInfo = json.createNestedObject("device");
+// Serialized config payloads, shared by all components. Never freed, since the payloads don't change.
+static char     s_config_cache[HA_CONFIG_CACHE_SIZE];
+static size_t   s_config_cache_used = 0;
 
-    String id = WiFi.macAddress();
+static void getDeviceInfo(JsonWriter& json, ComponentContext& context) {
+    static char id[18] = {0};
+    if (id[0] == '\0') {
+        uint8_t mac[6];
+        WiFi.macAddress(mac);
+        snprintf(id, sizeof(id), "%02X:%02X:%02X:%02X:%02X:%02X",
+            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    }
 
-    deviceInfo["identifiers"]   = id;
-    deviceInfo["name"]          = context.device_name;
-    deviceInfo["sw_version"]    = context.fw_version;
-    deviceInfo["model"]         = context.model;
-    deviceInfo["manufacturer"]  = context.manufacturer;
+    json.beginObject("device");
+    json.add("identifiers",     id);
+    json.add("name",            context.device_name);
+    json.add("sw_version",      context.fw_version);
+    json.add("model",           context.model);
+    json.add("manufacturer",    context.manufacturer);
 
     // This tells HA if the component is available (connected) or not.
     if (HAAvailabilityComponent::inst != nullptr) {
         // NOTE: This doesn't seem to have any effect as long as you make sure the availability
         // sensor is published with the same device information as other sensors...
-        //json["availability_topic"] = HAAvailabilityComponent::inst->getWillTopic();
+        //json.add("availability_topic", HAAvailabilityComponent::inst->getWillTopic());
     }
+    json.endObject();
 }
 
 template<Component c>
-void HACompBase<c>::getConfigInfo(JsonObject& json)
+void HACompBase<c>::getConfigInfo(JsonWriter& json)
 {
 }
 
@@ -78,77 +92,109 @@ void HACompBase<c>::getConfigInfo(JsonObject& json)
 //     return String(state_topic);
 // }
 
+// Format a topic into a fixed buffer, warning if it doesn't fit
+static void formatTopic(char* topic, size_t size, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(topic, size, fmt, args);
+    va_end(args);
+
+    if ((n < 0) || (n >= (int)size)) {
+        Debug.print("WARNING: Topic truncated, increase TOPIC_BUFFER_SIZE: ");
+        Debug.println(topic);
+    }
+}
+
 template<Component c>
 void HACompBase<c>::Initialize()
 {
-    char state_topic[TOPIC_BUFFER_SIZE];
-    snprintf(state_topic, sizeof(state_topic), 
-        "%s/%s/%s/state\0", 
+    formatTopic(m_state_topic, sizeof(m_state_topic), 
+        "%s/%s/%s/state", 
         context.device_name, m_component, m_name);
-    m_state_topic = String(state_topic);
 }
 
-// Generic publish implementation used for all component types
+// Serialize the discovery config payload. Returns its length, or 0 if it doesn't fit.
 template<Component c>
-void HACompBase<c>::PublishConfig(bool present)
+size_t HACompBase<c>::serializeConfig(char* buf, size_t size)
 {
-    // Generic implementation
-    char topic[TOPIC_BUFFER_SIZE];
+    // Unique ID for component.
+    // Also used as the name, so it's used for the entity ID instead of the friendly name.
+    char uid[TOPIC_BUFFER_SIZE];
+    snprintf(uid, sizeof(uid),
+        "%s_%s",
+        context.device_name, m_name);
 
-    snprintf(topic, sizeof(topic), 
-        "homeassistant/%s/%s/%s/config\0", 
-        m_component, context.device_name, m_name);
+    JsonWriter json(buf, size);
+    json.beginObject();
+    json.add("name",    uid);
+    json.add("stat_t",  m_state_topic);
 
-    if (present) {
-        StaticJsonBuffer<JSON_BUFFER_SIZE> jsonBuffer;
-        JsonObject& json = jsonBuffer.createObject();
+    // For a complete list of JSON parameters you can set, see:
+    // https://www.home-assistant.io/docs/mqtt/discovery/
+    getConfigInfo(json);
 
-        //Led::SetBuiltin(true);
+    json.add("unique_id", uid);
 
-        json["name"]    = m_name;
-        json["stat_t"]  = m_state_topic;
+    // Add device information
+    getDeviceInfo(json, context);
+    json.endObject();
 
-        // For a complete list of JSON parameters you can set, see:
-        // https://www.home-assistant.io/docs/mqtt/discovery/
-        getConfigInfo(json);
+    return json.ok() ? json.size() : 0;
+}
 
-        // // Prepend the AirNode friendly name to the sensor name
-        // char name[TOPIC_BUFFER_SIZE];
-        // snprintf(name, sizeof(name),
-        //     "%s %s",
-        //     context.friendly_name,
-        //     json.get<char*>("name"));
-        // json["name"] = String((const char*)name);
+// Generic publish implementation used for all component types.
+// Returns false if the client is disconnected.
+template<Component c>
+bool HACompBase<c>::PublishConfig(bool present)
+{
+    if (!context.client.connected())
+        return false;
 
-        // Add unique ID for component
-        char uid[TOPIC_BUFFER_SIZE];
-        snprintf(uid, sizeof(uid),
-            "%s_%s\0",
-            context.device_name, m_name);
-        json["unique_id"] = uid;
+    // Generic implementation
+    char topic[TOPIC_BUFFER_SIZE];
 
-        // Use the unique name instead of friendly name for entity IDs
-        json["name"] = String(uid);
+    snprintf(topic, sizeof(topic), 
+        "homeassistant/%s/%s/%s/config", 
+        m_component, context.device_name, m_name);
 
-        // Add device information
-        getDeviceInfo(json, context);
+    if (present) {
+        //Led::SetBuiltin(true);
 
-        String payload;
-        json.printTo(payload);
+        // The payload never changes, so it is only serialized the first time
+        if (m_config_len == 0) {
+            size_t len = serializeConfig(&s_config_cache[s_config_cache_used], sizeof(s_config_cache) - s_config_cache_used);
+            if (len > 0) {
+                m_config_offset = static_cast<uint16_t>(s_config_cache_used);
+                m_config_len    = static_cast<uint16_t>(len);
+                s_config_cache_used += len;
+            }
+        }
 
         Debug.print("publish: ");
-        Debug.print(topic);
-        if (!present) {
-            Debug.print(" (not present)");
-        } else {
-            //Debug.print(" -> ");
-            //Debug.print(payload.c_str());
+        Debug.println(topic);
+
+        bool ok;
+        if (m_config_len > 0) {
+            ok = context.client.publish(topic, reinterpret_cast<const uint8_t*>(&s_config_cache[m_config_offset]), m_config_len, true);
+        }
+        else {
+            // Cache full, serialize it again every time
+            char payload[JSON_BUFFER_SIZE];
+            size_t len = serializeConfig(payload, sizeof(payload));
+            if (len == 0) {
+                Debug.println("ERROR: Config too large");
+                return true;    // Skip it
+            }
+            ok = context.client.publish(topic, reinterpret_cast<const uint8_t*>(payload), len, true);
         }
-        Debug.println();
 
-        if (!context.client.publish(topic, payload.c_str(), true)) {
+        if (!ok) {
             Debug.println("ERROR PUBLISHING TOPIC");
+            return context.client.connected();
         }
+
+        onConfigPublished();
     } 
     else {
         // If not present, we should unpublish the topic
@@ -160,7 +206,7 @@ void HACompBase<c>::PublishConfig(bool present)
 
         // Also unpublish the parent node
         snprintf(topic, sizeof(topic), 
-            "homeassistant/%s/%s/%s\0", 
+            "homeassistant/%s/%s/%s", 
             m_component, context.device_name, m_name);
         context.client.publish(topic, nullptr, 0, true);
 
@@ -170,35 +216,39 @@ void HACompBase<c>::PublishConfig(bool present)
     }
 
     //Led::SetBuiltin(false);
+    return true;
 }
 
 HAComponent<Component::Switch>::HAComponent(ComponentContext& context, const char* name, std::function<void(boolean)> callback) :
     HACompBase(context, name),
     m_state(false),
-    m_callback(callback)
+    m_callback(callback),
+    m_next_switch(m_first_switch)
 {
-    HAComponent<Component::Switch>::m_switches.push_back(this);
+    m_cmd_topic[0] = '\0';
+    m_first_switch = this;
 }
 
 void HAComponent<Component::Switch>::Initialize()
 {
     HACompBase<Component::Switch>::Initialize();
 
-    char cmd_topic[TOPIC_BUFFER_SIZE];
-    snprintf(cmd_topic, sizeof(cmd_topic), 
-        "%s/%s/%s/ctrl\0", 
+    formatTopic(m_cmd_topic, sizeof(m_cmd_topic), 
+        "%s/%s/%s/ctrl", 
         context.device_name, m_component, m_name);
-    m_cmd_topic = String(cmd_topic);
 }
 
 // Topic specialization for switch components
-void HAComponent<Component::Switch>::getConfigInfo(JsonObject& json)
+void HAComponent<Component::Switch>::getConfigInfo(JsonWriter& json)
 {
     // https://www.home-assistant.io/components/switch.mqtt/
 
-    json["cmd_t"]   = m_cmd_topic; // "command_topic"
+    json.add("cmd_t", m_cmd_topic); // "command_topic"
+}
 
-    context.client.subscribe(m_cmd_topic.c_str());
+void HAComponent<Component::Switch>::onConfigPublished()
+{
+    context.client.subscribe(m_cmd_topic);
 
     ReportState();
 }
@@ -213,18 +263,18 @@ void HAComponent<Component::Switch>::SetState(bool state)
 
 void HAComponent<Component::Switch>::ReportState()
 {
-    context.client.publish(m_state_topic.c_str(), (m_state ? ON : OFF), true);
+    context.client.publish(m_state_topic, (m_state ? ON : OFF), true);
 }
 
-void HAComponent<Component::Switch>::ProcessMqttTopic(String& topic, String& value)
+void HAComponent<Component::Switch>::ProcessMqttTopic(const char* topic, const char* value)
 {
-    for (auto* sw : m_switches) {
+    for (auto* sw = m_first_switch; sw != nullptr; sw = sw->m_next_switch) {
         Debug.print("CHECK: "); Debug.println(sw->m_cmd_topic);
-        if (sw->m_cmd_topic == topic) {
-            if (value.equalsIgnoreCase(ON)) {
+        if (strcmp(sw->m_cmd_topic, topic) == 0) {
+            if (strcasecmp(value, ON) == 0) {
                 sw->SetState(true);
             }
-            else if (value.equalsIgnoreCase(OFF)) {
+            else if (strcasecmp(value, OFF) == 0) {
                 sw->SetState(false);
             }
             else {
@@ -238,7 +288,7 @@ void HAComponent<Component::Switch>::ProcessMqttTopic(String& topic, String& val
 
 
 // Topic specialization for sensor components
-void HAComponent<Component::Sensor>::getConfigInfo(JsonObject& json)
+void HAComponent<Component::Sensor>::getConfigInfo(JsonWriter& json)
 {
     // https://www.home-assistant.io/components/sensor.mqtt/
 
@@ -248,7 +298,11 @@ void HAComponent<Component::Sensor>::getConfigInfo(JsonObject& json)
 
     // Update sensor state even if value hasn't changed.
     // This ensures Graphite/Grafana get regularly spaced samples!
-    json["frc_upd"] = true; // "force_update"
+    json.add("frc_upd", true); // "force_update"
+
+    // The state is a summary of the sample window, the rest of which is shown as attributes
+    json.add("val_tpl", "{{ value_json.value }}");  // "value_template"
+    json.add("json_attr_t", m_state_topic);         // "json_attributes_topic"
 
     switch (m_sensor_class) {
         case SensorClass::Temperature:
@@ -271,6 +325,18 @@ void HAComponent<Component::Sensor>::getConfigInfo(JsonObject& json)
             device_class = SensorClassString<SensorClass::Pressure>::name;
             units = "mbar"; // "hPa"
             break;
+        case SensorClass::Voltage:
+            device_class = SensorClassString<SensorClass::Voltage>::name;
+            units = "V";
+            break;
+        case SensorClass::Current:
+            device_class = SensorClassString<SensorClass::Current>::name;
+            units = "A";
+            break;
+        case SensorClass::Energy:
+            device_class = SensorClassString<SensorClass::Energy>::name;
+            units = "Wh";
+            break;
         case SensorClass::Dust:
             device_class = nullptr;
             units = "ug/m³";
@@ -283,13 +349,28 @@ void HAComponent<Component::Sensor>::getConfigInfo(JsonObject& json)
             device_class = nullptr;
             units = "ppb";
             break;
+        case SensorClass::AmpHours:
+            device_class = nullptr;
+            units = "Ah";
+            break;
         default:
             break;
     }
 
-    json["unit_of_meas"] = units; // "unit_of_measurement"
+    json.add("unit_of_meas", units); // "unit_of_measurement"
     if (device_class != nullptr) {
-        json["dev_cla"] = device_class;
+        json.add("dev_cla", device_class);
+    }
+
+    switch (m_state_class) {
+        case StateClass::Measurement:
+            json.add("stat_cla", "measurement"); // "state_class"
+            break;
+        case StateClass::TotalIncreasing:
+            json.add("stat_cla", "total_increasing");
+            break;
+        default:
+            break;
     }
 }
 
@@ -305,7 +386,7 @@ void HACompBase<c>::PublishState(const char* value, bool retain)
     Debug.print("=");
     Debug.println(value);
 
-    context.client.publish(m_state_topic.c_str(), value, retain);
+    context.client.publish(m_state_topic, value, retain);
 
     //Led::SetBuiltin(false);
 }
@@ -315,7 +396,7 @@ void HACompBase<c>::ClearState()
 {
     // Un-publish the state topic
     // IMPORTANT: Use 4-arg overload. The 2 & 3-arg overloads try to call strlen() on payload
-    context.client.publish(m_state_topic.c_str(), nullptr, 0, true);
+    context.client.publish(m_state_topic, nullptr, 0, true);
 }
 
 // Sensor reading publish implementation
@@ -327,38 +408,93 @@ void HAComponent<Component::Sensor>::Update(float value)
     }
 
     // Accumulate value
-    m_samples++;
-    m_sum += value;
+    m_stats.add(value);
 
     long ts = millis();
     if (ts - m_last_ts > m_sample_interval) {
         m_last_ts = ts;
 
-        // Compute mean over the sample window
-        float avg_value = (m_samples > 0) ? (m_sum / (float)m_samples) : m_sum;
-        m_samples = 0;
-        m_sum = 0.f;
-
-        Debug.print(m_name); Debug.print(": "); Debug.println(avg_value);
+        // Summarize the sample window
+        SensorStats::Summary summary;
+        if (!m_stats.summarize(summary)) {
+            return;
+        }
+        int32_t state = reportsLast() ? summary.last :
+                        m_stats.smoothed() ? summary.ema : summary.mean;
+        float avg_value = m_stats.toFloat(state);
 
         // Only publish if the value is significant
-        if (std::isfinite(avg_value) && ((m_hysteresis == 0.0f) || (avg_value <= m_last_value - m_hysteresis || avg_value >= m_last_value + m_hysteresis))) {
+        if ((m_hysteresis == 0.0f) || (avg_value <= m_last_value - m_hysteresis || avg_value >= m_last_value + m_hysteresis)) {
             m_last_value = avg_value;
 
-            String value_s(avg_value);
-            HACompBase<Component::Sensor>::PublishState(value_s.c_str());
+            PublishSummary(summary, state);
         }
     }
 }
 
+// Eg. {"value":26.71,"mean":26.71,"min":26.50,"max":26.90,"last":26.80,"std":0.12,"n":15}
+void HAComponent<Component::Sensor>::PublishSummary(const SensorStats::Summary& summary, int32_t value)
+{
+    char payload[128];
+    char num[16];
+    JsonWriter json(payload, sizeof(payload));
+    json.beginObject();
+
+    m_stats.format(num, sizeof(num), value);
+    json.addRaw("value", num);
+
+    // The window statistics of a counter or a code aren't much use, eg. {"value":15230}
+    if (reportsLast()) {
+        json.endObject();
+        if (json.ok()) {
+            HACompBase<Component::Sensor>::PublishState(payload);
+        }
+        return;
+    }
+
+    m_stats.format(num, sizeof(num), summary.mean);
+    json.addRaw("mean", num);
+    m_stats.format(num, sizeof(num), summary.min);
+    json.addRaw("min", num);
+    m_stats.format(num, sizeof(num), summary.max);
+    json.addRaw("max", num);
+    m_stats.format(num, sizeof(num), summary.last);
+    json.addRaw("last", num);
+    m_stats.format(num, sizeof(num), summary.stddev);
+    json.addRaw("std", num);
+    json.add("n", static_cast<int>(summary.count));
+    json.endObject();
+
+    if (json.ok()) {
+        HACompBase<Component::Sensor>::PublishState(payload);
+    }
+}
+
 float HAComponent<Component::Sensor>::GetCurrent()
 {
     return m_last_value;
 }
 
+void HAComponent<Component::Sensor>::UpdateTotal(uint64_t total)
+{
+    char payload[48];
+    char num[24];
+    if (m_stats.format(num, sizeof(num), total) == 0)
+        return;
+
+    JsonWriter json(payload, sizeof(payload));
+    json.beginObject();
+    json.addRaw("value", num);
+    json.endObject();
+
+    if (json.ok()) {
+        HACompBase<Component::Sensor>::PublishState(payload);
+    }
+}
+
 
 // Topic specialization for sensor components
-void HAComponent<Component::BinarySensor>::getConfigInfo(JsonObject& json)
+void HAComponent<Component::BinarySensor>::getConfigInfo(JsonWriter& json)
 {
     // https://www.home-assistant.io/components/binary_sensor.mqtt/
 
@@ -372,7 +508,7 @@ void HAComponent<Component::BinarySensor>::getConfigInfo(JsonObject& json)
     }
 
     if (device_class != nullptr) {
-        json["dev_cla"] = device_class;
+        json.add("dev_cla", device_class);
     }
 }
 
@@ -389,23 +525,21 @@ HAAvailabilityComponent::HAAvailabilityComponent(ComponentContext& context)
 
 void HAAvailabilityComponent::Initialize()
 {
-    char state_topic[TOPIC_BUFFER_SIZE];
-    snprintf(state_topic, sizeof(state_topic), 
-        "%s/%s\0", 
+    formatTopic(m_state_topic, sizeof(m_state_topic), 
+        "%s/%s", 
         context.device_name, m_name);
-    m_state_topic = String(state_topic);
 }
 
-void HAAvailabilityComponent::getConfigInfo(JsonObject& json)
+void HAAvailabilityComponent::getConfigInfo(JsonWriter& json)
 {
     // TODO: values should be "online" and "offline"
-    json["payload_on"]  = ONLINE;
-    json["payload_off"] = OFFLINE;
+    json.add("payload_on",  ONLINE);
+    json.add("payload_off", OFFLINE);
 
-    json["dev_cla"] = "connectivity";
+    json.add("dev_cla", "connectivity");
 }
 
-String HAAvailabilityComponent::getWillTopic()
+const char* HAAvailabilityComponent::getWillTopic()
 {
     return m_state_topic;
 }
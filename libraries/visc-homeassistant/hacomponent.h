@@ -2,14 +2,31 @@
 #define __HA_COMPONENT_H__
 
 #include <Arduino.h>
-#include <vector>
+#include <functional>
 //#include "debug.h"
-#include <ArduinoJson.h>
 #include <PubSubClient.h>
+#include "jsonwriter.h"
+#include "sensorstats.h"
 
+// Components keep their topics in fixed buffers, and register themselves in intrusive
+// lists, so nothing is allocated on the heap once they are constructed.
+#ifndef TOPIC_BUFFER_SIZE
 #define TOPIC_BUFFER_SIZE (80)
+#endif
 #define JSON_BUFFER_SIZE (MQTT_MAX_PACKET_SIZE)
 
+// Discovery config payloads are serialized once, into a shared cache of this size.
+// Components that don't fit are serialized again each time they are published.
+#ifndef HA_CONFIG_CACHE_SIZE
+#define HA_CONFIG_CACHE_SIZE (4096)
+#endif
+
+// Max number of components whose config is published per call to PublishPending(),
+// so republishing everything after a reconnect doesn't hold up live data
+#ifndef HA_CONFIG_PER_LOOP
+#define HA_CONFIG_PER_LOOP (2)
+#endif
+
 class ComponentContext {
 public:
     PubSubClient& client;
@@ -46,10 +63,21 @@ enum class SensorClass {
     Illuminance,
     Temperature,
     Pressure,
+    Voltage,
+    Current,
+    Energy,
 // Extra ones only used to add units (device_class == null)
     Dust,
     PPM,
-    PPB
+    PPB,
+    AmpHours
+};
+
+// https://developers.home-assistant.io/docs/core/entity/sensor/#available-state-classes
+enum class StateClass {
+    Undefined,
+    Measurement,
+    TotalIncreasing     // Counter, a decrease is taken as the counter being reset
 };
 
 template<SensorClass c>
@@ -95,14 +123,56 @@ enum class BinarySensorClass {
 class HACompItem
 {
 public:
-    static std::vector<HACompItem*> m_components;
+    HACompItem() : m_next(m_first), m_queued(false) {
+        m_first = this;
+    }
 
     virtual void Initialize() = 0;
+    virtual bool PublishConfig(bool present = true) = 0;
+
     static void InitializeAll() {
-        for (auto item : m_components) {
+        for (HACompItem* item = m_first; item != nullptr; item = item->m_next) {
             item->Initialize();
         }
     }
+
+    // Queue the config of all components to be (re)published, eg. after reconnecting
+    static void PublishAll() {
+        for (HACompItem* item = m_first; item != nullptr; item = item->m_next) {
+            item->m_queued = true;
+        }
+        m_pending = m_first;
+    }
+
+    // Queue the config of just this component, eg. one created after connecting
+    void PublishLater() {
+        m_queued = true;
+        m_pending = m_first;    // Components that aren't queued are skipped over
+    }
+
+    // Publish the config of up to max_count queued components.
+    // Returns true while there are more left to publish.
+    static bool PublishPending(size_t max_count = HA_CONFIG_PER_LOOP) {
+        size_t n = 0;
+        while ((n < max_count) && (m_pending != nullptr)) {
+            if (m_pending->m_queued) {
+                if (!m_pending->PublishConfig()) {
+                    m_pending = nullptr;   // Disconnected, will start over with PublishAll()
+                    break;
+                }
+                m_pending->m_queued = false;
+                n++;
+            }
+            m_pending = m_pending->m_next;
+        }
+        return (m_pending != nullptr);
+    }
+
+private:
+    HACompItem* m_next;
+    bool m_queued;      // Config waiting to be published by PublishPending()
+    static HACompItem* m_first;
+    static HACompItem* m_pending;
 };
 
 // Base class to get around templating quirks. Do not use directly.
@@ -112,23 +182,31 @@ class HACompBase : public HACompItem
 protected:
     const char*     m_device_class;
     const char*     m_name;
-    String          m_state_topic;
+    char            m_state_topic[TOPIC_BUFFER_SIZE];
     ComponentContext& context;
 
     static const char* m_component;
 
-    virtual void getConfigInfo(JsonObject& json);
+    // Location of the serialized config in the cache (m_config_len = 0 if not cached)
+    uint16_t        m_config_offset;
+    uint16_t        m_config_len;
+
+    virtual void getConfigInfo(JsonWriter& json);
+    size_t serializeConfig(char* buf, size_t size);
+
+    // Called once the config has been published (eg. to subscribe to command topics)
+    virtual void onConfigPublished() { }
    // virtual String getStatusTopic();
 
 public:
     HACompBase(ComponentContext& context, const char* name)
-        : m_name(name), context(context)
+        : m_name(name), context(context), m_config_offset(0), m_config_len(0)
     {
-        m_components.push_back(this);
+        m_state_topic[0] = '\0';
     }
 
     virtual void Initialize();
-    void PublishConfig(bool present = true);
+    bool PublishConfig(bool present = true) override;
     void PublishState(const char* value, bool retain = true);
     void ClearState();
 };
@@ -140,40 +218,63 @@ class HAComponent : public HACompBase<component>
     using HACompBase<component>::HACompBase; // constructor
 };
 
-// Specialization of Component of type Sensor
+// Specialization of Component of type Sensor.
+// Samples are summarized (mean, min, max, last, stddev) over each sample interval, and the
+// summary is published as JSON, with the mean (or smoothed value) as the sensor state.
 template<>
 class HAComponent<Component::Sensor> : public HACompBase<Component::Sensor>
 {
 protected:
     SensorClass m_sensor_class;
+    StateClass m_state_class;
+
+    // Publish the last sample rather than the mean
+    bool m_report_last;
 
     // Hysteresis
     float m_hysteresis;
     float m_last_value;
 
-    // Averaging
-    float m_sum;
-    int m_samples;
+    // Statistics over the sample window
+    SensorStats m_stats;
 
     // Sampling
     int m_last_ts;
     int m_sample_interval;
 
-    virtual void getConfigInfo(JsonObject& json);
+    virtual void getConfigInfo(JsonWriter& json);
+    void PublishSummary(const SensorStats::Summary& summary, int32_t value);
+    bool reportsLast() const { return m_report_last || (m_state_class == StateClass::TotalIncreasing); }
 public:
-    HAComponent(ComponentContext& context, const char* name, int sample_interval_ms, float hysteresis = 0.0f, SensorClass sclass = SensorClass::Undefined) :
+    HAComponent(ComponentContext& context, const char* name, int sample_interval_ms, float hysteresis = 0.0f, SensorClass sclass = SensorClass::Undefined, uint8_t decimals = 2) :
         HACompBase(context, name),
         m_sensor_class(sclass),
+        m_state_class(StateClass::Undefined),
+        m_report_last(false),
         m_hysteresis(hysteresis),
         m_last_value(0.f),
-        m_sum(0.f),
-        m_samples(0),
+        m_stats(decimals),
         m_last_ts(0),
         m_sample_interval(sample_interval_ms)
     { }
 
+    // Publish an exponential moving average instead of the mean (see SensorStats::setSmoothing())
+    void SetSmoothing(uint8_t alpha) { m_stats.setSmoothing(alpha); }
+
+    // With StateClass::TotalIncreasing, the state is the last sample rather than the mean
+    void SetStateClass(StateClass sclass) { m_state_class = sclass; }
+
+    // Publish the last sample of each window, without the window statistics (eg. for a mode or
+    // error code, where the mean of two codes means nothing)
+    void SetReportLast(bool last) { m_report_last = last; }
+
     void Update(float value);
     float GetCurrent();
+
+    // Publish a counter straight away, without the window statistics, eg. {"value":15230}.
+    // total is fixed-point (10^decimals) in 64 bits, so it neither overflows nor loses precision
+    // the way Update() would. For StateClass::TotalIncreasing sensors.
+    void UpdateTotal(uint64_t total);
 };
 
 // Specialization of Component of type Switch
@@ -182,12 +283,14 @@ class HAComponent<Component::Switch> : public HACompBase<Component::Switch>
 {
 protected:
     bool m_state;
-    String m_cmd_topic;
+    char m_cmd_topic[TOPIC_BUFFER_SIZE];
     std::function<void(boolean)> m_callback;
 
-    static std::vector<HAComponent<Component::Switch>*> m_switches;
+    HAComponent<Component::Switch>* m_next_switch;
+    static HAComponent<Component::Switch>* m_first_switch;
 
-    virtual void getConfigInfo(JsonObject& json);
+    virtual void getConfigInfo(JsonWriter& json);
+    void onConfigPublished() override;
 public:
     HAComponent(ComponentContext& context, const char* name, std::function<void(boolean)> callback);
 
@@ -198,7 +301,7 @@ public:
     static const char* ON;
     static const char* OFF;
 
-    static void ProcessMqttTopic(String& topic, String& payload);
+    static void ProcessMqttTopic(const char* topic, const char* payload);
 };
 
 // Specialization of Component of type BinarySensor
@@ -208,7 +311,7 @@ class HAComponent<Component::BinarySensor> : public HACompBase<Component::Binary
 protected:
     BinarySensorClass m_sensor_class;
 
-    virtual void getConfigInfo(JsonObject& json);
+    virtual void getConfigInfo(JsonWriter& json);
 public:
     HAComponent(ComponentContext& context, const char* name, BinarySensorClass sensor_class = BinarySensorClass::Undefined) :
         HACompBase(context, name),
@@ -222,14 +325,14 @@ public:
 class HAAvailabilityComponent : public HACompBase<Component::BinarySensor>
 {
 protected:
-    virtual void getConfigInfo(JsonObject& json);
+    virtual void getConfigInfo(JsonWriter& json);
 public:
     HAAvailabilityComponent(ComponentContext& context);
 
     static const char* ONLINE;
     static const char* OFFLINE;
 
-    String getWillTopic();
+    const char* getWillTopic();
     void Initialize() override;
     void Connect();
 
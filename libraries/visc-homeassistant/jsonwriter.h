@@ -0,0 +1,137 @@
+#ifndef __JSON_WRITER_H__
+#define __JSON_WRITER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Streaming JSON writer into a fixed buffer. There is no DOM and nothing is allocated,
+// the output is written as it goes and the caller only needs to check ok() at the end. Eg.
+//
+//   JsonWriter json(buf, sizeof(buf));
+//   json.beginObject();
+//   json.add("name", "bat_voltage");
+//   json.beginObject("device");
+//   json.add("name", "mate");
+//   json.endObject();
+//   json.endObject();
+//   if (json.ok()) {
+//       publish(buf, json.size());  // {"name":"bat_voltage","device":{"name":"mate"}}
+//   }
+//
+// The output is null-terminated when it fits.
+class JsonWriter
+{
+public:
+    JsonWriter(char* buf, size_t size)
+        : m_buf(buf), m_size(size), m_len(0), m_first(true), m_overflow(false)
+    {
+        if (m_size > 0)
+            m_buf[0] = '\0';
+    }
+
+    // Begin an object, nested under key (or as an array element / the top level without one)
+    void beginObject(const char* key = nullptr) {
+        if (key != nullptr)
+            this->key(key);
+        else
+            separator();
+        put('{');
+        m_first = true;
+    }
+
+    void endObject() {
+        put('}');
+        m_first = false;
+    }
+
+    void add(const char* key, const char* value) {
+        this->key(key);
+        if (value != nullptr)
+            string(value);
+        else
+            raw("null");
+    }
+
+    void add(const char* key, bool value) {
+        this->key(key);
+        raw(value ? "true" : "false");
+    }
+
+    void add(const char* key, int value) {
+        char num[12];
+        snprintf(num, sizeof(num), "%d", value);
+        this->key(key);
+        raw(num);
+    }
+
+    // Add a value that is already formatted as JSON (eg. a number)
+    void addRaw(const char* key, const char* value) {
+        this->key(key);
+        raw(value);
+    }
+
+    // False if the output didn't fit in the buffer
+    bool ok() const { return !m_overflow; }
+
+    // Length of the output (excluding the null terminator)
+    size_t size() const { return m_len; }
+
+private:
+    void separator() {
+        if (!m_first)
+            put(',');
+        m_first = false;
+    }
+
+    void key(const char* key) {
+        separator();
+        string(key);
+        put(':');
+    }
+
+    void string(const char* s) {
+        put('"');
+        for (; *s != '\0'; s++) {
+            uint8_t c = static_cast<uint8_t>(*s);
+            if ((c == '"') || (c == '\\')) {
+                put('\\');
+                put(static_cast<char>(c));
+            }
+            else if (c < 0x20) {
+                char esc[7];
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                raw(esc);
+            }
+            else {
+                put(static_cast<char>(c));  // Including UTF-8
+            }
+        }
+        put('"');
+    }
+
+    void raw(const char* s) {
+        for (; *s != '\0'; s++) {
+            put(*s);
+        }
+    }
+
+    void put(char c) {
+        // Always leave room for the null terminator
+        if ((m_len + 1) >= m_size) {
+            m_overflow = true;
+            return;
+        }
+        m_buf[m_len++] = c;
+        m_buf[m_len] = '\0';
+    }
+
+    char*   m_buf;
+    size_t  m_size;
+    size_t  m_len;
+    bool    m_first;    // No elements written yet at the current level
+    bool    m_overflow;
+};
+
+#endif /* __JSON_WRITER_H__ */
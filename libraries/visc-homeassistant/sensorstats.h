@@ -0,0 +1,184 @@
+#ifndef __SENSOR_STATS_H__
+#define __SENSOR_STATS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+// Windowed statistics for a sensor sampled much faster than it is published.
+//
+// Samples are converted to fixed-point (value * 10^decimals) and accumulated with integer
+// arithmetic only, so adding a sample is a few adds and a multiply. The mean, min, max,
+// last value, standard deviation and (optionally) an exponential moving average are
+// computed once per window by summarize().
+//
+// The sum of squares is taken relative to the first sample in the window, which keeps it
+// small (so it can't overflow) and avoids the precision loss of the naive formula.
+class SensorStats
+{
+public:
+    struct Summary {
+        int32_t  mean;      // All fixed-point, 10^decimals
+        int32_t  min;
+        int32_t  max;
+        int32_t  last;
+        int32_t  stddev;
+        int32_t  ema;       // Equal to last if smoothing is disabled
+        uint32_t count;     // Samples in the window
+    };
+
+    SensorStats(uint8_t decimals = 2)
+        : m_decimals(decimals)
+        , m_scale(1.0f)
+        , m_alpha(0)
+        , m_ema(0)
+        , m_emaValid(false)
+    {
+        for (uint8_t i = 0; i < decimals; i++) {
+            m_scale *= 10.0f;
+        }
+        reset();
+    }
+
+    // Exponential smoothing of each sample, ema += alpha/256 * (sample - ema).
+    // 0 disables smoothing. The EMA keeps EMA_FRAC_BITS below the fixed-point unit, so small
+    // steps (where alpha * (sample - ema) < 256) still move it, rather than being truncated away.
+    void setSmoothing(uint8_t alpha) { m_alpha = alpha; }
+    bool smoothed() const { return m_alpha != 0; }
+
+    void add(float value) {
+        add(static_cast<int32_t>(lroundf(value * m_scale)));
+    }
+
+    // Add a sample that is already fixed-point
+    void add(int32_t x) {
+        if (m_count == 0) {
+            m_origin = x;
+            m_min = x;
+            m_max = x;
+        }
+        else {
+            if (x < m_min) m_min = x;
+            if (x > m_max) m_max = x;
+        }
+
+        int64_t d = static_cast<int64_t>(x) - m_origin;
+        m_sum += d;
+        m_sumSq += d * d;
+        m_last = x;
+        m_count++;
+
+        int64_t xf = static_cast<int64_t>(x) * (1 << EMA_FRAC_BITS);
+        if (!m_emaValid) {
+            m_ema = xf;
+            m_emaValid = true;
+        }
+        else if (m_alpha != 0) {
+            m_ema += roundedDiv((xf - m_ema) * m_alpha, 256);
+        }
+        else {
+            m_ema = xf;
+        }
+    }
+
+    uint32_t count() const { return m_count; }
+    uint8_t decimals() const { return m_decimals; }
+
+    // Summarize the window, and start a new one. Returns false if there were no samples.
+    // (The EMA carries on across windows)
+    bool summarize(Summary& s) {
+        if (m_count == 0)
+            return false;
+
+        int64_t n = m_count;
+        int64_t mean_d = roundedDiv(m_sum, n);
+        s.mean   = static_cast<int32_t>(m_origin + mean_d);
+        s.min    = m_min;
+        s.max    = m_max;
+        s.last   = m_last;
+        s.ema    = static_cast<int32_t>(roundedDiv(m_ema, 1 << EMA_FRAC_BITS));
+        s.count  = m_count;
+
+        // Population variance, n*var = sum(d^2) - sum(d)^2/n
+        int64_t var_n = m_sumSq - ((m_sum * m_sum) / n);
+        s.stddev = (var_n > 0) ? static_cast<int32_t>(sqrtf(static_cast<float>(var_n) / n) + 0.5f) : 0;
+
+        reset();
+        return true;
+    }
+
+    float toFloat(int32_t x) const { return x / m_scale; }
+
+    // Format a fixed-point value into buf with the configured number of decimals,
+    // without floating point or heap allocation. Returns the length (0 if it doesn't fit).
+    size_t format(char* buf, size_t size, int32_t x) const {
+        uint32_t v = (x < 0) ? (0u - static_cast<uint32_t>(x)) : static_cast<uint32_t>(x);
+        return format(buf, size, v, x < 0);
+    }
+
+    // Same for a value too large for a sample, eg. a 64-bit counter
+    size_t format(char* buf, size_t size, uint64_t x) const {
+        return format(buf, size, x, false);
+    }
+
+private:
+    size_t format(char* buf, size_t size, uint64_t v, bool negative) const {
+        char tmp[24];
+        size_t len = 0;
+
+        // Digits in reverse, with at least one before the decimal point
+        uint8_t digits = 0;
+        do {
+            if ((len + 3) > sizeof(tmp))
+                return 0;   // Room for a digit, '.' and '-'
+            if ((digits == m_decimals) && (digits > 0))
+                tmp[len++] = '.';
+            tmp[len++] = static_cast<char>('0' + (v % 10));
+            v /= 10;
+            digits++;
+        } while ((v > 0) || (digits <= m_decimals));
+
+        if (negative)
+            tmp[len++] = '-';
+
+        if ((len + 1) > size)
+            return 0;
+        for (size_t i = 0; i < len; i++) {
+            buf[i] = tmp[len - 1 - i];
+        }
+        buf[len] = '\0';
+        return len;
+    }
+
+    static const uint8_t EMA_FRAC_BITS = 8;
+
+    void reset() {
+        m_count = 0;
+        m_origin = 0;
+        m_sum = 0;
+        m_sumSq = 0;
+        m_min = 0;
+        m_max = 0;
+        m_last = 0;
+    }
+
+    static int64_t roundedDiv(int64_t a, int64_t b) {
+        return (a >= 0) ? ((a + b / 2) / b) : -((-a + b / 2) / b);
+    }
+
+    uint8_t  m_decimals;
+    float    m_scale;
+    uint8_t  m_alpha;
+    int64_t  m_ema;        // Fixed-point, with EMA_FRAC_BITS more fraction bits
+    bool     m_emaValid;
+
+    uint32_t m_count;
+    int32_t  m_origin;     // First sample in the window
+    int64_t  m_sum;        // Relative to m_origin
+    int64_t  m_sumSq;      // Relative to m_origin
+    int32_t  m_min;
+    int32_t  m_max;
+    int32_t  m_last;
+};
+
+#endif /* __SENSOR_STATS_H__ */
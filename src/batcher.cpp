@@ -0,0 +1,215 @@
+#include "batcher.h"
+#include "outbox.h"
+#include "metrics.h"
+#include "debug.h"
+#include "buffered-client.h"
+#include "connection.h"
+#include "inflight.h"
+
+#include <matewire.h>
+
+#if defined(MATE_BATCH) || defined(MATE_COMPRESS)
+
+// MQTT fixed header (2) + topic length (2)
+#define MQTT_PUBLISH_OVERHEAD (4)
+
+static char     topic[MAX_TOPIC_LEN] = {0};
+
+// Size of the (uncompressed) batch message holding these frames
+static size_t batchSize(const MateFrame* batch, size_t n)
+{
+    size_t bytes = MateWire::BATCH_HEADER_SIZE;
+    for (size_t i = 0; i < n; i++) {
+        bytes += MateWire::BATCH_RECORD_OVERHEAD + batch[i].size;
+    }
+    return bytes;
+}
+
+// Write the batch header & records straight into the MQTT packet,
+// rather than assembling the batch in a buffer first
+static bool streamBatch(PubSubClient& client, const MateFrame* batch, size_t n, size_t bytes)
+{
+    uint8_t header[MateWire::BATCH_HEADER_SIZE];
+    MateWire::encodeBatchHeader(header, sizeof(header), static_cast<uint16_t>(n));
+
+    if (!Inflight::beginPublish(client, topic, bytes, false) ||
+        (Inflight::write(client, header, sizeof(header)) != sizeof(header)))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        uint8_t record[MateWire::BATCH_RECORD_OVERHEAD];
+        MateWire::put_u16(record, batch[i].size);
+        if ((Inflight::write(client, record, sizeof(record)) != sizeof(record)) ||
+            (Inflight::write(client, batch[i].payload, batch[i].size) != batch[i].size))
+        {
+            return false;
+        }
+    }
+    return Inflight::endPublish(client);
+}
+
+#ifdef MATE_COMPRESS
+static Metric m_compress_msgs("compress_msgs");
+static Metric m_compress_bytes_in("compress_bytes_in");
+static Metric m_compress_bytes_saved("compress_bytes_saved");
+
+// Uncompressed records, and the compressed message (which must fit in an MQTT packet)
+static uint8_t  records[BATCH_MAX_FRAMES * (MateWire::BATCH_RECORD_OVERHEAD + MAX_FRAME_PAYLOAD)];
+static uint8_t  packed[BATCH_MAX_BYTES];
+
+// Compress the batch into 'packed'. Returns the size, or 0 if it doesn't fit
+// or isn't smaller than the uncompressed batch.
+static size_t compressBatch(const MateFrame* batch, size_t n, size_t bytes)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < n; i++) {
+        MateWire::put_u16(&records[len], batch[i].size);
+        memcpy(&records[len + MateWire::BATCH_RECORD_OVERHEAD], batch[i].payload, batch[i].size);
+        len += MateWire::BATCH_RECORD_OVERHEAD + batch[i].size;
+    }
+
+    size_t limit = (bytes <= sizeof(packed)) ? (bytes - 1) : sizeof(packed);
+    return MateWire::compressBatch(packed, limit, static_cast<uint16_t>(n), records, len);
+}
+#endif
+
+// Publish frames as a single batch message, compressed (MATE_COMPRESS) if that makes it smaller.
+// Returns the size of the message sent, or 0 on failure.
+static size_t sendBatch(PubSubClient& client, const MateFrame* batch, size_t n)
+{
+    size_t bytes = batchSize(batch, n);
+
+#ifdef MATE_COMPRESS
+    size_t packed_size = compressBatch(batch, n, bytes);
+    if (packed_size > 0) {
+        if (!Inflight::publish(client, topic, packed, packed_size, false))
+            return 0;
+
+        m_compress_msgs.add();
+        m_compress_bytes_in.add(bytes);
+        m_compress_bytes_saved.add(bytes - packed_size);
+        return packed_size;
+    }
+#endif
+
+    if ((bytes > BATCH_MAX_BYTES) || !streamBatch(client, batch, n, bytes))
+        return 0;
+    return bytes;
+}
+
+#endif
+
+#ifdef MATE_BATCH
+
+static Metric m_batch_msgs("batch_msgs");
+static Metric m_batch_frames("batch_frames");
+static Metric m_batch_msgs_saved("batch_msgs_saved");
+static Metric m_batch_bytes_saved("batch_bytes_saved");
+
+static MateFrame frames[BATCH_MAX_FRAMES];
+static size_t   count = 0;
+static size_t   batch_bytes = 0;    // Size of the batch message if flushed now
+static uint32_t tFirst = 0;         // When the oldest held frame was added
+
+#endif
+
+namespace Batcher {
+
+void setup(const char* prefix)
+{
+#if defined(MATE_BATCH) || defined(MATE_COMPRESS)
+    // Eg. 'mate/batch'
+    snprintf(topic, sizeof(topic), "%s/batch", prefix);
+#endif
+}
+
+bool publish(PubSubClient& client, const MateFrame& frame)
+{
+#ifdef MATE_BATCH
+    // While disconnected, frames go straight to the Outbox
+    if ((frame.flags & FRAME_BATCHABLE) && client.connected()) {
+        size_t record = MateWire::BATCH_RECORD_OVERHEAD + frame.size;
+        if ((count >= BATCH_MAX_FRAMES) || ((batch_bytes + record) > BATCH_MAX_BYTES)) {
+            flush(client);
+        }
+
+        if (count == 0) {
+            tFirst = static_cast<uint32_t>(millis());
+            batch_bytes = MateWire::BATCH_HEADER_SIZE;
+        }
+
+        frames[count++] = frame;
+        batch_bytes += record;
+        return true;
+    }
+#endif
+
+    return Outbox::publish(client, frame);
+}
+
+void process(PubSubClient& client, uint32_t now)
+{
+#ifdef MATE_BATCH
+    if ((count > 0) && ((now - tFirst) >= BATCH_MAX_AGE_MS)) {
+        flush(client);
+    }
+#endif
+}
+
+void flush(PubSubClient& client)
+{
+#ifdef MATE_BATCH
+    if (count == 0)
+        return;
+
+    // Not worth batching a single frame
+    if (count == 1) {
+        count = 0;
+        Outbox::publish(client, frames[0]);
+        return;
+    }
+
+    size_t unbatched_bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        unbatched_bytes += TLS_RECORD_OVERHEAD + MQTT_PUBLISH_OVERHEAD + strlen(frames[i].topic) + frames[i].size;
+    }
+
+    LOG_DEBUG("Publish: %s (%u frames)", topic, (unsigned)count);
+
+    size_t sent = client.connected() ? sendBatch(client, frames, count) : 0;
+    if (sent > 0) {
+        size_t batched_bytes = TLS_RECORD_OVERHEAD + MQTT_PUBLISH_OVERHEAD + strlen(topic) + sent;
+
+        Connection::framePublished();
+        m_batch_msgs.add();
+        m_batch_frames.add(count);
+        m_batch_msgs_saved.add(count - 1);
+        if (unbatched_bytes > batched_bytes) {
+            m_batch_bytes_saved.add(unbatched_bytes - batched_bytes);
+        }
+    }
+    else {
+        // Store the individual frames for replay
+        for (size_t i = 0; i < count; i++) {
+            Outbox::publish(client, frames[i]);
+        }
+    }
+
+    count = 0;
+#endif
+}
+
+bool publishBatch(PubSubClient& client, const MateFrame* batch, size_t n)
+{
+#if defined(MATE_BATCH) || defined(MATE_COMPRESS)
+    LOG_DEBUG("Publish: %s (%u stored frames)", topic, (unsigned)n);
+
+    return (n > 0) && client.connected() && (sendBatch(client, batch, n) > 0);
+#else
+    return false;
+#endif
+}
+
+};
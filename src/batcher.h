@@ -0,0 +1,38 @@
+#pragma once
+
+#include <PubSubClient.h>
+
+#include "mate-frame.h"
+
+// Batching (MATE_BATCH) combines the frames from all collectors into a
+// single message on '<prefix>/batch', so the per-message MQTT & TLS overhead
+// is only paid once per cycle instead of once per device.
+// A batch is flushed at the end of a collection cycle, or when any of these limits are hit:
+#define BATCH_MAX_FRAMES    (8)
+#define BATCH_MAX_BYTES     (MQTT_MAX_PACKET_SIZE - MAX_TOPIC_LEN - 8)  // Room for MQTT header & topic
+#define BATCH_MAX_AGE_MS    (2000)
+
+// Compression (MATE_COMPRESS) LZSS compresses the records of each batch message
+// (MateWire::BATCH_FLAG_COMPRESSED) when that makes it smaller, and also replays frames
+// buffered while offline as compressed batches, rather than one message per frame.
+// Successive status frames are very similar, so this mostly pays off for replayed backlogs.
+// The uncompressed records may exceed BATCH_MAX_BYTES, as long as the compressed message fits.
+
+namespace Batcher
+{
+    void setup(const char* prefix);
+
+    // Publish a frame. Batchable frames are held until the batch is flushed,
+    // anything else (or everything, without MATE_BATCH) is passed straight to the Outbox.
+    bool publish(PubSubClient& client, const MateFrame& frame);
+
+    // Flush the batch if it is older than BATCH_MAX_AGE_MS
+    void process(PubSubClient& client, uint32_t now);
+
+    // Publish any held frames (eg. at the end of a collection cycle)
+    void flush(PubSubClient& client);
+
+    // Publish stored frames (eg. replayed by the Outbox) straight away as a single batch.
+    // Returns false if not sent (eg. too large), in which case the caller still owns the frames.
+    bool publishBatch(PubSubClient& client, const MateFrame* batch, size_t n);
+};
@@ -0,0 +1,211 @@
+#include "buffered-client.h"
+#include "metrics.h"
+
+// MQTT control packet types (upper nibble of the fixed header)
+#define MQTT_PUBLISH (3)
+#define MQTT_PUBACK  (4)
+
+static Metric m_net_writes("net_writes");           // Writes made by the MQTT client
+static Metric m_net_records("net_records");         // Writes made to the underlying (TLS) client
+static Metric m_net_bytes_saved("net_bytes_saved"); // TLS record overhead avoided by coalescing
+static Metric m_net_dropped_publishes("net_dropped_publishes"); // Buffered publishes lost to a failed write
+static Metric m_net_dropped_bytes("net_dropped_bytes");
+
+BufferedClient::BufferedClient(Client& inner)
+    : m_inner(inner)
+    , m_pubackHandler(nullptr)
+{
+    reset();
+}
+
+void BufferedClient::PacketParser::reset()
+{
+    state = ParseState::Header;
+    type = 0;
+    shift = 0;
+    remaining = 0;
+    bodyLen = 0;
+}
+
+void BufferedClient::reset()
+{
+    m_len = 0;
+    m_writes = 0;
+    m_publishes = 0;
+    m_tFirst = 0;
+    m_out.reset();
+    m_in.reset();
+}
+
+// Empty the buffer once its contents have been sent
+void BufferedClient::clear()
+{
+    m_len = 0;
+    m_writes = 0;
+
+    // A PUBLISH still being written carries on into the next buffer
+    m_publishes = ((m_out.state != ParseState::Header) && (m_out.type == MQTT_PUBLISH)) ? 1 : 0;
+}
+
+int BufferedClient::connect(IPAddress ip, uint16_t port)
+{
+    reset();
+    return m_inner.connect(ip, port);
+}
+
+int BufferedClient::connect(const char* host, uint16_t port)
+{
+    reset();
+    return m_inner.connect(host, port);
+}
+
+void BufferedClient::stop()
+{
+    reset();
+    m_inner.stop();
+}
+
+size_t BufferedClient::write(const uint8_t* buf, size_t size)
+{
+    if (size == 0)
+        return 0;
+
+    m_net_writes.add();
+    if ((m_len + size) > sizeof(m_buf)) {
+        flush();
+    }
+    bool urgent = trackPackets(m_out, buf, size, true);
+
+    // Too large to buffer at all. A failure is reported to the caller, so nothing is lost.
+    if (size > sizeof(m_buf)) {
+        if (!send(buf, size))
+            return 0;
+        clear();
+        return size;
+    }
+
+    if (m_len == 0) {
+        m_tFirst = static_cast<uint32_t>(millis());
+    }
+    memcpy(&m_buf[m_len], buf, size);
+    m_len += size;
+    m_writes++;
+
+    if (urgent) {
+        flush();
+    }
+    return size;
+}
+
+void BufferedClient::flush()
+{
+    if (m_len == 0)
+        return;
+
+    size_t len = m_len;
+    size_t publishes = m_publishes;
+    if (send(m_buf, len)) {
+        if (m_writes > 1) {
+            m_net_bytes_saved.add((m_writes - 1) * TLS_RECORD_OVERHEAD);
+        }
+        clear();
+    }
+    else {
+        // These were reported as written, so can't be stored for later
+        m_net_dropped_publishes.add(publishes);
+        m_net_dropped_bytes.add(len);
+    }
+}
+
+void BufferedClient::process(uint32_t now)
+{
+    if ((m_len > 0) && ((now - m_tFirst) >= BUFFERED_CLIENT_MAX_DELAY_MS)) {
+        flush();
+    }
+}
+
+int BufferedClient::read()
+{
+    int c = m_inner.read();
+    if (c >= 0) {
+        uint8_t b = static_cast<uint8_t>(c);
+        trackPackets(m_in, &b, 1, false);
+    }
+    return c;
+}
+
+int BufferedClient::read(uint8_t* buf, size_t size)
+{
+    int n = m_inner.read(buf, size);
+    if (n > 0) {
+        trackPackets(m_in, buf, n, false);
+    }
+    return n;
+}
+
+bool BufferedClient::send(const uint8_t* buf, size_t size)
+{
+    m_net_records.add();
+    if (m_inner.write(buf, size) != size) {
+        // Leave it to PubSubClient to notice and reconnect
+        m_inner.stop();
+        reset();
+        return false;
+    }
+    return true;
+}
+
+// Follow the MQTT packet framing across writes (or reads).
+// Returns true if an outgoing packet other than PUBLISH was completed.
+bool BufferedClient::trackPackets(PacketParser& p, const uint8_t* buf, size_t size, bool outgoing)
+{
+    bool urgent = false;
+    size_t i = 0;
+    while (i < size) {
+        switch (p.state) {
+            case ParseState::Header:
+                p.type = buf[i++] >> 4;
+                if (outgoing && (p.type == MQTT_PUBLISH)) {
+                    m_publishes++;
+                }
+                p.remaining = 0;
+                p.shift = 0;
+                p.bodyLen = 0;
+                p.state = ParseState::Length;
+                break;
+
+            case ParseState::Length: {
+                uint8_t b = buf[i++];
+                p.remaining |= static_cast<uint32_t>(b & 0x7F) << p.shift;
+                p.shift += 7;
+                if (!(b & 0x80)) {
+                    p.state = ParseState::Body;
+                }
+                break;
+            }
+
+            case ParseState::Body: {
+                size_t n = size - i;
+                if (n > p.remaining)
+                    n = p.remaining;
+                for (size_t j = 0; (j < n) && (p.bodyLen < sizeof(p.body)); j++) {
+                    p.body[p.bodyLen++] = buf[i + j];
+                }
+                i += n;
+                p.remaining -= n;
+                break;
+            }
+        }
+
+        if ((p.state == ParseState::Body) && (p.remaining == 0)) {
+            if (outgoing) {
+                urgent |= (p.type != MQTT_PUBLISH);
+            }
+            else if ((p.type == MQTT_PUBACK) && (p.bodyLen == 2) && (m_pubackHandler != nullptr)) {
+                m_pubackHandler((static_cast<uint16_t>(p.body[0]) << 8) | p.body[1]);
+            }
+            p.state = ParseState::Header;
+        }
+    }
+    return urgent;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Client.h>
+
+// Approximate per-message TLS record overhead (header + explicit nonce + GCM tag)
+#define TLS_RECORD_OVERHEAD (29)
+
+// Writes are held until this many bytes are buffered
+#define BUFFERED_CLIENT_SIZE (1024)
+
+// Longest time a write is held before being sent. Buffered publishes are normally
+// sent at the end of each collection cycle, this only bounds the latency otherwise.
+#define BUFFERED_CLIENT_MAX_DELAY_MS (500)
+
+// Client wrapper that coalesces small writes, so a burst of publishes goes out
+// as one TLS record (and usually one TCP segment) instead of one each.
+//
+// The MQTT packets written through it are tracked, so only PUBLISH packets are held:
+// anything else (CONNECT, SUBSCRIBE, PINGREQ, ...) flushes the buffer immediately,
+// since PubSubClient may be waiting for the reply.
+// Buffered data is sent by flush(), when the buffer fills, or by process() after
+// BUFFERED_CLIENT_MAX_DELAY_MS.
+//
+// Incoming packets are tracked too, to pass PUBACKs (which PubSubClient discards)
+// to the QoS 1 publisher.
+//
+// Note a publish counts as successful once buffered. If sending fails later,
+// the connection is stopped (so PubSubClient reconnects), and the buffered publishes
+// are lost: they're counted by net_dropped_publishes & net_dropped_bytes. Callers that
+// must not lose a publish (eg. the Outbox replay) flush() and check it's still connected.
+class BufferedClient : public Client {
+public:
+    BufferedClient(Client& inner);
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char* host, uint16_t port) override;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buf, size_t size) override;
+    int available() override { return m_inner.available(); }
+    int read() override;
+    int read(uint8_t* buf, size_t size) override;
+    int peek() override { return m_inner.peek(); }
+    void stop() override;
+    uint8_t connected() override { return m_inner.connected(); }
+    operator bool() override { return static_cast<bool>(m_inner); }
+    using Print::write;
+
+    // Send anything buffered.
+    // (Unlike WiFiClient::flush(), this does not discard received data)
+    void flush() override;
+
+    // Send buffered data once it has been held for BUFFERED_CLIENT_MAX_DELAY_MS
+    void process(uint32_t now);
+
+    // Called with the packet ID of each PUBACK read by the MQTT client
+    void onPuback(void (*handler)(uint16_t packet_id)) { m_pubackHandler = handler; }
+
+private:
+    enum class ParseState : uint8_t {
+        Header,     // Expecting the fixed header of the next packet
+        Length,     // Remaining length (varint)
+        Body,
+    };
+
+    // Follows the MQTT packet framing of one direction of the stream
+    struct PacketParser {
+        ParseState state;
+        uint8_t type;       // MQTT packet type
+        uint8_t shift;
+        uint32_t remaining;
+        uint8_t body[2];    // Start of the variable header (eg. packet ID)
+        uint8_t bodyLen;
+
+        void reset();
+    };
+
+    void reset();
+    bool trackPackets(PacketParser& p, const uint8_t* buf, size_t size, bool outgoing);
+    bool send(const uint8_t* buf, size_t size);
+    void clear();
+
+    Client& m_inner;
+    uint8_t m_buf[BUFFERED_CLIENT_SIZE];
+    size_t m_len;
+    size_t m_writes;    // Writes held in m_buf
+    size_t m_publishes; // PUBLISH packets (wholly or partly) held in m_buf
+    uint32_t m_tFirst;  // When the oldest held write was made
+
+    PacketParser m_out;
+    PacketParser m_in;
+    void (*m_pubackHandler)(uint16_t packet_id);
+};
@@ -0,0 +1,70 @@
+#include "bus-stats.h"
+#include "metrics.h"
+
+// TxnOp values are sent as-is in diagnostics frames
+static_assert((uint8_t)TxnOp::ReadStatus == (uint8_t)MateWire::DiagOp::ReadStatus, "TxnOp doesn't match DiagOp");
+static_assert((uint8_t)TxnOp::ReadLog == (uint8_t)MateWire::DiagOp::ReadLog, "TxnOp doesn't match DiagOp");
+static_assert((uint8_t)TxnOp::Query == (uint8_t)MateWire::DiagOp::Query, "TxnOp doesn't match DiagOp");
+static_assert((uint8_t)TxnOp::UpdateTime == (uint8_t)MateWire::DiagOp::UpdateTime, "TxnOp doesn't match DiagOp");
+static_assert((uint8_t)TxnOp::UpdateBatteryTemp == (uint8_t)MateWire::DiagOp::UpdateBatteryTemp, "TxnOp doesn't match DiagOp");
+static_assert((uint8_t)TxnOp::Begin == (uint8_t)MateWire::DiagOp::Begin, "TxnOp doesn't match DiagOp");
+
+static MateWire::DiagEntry stats[NUM_MATE_PORTS][BUS_STATS_OPS];
+
+static Metric m_bus_transactions("bus_transactions");
+static Metric m_bus_failures("bus_failures");
+
+namespace BusStats {
+
+void record(uint8_t port, TxnOp op, uint32_t elapsed_us, bool success)
+{
+    if ((port >= NUM_MATE_PORTS) || ((size_t)op >= BUS_STATS_OPS))
+        return;
+
+    MateWire::DiagEntry& entry = stats[port][(size_t)op];
+    uint32_t elapsed_ms = elapsed_us / 1000;
+
+    if (entry.count < UINT16_MAX)
+        entry.count++;
+    if (!success && (entry.failures < UINT16_MAX))
+        entry.failures++;
+    if (elapsed_ms > entry.max_ms)
+        entry.max_ms = (elapsed_ms < UINT16_MAX) ? static_cast<uint16_t>(elapsed_ms) : UINT16_MAX;
+
+    uint8_t& bucket = entry.buckets[MateWire::diagBucket(elapsed_ms)];
+    if (bucket < UINT8_MAX)
+        bucket++;
+
+    m_bus_transactions.add();
+    if (!success)
+        m_bus_failures.add();
+}
+
+size_t encode(uint8_t port, uint8_t* out, size_t out_size)
+{
+    if ((port >= NUM_MATE_PORTS) || (out_size < MateWire::DIAG_HEADER_SIZE))
+        return 0;
+
+    out[0] = MateScheduler::busUtilization();
+    out[1] = 0;
+    size_t n = MateWire::DIAG_HEADER_SIZE;
+
+    // Only operations used since the last report are included
+    for (size_t op = 0; op < BUS_STATS_OPS; op++) {
+        MateWire::DiagEntry& entry = stats[port][op];
+        if (entry.count == 0)
+            continue;
+
+        entry.op = static_cast<MateWire::DiagOp>(op);
+        size_t len = MateWire::encodeDiagEntry(&out[n], out_size - n, entry);
+        if (len == 0)
+            return 0;
+
+        n += len;
+        out[1]++;
+        entry = MateWire::DiagEntry();
+    }
+    return n;
+}
+
+};
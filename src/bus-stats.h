@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <matewire.h>
+
+#include "mate-scheduler.h"
+#include "mate-frame.h"
+
+#define BUS_STATS_OPS ((size_t)TxnOp::MaxOps)
+
+// Per-device, per-operation statistics for every call made on the MATE bus.
+// Published periodically by each collector as a diagnostics frame (see MateWire).
+namespace BusStats
+{
+    // Record a completed bus call
+    void record(uint8_t port, TxnOp op, uint32_t elapsed_us, bool success);
+
+    // Make a bus call outside of MateScheduler (which records its own) and record it.
+    // call() returns whether the device responded, eg.
+    //   BusStats::timed(port, TxnOp::Begin, [&] { return device.begin(port); });
+    template <typename F>
+    bool timed(uint8_t port, TxnOp op, F call)
+    {
+        uint32_t tStart = static_cast<uint32_t>(micros());
+        bool success = call();
+        record(port, op, static_cast<uint32_t>(micros()) - tStart, success);
+        return success;
+    }
+
+    // Encode the diagnostics payload for a port and reset its counters.
+    // Returns the payload size, or 0 if out is too small.
+    size_t encode(uint8_t port, uint8_t* out, size_t out_size);
+};
+
+static_assert(MateWire::DIAG_HEADER_SIZE + (BUS_STATS_OPS * MateWire::DIAG_ENTRY_SIZE) + MateWire::OVERHEAD <= MAX_FRAME_PAYLOAD,
+    "Diagnostics frame exceeds frame size");
@@ -0,0 +1,412 @@
+#include "connection.h"
+#include "debug.h"
+#include "mqtt.h"
+#include "metrics.h"
+#include "secrets.h"
+
+#include <WiFi.h>
+#ifndef MODE_NATIVE
+#include <ETH.h>
+#endif
+
+static const char* ntpServer1 = "pool.ntp.org";
+
+// Give up waiting on a state after this long, and retry (with backoff)
+static const uint32_t stateTimeoutMs = 30000;
+
+// Exponential backoff between failed attempts
+static const uint32_t backoffMinMs = 1000;
+static const uint32_t backoffMaxMs = 60000;
+static const uint32_t backoffJitterPct = 25; // +/-
+
+static const char* stateNames[(size_t)ConnState::MaxStates] = {
+    "link",
+    "ip",
+    "time",
+    "tls",
+    "session",
+    "connected",
+    "backoff"
+};
+
+// Total time spent in each state (ms)
+static Metric m_link_ms("conn_link_ms");
+static Metric m_ip_ms("conn_ip_ms");
+static Metric m_time_ms("conn_time_ms");
+static Metric m_tls_ms("conn_tls_ms");
+static Metric m_session_ms("conn_session_ms");
+static Metric m_connected_s("conn_connected_s"); // Seconds, to avoid overflow
+static Metric m_backoff_ms_total("conn_backoff_ms");
+
+static Metric* m_state_ms[(size_t)ConnState::MaxStates] = {
+    &m_link_ms,
+    &m_ip_ms,
+    &m_time_ms,
+    &m_tls_ms,
+    &m_session_ms,
+    &m_connected_s,
+    &m_backoff_ms_total,
+};
+static Metric m_reconnects("conn_reconnects");
+static Metric m_failures("conn_failures");
+static Metric m_last_reconnect_ms("conn_last_reconnect_ms"); // Time from disconnect to MQTT session
+static Metric m_first_publish_ms("conn_first_publish_ms");  // Time from disconnect to the first frame published
+
+static Client*      m_net = nullptr;
+#ifndef MODE_NATIVE
+static TlsClient*   m_tls = nullptr;
+#endif
+static bool         m_connecting = false;   // Started a TlsClient connection
+static const char*  m_host = nullptr;
+static uint16_t     m_port = 0;
+
+static ConnState    m_state = ConnState::Link;
+static ConnState    m_retry_state = ConnState::Link;
+static uint32_t     tEnter = 0;         // When the current state was entered
+static uint32_t     tDisconnect = 0;    // When the last connection was lost
+static uint32_t     tRetry = 0;         // When to leave Backoff
+static uint32_t     m_backoff_ms = 0;
+static bool         m_link_started = false;
+static bool         m_time_configured = false;
+static bool         m_awaiting_publish = false; // No frame published since the session was established
+
+#ifdef MODE_WIFI
+static void printWiFiStatus(wl_status_t status) {
+    switch (status) {
+        case WL_CONNECTED:
+            Debug.println("Connected!");
+            break;
+        case WL_NO_SSID_AVAIL:
+            // Bad SSID or AP not present
+            Debug.println("No SSID Available");
+            break;
+        case WL_CONNECT_FAILED:
+            // Bad password
+            Debug.println("Failed to connect");
+            break;
+        case WL_IDLE_STATUS:
+            Debug.println("Station Idle");
+            break;
+        case WL_CONNECTION_LOST:
+            Debug.println("Connection lost");
+            break;
+        default:
+            Debug.println(status, HEX);
+    }
+}
+#endif
+
+static bool linkUp()
+{
+#ifdef MODE_WIFI
+    return WiFi.status() == WL_CONNECTED;
+#endif
+#ifdef MODE_ETH
+    return ETH.linkUp();
+#endif
+#ifdef MODE_NATIVE
+    return true;
+#endif
+}
+
+static IPAddress localIP()
+{
+#ifdef MODE_WIFI
+    return WiFi.localIP();
+#endif
+#ifdef MODE_ETH
+    return ETH.localIP();
+#endif
+#ifdef MODE_NATIVE
+    return WiFi.localIP();
+#endif
+}
+
+static void beginLink()
+{
+#ifdef MODE_WIFI
+    Debug.print("Connecting to SSID: "); Debug.println(secrets::wifi_ssid);
+
+    WiFi.persistent(false);
+    WiFi.mode(WIFI_STA);
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
+    WiFi.setHostname(secrets::device_name);
+    WiFi.begin(secrets::wifi_ssid, secrets::wifi_pw);
+#endif
+#ifdef MODE_ETH
+    // ETH.begin() is called once in setup(), the link comes up by itself
+    Debug.println("Waiting for LAN...");
+#endif
+}
+
+static void restartLink()
+{
+#ifdef MODE_WIFI
+    Debug.print("Error connecting: "); printWiFiStatus(WiFi.status());
+    WiFi.disconnect();
+    m_link_started = false;
+#endif
+}
+
+// Time must be valid to check the broker's certificate
+static bool timeValid()
+{
+    struct tm timeinfo;
+    return getLocalTime(&timeinfo, 0);
+}
+
+static void enter(ConnState state, uint32_t now)
+{
+    uint32_t elapsed = now - tEnter;
+    if (m_state == ConnState::Connected) {
+        m_state_ms[(size_t)m_state]->add(elapsed / 1000);
+    } else {
+        m_state_ms[(size_t)m_state]->add(elapsed);
+    }
+
+    m_state = state;
+    tEnter = now;
+}
+
+static void fail(ConnState retry_state, uint32_t now)
+{
+    m_failures.add();
+
+    // Exponential backoff
+    if (m_backoff_ms == 0) {
+        m_backoff_ms = backoffMinMs;
+    } else {
+        m_backoff_ms *= 2;
+        if (m_backoff_ms > backoffMaxMs)
+            m_backoff_ms = backoffMaxMs;
+    }
+
+    // Add jitter, so many gateways don't all retry in lock-step after a broker outage
+    int32_t jitter = (int32_t)((m_backoff_ms * backoffJitterPct) / 100);
+    uint32_t delay_ms = m_backoff_ms + random(-jitter, jitter + 1);
+
+    Debug.print("Connection failed (");
+    Debug.print(stateNames[(size_t)m_state]);
+    Debug.print("), retrying in ");
+    Debug.print(delay_ms);
+    Debug.println("ms");
+
+    m_retry_state = retry_state;
+    tRetry = now + delay_ms;
+    enter(ConnState::Backoff, now);
+}
+
+static void disconnected(ConnState next, uint32_t now)
+{
+    Debug.println("Connection lost");
+    tDisconnect = now;
+    enter(next, now);
+}
+
+namespace Connection {
+
+#ifndef MODE_NATIVE
+void setup(Client& net, TlsClient& tls, const char* host, uint16_t port)
+{
+    m_tls = &tls;
+    setup(net, host, port);
+}
+#endif
+
+void setup(Client& net, const char* host, uint16_t port)
+{
+    m_net = &net;
+    m_host = host;
+    m_port = port;
+    Mqtt::client.setSocketTimeout(MQTT_CONNECT_TIMEOUT_S);
+
+#ifdef MODE_ETH
+    Debug.println("Connecting to LAN...");
+    //ETH.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
+    ETH.begin();
+    ETH.setHostname(secrets::device_name);
+#endif
+
+    uint32_t now = static_cast<uint32_t>(millis());
+    tEnter = now;
+    tDisconnect = now;
+    m_state = ConnState::Link;
+}
+
+bool process(uint32_t now)
+{
+    bool timeout = ((now - tEnter) >= stateTimeoutMs);
+
+    switch (m_state) {
+        case ConnState::Link:
+            if (linkUp()) {
+                enter(ConnState::Ip, now);
+            }
+            else if (!m_link_started) {
+                beginLink();
+                m_link_started = true;
+            }
+            else if (timeout) {
+                restartLink();
+                fail(ConnState::Link, now);
+            }
+            break;
+
+        case ConnState::Ip:
+            if (!linkUp()) {
+                enter(ConnState::Link, now);
+            }
+            else if (static_cast<uint32_t>(localIP()) != 0) {
+                Debug.print("IP address: ");
+                Debug.println(localIP());
+
+                // Time only needs to be acquired once
+                enter(timeValid() ? ConnState::Tls : ConnState::Time, now);
+            }
+            else if (timeout) {
+                restartLink();
+                fail(ConnState::Link, now);
+            }
+            break;
+
+        case ConnState::Time:
+            if (!m_time_configured) {
+                // Configure NTP server (GMT timezone)
+                // Required before we can validate SSL
+                configTime(0, 0, ntpServer1);
+                m_time_configured = true;
+            }
+            if (timeValid()) {
+                struct tm timeinfo;
+                getLocalTime(&timeinfo, 0);
+                Debug.println(&timeinfo, "Current time (UTC): %Y-%m-%d %H:%M:%S");
+                enter(ConnState::Tls, now);
+            }
+            else if (timeout) {
+                fail(ConnState::Time, now);
+            }
+            break;
+
+        case ConnState::Tls:
+            if (!linkUp()) {
+                if (m_connecting) {
+                    m_net->stop();
+                    m_connecting = false;
+                }
+                enter(ConnState::Link, now);
+            }
+            else if (m_net->connected()) {
+                m_connecting = false;
+                enter(ConnState::Session, now);
+            }
+#ifndef MODE_NATIVE
+            else if (m_tls != nullptr) {
+                int rc = -1;
+                if (m_connecting) {
+                    rc = m_tls->connectStep();
+                }
+                else {
+                    m_net->stop();  // Resets the BufferedClient
+                    m_connecting = m_tls->connectBegin(m_host, m_port);
+                    rc = m_connecting ? 0 : -1;
+                }
+
+                if ((rc < 0) || ((rc == 0) && timeout)) {
+                    m_net->stop();
+                    m_connecting = false;
+                    fail(ConnState::Tls, now);
+                }
+                else if (rc > 0) {
+                    m_connecting = false;
+                    enter(ConnState::Session, now);
+                }
+            }
+#endif
+            else if (m_net->connect(m_host, m_port)) {
+                enter(ConnState::Session, now);
+            }
+            else {
+                fail(ConnState::Tls, now);
+            }
+            break;
+
+        case ConnState::Session:
+            if (Mqtt::tryConnect()) {
+                m_reconnects.add();
+                m_last_reconnect_ms.set(now - tDisconnect);
+                m_awaiting_publish = true;
+                m_backoff_ms = 0;
+                enter(ConnState::Connected, now);
+                return true; // New session
+            }
+            else {
+                m_net->stop();
+                fail(ConnState::Tls, now);
+            }
+            break;
+
+        case ConnState::Connected:
+            if (!linkUp()) {
+                m_net->stop();
+                disconnected(ConnState::Link, now);
+            }
+            else if (!Mqtt::client.connected()) {
+                m_net->stop();
+                disconnected(ConnState::Tls, now);
+            }
+            else {
+                Mqtt::client.loop();
+            }
+            break;
+
+        case ConnState::Backoff:
+            if (static_cast<int32_t>(now - tRetry) >= 0) {
+                enter(m_retry_state, now);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return false;
+}
+
+ConnState state()
+{
+    return m_state;
+}
+
+const char* stateName(ConnState state)
+{
+    if (state < ConnState::MaxStates)
+        return stateNames[(size_t)state];
+    return "?";
+}
+
+bool networkUp()
+{
+    return linkUp() && (static_cast<uint32_t>(localIP()) != 0);
+}
+
+bool connected()
+{
+    return m_state == ConnState::Connected;
+}
+
+void flush()
+{
+    if (m_net != nullptr) {
+        m_net->flush();
+    }
+}
+
+void framePublished()
+{
+    if (m_awaiting_publish) {
+        m_awaiting_publish = false;
+        m_first_publish_ms.set(static_cast<uint32_t>(millis()) - tDisconnect);
+    }
+}
+
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Client.h>
+
+#ifndef MODE_NATIVE
+#include "tls-client.h"
+#endif
+
+// Longest the Session state waits for the broker's CONNACK (s)
+#define MQTT_CONNECT_TIMEOUT_S  (5)
+
+// Connection states, in the order they are normally passed through
+enum class ConnState : uint8_t {
+    Link,       // Waiting for WiFi association / Ethernet link
+    Ip,         // Waiting for an IP address
+    Time,       // Waiting for NTP (required to validate TLS certificates)
+    Tls,        // Opening the TLS connection to the broker
+    Session,    // Establishing the MQTT session
+    Connected,
+    Backoff,    // Waiting to retry after a failure
+    MaxStates
+};
+
+// Non-blocking connection manager.
+// Brings the uplink up one step per call to process(), so MATE data keeps
+// being collected (and buffered) while the network or broker is unavailable.
+// Failures are retried with exponential backoff + jitter.
+//
+// Given the TlsClient, the Tls state makes one handshake step per call (see TlsClient::connectStep()).
+// Otherwise (eg. the native build) it blocks in Client::connect().
+// The Session state still blocks in PubSubClient::connect() until the broker replies to
+// CONNECT, for up to MQTT_CONNECT_TIMEOUT_S. Use MODE_DUAL_CORE if the MATE bus must
+// never wait on the network at all.
+namespace Connection
+{
+    // net is the client used by Mqtt::client
+    void setup(Client& net, const char* host, uint16_t port);
+
+#ifndef MODE_NATIVE
+    // As above, where net wraps tls
+    void setup(Client& net, TlsClient& tls, const char* host, uint16_t port);
+#endif
+
+    // Advance the state machine by at most one step.
+    // Returns true when a new MQTT session has just been established.
+    bool process(uint32_t now);
+
+    ConnState state();
+    const char* stateName(ConnState state);
+
+    // True once we have a link & IP address
+    bool networkUp();
+
+    bool connected();
+
+    // Send anything the client is holding back (see BufferedClient)
+    void flush();
+
+    // Called when a MATE frame has been published, to measure the time from losing
+    // the connection to data flowing again (conn_first_publish_ms)
+    void framePublished();
+};
@@ -4,4 +4,6 @@
 #include <Wire.h>
 #include <assert.h>
 
+#include "log.h"
+
 extern Stream& Debug;
@@ -0,0 +1,439 @@
+#include "energy.h"
+#include "mqtt.h"
+#include "allocator.h"
+#include "debug.h"
+
+#include <uMate.h>
+#include <matestatus.h>
+#include <atomic>
+
+#ifdef MATE_ENERGY
+
+#ifndef MODE_NATIVE
+#include <LittleFS.h>
+#include <esp_attr.h>
+#endif
+
+typedef HAComponent<Component::Sensor> Sensor;
+
+// Name (eg. 'dc1_shunt_a_out_ah') must fit within the HA topic & unique ID
+#define COUNTER_NAME_LEN (24)
+
+// Counters per device (FLEXnet DC has the most)
+#define DEVICE_COUNTERS (8)
+
+#define SAVED_COUNTERS_MAGIC (0x454E5231) // 'ENR1'
+
+// A counter integrates voltage * (sum of currents), or just the currents for amp-hours.
+// Only current in the direction of sign is counted, so each counter only increases.
+struct CounterDef {
+    const char* name;
+    const char* voltage;        // Status field, or nullptr for amp-hours
+    const char* currents[3];    // Status fields, summed
+    int8_t      sign;
+};
+
+static const CounterDef MX_COUNTERS[] = {
+    // name                 voltage             currents                                                        sign
+    { "pv_energy",          "pv_voltage",       { "pv_current" },                                               +1 },
+    { "charge_energy",      "bat_voltage",      { "charge_current" },                                           +1 },
+};
+
+static const CounterDef FX_COUNTERS[] = {
+    // name                 voltage             currents                                                        sign
+    { "ac_in_energy",       "ac_in_voltage",    { "buy_current" },                                              +1 },
+    { "ac_out_energy",      "ac_out_voltage",   { "inv_current" },                                              +1 },
+    { "ac_sold_energy",     "ac_in_voltage",    { "sell_current" },                                             +1 },
+};
+
+static const CounterDef DC_COUNTERS[] = {
+    // name                 voltage             currents                                                        sign
+    { "bat_in_energy",      "bat_voltage",      { "shunt_a_current", "shunt_b_current", "shunt_c_current" },    +1 },
+    { "bat_out_energy",     "bat_voltage",      { "shunt_a_current", "shunt_b_current", "shunt_c_current" },    -1 },
+    { "shunt_a_in_ah",      nullptr,            { "shunt_a_current" },                                          +1 },
+    { "shunt_a_out_ah",     nullptr,            { "shunt_a_current" },                                          -1 },
+    { "shunt_b_in_ah",      nullptr,            { "shunt_b_current" },                                          +1 },
+    { "shunt_b_out_ah",     nullptr,            { "shunt_b_current" },                                          -1 },
+    { "shunt_c_in_ah",      nullptr,            { "shunt_c_current" },                                          +1 },
+    { "shunt_c_out_ah",     nullptr,            { "shunt_c_current" },                                          -1 },
+};
+
+static_assert(sizeof(MX_COUNTERS) / sizeof(MX_COUNTERS[0]) <= DEVICE_COUNTERS, "Too many MX counters");
+static_assert(sizeof(FX_COUNTERS) / sizeof(FX_COUNTERS[0]) <= DEVICE_COUNTERS, "Too many FX counters");
+static_assert(sizeof(DC_COUNTERS) / sizeof(DC_COUNTERS[0]) <= DEVICE_COUNTERS, "Too many DC counters");
+
+struct DeviceEnergy {
+    const MateWire::StatusLayout* layout;
+    const CounterDef* defs;
+    size_t count;
+    size_t first;                                   // Index of the first counter in counter_names/saved
+    int8_t voltage[DEVICE_COUNTERS];                // Status field indices, -1 if unused
+    int8_t currents[DEVICE_COUNTERS][3];
+
+    // Only used by the MATE bus task
+    bool     havePrev;
+    uint32_t tPrev;
+    float    prev[DEVICE_COUNTERS];                 // W or A at tPrev
+    float    frac[DEVICE_COUNTERS];                 // Fraction of a milli-unit not yet counted
+
+    // Written by the MATE bus task. seq is odd while the totals are being updated.
+    std::atomic<uint32_t> seq;
+    uint64_t totals[DEVICE_COUNTERS];               // mWh or mAh
+
+    // Only used by the network task
+    bool unregistered;                              // No room for the sensors
+    Sensor* sensors[DEVICE_COUNTERS];               // nullptr until registered
+};
+
+struct SavedCounter {
+    char     name[COUNTER_NAME_LEN];                // eg. 'mx1_pv_energy'
+    uint64_t total;
+};
+
+// Layout of the counters in flash & RTC memory
+struct SavedCounters {
+    uint32_t magic;
+    uint16_t count;
+    uint16_t crc;   // Over counters[count]
+    SavedCounter counters[ENERGY_COUNTER_MAX];
+};
+
+static DeviceEnergy devices[NUM_MATE_PORTS];
+static std::atomic<int> device_count(0);
+static size_t counter_count = 0;
+
+static fixed_pool_allocator<Sensor, ENERGY_COUNTER_MAX> sensor_pool;
+
+static SavedCounters restored;      // Counters saved before the last reboot
+static SavedCounters current;       // Latest snapshot (network task)
+static SavedCounters image;         // What's saved: current, plus restored counters not in it
+static uint32_t snapshot_seq = 0;   // Sum of device seqs at the last snapshot
+static uint32_t tPrevPublish = 0;
+static bool publish_now = false;
+
+#ifndef MODE_NATIVE
+static const char* ENERGY_FILE = "/energy";
+static const char* ENERGY_TMP_FILE = "/energy.tmp";
+
+// Kept across soft reboots, so counts since the last save aren't lost (eg. on OTA update).
+// RTC memory is not initialized on boot, so it is only trusted if the magic and CRC match.
+static RTC_NOINIT_ATTR SavedCounters rtc;
+#endif
+
+static uint16_t savedCrc(const SavedCounters& saved)
+{
+    return MateWire::crc16(reinterpret_cast<const uint8_t*>(saved.counters), saved.count * sizeof(SavedCounter));
+}
+
+static bool savedValid(const SavedCounters& saved)
+{
+    return (saved.magic == SAVED_COUNTERS_MAGIC) &&
+           (saved.count <= ENERGY_COUNTER_MAX) &&
+           (saved.crc == savedCrc(saved));
+}
+
+static SavedCounter* findSaved(SavedCounters& saved, const char* name)
+{
+    for (size_t i = 0; i < saved.count; i++) {
+        if (strncmp(saved.counters[i].name, name, COUNTER_NAME_LEN) == 0)
+            return &saved.counters[i];
+    }
+    return nullptr;
+}
+
+// Take the larger of each counter, so a restored counter never goes backwards
+static void mergeSaved(SavedCounters& into, const SavedCounters& from)
+{
+    for (size_t i = 0; i < from.count; i++) {
+        SavedCounter* c = findSaved(into, from.counters[i].name);
+        if (c == nullptr) {
+            if (into.count >= ENERGY_COUNTER_MAX)
+                continue;
+            c = &into.counters[into.count++];
+            memcpy(c->name, from.counters[i].name, COUNTER_NAME_LEN);
+            c->total = 0;
+        }
+        if (from.counters[i].total > c->total)
+            c->total = from.counters[i].total;
+    }
+}
+
+static bool saveFlash(const SavedCounters& saved)
+{
+#ifndef MODE_NATIVE
+    // Written in full then renamed, so a reset part way through leaves the previous save intact
+    File f = LittleFS.open(ENERGY_TMP_FILE, "w");
+    if (!f)
+        return false;
+    size_t len = f.write(reinterpret_cast<const uint8_t*>(&saved), sizeof(saved));
+    f.close();
+    return (len == sizeof(saved)) && LittleFS.rename(ENERGY_TMP_FILE, ENERGY_FILE);
+#else
+    return true;
+#endif
+}
+
+static void restore()
+{
+    memset(&restored, 0, sizeof(restored));
+
+#ifndef MODE_NATIVE
+    if (!LittleFS.begin(true)) {
+        LOG_ERROR("Energy: Could not mount flash");
+    }
+    else {
+        File f = LittleFS.open(ENERGY_FILE, "r");
+        if (f) {
+            static SavedCounters flash;
+            if ((f.read(reinterpret_cast<uint8_t*>(&flash), sizeof(flash)) == sizeof(flash)) && savedValid(flash)) {
+                mergeSaved(restored, flash);
+            }
+            f.close();
+        }
+    }
+
+    if (savedValid(rtc)) {
+        mergeSaved(restored, rtc);
+    }
+#endif
+
+    LOG_INFO("Energy: Restored %u counters", (unsigned)restored.count);
+}
+
+// Copy every counter into current. Returns false if nothing has changed.
+static bool snapshot()
+{
+    uint32_t seq_sum = 0;
+    int n = device_count.load(std::memory_order_acquire);
+    for (int d = 0; d < n; d++) {
+        DeviceEnergy& dev = devices[d];
+
+        uint32_t seq;
+        do {
+            seq = dev.seq.load(std::memory_order_acquire);
+            for (size_t i = 0; i < dev.count; i++) {
+                current.counters[dev.first + i].total = dev.totals[i];
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((seq & 1) || (seq != dev.seq.load(std::memory_order_relaxed)));
+
+        seq_sum += seq;
+    }
+
+    if (seq_sum == snapshot_seq)
+        return false;
+    snapshot_seq = seq_sum;
+
+    current.magic = SAVED_COUNTERS_MAGIC;
+    current.count = static_cast<uint16_t>(counter_count);
+    return true;
+}
+
+// The counters to save. Counters restored for devices that haven't been found this boot
+// are carried over, so a device that's missing for a while doesn't lose its totals.
+static const SavedCounters& saveImage()
+{
+    image = current;
+    mergeSaved(image, restored);
+    image.crc = savedCrc(image);
+    return image;
+}
+
+// Create a sensor entity for each of the device's counters
+static bool registerSensors(DeviceEnergy& dev)
+{
+    for (size_t i = 0; i < dev.count; i++) {
+        bool amp_hours = (dev.defs[i].voltage == nullptr);
+        Sensor* sensor = sensor_pool.make_new(Mqtt::context, current.counters[dev.first + i].name, 0, 0.0f,
+            amp_hours ? SensorClass::AmpHours : SensorClass::Energy,
+            amp_hours ? 3 : 0);
+        if (sensor == nullptr) {
+            LOG_WARN("No room for energy sensors, increase ENERGY_COUNTER_MAX");
+            dev.unregistered = true;
+            return false;
+        }
+        sensor->SetStateClass(StateClass::TotalIncreasing);
+        sensor->Initialize();
+        sensor->PublishLater();
+        dev.sensors[i] = sensor;
+    }
+
+    LOG_INFO("Registered %u energy sensors", (unsigned)dev.count);
+    return true;
+}
+
+static int8_t fieldIndex(const MateWire::StatusLayout& layout, const char* name)
+{
+    if (name == nullptr)
+        return -1;
+    for (size_t i = 0; i < layout.count; i++) {
+        if (strcmp(layout.fields[i].name, name) == 0)
+            return static_cast<int8_t>(i);
+    }
+    return -1;
+}
+
+namespace Energy {
+
+void setup()
+{
+    restore();
+}
+
+int addDevice(MateWire::DeviceType type, const char* label)
+{
+    const CounterDef* defs;
+    size_t count;
+    switch (type) {
+        case MateWire::DeviceType::Mx:  defs = MX_COUNTERS; count = sizeof(MX_COUNTERS) / sizeof(MX_COUNTERS[0]); break;
+        case MateWire::DeviceType::Fx:  defs = FX_COUNTERS; count = sizeof(FX_COUNTERS) / sizeof(FX_COUNTERS[0]); break;
+        case MateWire::DeviceType::Dc:  defs = DC_COUNTERS; count = sizeof(DC_COUNTERS) / sizeof(DC_COUNTERS[0]); break;
+        default:                        return -1;
+    }
+
+    const MateWire::StatusLayout* layout = MateWire::statusLayout(type);
+    int n = device_count.load(std::memory_order_relaxed);
+    if ((layout == nullptr) || (n >= NUM_MATE_PORTS))
+        return -1;
+    if ((counter_count + count) > ENERGY_COUNTER_MAX) {
+        LOG_WARN("No room for %s energy counters, increase ENERGY_COUNTER_MAX", label);
+        return -1;
+    }
+
+    DeviceEnergy& dev = devices[n];
+    dev.layout = layout;
+    dev.defs = defs;
+    dev.count = count;
+    dev.first = counter_count;
+
+    for (size_t i = 0; i < count; i++) {
+        dev.voltage[i] = fieldIndex(*layout, defs[i].voltage);
+        for (size_t j = 0; j < 3; j++) {
+            dev.currents[i][j] = fieldIndex(*layout, defs[i].currents[j]);
+        }
+
+        // Carry on from the saved count, eg. 'mx1_pv_energy'
+        SavedCounter& c = current.counters[counter_count++];
+        snprintf(c.name, sizeof(c.name), "%s_%s", label, defs[i].name);
+        SavedCounter* saved = findSaved(restored, c.name);
+        dev.totals[i] = (saved != nullptr) ? saved->total : 0;
+        c.total = dev.totals[i];
+    }
+
+    device_count.store(n + 1, std::memory_order_release);
+    return n;
+}
+
+void sample(int device, const uint8_t* status, size_t size)
+{
+    if (device < 0)
+        return;
+
+    DeviceEnergy& dev = devices[device];
+    float values[MateWire::MAX_STATUS_FIELDS];
+    if (!MateWire::decodeStatus(*dev.layout, status, size, values))
+        return;
+
+    // Power (W) or current (A) in the direction counted
+    float x[DEVICE_COUNTERS];
+    for (size_t i = 0; i < dev.count; i++) {
+        float current = 0.0f;
+        for (size_t j = 0; j < 3; j++) {
+            if (dev.currents[i][j] >= 0)
+                current += values[dev.currents[i][j]];
+        }
+        current *= dev.defs[i].sign;
+        if (!(current > 0.0f))
+            current = 0.0f;     // Also discards NaN
+
+        x[i] = (dev.voltage[i] >= 0) ? (current * values[dev.voltage[i]]) : current;
+    }
+
+    uint32_t now = static_cast<uint32_t>(millis());
+    uint32_t dt = now - dev.tPrev;
+    if (dev.havePrev && (dt <= ENERGY_MAX_GAP_MS)) {
+        uint32_t seq = dev.seq.load(std::memory_order_relaxed);
+        dev.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (size_t i = 0; i < dev.count; i++) {
+            // Trapezoidal rule, W.ms (or A.ms) / 3600 = mWh (or mAh)
+            dev.frac[i] += (dev.prev[i] + x[i]) * 0.5f * dt * (1.0f / 3600.0f);
+            if (dev.frac[i] >= 1.0f) {
+                uint32_t whole = static_cast<uint32_t>(dev.frac[i]);
+                dev.totals[i] += whole;
+                dev.frac[i] -= whole;
+            }
+        }
+
+        dev.seq.store(seq + 2, std::memory_order_release);
+    }
+
+    memcpy(dev.prev, x, sizeof(float) * dev.count);
+    dev.tPrev = now;
+    dev.havePrev = true;
+}
+
+void process()
+{
+    bool registered = false;
+
+    int n = device_count.load(std::memory_order_acquire);
+    for (int d = 0; d < n; d++) {
+        DeviceEnergy& dev = devices[d];
+        if ((dev.sensors[0] == nullptr) && !dev.unregistered) {
+            if (registerSensors(dev))
+                registered = true;
+        }
+    }
+
+    // Publish the new entities' current count
+    if (registered) {
+        publish_now = true;
+    }
+
+    if (snapshot()) {
+#ifndef MODE_NATIVE
+        rtc = saveImage();
+#endif
+    }
+
+    uint32_t now = static_cast<uint32_t>(millis());
+    if (!publish_now && ((now - tPrevPublish) < ENERGY_PUBLISH_INTERVAL_MS))
+        return;
+    tPrevPublish = now;
+    publish_now = false;
+
+    // Saved first, so the published count is never more than what would be restored after a reset
+    if (!saveFlash(saveImage())) {
+        LOG_WARN("Energy: Could not save counters");
+    }
+
+    for (int d = 0; d < n; d++) {
+        DeviceEnergy& dev = devices[d];
+        if (dev.sensors[0] == nullptr)
+            continue;
+
+        // Wh from mWh, or mAh as Ah with 3 decimals (see registerSensors())
+        for (size_t i = 0; i < dev.count; i++) {
+            uint64_t total = current.counters[dev.first + i].total;
+            bool amp_hours = (dev.defs[i].voltage == nullptr);
+            dev.sensors[i]->UpdateTotal(amp_hours ? total : (total / 1000));
+        }
+    }
+}
+
+};
+
+#else
+
+namespace Energy {
+
+void setup() { }
+int addDevice(MateWire::DeviceType type, const char* label) { return -1; }
+void sample(int device, const uint8_t* status, size_t size) { }
+void process() { }
+
+};
+
+#endif
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <matewire.h>
+
+// Status is read for the energy counters at least this often, whatever the publish rate
+#define ENERGY_SAMPLE_INTERVAL_MS   (2000)
+
+// Samples further apart than this aren't integrated (eg. the device was unreachable)
+#define ENERGY_MAX_GAP_MS           (60000)
+
+// Counters are saved to flash, then published to Home Assistant, at this rate
+#define ENERGY_PUBLISH_INTERVAL_MS  (300000)
+
+// Maximum number of counters, across all devices
+#define ENERGY_COUNTER_MAX          (32)
+
+// Energy counters for MATE devices (MATE_ENERGY).
+//
+// kWh figures integrated server-side from status frames miss anything shorter than the
+// publish interval. With MATE_ENERGY, the collectors read status every ENERGY_SAMPLE_INTERVAL_MS
+// (only publishing it at their usual rate), and the power (or current) fields are integrated
+// on the gateway into per-device counters:
+//
+//   - MX: PV energy in, battery charge energy
+//   - FX: AC in (bought), AC out (inverter), AC sold
+//   - FLEXnet DC: battery energy in/out, amp-hours in/out of each shunt
+//
+// Counters are kept in milli-units (mWh, mAh) in 64 bits, and only ever increase.
+// They're kept in RTC memory (for soft reboots) and saved to flash before being published,
+// so a counter never goes backwards in Home Assistant, where each one is a 'total_increasing'
+// sensor, eg. 'mate_mx1_pv_energy'.
+//
+// Samples are integrated on the MATE bus task, and the sensors are only touched by the network task.
+namespace Energy
+{
+    // Restore the saved counters. Called before any devices are added.
+    void setup();
+
+    // Add a device, eg. (Mx, "mx1"). Returns a handle for sample(), or -1 if it has no counters.
+    int addDevice(MateWire::DeviceType type, const char* label);
+
+    // Integrate the status read from a device
+    void sample(int device, const uint8_t* status, size_t size);
+
+    // Register new entities, save and publish the counters. Called from the network task.
+    void process();
+};
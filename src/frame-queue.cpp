@@ -0,0 +1,77 @@
+#include "frame-queue.h"
+#include "spsc-ring.h"
+#include "debug.h"
+#include "batcher.h"
+#include "connection.h"
+
+static SpscRing<MateFrame, FRAME_QUEUE_SIZE> ring;
+
+namespace FrameQueue {
+
+bool push(const char* topic, const uint8_t* payload, size_t size, bool retained, uint8_t flags)
+{
+    MateFrame* frame = ring.reserve();
+    if (frame == nullptr) {
+        return false; // Queue full, frame dropped
+    }
+
+    if (!frame->set(topic, payload, size, retained, flags)) {
+        return false; // Payload too large
+    }
+
+    ring.commit();
+    return true;
+}
+
+bool pushFrame(const char* topic, const MateWire::FrameHeader& hdr, const uint8_t* payload, size_t size, uint8_t flags)
+{
+    MateFrame* frame = ring.reserve();
+    if (frame == nullptr) {
+        return false; // Queue full, frame dropped
+    }
+
+    if (!frame->setFrame(topic, hdr, payload, size, flags)) {
+        return false; // Payload too large
+    }
+
+    ring.commit();
+    return true;
+}
+
+size_t drain(PubSubClient& client, size_t max_frames)
+{
+    size_t n = 0;
+    while (n < max_frames) {
+        MateFrame* frame = ring.front();
+        if (frame == nullptr)
+            break;
+
+        if (frame->flags & FRAME_CYCLE_END) {
+            Batcher::flush(client);
+            Connection::flush();
+        }
+        else {
+            Debug.print("Publish: ");
+            Debug.print(frame->topic);
+            Debug.println();
+
+            // Batched, or stored for later if disconnected
+            Batcher::publish(client, *frame);
+        }
+        ring.release();
+        n++;
+    }
+    return n;
+}
+
+size_t pending()
+{
+    return ring.size();
+}
+
+uint32_t dropped()
+{
+    return ring.droppedCount();
+}
+
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <PubSubClient.h>
+
+#include "mate-frame.h"
+
+// Number of frames that can be buffered between the MATE bus task
+// and the network task. Must be a power of two.
+#define FRAME_QUEUE_SIZE (32)
+
+// Hands published frames from the MATE bus task to the network task (MODE_DUAL_CORE)
+namespace FrameQueue
+{
+    // Called from the MATE bus task. Never blocks, returns false if the queue is full.
+    bool push(const char* topic, const uint8_t* payload, size_t size, bool retained, uint8_t flags = FRAME_FLAG_NONE);
+
+    // As above, encoding a MateWire frame directly into the queue
+    bool pushFrame(const char* topic, const MateWire::FrameHeader& hdr, const uint8_t* payload, size_t size, uint8_t flags = FRAME_FLAG_NONE);
+
+    // Called from the network task. Publishes up to max_frames queued frames.
+    // Batchable frames are passed to the Batcher, and to the Outbox while the client is disconnected.
+    size_t drain(PubSubClient& client, size_t max_frames);
+
+    size_t pending();
+    uint32_t dropped();
+};
@@ -0,0 +1,299 @@
+#include "inflight.h"
+#include "metrics.h"
+#include "debug.h"
+
+#include <atomic>
+
+#ifdef MQTT_QOS1
+
+// PUBLISH fixed header flags
+#define MQTT_PUBLISH_QOS1   (0x32)
+#define MQTT_FLAG_DUP       (0x08)
+#define MQTT_FLAG_RETAIN    (0x01)
+
+static Metric m_qos_inflight("qos_inflight");       // Publishes awaiting a PUBACK
+static Metric m_qos_acked("qos_acked");
+static Metric m_qos_resent("qos_resent");           // Retransmitted after a reconnect
+static Metric m_qos_full("qos_full");               // Publishes refused because the window was full
+static Metric m_qos_ack_ms("qos_ack_ms");           // Publish to PUBACK time of the last acknowledged packet
+static Metric m_qos_timeouts("qos_timeouts");       // Connections dropped for an overdue PUBACK
+
+struct Slot {
+    uint16_t id;
+    uint16_t offset;    // Of the packet in buf
+    uint16_t len;
+    bool     sent;      // Written at least once (retransmissions set DUP)
+    bool     acked;
+    uint32_t tSent;
+};
+
+// Packets are stored contiguously in buf, oldest first, and released once
+// they and every packet before them have been acknowledged.
+static uint8_t  buf[INFLIGHT_BUFFER_SIZE];
+static size_t   buf_head = 0;
+static Slot     slots[INFLIGHT_WINDOW];
+static size_t   slot_tail = 0;
+static size_t   slot_count = 0;
+static uint16_t next_id = 1;
+
+// Packet being built by beginPublish() / write()
+static Slot*    building = nullptr;
+static size_t   build_pos = 0;
+static size_t   build_prev_head = 0;    // To give the space back if the packet is abandoned
+
+static std::atomic<bool> m_congested(false);
+
+static bool full()
+{
+    return slot_count >= INFLIGHT_WINDOW;
+}
+
+// Find len contiguous bytes in buf. Returns false if there is no room.
+static bool reserve(size_t len, uint16_t& offset)
+{
+    if (slot_count == 0) {
+        buf_head = 0;
+    }
+
+    size_t oldest = (slot_count > 0) ? slots[slot_tail].offset : 0;
+    if ((slot_count == 0) || (buf_head > oldest)) {
+        if ((buf_head + len) <= sizeof(buf)) {
+            offset = static_cast<uint16_t>(buf_head);
+        }
+        else if (len <= oldest) {
+            offset = 0; // Wrap around
+        }
+        else {
+            return false;
+        }
+    }
+    else if ((buf_head < oldest) && ((buf_head + len) <= oldest)) {
+        offset = static_cast<uint16_t>(buf_head);
+    }
+    else {
+        return false;
+    }
+
+    buf_head = offset + len;
+    return true;
+}
+
+static bool send(PubSubClient& client, Slot& slot)
+{
+    if (slot.sent) {
+        buf[slot.offset] |= MQTT_FLAG_DUP;
+        m_qos_resent.add();
+    }
+    slot.tSent = static_cast<uint32_t>(millis());
+
+    // PubSubClient::write() goes straight to the network client (and counts as activity for keepalive)
+    if (client.write(&buf[slot.offset], slot.len) != slot.len)
+        return false;
+
+    slot.sent = true;
+    return true;
+}
+
+static void abandon()
+{
+    if (building != nullptr) {
+        buf_head = build_prev_head;
+        building = nullptr;
+    }
+}
+
+// Oldest publish sent in this session that is still awaiting its PUBACK, or nullptr
+static const Slot* oldestUnacked()
+{
+    for (size_t i = 0; i < slot_count; i++) {
+        const Slot& slot = slots[(slot_tail + i) % INFLIGHT_WINDOW];
+        if (slot.sent && !slot.acked)
+            return &slot;
+    }
+    return nullptr;
+}
+
+static void release()
+{
+    while ((slot_count > 0) && slots[slot_tail].acked) {
+        slot_tail = (slot_tail + 1) % INFLIGHT_WINDOW;
+        slot_count--;
+    }
+    m_qos_inflight.set(slot_count);
+}
+
+namespace Inflight {
+
+bool publish(PubSubClient& client, const char* topic, const uint8_t* payload, size_t size, bool retained)
+{
+    return beginPublish(client, topic, size, retained) &&
+        (write(client, payload, size) == size) &&
+        endPublish(client);
+}
+
+bool beginPublish(PubSubClient& client, const char* topic, size_t size, bool retained)
+{
+    abandon();
+
+    size_t topic_len = strlen(topic);
+    size_t remaining = 2 + topic_len + 2 + size;   // Topic, packet ID & payload
+    if (full() || (remaining > 0x3FFF)) {
+        m_qos_full.add();
+        return false;
+    }
+
+    uint8_t header[3];
+    size_t header_len = 1;
+    header[0] = MQTT_PUBLISH_QOS1 | (retained ? MQTT_FLAG_RETAIN : 0);
+    if (remaining < 128) {
+        header[header_len++] = static_cast<uint8_t>(remaining);
+    } else {
+        header[header_len++] = static_cast<uint8_t>(remaining & 0x7F) | 0x80;
+        header[header_len++] = static_cast<uint8_t>(remaining >> 7);
+    }
+
+    uint16_t offset;
+    build_prev_head = buf_head;
+    if (!reserve(header_len + remaining, offset)) {
+        m_qos_full.add();
+        return false;
+    }
+
+    building = &slots[(slot_tail + slot_count) % INFLIGHT_WINDOW];
+    building->id = next_id;
+    building->offset = offset;
+    building->len = static_cast<uint16_t>(header_len + remaining);
+    building->sent = false;
+    building->acked = false;
+
+    next_id = (next_id == 0xFFFF) ? 1 : (next_id + 1);  // 0 is not a valid packet ID
+
+    uint8_t* p = &buf[offset];
+    memcpy(p, header, header_len);
+    p += header_len;
+    *p++ = static_cast<uint8_t>(topic_len >> 8);
+    *p++ = static_cast<uint8_t>(topic_len);
+    memcpy(p, topic, topic_len);
+    p += topic_len;
+    *p++ = static_cast<uint8_t>(building->id >> 8);
+    *p++ = static_cast<uint8_t>(building->id);
+    build_pos = p - buf;
+    return true;
+}
+
+size_t write(PubSubClient& client, const uint8_t* data, size_t size)
+{
+    if ((building == nullptr) || ((build_pos + size) > (building->offset + building->len)))
+        return 0;
+
+    memcpy(&buf[build_pos], data, size);
+    build_pos += size;
+    return size;
+}
+
+bool endPublish(PubSubClient& client)
+{
+    if ((building == nullptr) || (build_pos != (building->offset + building->len))) {
+        abandon();
+        return false;   // Size didn't match beginPublish()
+    }
+
+    Slot& slot = *building;
+    building = nullptr;
+    slot_count++;
+    m_qos_inflight.set(slot_count);
+
+    // If this fails the connection has dropped, and the packet is sent again after reconnecting
+    send(client, slot);
+    return true;
+}
+
+void resend(PubSubClient& client)
+{
+    for (size_t i = 0; i < slot_count; i++) {
+        Slot& slot = slots[(slot_tail + i) % INFLIGHT_WINDOW];
+        if (!slot.acked && !send(client, slot))
+            break;
+    }
+    if (slot_count > 0) {
+        LOG_INFO("Resent %u unacknowledged publishes", (unsigned)slot_count);
+    }
+}
+
+void process(PubSubClient& client, uint32_t now)
+{
+    bool connected = client.connected();
+
+    const Slot* oldest = connected ? oldestUnacked() : nullptr;
+    if ((oldest != nullptr) && ((now - oldest->tSent) >= INFLIGHT_ACK_TIMEOUT_MS)) {
+        LOG_WARN("No PUBACK for packet %u after %ums, reconnecting", oldest->id, (unsigned)(now - oldest->tSent));
+        m_qos_timeouts.add();
+        client.disconnect();    // Everything unacknowledged is resent in the new session
+        connected = false;
+    }
+
+    m_congested.store(full() && connected, std::memory_order_relaxed);
+}
+
+void onPuback(uint16_t packet_id)
+{
+    for (size_t i = 0; i < slot_count; i++) {
+        Slot& slot = slots[(slot_tail + i) % INFLIGHT_WINDOW];
+        if ((slot.id == packet_id) && !slot.acked) {
+            slot.acked = true;
+            m_qos_acked.add();
+            m_qos_ack_ms.set(static_cast<uint32_t>(millis()) - slot.tSent);
+            break;
+        }
+    }
+    release();
+    if (!full()) {
+        m_congested.store(false, std::memory_order_relaxed);
+    }
+}
+
+bool congested()
+{
+    return m_congested.load(std::memory_order_relaxed);
+}
+
+size_t pending()
+{
+    return slot_count;
+}
+
+};
+
+#else
+
+namespace Inflight {
+
+bool publish(PubSubClient& client, const char* topic, const uint8_t* payload, size_t size, bool retained)
+{
+    return client.publish(topic, payload, size, retained);
+}
+
+bool beginPublish(PubSubClient& client, const char* topic, size_t size, bool retained)
+{
+    return client.beginPublish(topic, size, retained);
+}
+
+size_t write(PubSubClient& client, const uint8_t* data, size_t size)
+{
+    return client.write(data, size);
+}
+
+bool endPublish(PubSubClient& client)
+{
+    return client.endPublish() != 0;
+}
+
+void resend(PubSubClient& client) { }
+void process(PubSubClient& client, uint32_t now) { }
+void onPuback(uint16_t packet_id) { }
+bool congested() { return false; }
+size_t pending() { return 0; }
+
+};
+
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <PubSubClient.h>
+
+// Maximum number of QoS 1 publishes awaiting a PUBACK (MQTT_QOS1)
+#define INFLIGHT_WINDOW         (16)
+
+// Space for the encoded packets in flight, kept for retransmission
+#define INFLIGHT_BUFFER_SIZE    (4096)
+
+// A publish not acknowledged within this long (ms) drops the connection,
+// so it is retransmitted in the new session
+#define INFLIGHT_ACK_TIMEOUT_MS (20000)
+
+// The publish path used by the Outbox & Batcher.
+//
+// PubSubClient only publishes at QoS 0, so anything written just before the connection
+// drops is silently lost. With MQTT_QOS1, frames are published at QoS 1 instead, and each
+// encoded PUBLISH packet is kept until the broker acknowledges it. Up to INFLIGHT_WINDOW
+// packets are outstanding at once, so throughput isn't limited by waiting for each PUBACK
+// in turn. Unacknowledged packets are retransmitted (with DUP set) in their original order
+// once a new session is established. The broker doesn't resend a lost PUBACK within a session,
+// so if one is overdue (INFLIGHT_ACK_TIMEOUT_MS) the connection is dropped, rather than leaving
+// the window full (and MATE polling stopped) until something else breaks the connection.
+//
+// PubSubClient discards PUBACKs, so they are picked out of the incoming stream
+// by BufferedClient and passed to onPuback().
+//
+// Without MQTT_QOS1, these pass straight through to PubSubClient (QoS 0).
+namespace Inflight
+{
+    // As PubSubClient. A QoS 1 publish fails if the window is full (the caller should
+    // store the frame for later), and isn't sent until endPublish().
+    bool publish(PubSubClient& client, const char* topic, const uint8_t* payload, size_t size, bool retained);
+    bool beginPublish(PubSubClient& client, const char* topic, size_t size, bool retained);
+    size_t write(PubSubClient& client, const uint8_t* data, size_t size);
+    bool endPublish(PubSubClient& client);
+
+    // Retransmit everything unacknowledged. Called once a new session is established.
+    void resend(PubSubClient& client);
+
+    // Update the congestion state, and disconnect if a PUBACK is overdue
+    void process(PubSubClient& client, uint32_t now);
+
+    // Called for each PUBACK received
+    void onPuback(uint16_t packet_id);
+
+    // True while connected with the window full. The collectors hold off polling until
+    // it clears, rather than producing frames faster than the broker acknowledges them.
+    // (Safe to call from the MATE bus task)
+    bool congested();
+
+    // Publishes awaiting a PUBACK
+    size_t pending();
+};
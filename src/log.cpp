@@ -0,0 +1,207 @@
+#include "log.h"
+#include "metrics.h"
+
+#include <atomic>
+
+// process() never writes more than the UART has TX buffer space for, so it never blocks.
+// A record that doesn't fit is written in pieces, once at least this much space is free.
+#define LOG_TX_MIN_FREE (64)
+
+#define LOG_WORDS       (LOG_BUFFER_SIZE / 4)
+
+static_assert((LOG_WORDS & (LOG_WORDS - 1)) == 0, "LOG_BUFFER_SIZE must be a power of two");
+static_assert(LOG_MAX_RECORD <= 0xFF, "LOG_MAX_RECORD must fit the binary record length");
+
+// Record header word: written last by the producer, so the consumer never sees a partial record
+static const uint32_t HDR_READY     = 0x80000000;
+static const uint32_t HDR_BINARY    = 0x00010000;
+static const uint32_t HDR_LEN_MASK  = 0x0000FFFF;
+
+static Metric m_log_dropped("log_dropped");
+
+// Multi-producer / single-consumer ring of 32-bit words.
+// Producers (any task) claim space by advancing head with a CAS, fill it in,
+// then set the READY header. The consumer (Log::process) stops at the first
+// record that isn't ready yet, and zeroes what it has written before releasing it.
+static std::atomic<uint32_t> words[LOG_WORDS];
+static std::atomic<uint32_t> head(0);
+static std::atomic<uint32_t> tail(0);
+
+static Stream* out = nullptr;
+static bool deferred = false;
+static size_t written = 0;  // Bytes of the oldest record already written (only used by the consumer)
+
+static inline uint32_t recordWords(uint32_t len)
+{
+    return 1 + ((len + 3) / 4);
+}
+
+static bool append(const uint8_t* data, size_t size, uint32_t type)
+{
+    uint32_t n = recordWords(size);
+    uint32_t h = head.load(std::memory_order_relaxed);
+    do {
+        if ((h + n - tail.load(std::memory_order_acquire)) > LOG_WORDS) {
+            m_log_dropped.add();
+            return false;
+        }
+    } while (!head.compare_exchange_weak(h, h + n, std::memory_order_acquire, std::memory_order_relaxed));
+
+    for (uint32_t i = 0; i < (n - 1); i++) {
+        uint32_t w = 0;
+        for (uint32_t b = 0; b < 4; b++) {
+            size_t pos = (i * 4) + b;
+            if (pos < size) {
+                w |= static_cast<uint32_t>(data[pos]) << (b * 8);
+            }
+        }
+        words[(h + 1 + i) & (LOG_WORDS - 1)].store(w, std::memory_order_relaxed);
+    }
+
+    words[h & (LOG_WORDS - 1)].store(HDR_READY | type | static_cast<uint32_t>(size), std::memory_order_release);
+    return true;
+}
+
+// Write the oldest record if it is ready (and the output has room, unless blocking).
+// Returns false if there was nothing that could be written.
+static bool writeRecord(bool blocking)
+{
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire))
+        return false;
+
+    uint32_t hdr = words[t & (LOG_WORDS - 1)].load(std::memory_order_acquire);
+    if (!(hdr & HDR_READY))
+        return false; // Still being written
+
+    uint32_t len = hdr & HDR_LEN_MASK;
+    uint32_t n = recordWords(len);
+
+    size_t needed = len + ((hdr & HDR_BINARY) ? 2 : 0) - written;
+    size_t space = needed;
+    if (!blocking) {
+        int avail = out->availableForWrite();
+        if ((avail < static_cast<int>(needed)) && (avail < LOG_TX_MIN_FREE))
+            return false;
+        if (avail < static_cast<int>(needed))
+            space = static_cast<size_t>(avail);
+    }
+
+    uint8_t buf[LOG_MAX_RECORD];
+    size_t pos = 0;
+    if (hdr & HDR_BINARY) {
+        buf[pos++] = LOG_BINARY_MARKER;
+        buf[pos++] = static_cast<uint8_t>(len);
+    }
+    for (uint32_t i = 0; i < (n - 1); i++) {
+        uint32_t w = words[(t + 1 + i) & (LOG_WORDS - 1)].load(std::memory_order_relaxed);
+        for (uint32_t b = 0; (b < 4) && (((i * 4) + b) < len); b++) {
+            buf[pos++] = static_cast<uint8_t>(w >> (b * 8));
+        }
+    }
+
+    out->write(&buf[written], space);
+    if (space < needed) {
+        written += space;
+        return false;   // The rest is written once there is room
+    }
+    written = 0;
+
+    // Stale data must never look like a READY header to a later record
+    for (uint32_t i = 0; i < n; i++) {
+        words[(t + i) & (LOG_WORDS - 1)].store(0, std::memory_order_relaxed);
+    }
+    tail.store(t + n, std::memory_order_release);
+    return true;
+}
+
+namespace Log {
+
+void setup(Stream& stream)
+{
+    out = &stream;
+}
+
+void defer(bool enable)
+{
+    deferred = enable;
+    if (!enable) {
+        flush();
+    }
+}
+
+void process()
+{
+    if (out == nullptr)
+        return;
+
+    while (writeRecord(false)) { }
+}
+
+void flush()
+{
+    if (out == nullptr)
+        return;
+
+    while (writeRecord(true)) { }
+    out->flush();
+}
+
+bool write(const uint8_t* data, size_t size)
+{
+    // Split long writes, so any record fits in the consumer's buffer
+    while (size > 0) {
+        size_t chunk = (size < LOG_MAX_RECORD) ? size : LOG_MAX_RECORD;
+        if (!append(data, chunk, 0))
+            return false;
+        data += chunk;
+        size -= chunk;
+    }
+
+    if (!deferred) {
+        flush();
+    }
+    return true;
+}
+
+bool writeBinary(const uint8_t* data, size_t size)
+{
+    if (!append(data, size, HDR_BINARY))
+        return false;
+
+    if (!deferred) {
+        flush();
+    }
+    return true;
+}
+
+void printf(const char* fmt, ...)
+{
+    char line[LOG_MAX_RECORD];
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line) - 2, fmt, args);
+    va_end(args);
+
+    if (len < 0)
+        return;
+    if (len > static_cast<int>(sizeof(line) - 3))
+        len = sizeof(line) - 3;  // Truncated
+
+    line[len++] = '\r';
+    line[len++] = '\n';
+    write(reinterpret_cast<const uint8_t*>(line), len);
+}
+
+uint32_t dropped()
+{
+    return m_log_dropped.get();
+}
+
+size_t pending()
+{
+    return (head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire)) * 4;
+}
+
+};
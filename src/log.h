@@ -0,0 +1,204 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdarg.h>
+#include <type_traits>
+
+// Deferred logging.
+//
+// Log output is appended to a lock-free RAM ring buffer, and only written to the
+// serial port by Log::process() when the network loop has time to spare, so a log
+// line never blocks the MATE bus or network on the 115200 baud UART.
+// Debug (the Stream used throughout the firmware) writes into the same buffer.
+//
+// LOG_ERROR/LOG_WARN/LOG_INFO/LOG_DEBUG take printf-style arguments, and are
+// compiled out entirely above LOG_LEVEL.
+//
+// With LOG_BINARY, LOG_* calls store a compact record instead of formatted text:
+// a hash of the format string plus the raw arguments. Formatting is done on the host
+// by tools/log-decode.py, which finds the format strings in the source.
+// Binary records are sent as: 0x1E, length (u8), format id (u32), then for each
+// argument a type tag (LogArg) followed by its value (little-endian).
+
+#define LOG_LEVEL_NONE  (0)
+#define LOG_LEVEL_ERROR (1)
+#define LOG_LEVEL_WARN  (2)
+#define LOG_LEVEL_INFO  (3)
+#define LOG_LEVEL_DEBUG (4)
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Ring buffer size in bytes. Must be a power of two.
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE (4096)
+#endif
+
+// Longest single record. Longer writes to Debug are split, longer LOG_* lines are truncated.
+#define LOG_MAX_RECORD (128)
+
+// Marks the start of a binary record in the serial output (ASCII record separator)
+#define LOG_BINARY_MARKER (0x1E)
+
+enum class LogArg : uint8_t {
+    Int32   = 'i',
+    Uint32  = 'u',
+    Int64   = 'q',
+    Uint64  = 'Q',
+    Float   = 'f',
+    String  = 's',  // u8 length, then the characters (truncated to fit the record)
+    Char    = 'c',
+};
+
+namespace Log
+{
+    // Serial port the buffered log is written to
+    void setup(Stream& out);
+
+    // Until enabled, output is written out immediately (eg. during startup,
+    // which logs more than the buffer holds).
+    void defer(bool enable);
+
+    // Write buffered records, as long as the output can take them without blocking
+    void process();
+
+    // Write everything that's buffered, blocking if necessary (eg. before a restart)
+    void flush();
+
+    // Append raw text. Returns false (and counts a drop) if the buffer is full.
+    bool write(const uint8_t* data, size_t size);
+
+    // Append a formatted text line
+    void printf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+    // Records lost because the buffer was full
+    uint32_t dropped();
+
+    // Bytes waiting to be written
+    size_t pending();
+
+    // Append a binary record (see LOG_BINARY)
+    bool writeBinary(const uint8_t* data, size_t size);
+
+    // FNV-1a hash of a format string, used as its id in binary records
+    constexpr uint32_t formatId(const char* s, uint32_t hash = 2166136261u)
+    {
+        return (*s == '\0') ? hash : formatId(s + 1, (hash ^ static_cast<uint8_t>(*s)) * 16777619u);
+    }
+
+    // Builds a binary record
+    class BinaryRecord {
+    public:
+        explicit BinaryRecord(uint32_t id) : len(0) {
+            put(&id, sizeof(id));
+        }
+
+        void arg(int v)                 { tag(LogArg::Int32);  put32(static_cast<uint32_t>(v)); }
+        void arg(unsigned int v)        { tag(LogArg::Uint32); put32(v); }
+        void arg(long v)                { arg(static_cast<long long>(v)); }
+        void arg(unsigned long v)       { arg(static_cast<unsigned long long>(v)); }
+        void arg(long long v)           { tag(LogArg::Int64);  put64(static_cast<uint64_t>(v)); }
+        void arg(unsigned long long v)  { tag(LogArg::Uint64); put64(v); }
+        void arg(double v)              { float f = static_cast<float>(v); uint32_t u; memcpy(&u, &f, sizeof(u)); tag(LogArg::Float); put32(u); }
+        void arg(char v)                { tag(LogArg::Char); put(&v, 1); }
+        void arg(bool v)                { arg(static_cast<int>(v)); }
+        void arg(const String& v)       { arg(v.c_str()); }
+        void arg(const char* v) {
+            size_t n = (v != nullptr) ? strlen(v) : 0;
+            size_t space = (len + 2 < sizeof(buf)) ? (sizeof(buf) - len - 2) : 0;
+            uint8_t n8 = static_cast<uint8_t>((n < space) ? n : space);
+            tag(LogArg::String);
+            put(&n8, 1);
+            put(v, n8);
+        }
+
+        const uint8_t* data() const { return buf; }
+        size_t size() const { return len; }
+
+    private:
+        void tag(LogArg t) { uint8_t b = static_cast<uint8_t>(t); put(&b, 1); }
+        void put32(uint32_t v) {
+            uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+            put(b, sizeof(b));
+        }
+        void put64(uint64_t v) {
+            put32(static_cast<uint32_t>(v));
+            put32(static_cast<uint32_t>(v >> 32));
+        }
+        void put(const void* p, size_t n) {
+            if ((len + n) <= sizeof(buf)) {
+                memcpy(&buf[len], p, n);
+                len += n;
+            }
+        }
+
+        uint8_t buf[LOG_MAX_RECORD - 2];    // Less the marker & length
+        size_t len;
+    };
+
+    inline void encodeArgs(BinaryRecord& r) { }
+
+    template<typename T, typename... Rest>
+    inline void encodeArgs(BinaryRecord& r, T value, Rest... rest)
+    {
+        r.arg(value);
+        encodeArgs(r, rest...);
+    }
+
+    template<typename... Args>
+    inline void binary(uint32_t id, Args... args)
+    {
+        BinaryRecord r(id);
+        encodeArgs(r, args...);
+        writeBinary(r.data(), r.size());
+    }
+};
+
+// Stream that writes into the log buffer (reads come from the underlying serial port)
+class LogStream : public Stream {
+public:
+    LogStream() : m_out(nullptr) { }
+
+    void begin(Stream& out) { m_out = &out; }
+
+    size_t write(uint8_t c) override { return Log::write(&c, 1) ? 1 : 0; }
+    size_t write(const uint8_t* buffer, size_t size) override { return Log::write(buffer, size) ? size : 0; }
+    int available() override { return (m_out != nullptr) ? m_out->available() : 0; }
+    int read() override { return (m_out != nullptr) ? m_out->read() : -1; }
+    int peek() override { return (m_out != nullptr) ? m_out->peek() : -1; }
+    void flush() override { Log::flush(); }
+
+private:
+    Stream* m_out;
+};
+
+#ifdef LOG_BINARY
+#define LOG_RECORD(fmt, ...) Log::binary(std::integral_constant<uint32_t, Log::formatId(fmt)>::value, ##__VA_ARGS__)
+#else
+#define LOG_RECORD(fmt, ...) Log::printf(fmt, ##__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(fmt, ...) LOG_RECORD("ERROR: " fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...) do { } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(fmt, ...) LOG_RECORD("WARNING: " fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARN(fmt, ...) do { } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(fmt, ...) LOG_RECORD(fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...) do { } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(fmt, ...) LOG_RECORD(fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...) do { } while (0)
+#endif
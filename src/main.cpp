@@ -1,6 +1,5 @@
 
 #include <Arduino.h>
-#include <WiFiClientSecure.h>
 //#include <TelnetSpy.h>
 #include <ArduinoOTA.h>
 #include <Serial9b.h>
@@ -12,12 +11,25 @@
 #include "mate.h"
 #include "mqtt.h"
 #include "mate-collector.h"
-
-const char* ntpServer1 = "pool.ntp.org";
+#include "outbox.h"
+#include "batcher.h"
+#include "connection.h"
+#include "network.h"
+#include "buffered-client.h"
+#include "tls-client.h"
+#include "topic-alias.h"
+#include "rollup.h"
+#include "energy.h"
+#include "metrics.h"
+#include "rtos.h"
+#include "log.h"
 
 // Debugging is available at port 23 (raw connection)
 //static TelnetSpy telnet;
-Stream& Debug = Serial;//telnet;
+
+// Debug output is buffered, and written to Serial from Network::loop()/idle_loop()
+static LogStream log_stream;
+Stream& Debug = log_stream;//telnet;
 
 // Generated by version.py
 extern const char* GEN_BUILD_VERSION;
@@ -30,8 +42,9 @@ static boolean m_ota_initialized = false;
 SoftwareSerial Serial9b;
 
 //WiFiClient                  net;
-WiFiClientSecure            net;
-PubSubClient                Mqtt::client(net);
+TlsClient                   net;                // Resumes the previous TLS session when reconnecting
+BufferedClient              buffered_net(net);  // Coalesces each cycle's publishes into fewer TLS records
+PubSubClient                Mqtt::client(buffered_net);
 ComponentContext            Mqtt::context(Mqtt::client);
 HAAvailabilityComponent     availability(Mqtt::context);
 MatePubContext              mate_context(Mqtt::client);
@@ -44,10 +57,23 @@ MatePubContext              mate_context(Mqtt::client);
 #define MATE_TX (5)
 #define MATE_RX (18)
 
+#ifdef MODE_DUAL_CORE
+// The MATE bus runs on the application core, away from the WiFi/lwIP stack,
+// so TLS handshakes & reconnects don't add jitter to the bit-banged Serial9b timing.
+#define MATE_TASK_CORE      (rtos::CORE_APP)
+#define MATE_TASK_PRIORITY  (3)
+#define MATE_TASK_STACK     (8192)
+
+#define NET_TASK_CORE       (rtos::CORE_PRO)
+#define NET_TASK_PRIORITY   (1)
+#define NET_TASK_STACK      (16384)
+#endif
+
 
 void fault()
 {
     Debug.println("HALTED.");
+    Log::flush();
     delay(5000);
     ESP.restart();
     while (true) continue;
@@ -62,101 +88,6 @@ void fault()
 }
 
 
-void printWiFiStatus(wl_status_t status) {
-    switch (status) {
-        case WL_CONNECTED:
-            Debug.println("Connected!");
-            break;
-        case WL_NO_SSID_AVAIL:
-            // Bad SSID or AP not present
-            Debug.println("No SSID Available");
-            break;
-        case WL_CONNECT_FAILED:
-            // Bad password
-            Debug.println("Failed to connect");
-            break;
-        case WL_IDLE_STATUS:
-            Debug.println("Station Idle");
-            break;
-        case WL_CONNECTION_LOST:
-            Debug.println("Connection lost");
-            break;
-        default:
-            Debug.println(status, HEX);
-    }
-}
-
-#ifdef MODE_WIFI
-void connectWiFi()
-{
-    wl_status_t result;
-
-    WiFi.persistent(false);
-
-    while (WiFi.status() != WL_CONNECTED) {
-        Debug.println();
-
-        WiFi.mode(WIFI_STA);
-        WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
-        WiFi.setHostname(secrets::device_name);
-        WiFi.begin(secrets::wifi_ssid, secrets::wifi_pw);
-        Debug.print("Connecting to SSID: "); Debug.println(secrets::wifi_ssid);
-
-        result = (wl_status_t)WiFi.waitForConnectResult();
-        if (result != WL_CONNECTED) {
-            Debug.print("Error connecting: "); printWiFiStatus(result);
-
-            Debug.println("Diagnostics:");
-            WiFi.printDiag(Serial);
-            Debug.println();
-
-            delay(1000);
-        }
-    }
-
-    Debug.print("IP address: ");
-    Debug.println(WiFi.localIP());
-}
-#endif
-
-#ifdef MODE_ETH
-void connectLan()
-{
-    Debug.println();
-    Debug.println("Connecting to LAN...");
-
-    //ETH.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
-    ETH.begin();
-    ETH.setHostname(secrets::device_name);
-
-    while (!ETH.linkUp())
-        continue;
-    while (static_cast<uint32_t>(ETH.localIP()) == 0)
-        continue;
-    
-    Debug.print("IP address: ");
-    Debug.println(ETH.localIP());
-
-    Debug.print("Gateway:    ");
-    Debug.println(ETH.gatewayIP());
-}
-#endif
-
-void connectNtp()
-{
-    configTime(0, 0, ntpServer1);
-
-    Debug.println("Current time (UTC):");
-
-    struct tm timeinfo;
-    if (getLocalTime(&timeinfo)) {
-        Serial.println(&timeinfo, "%Y-%m-%d %H:%M:%S");
-    }
-    else {
-        Debug.println("<error>");
-    }
-}
-
 void setupOTA()
 {
     ArduinoOTA.setHostname(secrets::device_name);
@@ -223,15 +154,46 @@ void setupOTA()
     m_ota_initialized = true;
 }
 
-void publish() {
-    // Publish entities to Home-Assistant
-    availability.PublishConfig();
-    availability.Connect();
+// OTA is started once the network first comes up
+void onNetworkUp() {
+    if (!m_ota_initialized) {
+        setupOTA();
+    }
+
+    //telnet.handle();
+    ArduinoOTA.handle();
+}
+
+#ifdef MODE_DUAL_CORE
+void mateTask(void* arg) {
+    while (true) {
+        MateAggregator::loop();
+        rtos::delayMs(1); // Let lower priority tasks on this core run
+    }
+}
+
+void networkTask(void* arg) {
+    while (true) {
+        Network::loop();
+        rtos::delayMs(1);
+    }
 }
 
+void startTasks() {
+    if (!rtos::createPinnedTask(mateTask, "mate", MATE_TASK_STACK, nullptr, MATE_TASK_PRIORITY, MATE_TASK_CORE) ||
+        !rtos::createPinnedTask(networkTask, "net", NET_TASK_STACK, nullptr, NET_TASK_PRIORITY, NET_TASK_CORE))
+    {
+        Debug.println("ERROR: Could not create tasks");
+        fault();
+    }
+}
+#endif
+
 void setup()
 {
     Serial.begin(115200);
+    Log::setup(Serial);
+    log_stream.begin(Serial);
 
     Debug.println();
 
@@ -269,79 +231,65 @@ void setup()
 
     mate_context.device_name    = secrets::device_name;
     mate_context.prefix         = secrets::device_name; // MQTT topic prefix for publishing MATE data
+    mate_context.boot           = static_cast<uint16_t>(esp_random()); // Random per-boot ID, so subscribers can tell a reboot from a sequence gap
+#ifdef MATE_LEGACY_TOPICS
+    mate_context.schema         = TopicSchema::Legacy;  // Also publish deprecated stat/raw & stat/ts topics
+#endif
 
     // Initialize all HA components
     // IMPORTANT: Mqtt::context must be initialized first!
     HACompItem::InitializeAll();
 
-/// Initialization done, connect to network ///
-
-    // Connect to network (blocks until connection formed)
-#ifdef MODE_WIFI
-    connectWiFi();
-    Debug.println();
-#endif
-#ifdef MODE_ETH
-    connectLan();
-    Debug.println();
-#endif
-
-    setupOTA();
+    // Store-and-forward buffer for frames published while disconnected
+    Outbox::setup();
+    Batcher::setup(mate_context.prefix);
+    TopicAlias::setup(mate_context.prefix);
+    Rollup::setup(mate_context.prefix);
+    Energy::setup();    // Saved counters, before any devices are found
 
-    // Configure NTP server (GMT timezone)
-    // Required before we can validate SSL
-    connectNtp();
-    Debug.println();
+/// Initialization done, start connecting to network ///
 
     // Set up SSL
     net.setCACert(secrets::ca_root_cert);
     //net.setInsecure();
 
-    // Connect to MQTT (blocks until connection formed)
+    // The connection is brought up in the background by Network::loop()
     Mqtt::setup(secrets::mqtt_server, secrets::mqtt_port);
-    Mqtt::connect();
-
-    publish();
+    Connection::setup(buffered_net, net, secrets::mqtt_server, secrets::mqtt_port);
+    Network::setup(buffered_net, availability, nullptr, onNetworkUp);
+    Metrics::setup(secrets::device_name);
     Debug.println();
 
-/// Connected to network, set up devices ///
+/// Set up devices ///
 
-    // Discover MATE devices
+    // Discover MATE devices.
+    // Anything published before the network is up is held in the Outbox.
     MateAggregator::setup();
     Debug.println();
+
+    // From here on, log output is only written when the network loop has time
+    Log::defer(true);
+
+#ifdef MODE_DUAL_CORE
+    startTasks();
+#endif
 }
 
 void idle_loop() {
     //Led::Process();
     ArduinoOTA.handle();
+    Log::process();
     yield();
 }
 
 void loop() {
-#ifdef MODE_ETH
-    // Only process network tasks if ethernet is connected.
-    if (ETH.linkUp())
-#endif
-    {
-        //telnet.handle();
-        ArduinoOTA.handle();
-
-        bool reconnected = Mqtt::process();
-        if (reconnected) {
-            publish(); // Re-publish entity config
-            Debug.println();
-        }
-    }
-
-#ifdef MODE_WIFI
-    if (WiFi.status() != WL_CONNECTED) {
-        Debug.println("Disconnected from WiFi");
-        connectWiFi();
-        Debug.println();
-    }
-#endif
-
+#ifdef MODE_DUAL_CORE
+    // All work is done by mateTask & networkTask, the Arduino loop task is not needed.
+    rtos::exitTask();
+#else
+    Network::loop();
     MateAggregator::loop();
+#endif
 }
 
 void __assert(const char * a, int b, const char * c) {
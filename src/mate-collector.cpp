@@ -1,6 +1,16 @@
 #include <type_traits>
+#include <sys/time.h>
 #include "mate-collector.h"
 #include "debug.h"
+#include "frame-queue.h"
+#include "batcher.h"
+#include "connection.h"
+#include "topic-alias.h"
+#include "outbox.h"
+#include "metrics.h"
+#include "bus-stats.h"
+#include "mate-sensors.h"
+#include "rollup.h"
 
 //static_assert(sizeof(MxCollector) <= sizeof(MateCollector), "sizeof(MxCollector) must be the same as parent class MateCollector");
 
@@ -13,6 +23,76 @@ const char* dtype_strings[] = {
     "dc"
 };
 
+// Messages/bytes not sent because the legacy stat/raw & stat/ts topics are disabled
+static Metric m_legacy_msgs_saved("legacy_msgs_saved");
+static Metric m_legacy_bytes_saved("legacy_bytes_saved");
+
+#ifdef MQTT_SHORT_TOPICS
+static Metric m_topic_bytes_saved("topic_bytes_saved");    // Topic bytes not sent thanks to short topics
+#endif
+
+#ifdef MATE_STATUS_DELTA
+static Metric m_status_keyframes("status_keyframes");
+static Metric m_status_deltas("status_deltas");
+static Metric m_status_unchanged("status_unchanged");      // Not published
+static Metric m_status_bytes_saved("status_bytes_saved");  // Payload bytes saved by deltas
+#endif
+
+bool MatePubContext::publish(const char* topic, const uint8_t* payload, size_t size, bool retained, uint8_t flags)
+{
+#ifdef MODE_DUAL_CORE
+    // Runs on the MATE bus task, so never block waiting for the network
+    if (!FrameQueue::push(topic, payload, size, retained, flags)) {
+        LOG_WARN("Frame queue full, dropped %s", topic);
+        return false;
+    }
+    return true;
+#else
+    if (flags & FRAME_BATCHABLE) {
+        MateFrame frame;
+        if (!frame.set(topic, payload, size, retained, flags))
+            return false;
+        return Batcher::publish(client, frame);
+    }
+
+    LOG_DEBUG("Publish: %s", topic);
+
+    // Stored for later if disconnected
+    return Outbox::publish(client, topic, payload, size, retained);
+#endif
+}
+
+bool MatePubContext::publishFrame(const char* topic, const MateWire::FrameHeader& hdr, const uint8_t* payload, size_t size)
+{
+#ifdef MODE_DUAL_CORE
+    if (!FrameQueue::pushFrame(topic, hdr, payload, size, FRAME_BATCHABLE)) {
+        LOG_WARN("Frame queue full, dropped %s", topic);
+        return false;
+    }
+    return true;
+#elif defined(MATE_BATCH)
+    MateFrame frame;
+    if (!frame.setFrame(topic, hdr, payload, size, FRAME_BATCHABLE))
+        return false;
+    return Batcher::publish(client, frame);
+#else
+    LOG_DEBUG("Publish: %s", topic);
+
+    return Outbox::publishFrame(client, topic, hdr, payload, size);
+#endif
+}
+
+void MatePubContext::endCycle()
+{
+#ifdef MODE_DUAL_CORE
+    // Tells the network task to flush the batch
+    FrameQueue::push("", nullptr, 0, false, FRAME_CYCLE_END);
+#else
+    Batcher::flush(client);
+    Connection::flush();
+#endif
+}
+
 void MateCollector::initialize()
 {
     DeviceType dtype = dev.deviceType();
@@ -20,8 +100,75 @@ void MateCollector::initialize()
 
     m_deviceCounts[dtype]++;
 
-    // Eg. 'mate/mx-1'
-    snprintf(m_prefix, sizeof(m_prefix), "%s/%s-%d", context.prefix, dtype_strings[dtype], m_deviceCounts[dtype]);
+    // Build every topic up front, so publishing never has to format one.
+    // Eg. 'mate/mx-1/mx-status'
+    const char* dtype_str = dtype_strings[dtype];
+    const int n = m_deviceCounts[dtype];
+    snprintf(m_topics[(size_t)MateTopic::Status],       MAX_TOPIC_LEN, "%s/%s-%d/%s-status",  context.prefix, dtype_str, n, dtype_str);
+    snprintf(m_topics[(size_t)MateTopic::LogPage],      MAX_TOPIC_LEN, "%s/%s-%d/%s-logpage", context.prefix, dtype_str, n, dtype_str);
+    snprintf(m_topics[(size_t)MateTopic::Diagnostics],  MAX_TOPIC_LEN, "%s/%s-%d/diag",       context.prefix, dtype_str, n);
+    snprintf(m_topics[(size_t)MateTopic::Availability], MAX_TOPIC_LEN, "%s/%s-%d/status",     context.prefix, dtype_str, n);
+    snprintf(m_topics[(size_t)MateTopic::Port],         MAX_TOPIC_LEN, "%s/%s-%d/port",       context.prefix, dtype_str, n);
+    snprintf(m_topics[(size_t)MateTopic::Revision],     MAX_TOPIC_LEN, "%s/%s-%d/rev",        context.prefix, dtype_str, n);
+#ifdef MATE_LEGACY_TOPICS
+    snprintf(m_topics[(size_t)MateTopic::LegacyRaw],    MAX_TOPIC_LEN, "%s/%s-%d/stat/raw",   context.prefix, dtype_str, n);
+    snprintf(m_topics[(size_t)MateTopic::LegacyTs],     MAX_TOPIC_LEN, "%s/%s-%d/stat/ts",    context.prefix, dtype_str, n);
+#endif
+
+#ifdef MATE_ROLLUP
+    static_assert(((size_t)MateTopic::Rollup2 - (size_t)MateTopic::Rollup1 + 1) == ROLLUP_TIERS, "One rollup topic per tier");
+    for (size_t tier = 0; tier < ROLLUP_TIERS; tier++) {
+        // Eg. 'mate/mx-1/rollup-15m'
+        uint16_t period = Rollup::period(tier);
+        snprintf(m_topics[(size_t)MateTopic::Rollup1 + tier], MAX_TOPIC_LEN, "%s/%s-%d/rollup-%u%s", context.prefix, dtype_str, n,
+            (period % 60) ? period : (period / 60), (period % 60) ? "s" : "m");
+    }
+#endif
+
+#ifdef MQTT_SHORT_TOPICS
+    // Frames are published often enough for the topic length to matter.
+    // Aliases are named after the port (eg. 'mx3s'), which is set by the time the collector is created.
+    static const MateTopic aliased[] = { MateTopic::Status, MateTopic::LogPage, MateTopic::Diagnostics };
+    static const char alias_suffix[] = { 's', 'l', 'd' };
+    memset(m_topicSaved, 0, sizeof(m_topicSaved));
+    for (size_t i = 0; i < (sizeof(aliased) / sizeof(aliased[0])); i++) {
+        MateTopic t = aliased[i];
+        char* full = m_topics[(size_t)t];
+        char key[TOPIC_ALIAS_KEY_LEN];
+        char alias[MAX_TOPIC_LEN];
+        snprintf(key, sizeof(key), "%s%u%c", dtype_str, (unsigned)dev.port(), alias_suffix[i]);
+        if (TopicAlias::add(full, key, alias, sizeof(alias))) {
+            m_topicSaved[(size_t)t] = static_cast<uint8_t>(strlen(full) - strlen(alias));
+            strcpy(full, alias);
+        }
+    }
+#endif
+
+#ifdef MATE_HA_SENSORS
+    // Eg. 'mx1' (mate_mx1_bat_voltage)
+    char label[8];
+    snprintf(label, sizeof(label), "%s%d", dtype_str, n);
+    m_sensors = MateSensors::addDevice(static_cast<MateWire::DeviceType>(dtype), label);
+#endif
+
+#ifdef MATE_ENERGY
+    char energy_label[8];
+    snprintf(energy_label, sizeof(energy_label), "%s%d", dtype_str, n);
+    m_energy = Energy::addDevice(static_cast<MateWire::DeviceType>(dtype), energy_label);
+    m_tPrevSample = 0;
+#endif
+
+#ifdef MATE_ROLLUP
+    // The status topic is only used for replays, so may already be aliased
+    m_rollup = Rollup::addDevice(static_cast<MateWire::DeviceType>(dtype), dev.port(), topic(MateTopic::Status));
+#endif
+
+#ifdef MATE_STATUS_DELTA
+    m_keyframeSize = 0;
+    m_keyframeSeq = 0;
+    m_keyframeSession = 0;
+    m_cyclesSinceKeyframe = 0;
+#endif
 }
 
 void MateCollector::publishInfo()
@@ -41,61 +188,219 @@ void MateCollector::publishInfo()
 #else
     snprintf(payload, sizeof(payload), "%d", dev.port());
 #endif
-    publishTopic("port", payload, true); // Retained
+    publishTopic(MateTopic::Port, payload, true); // Retained
 
 #ifdef FAKE_MATE_DEVICES
     revision_t rev = {1,2,3};
 #else
-    revision_t rev = dev.get_revision();
+    revision_t rev;
+    BusStats::timed(dev.port(), TxnOp::Query, [&] { rev = dev.get_revision(); return true; });
 #endif
     snprintf(payload, sizeof(payload), "%d.%d.%d", rev.a, rev.b, rev.c);
-    publishTopic("rev", payload, true); // Retained
+    publishTopic(MateTopic::Revision, payload, true); // Retained
 
     ping(true);
 
-    // Future: (HAComponent)
-    // mate/mx-1/sensor/bat_voltage
-    // mate/mx-1/sensor/bat_current
-    // ...
+    // HA sensor entities (mate_mx1_bat_voltage, ...) are registered by MateSensors
+    // once the status has been read (only with MATE_HA_SENSORS)
+}
+
+void MateCollector::publishTopic(MateTopic t, const char* payload, bool retained)
+{
+    context.publish(topic(t), reinterpret_cast<const uint8_t*>(payload), strlen(payload), retained);
+}
+
+void MateCollector::publishTopic(MateTopic t, const uint8_t* payload, size_t payload_size, bool retained)
+{
+    context.publish(topic(t), payload, payload_size, retained);
 }
 
-void MateCollector::publishTopic(const char* topic_suffix, const char* payload, bool retained)
+void MateCollector::publishFrame(MateTopic t, MateWire::FrameType type, uint64_t timestamp_ms, const uint8_t* payload, size_t payload_size, uint8_t flags)
 {
-    char topic[MAX_TOPIC_LEN];
-    snprintf(topic, sizeof(topic), "%s/%s", m_prefix, topic_suffix);
+    if (MateWire::encodedSize(payload_size) > MAX_FRAME_PAYLOAD) {
+        LOG_ERROR("Frame too large");
+        return;
+    }
 
-    Debug.print("Publish: ");
-    Debug.print(topic);
-    Debug.println();
+    MateWire::FrameHeader hdr = {};
+    hdr.type            = type;
+    hdr.device_type     = static_cast<uint8_t>(dev.deviceType());
+    hdr.port            = dev.port();
+    hdr.flags           = flags;
+    hdr.seq             = m_seq++;
+    hdr.timestamp_ms    = timestamp_ms;
+    hdr.boot            = context.boot;
 
-    client.publish(topic, payload, retained);
+#ifdef MQTT_SHORT_TOPICS
+    m_topic_bytes_saved.add(m_topicSaved[(size_t)t]);
+#endif
+    context.publishFrame(topic(t), hdr, payload, payload_size);
 }
 
-void MateCollector::publishTopic(const char* topic_suffix, const uint8_t* payload, size_t payload_size, bool retained)
+void MateCollector::publishStatusFrame(uint64_t timestamp_ms, const uint8_t* status, size_t size)
 {
-    char topic[MAX_TOPIC_LEN];
-    snprintf(topic, sizeof(topic), "%s/%s", m_prefix, topic_suffix);
+#ifdef MATE_HA_SENSORS
+    MateSensors::update(m_sensors, status, size);
+#endif
 
-    Debug.print("Publish: ");
-    Debug.print(topic);
-    Debug.println();
+#ifdef MATE_ROLLUP
+    publishRollups(timestamp_ms, status, size);
+    return;
+#endif
+
+#ifdef MATE_STATUS_DELTA
+    assert(size <= MAX_STATUS_RESP_SIZE);
+
+    bool keyframe = (m_keyframeSize != size) ||
+                    (m_cyclesSinceKeyframe >= STATUS_KEYFRAME_INTERVAL) ||
+                    (m_keyframeSession != context.session);
+
+    if (!keyframe) {
+        m_cyclesSinceKeyframe++;
+
+        if (memcmp(status, m_lastStatus, size) == 0) {
+            m_status_unchanged.add();
+            return;
+        }
+
+        uint8_t delta[MAX_STATUS_RESP_SIZE];
+        size_t delta_size = MateWire::encodeDelta(delta, sizeof(delta), m_keyframeSeq, m_keyframe, status, size);
+        if ((delta_size > 0) && (delta_size < size)) {
+            publishFrame(MateTopic::Status, MateWire::FrameType::Status, timestamp_ms, delta, delta_size, MateWire::FLAG_DELTA);
+            memcpy(m_lastStatus, status, size);
+            m_status_deltas.add();
+            m_status_bytes_saved.add(size - delta_size);
+            return;
+        }
+        // Delta is no smaller than the status itself, send a new keyframe instead
+    }
+
+    m_keyframeSeq = m_seq;  // Sequence number of the frame about to be published
+    m_keyframeSize = static_cast<uint16_t>(size);
+    m_keyframeSession = context.session;
+    m_cyclesSinceKeyframe = 0;
+    memcpy(m_keyframe, status, size);
+    memcpy(m_lastStatus, status, size);
+    m_status_keyframes.add();
+#endif
+
+    publishFrame(MateTopic::Status, MateWire::FrameType::Status, timestamp_ms, status, size);
+}
+
+bool MateCollector::statusDue(uint32_t now, const PollRate& rate, uint32_t& tPrevStatus, uint32_t sample_ms)
+{
+    m_statusPublish = rate.due(now, tPrevStatus);
+#ifdef MATE_ENERGY
+    bool sample = (now - m_tPrevSample) >= sample_ms;
+#else
+    bool sample = false;
+#endif
+
+    if (!m_statusPublish && !sample)
+        return false;
+
+    if (m_statusPublish)
+        tPrevStatus = now;
+#ifdef MATE_ENERGY
+    m_tPrevSample = now;
+#endif
+    return true;
+}
+
+bool MateCollector::sampleStatus(const uint8_t* status, size_t size)
+{
+#ifdef MATE_ENERGY
+    Energy::sample(m_energy, status, size);
+#endif
+    return m_statusPublish;
+}
 
-    client.publish(topic, payload, payload_size, retained);
+#ifdef MATE_ROLLUP
+void MateCollector::publishRollups(uint64_t timestamp_ms, const uint8_t* status, size_t size)
+{
+    // Publish each tier's window once it is complete, eg. mate/mx-1/rollup-1m
+    uint8_t payload[MAX_FRAME_PAYLOAD - MateWire::OVERHEAD];
+    for (size_t tier = 0; tier < ROLLUP_TIERS; tier++) {
+        uint64_t start_ms;
+        size_t n = Rollup::roll(m_rollup, tier, timestamp_ms, payload, sizeof(payload), start_ms);
+        if (n > 0) {
+            publishFrame(static_cast<MateTopic>((size_t)MateTopic::Rollup1 + tier), MateWire::FrameType::Rollup, start_ms, payload, n);
+        }
+    }
+    Rollup::add(m_rollup, status, size);
+
+    // The status itself is only kept, to be replayed on request (numbered separately, see rollup.h)
+    Rollup::keep(m_rollup, timestamp_ms, status, size);
+}
+#endif
+
+void MateCollector::publishDiagnostics()
+{
+    // mate/mx-1/diag
+    uint64_t timestamp_ms;
+    if (!getTimestampMs(&timestamp_ms)) {
+        return; // Cannot publish.
+    }
+
+    uint8_t payload[MAX_FRAME_PAYLOAD - MateWire::OVERHEAD];
+    size_t size = BusStats::encode(dev.port(), payload, sizeof(payload));
+    if (size > 0) {
+        publishFrame(MateTopic::Diagnostics, MateWire::FrameType::Diagnostics, timestamp_ms, payload, size);
+    }
+}
+
+void MateCollector::publishLegacyStatus(uint64_t timestamp_ms, const uint8_t* status, size_t size)
+{
+    // mate/mx-1/stat/raw
+    // mate/mx-1/stat/ts
+
+    char ts_str[20];
+    snprintf(ts_str, sizeof(ts_str), "%lu", (unsigned long)(timestamp_ms / 1000));
+
+#ifdef MATE_LEGACY_TOPICS
+    if (context.schema == TopicSchema::Legacy) {
+        // TODO: Deprecate
+        publishTopic(MateTopic::LegacyRaw, status, size, false);
+        publishTopic(MateTopic::LegacyTs, ts_str, false);
+        return;
+    }
+#endif
+
+    // Account for what the legacy topics would have cost:
+    // MQTT fixed header (2) + topic length (2) + topic + payload
+    const size_t prefix_len = strlen(topic(MateTopic::Port)) - strlen("port");
+    m_legacy_msgs_saved.add(2);
+    m_legacy_bytes_saved.add(
+        (4 + prefix_len + strlen("stat/raw") + size) +
+        (4 + prefix_len + strlen("stat/ts") + strlen(ts_str)));
 }
 
 void MateCollector::ping(bool initial_publish)
 {
     // Check if device is still responding, and update status topic if needed.
     //bool is_connected       = dev.isConnected();
-    bool is_still_connected = dev.begin(dev.port());
+    bool is_still_connected = BusStats::timed(dev.port(), TxnOp::Begin, [&] { return dev.begin(dev.port()); });
     if ((is_still_connected != this->is_connected) || initial_publish) {
         this->is_connected = is_still_connected;
         if (!is_still_connected) {
-            Debug.println("Device disconnected");
-            publishTopic("status", "offline", true); // Retained
+            LOG_INFO("Device disconnected");
+            publishTopic(MateTopic::Availability, "offline", true); // Retained
         } else {
-            Debug.println("Device connected");
-            publishTopic("status", "online", true); // Retained
+            LOG_INFO("Device connected");
+            publishTopic(MateTopic::Availability, "online", true); // Retained
         }
     }
-}
\ No newline at end of file
+}
+
+bool getTimestampMs(uint64_t* timestamp_ms)
+{
+    struct tm timeinfo;
+    if (!getLocalTime(&timeinfo, 0)) {
+        return false; // Time not yet set
+    }
+
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    *timestamp_ms = (static_cast<uint64_t>(tv.tv_sec) * 1000) + (tv.tv_usec / 1000);
+    return true;
+}
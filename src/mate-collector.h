@@ -2,24 +2,84 @@
 
 #include <PubSubClient.h>
 #include <uMate.h>
+#include <matewire.h>
 #include <time.h>
+#include <atomic>
 
 #include "debug.h"
+#include "mate-scheduler.h"
+#include "mate-frame.h"
+#include "poll-rate.h"
+#include "energy.h"
 
-#define MAX_TOPIC_LEN (40)
+// A DC status packet consists of 6 individual status packets
+#define DC_STATUS_PAGE_FIRST (0x0A)
+#define DC_STATUS_PAGE_LAST  (0x0F)
+#define DC_STATUS_RESP_SIZE (STATUS_RESP_SIZE * 6)
+
+// Largest status payload published by any collector
+#define MAX_STATUS_RESP_SIZE (DC_STATUS_RESP_SIZE)
+
+// With MATE_STATUS_DELTA, unchanged status is not published and changed status is
+// sent as a delta against the last keyframe. A full keyframe is still published
+// at least this often (in collection cycles), and after reconnecting.
+#define STATUS_KEYFRAME_INTERVAL (30)
+
+// Topic layout used for status data
+enum class TopicSchema : uint8_t {
+    Single,     // One frame per device per cycle (<dev>-status)
+#ifdef MATE_LEGACY_TOPICS
+    Legacy,     // Also publish the deprecated stat/raw & stat/ts topics
+#endif
+};
+
+// Topics published by each collector, built once in MateCollector::initialize()
+enum class MateTopic : uint8_t {
+    Status,         // <prefix>/mx-1/mx-status
+    LogPage,        // <prefix>/mx-1/mx-logpage
+    Diagnostics,    // <prefix>/mx-1/diag
+    Availability,   // <prefix>/mx-1/status
+    Port,           // <prefix>/mx-1/port
+    Revision,       // <prefix>/mx-1/rev
+#ifdef MATE_LEGACY_TOPICS
+    LegacyRaw,      // <prefix>/mx-1/stat/raw
+    LegacyTs,       // <prefix>/mx-1/stat/ts
+#endif
+#ifdef MATE_ROLLUP
+    Rollup1,        // <prefix>/mx-1/rollup-1m (one per tier, see rollup.h)
+    Rollup2,        // <prefix>/mx-1/rollup-15m
+#endif
+    MaxTopics
+};
 
 class MatePubContext {
 public:
     MatePubContext(PubSubClient& client)
         : client(client)
+        , schema(TopicSchema::Single)
+        , session(0)
+        , boot(0)
     { }
 
+    // Publish directly, or hand off to the network task when running in MODE_DUAL_CORE
+    bool publish(const char* topic, const uint8_t* payload, size_t size, bool retained, uint8_t flags = FRAME_FLAG_NONE);
+
+    // Publish a MateWire frame. Encoded directly into its destination (the MQTT packet,
+    // batch, outbox or queue for the network task), so the frame is never copied.
+    bool publishFrame(const char* topic, const MateWire::FrameHeader& hdr, const uint8_t* payload, size_t size);
+
+    // Called once all collectors have finished a collection cycle (flushes any batched frames)
+    void endCycle();
+
     PubSubClient& client;
     const char* prefix;         // eg. 'mate'
     const char* device_name;    // eg. 'mate'
+    TopicSchema schema;
+    std::atomic<uint32_t> session;  // Incremented for each new MQTT session
+    uint16_t boot;              // Boot ID written into every frame, chosen at random in setup()
 };
 
-class MateCollector {
+class MateCollector : public MateTransactionHandler {
 public:
     MateCollector(MateControllerDevice& dev, MatePubContext& context)
         : dev(dev)
@@ -27,48 +87,115 @@ public:
         , client(context.client)
         , m_deviceCounts{0}
         , is_connected(false)
+        , m_seq(0)
+        , m_statusPublish(true)
     {
         initialize();
     }
 
     void publishInfo();
 
+    // Publish bus statistics for this device since the last call (see BusStats)
+    void publishDiagnostics();
+
+    // Queue any bus transactions that are due. Must not block on the bus.
     virtual void process(uint32_t now)
     { }
 
+    void onTransactionComplete(MateTransaction& txn, bool success) override
+    { }
+
     MateControllerDevice& dev;
 
 protected:
     void initialize();
 
-    void publishTopic(const char* topic_suffix, const char* payload, bool retained);
-    void publishTopic(const char* topic_suffix, const uint8_t* payload, size_t payload_size, bool retained);
+    const char* topic(MateTopic t) const
+    {
+        return m_topics[static_cast<size_t>(t)];
+    }
+
+    void publishTopic(MateTopic t, const char* payload, bool retained);
+    void publishTopic(MateTopic t, const uint8_t* payload, size_t payload_size, bool retained);
+    void publishFrame(MateTopic t, MateWire::FrameType type, uint64_t timestamp_ms, const uint8_t* payload, size_t payload_size, uint8_t flags = MateWire::FLAG_NONE);
+    void publishStatusFrame(uint64_t timestamp_ms, const uint8_t* status, size_t size);
+
+    // Whether to read the status now: when the adaptive poll rate is due, or with MATE_ENERGY,
+    // every sample_ms for the energy counters. Sets m_statusPublish if it is to be published.
+    bool statusDue(uint32_t now, const PollRate& rate, uint32_t& tPrevStatus, uint32_t sample_ms);
+
+    // Feed a status read to the energy counters.
+    // Returns false if the read was only an energy sample, and shouldn't be published.
+    bool sampleStatus(const uint8_t* status, size_t size);
+    void publishLegacyStatus(uint64_t timestamp_ms, const uint8_t* status, size_t size);
+#ifdef MATE_ROLLUP
+    void publishRollups(uint64_t timestamp_ms, const uint8_t* status, size_t size);
+#endif
     void ping(bool initial_publish);
 
 protected:
     MatePubContext& context;
     PubSubClient& client;
 
-    char m_prefix[MAX_TOPIC_LEN];
+    char m_topics[static_cast<size_t>(MateTopic::MaxTopics)][MAX_TOPIC_LEN];
+#ifdef MQTT_SHORT_TOPICS
+    uint8_t m_topicSaved[static_cast<size_t>(MateTopic::MaxTopics)];    // Bytes saved per message by the alias
+#endif
+#ifdef MATE_HA_SENSORS
+    int m_sensors;      // MateSensors handle
+#endif
+#ifdef MATE_ROLLUP
+    int m_rollup;       // Rollup handle
+#endif
     std::array<uint8_t, (size_t)DeviceType::MaxDevices> m_deviceCounts;
     bool is_connected;
+    uint32_t m_seq;     // Frame sequence number, so the server can detect dropped frames
+    bool m_statusPublish;   // The status being read is to be published (see statusDue())
+#ifdef MATE_ENERGY
+    int m_energy;       // Energy handle
+    uint32_t m_tPrevSample;
+#endif
+
+#ifdef MATE_STATUS_DELTA
+    uint8_t  m_keyframe[MAX_STATUS_RESP_SIZE];
+    uint8_t  m_lastStatus[MAX_STATUS_RESP_SIZE];
+    uint16_t m_keyframeSize;            // 0 until the first keyframe is published
+    uint32_t m_keyframeSeq;
+    uint32_t m_keyframeSession;
+    uint16_t m_cyclesSinceKeyframe;
+#endif
 };
 
+// Current time in ms since the Unix epoch.
+// Returns false if the time has not yet been set (by NTP).
+bool getTimestampMs(uint64_t* timestamp_ms);
+
 class FxCollector : public MateCollector
 {
 public:
     FxCollector(MateControllerDevice& dev, MatePubContext& context)
         : MateCollector(dev, context)
+        , statusRate(statusMinIntervalMs, statusIntervalMs, statusMaxIntervalMs, MateWire::statusLayout(MateWire::DeviceType::Fx))
         , tPrevStatus(0)
+        , statusPending(false)
+        , status{0}
     { }
 
     void process(uint32_t now) override;
+    void onTransactionComplete(MateTransaction& txn, bool success) override;
+
+    // Status poll interval adapts between min & max, depending on how often the status changes
+    static const uint32_t statusMinIntervalMs = 10000; //ms
+    static const uint32_t statusIntervalMs = 60000; //ms
+    static const uint32_t statusMaxIntervalMs = 120000; //ms
 
 protected:
-    void publishStatus(struct tm* currTime, uint8_t* status, size_t size);
+    void publishStatus(uint64_t timestamp_ms, uint8_t* status, size_t size);
 
-    static const uint32_t statusIntervalMs = 60000; //ms
+    PollRate statusRate;
     uint32_t tPrevStatus;
+    bool statusPending;
+    uint8_t status[STATUS_RESP_SIZE];
 };
 
 class MxCollector : public MateCollector
@@ -76,25 +203,39 @@ class MxCollector : public MateCollector
 public:
     MxCollector(MateControllerDevice& dev, MatePubContext& context)
         : MateCollector(dev, context)
+        , statusRate(statusMinIntervalMs, statusIntervalMs, statusMaxIntervalMs, MateWire::statusLayout(MateWire::DeviceType::Mx))
         , tPrevStatus(0)
         , tPrevLog(0)
         , nextLogpageTime{0}
+        , statusPending(false)
+        , logPending(false)
+        , status{0}
+        , logpage{0}
     { }
 
     void process(uint32_t now) override;
+    void onTransactionComplete(MateTransaction& txn, bool success) override;
+
+    static const uint32_t statusMinIntervalMs = 2000; //ms
+    static const uint32_t statusIntervalMs = 10000; //ms
+    static const uint32_t statusMaxIntervalMs = 30000; //ms
 
 protected:
-    void publishStatus(struct tm* currTime, uint8_t* status, size_t size);
+    void publishStatus(uint64_t timestamp_ms, uint8_t* status, size_t size);
 
-    void publishLog(struct tm* currTime, uint8_t* log, size_t size);
+    void publishLog(uint64_t timestamp_ms, uint8_t* log, size_t size);
 
     void setNextLogpage(struct tm* currTime);
 
-    static const uint32_t statusIntervalMs = 10000; //ms
     static const uint32_t logIntervalMs = 60000; // 1min
+    PollRate statusRate;
     uint32_t tPrevStatus;
     uint32_t tPrevLog;
     struct tm nextLogpageTime;
+    bool statusPending;
+    bool logPending;
+    uint8_t status[STATUS_RESP_SIZE];
+    uint8_t logpage[LOG_RESP_SIZE];
 };
 
 class DcCollector : public MateCollector
@@ -102,16 +243,28 @@ class DcCollector : public MateCollector
 public:
     DcCollector(MateControllerDevice& dev, MatePubContext& context)
         : MateCollector(dev, context)
+        , statusRate(statusMinIntervalMs, statusIntervalMs, statusMaxIntervalMs, MateWire::statusLayout(MateWire::DeviceType::Dc))
         , tPrevStatus(0)
+        , pagesPending(0)
+        , pageError(false)
+        , status{0}
     { }
 
     void process(uint32_t now) override;
+    void onTransactionComplete(MateTransaction& txn, bool success) override;
+
+    static const uint32_t statusMinIntervalMs = 5000; //ms (6 transactions per poll)
+    static const uint32_t statusIntervalMs = 10000; //ms
+    static const uint32_t statusMaxIntervalMs = 30000; //ms
 
 protected:
-    void publishStatus(struct tm* currTime, uint8_t* status, size_t size);
+    void publishStatus(uint64_t timestamp_ms, uint8_t* status, size_t size);
 
-    static const uint32_t statusIntervalMs = 10000; //ms
+    PollRate statusRate;
     uint32_t tPrevStatus;
+    uint8_t pagesPending;   // Status pages still to be read this cycle
+    bool pageError;
+    uint8_t status[DC_STATUS_RESP_SIZE];
 };
 
 // By inheriting from each class, we can figure out how much memory
@@ -124,23 +277,10 @@ private:
     MateCollectorContainer() = delete;
 };
 
-// A DC status packet consists of 6 individual status packets
-#define DC_STATUS_RESP_SIZE (STATUS_RESP_SIZE * 6)
-
-typedef struct {
-    time_t  timestamp;
-    uint8_t status[STATUS_RESP_SIZE];
-} StatusMqttPayload;
-
-typedef struct {
-    time_t  timestamp;
-    uint8_t status[DC_STATUS_RESP_SIZE];
-} DcStatusMqttPayload;
-
-typedef struct {
-    time_t  timestamp;
-    uint8_t logpage[LOG_RESP_SIZE];
-} MxLogPageMqttPayload;
+static_assert(MateWire::encodedSize(STATUS_RESP_SIZE) <= MAX_FRAME_PAYLOAD, "Status frame exceeds frame size");
+static_assert(MateWire::encodedSize(DC_STATUS_RESP_SIZE) <= MAX_FRAME_PAYLOAD, "DC status frame exceeds frame size");
+static_assert(MateWire::encodedSize(LOG_RESP_SIZE) <= MAX_FRAME_PAYLOAD, "Logpage frame exceeds frame size");
+static_assert(MAX_STATUS_RESP_SIZE <= MateWire::StatusReconstructor::MAX_STATUS_SIZE, "Status too large to reconstruct from deltas");
 
 static_assert(sizeof(MateCollector) <= sizeof(MateCollectorContainer), "MateCollector size exceeds available container");
 static_assert(sizeof(MxCollector) <= sizeof(MateCollectorContainer), "MxCollector size exceeds available container");
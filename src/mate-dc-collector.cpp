@@ -2,59 +2,70 @@
 
 void DcCollector::process(uint32_t now)
 { 
-    // A DC status packet consists of 6 individual status packets
-    static uint8_t status[STATUS_RESP_SIZE * 6] = {0};
-    struct tm currTime;
+    // Poll at the adaptive rate (or faster for energy counters), unless the bus budget has been used up
+    if ((pagesPending == 0) && MateScheduler::withinBudget() && statusDue(now, statusRate, tPrevStatus, ENERGY_SAMPLE_INTERVAL_MS)) {
+        LOG_DEBUG("Collect DC Status");
 
-    // Rollover-safe timestamp check
-    if ((now - tPrevStatus) >= statusIntervalMs) {
-        Debug.println("Collect DC Status");
-
-        if (!getLocalTime(&currTime)) {
-            Debug.println("Error retrieving current time");
-            return; // Cannot publish.
-        }
-
-#ifndef FAKE_MATE_DEVICES
+        // A DC status packet consists of 6 individual status packets,
+        // each read in a separate transaction so the bus is never held for long.
+        // Energy samples only need the first page (shunt currents & battery voltage).
+        int last_page = m_statusPublish ? DC_STATUS_PAGE_LAST : DC_STATUS_PAGE_FIRST;
+        pageError = false;
         uint8_t* curr_status = status;
-        for (int i = 0x0A; i <= 0x0F; i++) {
-            if (!dev.read_status(curr_status, STATUS_RESP_SIZE, i)) {
-                Debug.println("ERROR: Cannot read complete DC status");
-                return;
+        for (int i = DC_STATUS_PAGE_FIRST; i <= last_page; i++) {
+            if (MateScheduler::submit(
+                MateScheduler::readStatus(dev, this, curr_status, STATUS_RESP_SIZE, i)))
+            {
+                pagesPending++;
+            } else {
+                pageError = true;
             }
 
             curr_status += STATUS_RESP_SIZE;
         }
-#endif
+    }
+}
 
-        publishStatus(&currTime, status, sizeof(status));
+void DcCollector::onTransactionComplete(MateTransaction& txn, bool success)
+{
+    uint64_t timestamp_ms;
+
+    if (!success) {
+        pageError = true;
+    }
 
-        tPrevStatus = now;
+    if (pagesPending > 0) {
+        pagesPending--;
+    }
+    if (pagesPending > 0) {
+        return; // Wait for remaining pages
     }
+
+    if (pageError) {
+        LOG_ERROR("Cannot read complete DC status");
+        return;
+    }
+
+    // Energy samples are read more often than the status is published
+    if (!sampleStatus(status, sizeof(status)))
+        return;
+
+    // Poll faster while the status is changing
+    statusRate.update(status, sizeof(status));
+
+    if (!getTimestampMs(&timestamp_ms)) {
+        LOG_ERROR("Cannot retrieve current time");
+        return; // Cannot publish.
+    }
+
+    publishStatus(timestamp_ms, status, sizeof(status));
 }
 
-void DcCollector::publishStatus(struct tm* currTime, uint8_t* status, size_t size)
+void DcCollector::publishStatus(uint64_t timestamp_ms, uint8_t* status, size_t size)
 {
-    // mate/dc-1/stat/raw
-    // mate/dc-1/stat/ts
-    DcStatusMqttPayload payload;
-
-    if (size > sizeof(payload.status))
-        size = sizeof(payload.status);
-
-    payload.timestamp = mktime(currTime);
-    memcpy(payload.status, status, sizeof(payload.status));
-    
-    publishTopic("dc-status", 
-        reinterpret_cast<uint8_t*>(&payload), 
-        sizeof(payload), 
-        false);
-
-    // TODO: Deprecate
-    publishTopic("stat/raw", status, size, false);
-
-    // TODO: Deprecate
-    char ts_str[20];
-    snprintf(ts_str, sizeof(ts_str), "%lu", payload.timestamp);
-    publishTopic("stat/ts", ts_str, false);
+    // mate/dc-1/dc-status
+    publishStatusFrame(timestamp_ms, status, size);
+
+    // mate/dc-1/stat/raw, mate/dc-1/stat/ts (only with MATE_LEGACY_TOPICS)
+    publishLegacyStatus(timestamp_ms, status, size);
 }
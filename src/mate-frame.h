@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <matewire.h>
+
+#ifndef MAX_TOPIC_LEN
+#define MAX_TOPIC_LEN (40)
+#endif
+
+// Largest payload a collector can publish in a single frame.
+// Must fit a DC status payload (timestamp + 6 status pages).
+#define MAX_FRAME_PAYLOAD (128)
+
+enum FrameFlags : uint8_t {
+    FRAME_FLAG_NONE     = 0x00,
+    FRAME_BATCHABLE     = 0x01,     // Payload is a MateWire frame, and may be combined into a batch
+    FRAME_CYCLE_END     = 0x02,     // Marker: all collectors have finished their current cycle (no payload)
+};
+
+// A fixed-size record describing a single MQTT publish.
+// Used to hand data from the MATE bus task to the network task
+// without allocating memory.
+struct MateFrame {
+    char        topic[MAX_TOPIC_LEN];
+    uint16_t    size;
+    bool        retained;
+    uint8_t     flags;      // FrameFlags
+    uint8_t     payload[MAX_FRAME_PAYLOAD];
+
+    bool set(const char* topic, const uint8_t* payload, size_t size, bool retained, uint8_t flags = FRAME_FLAG_NONE) {
+        if (size > sizeof(this->payload))
+            return false;
+
+        strncpy(this->topic, topic, sizeof(this->topic) - 1);
+        this->topic[sizeof(this->topic) - 1] = '\0';
+        if (size > 0)
+            memcpy(this->payload, payload, size);
+        this->size      = static_cast<uint16_t>(size);
+        this->retained  = retained;
+        this->flags     = flags;
+        return true;
+    }
+
+    // Encode a MateWire frame directly into the payload
+    bool setFrame(const char* topic, const MateWire::FrameHeader& hdr, const uint8_t* payload, size_t size, uint8_t flags = FRAME_FLAG_NONE) {
+        size_t encoded = MateWire::encode(this->payload, sizeof(this->payload), hdr, payload, size);
+        if (encoded == 0)
+            return false;
+
+        strncpy(this->topic, topic, sizeof(this->topic) - 1);
+        this->topic[sizeof(this->topic) - 1] = '\0';
+        this->size      = static_cast<uint16_t>(encoded);
+        this->retained  = false;
+        this->flags     = flags;
+        return true;
+    }
+};
@@ -2,58 +2,41 @@
 
 void FxCollector::process(uint32_t now)
 { 
-    static uint8_t status[STATUS_RESP_SIZE] = {0};
-    struct tm currTime;
+    // Poll at the adaptive rate (or faster for energy counters), unless the bus budget has been used up
+    if (!statusPending && MateScheduler::withinBudget() && statusDue(now, statusRate, tPrevStatus, ENERGY_SAMPLE_INTERVAL_MS)) {
+        LOG_DEBUG("Collect FX Status");
 
-    // Rollover-safe timestamp check
-    if ((now - tPrevStatus) >= statusIntervalMs) {
-        tPrevStatus = now;
-        Debug.println("Collect FX Status");
+        statusPending = MateScheduler::submit(
+            MateScheduler::readStatus(dev, this, status, sizeof(status)));
+    }
+}
 
-        if (!getLocalTime(&currTime)) {
-            Debug.println("Error retrieving current time");
-            return; // Cannot publish.
-        }
+void FxCollector::onTransactionComplete(MateTransaction& txn, bool success)
+{
+    uint64_t timestamp_ms;
 
-#ifdef FAKE_MATE_DEVICES
-        publishStatus(&currTime, status, sizeof(status));
-#else
-        if (dev.read_status(status, sizeof(status))) {
-            publishStatus(&currTime, status, sizeof(status));
+    statusPending = false;
+    if (success) {
+        // Energy samples are read more often than the status is published
+        if (!sampleStatus(status, sizeof(status)))
+            return;
+
+        // Poll faster while the status is changing
+        statusRate.update(status, sizeof(status));
+
+        if (!getTimestampMs(&timestamp_ms)) {
+            LOG_ERROR("Cannot retrieve current time");
+            return; // Cannot publish.
         }
-#endif
+        publishStatus(timestamp_ms, status, sizeof(status));
     }
 }
 
-typedef struct {
-    time_t  timestamp;
-    uint8_t status[STATUS_RESP_SIZE];
-} FxStatusMqttPayload;
-
-void FxCollector::publishStatus(struct tm* currTime, uint8_t* status, size_t size)
+void FxCollector::publishStatus(uint64_t timestamp_ms, uint8_t* status, size_t size)
 {
-    // mate/fx-1/stat/raw
-    // mate/fx-1/stat/ts
-
-    StatusMqttPayload payload;
-
-    if (size > sizeof(payload.status))
-        size = sizeof(payload.status);
-
-    payload.timestamp = mktime(currTime);
-    memcpy(payload.status, status, sizeof(payload.status));
-    
-
-    publishTopic("fx-status", 
-        reinterpret_cast<uint8_t*>(&payload), 
-        sizeof(payload), 
-        false);
- 
-    // TODO: Deprecate
-    publishTopic("stat/raw", status, size, false);
-
-    char ts_str[20];
-    snprintf(ts_str, sizeof(ts_str), "%lu", payload.timestamp);
-    // TODO: Deprecate
-    publishTopic("stat/ts", ts_str, false);
+    // mate/fx-1/fx-status
+    publishStatusFrame(timestamp_ms, status, size);
+
+    // mate/fx-1/stat/raw, mate/fx-1/stat/ts (only with MATE_LEGACY_TOPICS)
+    publishLegacyStatus(timestamp_ms, status, size);
 }
@@ -2,42 +2,22 @@
 
 void MxCollector::process(uint32_t now)
 { 
-    static uint8_t status[STATUS_RESP_SIZE] = {0};
-    static uint8_t logpage[LOG_RESP_SIZE] = {0};
-    struct tm currTime;
+    // Poll at the adaptive rate (or faster for energy counters), unless the bus budget has been used up
+    if (!statusPending && MateScheduler::withinBudget() && statusDue(now, statusRate, tPrevStatus, ENERGY_SAMPLE_INTERVAL_MS)) {
+        LOG_DEBUG("Collect MX Status");
 
-    // Rollover-safe timestamp check
-    if ((now - tPrevStatus) >= statusIntervalMs) {
-        tPrevStatus = now;
-
-        Debug.println("Collect MX Status");
-
-        if (!getLocalTime(&currTime)) {
-            Debug.println("Error retrieving current time");
-            return; // Cannot publish.
-        }
-
-#ifdef FAKE_MATE_DEVICES   
-        publishStatus(&currTime, status, sizeof(status));
-#else
-        if (dev.read_status(status, sizeof(status))) {
-            // Debug.println("Status:");
-            // for (int i = 0; i < sizeof(status); i++) {
-            //     Debug.print(status[i], 16);
-            // }
-            // Debug.println();
-
-            publishStatus(&currTime, status, sizeof(status));
-        }
-#endif
+        statusPending = MateScheduler::submit(
+            MateScheduler::readStatus(dev, this, status, sizeof(status)));
     }
 
-    if ((now - tPrevLog) >= logIntervalMs) {
+    if (((now - tPrevLog) >= logIntervalMs) && !logPending) {
         tPrevLog = now;
 
         struct tm currTime;
-        if (getLocalTime(&currTime)) {
-            Serial.println(&currTime, "Time: %Y-%m-%d %H:%M:%S");
+        if (getLocalTime(&currTime, 0)) {
+            LOG_DEBUG("Time: %04d-%02d-%02d %02d:%02d:%02d",
+                currTime.tm_year + 1900, currTime.tm_mon + 1, currTime.tm_mday,
+                currTime.tm_hour, currTime.tm_min, currTime.tm_sec);
 
             // Next logpage timestamp not yet set, use current time
             if (nextLogpageTime.tm_year == 0) {
@@ -51,15 +31,10 @@ void MxCollector::process(uint32_t now)
                 (currTime.tm_hour >= nextLogpageTime.tm_hour) &&
                 (currTime.tm_min >= nextLogpageTime.tm_min))
             {
-                Debug.println("Collect MX Logpage");
+                LOG_INFO("Collect MX Logpage");
 
-#ifdef FAKE_MATE_DEVICES
-                publishLog(&currTime, logpage, sizeof(logpage));
-#else
-                if (dev.read_log(logpage, sizeof(logpage))) {
-                    publishLog(&currTime, logpage, sizeof(logpage));
-                }
-#endif
+                logPending = MateScheduler::submit(
+                    MateScheduler::readLog(dev, this, logpage, sizeof(logpage)));
 
                 setNextLogpage(&currTime);
                 nextLogpageTime.tm_mday += 1;
@@ -68,6 +43,51 @@ void MxCollector::process(uint32_t now)
     }
 }
 
+void MxCollector::onTransactionComplete(MateTransaction& txn, bool success)
+{
+    uint64_t timestamp_ms;
+
+    switch (txn.op) {
+        case TxnOp::ReadStatus:
+            statusPending = false;
+            if (success) {
+                // Energy samples are read more often than the status is published
+                if (!sampleStatus(status, sizeof(status)))
+                    break;
+
+                // Poll faster while the status is changing
+                statusRate.update(status, sizeof(status));
+
+                // Debug.println("Status:");
+                // for (int i = 0; i < sizeof(status); i++) {
+                //     Debug.print(status[i], 16);
+                // }
+                // Debug.println();
+
+                if (!getTimestampMs(&timestamp_ms)) {
+                    LOG_ERROR("Cannot retrieve current time");
+                    return; // Cannot publish.
+                }
+                publishStatus(timestamp_ms, status, sizeof(status));
+            }
+            break;
+
+        case TxnOp::ReadLog:
+            logPending = false;
+            if (success) {
+                if (!getTimestampMs(&timestamp_ms)) {
+                    LOG_ERROR("Cannot retrieve current time");
+                    return; // Cannot publish.
+                }
+                publishLog(timestamp_ms, logpage, sizeof(logpage));
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
 void MxCollector::setNextLogpage(struct tm* currTime)
 {
     nextLogpageTime = *currTime;
@@ -80,51 +100,22 @@ void MxCollector::setNextLogpage(struct tm* currTime)
     nextLogpageTime.tm_min = 5;
     nextLogpageTime.tm_sec = 0;
 
-    Serial.println(&nextLogpageTime, "Next Logpage: %Y-%m-%d %H:%M:%S");
+    LOG_INFO("Next Logpage: %04d-%02d-%02d %02d:%02d:%02d",
+        nextLogpageTime.tm_year + 1900, nextLogpageTime.tm_mon + 1, nextLogpageTime.tm_mday,
+        nextLogpageTime.tm_hour, nextLogpageTime.tm_min, nextLogpageTime.tm_sec);
 }
 
-void MxCollector::publishStatus(struct tm* currTime, uint8_t* status, size_t size)
+void MxCollector::publishStatus(uint64_t timestamp_ms, uint8_t* status, size_t size)
 {
     // mate/mx-1/mx-status
-    // mate/mx-1/stat/raw
-    // mate/mx-1/stat/ts
-
-    StatusMqttPayload payload;
-
-    if (size > sizeof(payload.status))
-        size = sizeof(payload.status);
-
-    payload.timestamp = mktime(currTime);
-    memcpy(payload.status, status, sizeof(payload.status));
-    
-
-    publishTopic("mx-status", 
-        reinterpret_cast<uint8_t*>(&payload), 
-        sizeof(payload), 
-        false);
-
-    // TODO: Deprecate
-    publishTopic("stat/raw", status, size, false);
+    publishStatusFrame(timestamp_ms, status, size);
 
-    // TODO: Deprecate
-    char ts_str[20];
-    snprintf(ts_str, sizeof(ts_str), "%lu", payload.timestamp);
-    publishTopic("stat/ts", ts_str, false);
+    // mate/mx-1/stat/raw, mate/mx-1/stat/ts (only with MATE_LEGACY_TOPICS)
+    publishLegacyStatus(timestamp_ms, status, size);
 }
 
-void MxCollector::publishLog(struct tm* currTime, uint8_t* logpage, size_t size)
+void MxCollector::publishLog(uint64_t timestamp_ms, uint8_t* logpage, size_t size)
 {
     // mate/mx-1/mx-logpage
-    MxLogPageMqttPayload payload;
-
-    if (size > sizeof(payload.logpage))
-        size = sizeof(payload.logpage);
-
-    payload.timestamp = mktime(currTime);
-    memcpy(payload.logpage, logpage, sizeof(payload.logpage));
-    
-    publishTopic("mx-logpage", 
-        reinterpret_cast<uint8_t*>(&payload), 
-        sizeof(payload), 
-        false);
+    publishFrame(MateTopic::LogPage, MateWire::FrameType::LogPage, timestamp_ms, logpage, size);
 }
@@ -0,0 +1,221 @@
+#include "mate-scheduler.h"
+#include "metrics.h"
+#include "bus-stats.h"
+
+// Deadline for each transaction class, relative to when it was submitted.
+// Transactions are issued earliest-deadline-first, so a short deadline
+// effectively gives a class priority over the others.
+static const uint32_t classDeadlineMs[(size_t)TxnClass::MaxClasses] = {
+    1000,   // Status
+    5000,   // Sync
+    30000,  // LogPage
+    10000,  // Query
+};
+
+static MateTransaction queue[MAX_MATE_TRANSACTIONS];
+static uint32_t nextSeq = 0;
+static uint32_t missedDeadlines = 0;
+
+// Bus utilization, measured over fixed windows
+static uint32_t tWindow = 0;
+static uint32_t busyUs = 0;         // Bus time used in the current window
+static uint8_t  utilizationPct = 0; // Of the last complete window
+
+static Metric m_bus_busy_ms("bus_busy_ms");
+static Metric m_bus_util_pct("bus_util_pct");
+
+static bool execute(MateTransaction& txn)
+{
+#ifdef FAKE_MATE_DEVICES
+    // Fake devices respond instantly with zero-filled data
+    return true;
+#else
+    MateControllerDevice& dev = *txn.device;
+    switch (txn.op) {
+        case TxnOp::ReadStatus:
+            if (txn.page != 0) {
+                return dev.read_status(txn.buffer, txn.size, txn.page);
+            }
+            return dev.read_status(txn.buffer, txn.size);
+
+        case TxnOp::ReadLog:
+            return dev.read_log(txn.buffer, txn.size);
+
+        case TxnOp::Query:
+            txn.value = dev.query(txn.reg);
+            return true;
+
+        case TxnOp::UpdateTime:
+            dev.update_time(&txn.time);
+            return true;
+
+        case TxnOp::UpdateBatteryTemp:
+            dev.update_battery_temperature(txn.value);
+            return true;
+
+        case TxnOp::Begin:
+            return dev.begin(dev.port());
+
+        default:
+            return false;
+    }
+#endif
+}
+
+// Earliest deadline first. Ties are broken by class priority, then submission order.
+static MateTransaction* selectNext()
+{
+    MateTransaction* next = nullptr;
+    for (auto& txn : queue) {
+        if (!txn.active)
+            continue;
+
+        if (next == nullptr) {
+            next = &txn;
+            continue;
+        }
+
+        // Rollover-safe deadline comparison
+        int32_t diff = static_cast<int32_t>(txn.deadline - next->deadline);
+        if ((diff < 0) ||
+            ((diff == 0) && (txn.cls < next->cls)) ||
+            ((diff == 0) && (txn.cls == next->cls) && (static_cast<int32_t>(txn.seq - next->seq) < 0)))
+        {
+            next = &txn;
+        }
+    }
+    return next;
+}
+
+namespace MateScheduler {
+
+bool submit(const MateTransaction& txn)
+{
+    assert(txn.device != nullptr);
+    assert(txn.cls < TxnClass::MaxClasses);
+
+    for (auto& slot : queue) {
+        if (!slot.active) {
+            uint32_t now = static_cast<uint32_t>(millis());
+            slot = txn;
+            slot.tSubmit  = now;
+            slot.deadline = now + classDeadlineMs[(size_t)txn.cls];
+            slot.seq      = nextSeq++;
+            slot.active   = true;
+            return true;
+        }
+    }
+
+    LOG_ERROR("MATE transaction queue full");
+    return false;
+}
+
+bool process(uint32_t now)
+{
+    uint32_t elapsed = now - tWindow;
+    if (elapsed >= MATE_BUS_WINDOW_MS) {
+        utilizationPct = static_cast<uint8_t>((busyUs / 10) / elapsed);
+        m_bus_util_pct.set(utilizationPct);
+        m_bus_busy_ms.add(busyUs / 1000);
+        busyUs = 0;
+        tWindow = now;
+    }
+
+    MateTransaction* slot = selectNext();
+    if (slot == nullptr)
+        return false;
+
+    if (static_cast<int32_t>(now - slot->deadline) > 0) {
+        missedDeadlines++;
+        LOG_WARN("MATE transaction missed deadline by %ums", (unsigned)(now - slot->deadline));
+    }
+
+    // Free the slot before dispatching, so the handler may queue follow-up transactions
+    MateTransaction txn = *slot;
+    slot->active = false;
+
+    uint32_t tStart = static_cast<uint32_t>(micros());
+    bool success = execute(txn);
+    uint32_t elapsed_us = static_cast<uint32_t>(micros()) - tStart;
+    busyUs += elapsed_us;
+    BusStats::record(txn.device->port(), txn.op, elapsed_us, success);
+    if (txn.handler != nullptr) {
+        txn.handler->onTransactionComplete(txn, success);
+    }
+    return true;
+}
+
+void clear()
+{
+    for (auto& txn : queue) {
+        txn.active = false;
+    }
+}
+
+size_t pending()
+{
+    size_t n = 0;
+    for (auto& txn : queue) {
+        if (txn.active)
+            n++;
+    }
+    return n;
+}
+
+size_t pending(TxnClass cls)
+{
+    size_t n = 0;
+    for (auto& txn : queue) {
+        if (txn.active && (txn.cls == cls))
+            n++;
+    }
+    return n;
+}
+
+bool withinBudget()
+{
+    return (busyUs / 10) < (static_cast<uint32_t>(MATE_BUS_WINDOW_MS) * MATE_BUS_BUDGET_PCT);
+}
+
+uint8_t busUtilization()
+{
+    return utilizationPct;
+}
+
+MateTransaction readStatus(MateControllerDevice& dev, MateTransactionHandler* handler, uint8_t* buffer, size_t size, uint8_t page)
+{
+    MateTransaction txn = {};
+    txn.device  = &dev;
+    txn.handler = handler;
+    txn.op      = TxnOp::ReadStatus;
+    txn.cls     = TxnClass::Status;
+    txn.page    = page;
+    txn.buffer  = buffer;
+    txn.size    = size;
+    return txn;
+}
+
+MateTransaction readLog(MateControllerDevice& dev, MateTransactionHandler* handler, uint8_t* buffer, size_t size)
+{
+    MateTransaction txn = {};
+    txn.device  = &dev;
+    txn.handler = handler;
+    txn.op      = TxnOp::ReadLog;
+    txn.cls     = TxnClass::LogPage;
+    txn.buffer  = buffer;
+    txn.size    = size;
+    return txn;
+}
+
+MateTransaction query(MateControllerDevice& dev, MateTransactionHandler* handler, uint16_t reg, TxnClass cls)
+{
+    MateTransaction txn = {};
+    txn.device  = &dev;
+    txn.handler = handler;
+    txn.op      = TxnOp::Query;
+    txn.cls     = cls;
+    txn.reg     = reg;
+    return txn;
+}
+
+};
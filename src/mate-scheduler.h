@@ -0,0 +1,93 @@
+#pragma once
+
+#include <uMate.h>
+#include <time.h>
+
+#include "debug.h"
+
+// Maximum number of transactions that can be queued at once.
+// A DC status read needs 6 transactions (one per status page).
+#define MAX_MATE_TRANSACTIONS (NUM_MATE_PORTS * 4)
+
+// Bus utilization budget for status polling.
+// Collectors hold off new status polls once the bus has been busy for more than
+// MATE_BUS_BUDGET_PCT of the current window, however fast their poll rate has adapted.
+#ifndef MATE_BUS_BUDGET_PCT
+#define MATE_BUS_BUDGET_PCT (25)
+#endif
+#define MATE_BUS_WINDOW_MS  (10000)
+
+// Transaction classes, in order of priority.
+// Each class has a deadline (see classDeadlineMs) which is used to order
+// transactions, so a status poll is never starved by a logpage read.
+enum class TxnClass : uint8_t {
+    Status,     // Periodic status polls
+    Sync,       // Time / battery temperature synchronization
+    LogPage,    // Daily MX logpage reads
+    Query,      // Ad-hoc register queries
+    MaxClasses
+};
+
+enum class TxnOp : uint8_t {
+    ReadStatus,
+    ReadLog,
+    Query,      // Register queries (incl. revision reads)
+    UpdateTime,
+    UpdateBatteryTemp,
+    Begin,      // Detect / ping a device
+    MaxOps
+};
+
+struct MateTransaction;
+
+// Receives the result of a transaction once it has been issued on the bus
+class MateTransactionHandler {
+public:
+    virtual void onTransactionComplete(MateTransaction& txn, bool success) = 0;
+};
+
+struct MateTransaction {
+    MateControllerDevice*   device;
+    MateTransactionHandler* handler;    // May be null (fire & forget)
+    TxnOp       op;
+    TxnClass    cls;
+    uint8_t     page;       // Status page (0 = device default)
+    uint16_t    reg;        // Query register
+    uint16_t    value;      // Query result / battery temperature
+    uint8_t*    buffer;     // Status / logpage response buffer
+    size_t      size;
+    struct tm   time;       // Time to send for UpdateTime
+
+    // Managed by the scheduler
+    uint32_t    tSubmit;
+    uint32_t    deadline;
+    uint32_t    seq;
+    bool        active;
+};
+
+namespace MateScheduler
+{
+    // Queue a transaction. Returns false if the queue is full.
+    bool submit(const MateTransaction& txn);
+
+    // Issue at most one queued transaction on the bus and dispatch its result.
+    // Returns true if a transaction was issued.
+    bool process(uint32_t now);
+
+    // Discard all queued transactions (eg. when rescanning the bus)
+    void clear();
+
+    size_t pending();
+    size_t pending(TxnClass cls);
+
+    // False once the bus budget for the current window has been used up
+    bool withinBudget();
+
+    // Bus utilization over the last complete window (%)
+    uint8_t busUtilization();
+
+    // Convenience helpers for building transactions
+    MateTransaction readStatus(MateControllerDevice& dev, MateTransactionHandler* handler, uint8_t* buffer, size_t size, uint8_t page = 0);
+    MateTransaction readLog(MateControllerDevice& dev, MateTransactionHandler* handler, uint8_t* buffer, size_t size);
+    MateTransaction query(MateControllerDevice& dev, MateTransactionHandler* handler, uint16_t reg, TxnClass cls = TxnClass::Query);
+};
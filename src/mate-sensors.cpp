@@ -0,0 +1,140 @@
+#include "mate-sensors.h"
+#include "mqtt.h"
+#include "allocator.h"
+#include "debug.h"
+
+#include <uMate.h>
+#include <matestatus.h>
+#include <atomic>
+
+#ifdef MATE_HA_SENSORS
+
+typedef HAComponent<Component::Sensor> Sensor;
+
+// Name (eg. 'mx1_bat_voltage') must fit within the HA topic & unique ID
+#define SENSOR_NAME_LEN (24)
+
+struct DeviceSensors {
+    const MateWire::StatusLayout* layout;
+    char label[8];                                      // eg. 'mx1'
+
+    // Written by the MATE bus task
+    std::atomic<float> values[MateWire::MAX_STATUS_FIELDS];
+    std::atomic<uint32_t> updates;
+
+    // Only used by the network task
+    uint32_t seen;                                      // updates already fed to the sensors
+    bool unregistered;                                  // No room for the sensors
+    Sensor* sensors[MateWire::MAX_STATUS_FIELDS];       // nullptr until registered
+};
+
+static DeviceSensors devices[NUM_MATE_PORTS];
+static std::atomic<int> device_count(0);
+
+static fixed_pool_allocator<Sensor, MATE_SENSOR_MAX> sensor_pool;
+static char sensor_names[MATE_SENSOR_MAX][SENSOR_NAME_LEN];
+static size_t sensor_count = 0;
+
+static SensorClass sensorClass(MateWire::FieldUnit unit)
+{
+    switch (unit) {
+        case MateWire::FieldUnit::Volts:    return SensorClass::Voltage;
+        case MateWire::FieldUnit::Amps:     return SensorClass::Current;
+        case MateWire::FieldUnit::Percent:  return SensorClass::Battery;
+        default:                            return SensorClass::Undefined;
+    }
+}
+
+// Create a sensor entity for each field of the device's status
+static bool registerSensors(DeviceSensors& dev)
+{
+    const MateWire::StatusLayout& layout = *dev.layout;
+    if ((sensor_count + layout.count) > MATE_SENSOR_MAX) {
+        LOG_WARN("No room for %s sensors, increase MATE_SENSOR_MAX", dev.label);
+        dev.unregistered = true;
+        return false;
+    }
+
+    for (size_t i = 0; i < layout.count; i++) {
+        char* name = sensor_names[sensor_count++];
+        snprintf(name, SENSOR_NAME_LEN, "%s_%s", dev.label, layout.fields[i].name);
+
+        // Mode and state codes are published as they are, not averaged
+        bool code = (layout.fields[i].unit == MateWire::FieldUnit::None);
+        Sensor* sensor = sensor_pool.make_new(Mqtt::context, name, MATE_SENSOR_INTERVAL_MS, 0.0f, sensorClass(layout.fields[i].unit), code ? 0 : 2);
+        sensor->SetReportLast(code);
+        sensor->Initialize();
+        sensor->PublishLater();
+        dev.sensors[i] = sensor;
+    }
+
+    LOG_INFO("Registered %u %s sensors", (unsigned)layout.count, dev.label);
+    return true;
+}
+
+namespace MateSensors {
+
+int addDevice(MateWire::DeviceType type, const char* label)
+{
+    const MateWire::StatusLayout* layout = MateWire::statusLayout(type);
+    int n = device_count.load(std::memory_order_relaxed);
+    if ((layout == nullptr) || (n >= NUM_MATE_PORTS))
+        return -1;
+
+    DeviceSensors& dev = devices[n];
+    dev.layout = layout;
+    strncpy(dev.label, label, sizeof(dev.label) - 1);
+    device_count.store(n + 1, std::memory_order_release);
+    return n;
+}
+
+void update(int device, const uint8_t* status, size_t size)
+{
+    if (device < 0)
+        return;
+
+    DeviceSensors& dev = devices[device];
+    const MateWire::StatusLayout* layout = dev.layout;
+    float values[MateWire::MAX_STATUS_FIELDS];
+    if ((layout == nullptr) || !MateWire::decodeStatus(*layout, status, size, values))
+        return;
+
+    for (size_t i = 0; i < layout->count; i++) {
+        dev.values[i].store(values[i], std::memory_order_relaxed);
+    }
+    dev.updates.fetch_add(1, std::memory_order_release);
+}
+
+void process()
+{
+    int n = device_count.load(std::memory_order_acquire);
+    for (int d = 0; d < n; d++) {
+        DeviceSensors& dev = devices[d];
+        uint32_t updates = dev.updates.load(std::memory_order_acquire);
+        if ((updates == dev.seen) || dev.unregistered)
+            continue;
+        dev.seen = updates;
+
+        if ((dev.sensors[0] == nullptr) && !registerSensors(dev))
+            continue;
+
+        // Averaged (or the last value, for codes), and published every MATE_SENSOR_INTERVAL_MS
+        for (size_t i = 0; i < dev.layout->count; i++) {
+            dev.sensors[i]->Update(dev.values[i].load(std::memory_order_relaxed));
+        }
+    }
+}
+
+};
+
+#else
+
+namespace MateSensors {
+
+int addDevice(MateWire::DeviceType type, const char* label) { return -1; }
+void update(int device, const uint8_t* status, size_t size) { }
+void process() { }
+
+};
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <matewire.h>
+
+// Maximum number of sensor entities, across all devices
+#define MATE_SENSOR_MAX         (40)
+
+// Sensor values are averaged over this period, and published to Home Assistant at this rate
+#define MATE_SENSOR_INTERVAL_MS (30000)
+
+// Home Assistant sensors for MATE devices (MATE_HA_SENSORS).
+//
+// Status frames are only decoded by the remote aggregator, so without this Home Assistant
+// sees nothing from the MATE devices. With MATE_HA_SENSORS, each status read is also decoded
+// on the gateway (see MateWire::decodeStatus() in matestatus.h), and each field feeds a
+// sensor entity, eg. 'mate_mx1_bat_voltage'. Entities are registered automatically the
+// first time a device reports its status.
+//
+// Status is decoded on the MATE bus task, and the entities are only touched by the network task.
+namespace MateSensors
+{
+    // Add a device, eg. (Mx, "mx1"). Returns a handle for update(), or -1 if there's no room.
+    int addDevice(MateWire::DeviceType type, const char* label);
+
+    // Decode the status read from a device
+    void update(int device, const uint8_t* status, size_t size);
+
+    // Register new entities, and feed them the latest values. Called from the network task.
+    void process();
+};
@@ -7,6 +7,11 @@
 #include "debug.h"
 #include "allocator.h"
 #include "mate-collector.h"
+#include "mate-scheduler.h"
+#include "bus-stats.h"
+#include "metrics.h"
+#include "inflight.h"
+#include "rollup.h"
 
 //#define DEBUG_COMMS
 
@@ -33,6 +38,14 @@ fixed_pool_allocator<MateCollectorContainer, NUM_MATE_PORTS> collector_pool;
 
 static uint32_t tPrevSync = 0;
 static const uint32_t syncIntervalMs = 60000; // Period to synchronize devices
+static uint32_t tPrevDiag = 0;
+static const uint32_t diagIntervalMs = 300000; // Period to publish bus diagnostics
+
+// A cycle runs from the first transaction issued until the queue is empty again
+static bool     cycleActive = false;
+static uint32_t tCycleStart = 0;
+static Metric   m_cycles("mate_cycles");
+static Metric   m_cycle_ms("mate_cycle_ms");    // Duration of the last cycle
 
 extern const char* dtype_strings[];
 const char* dtypes[] = {
@@ -55,7 +68,9 @@ void print_dtype(DeviceType dtype) {
 void print_revision(MateControllerDevice& device)
 {
 #ifndef FAKE_MATE_DEVICES
-    auto rev = device.get_revision();
+    // Revision registers are queried, so it's recorded as a query
+    revision_t rev;
+    BusStats::timed(device.port(), TxnOp::Query, [&] { rev = device.get_revision(); return true; });
     Debug.print("(Rev:");
     Debug.print(rev.a); Debug.print("."); 
     Debug.print(rev.b); Debug.print(".");
@@ -72,40 +87,42 @@ void create_device(int port, DeviceType dtype)
     // Create a device object for interacting with the device type
     MateControllerDevice* device = new(device_pool) MateControllerDevice(mate_bus, dtype);
     if (device != nullptr) {
+        #ifdef DEBUG_COMMS
+        Debug.println();
+        #endif
+
+#ifdef FAKE_MATE_DEVICES
+        bool connected = true;
+#else
+        // Check that we can communicate before creating the collector,
+        // which names its topic aliases after the port
+        bool connected = BusStats::timed(port, TxnOp::Begin, [&] { return device->begin(port); });
+#endif
 
         // Create an appropriate wrapper class for the device type
         MateCollector* collector = nullptr;
-        switch (dtype) {
-            case DeviceType::Mx: collector = new (collector_pool) MxCollector(*device, mate_context); break;
-            case DeviceType::Fx: collector = new (collector_pool) FxCollector(*device, mate_context); break;
-            case DeviceType::Dc: collector = new (collector_pool) DcCollector(*device, mate_context); break;
-            default: break;
+        if (connected) {
+            switch (dtype) {
+                case DeviceType::Mx: collector = new (collector_pool) MxCollector(*device, mate_context); break;
+                case DeviceType::Fx: collector = new (collector_pool) FxCollector(*device, mate_context); break;
+                case DeviceType::Dc: collector = new (collector_pool) DcCollector(*device, mate_context); break;
+                default: break;
+            }
         }
         //MateCollector* collector = new(collector_pool) MateCollector(*device, mate_context);
 
+        // Add it to our list
         if (collector != nullptr) {
-            #ifdef DEBUG_COMMS
-            Debug.println();
-            #endif
-
-#ifdef FAKE_MATE_DEVICES
-            bool connected = true;
-#else
-            // Check that we can communicate and add it to our list
-            bool connected = device->begin(port);
-#endif
-            if (connected) {
-                print_revision(*device);
-                devices[num_devices] = device;
-                collectors[num_devices] = collector;
-                num_devices++;
-
-                // First MX present is the master
-                if ((dtype == DeviceType::Mx) && (mx_master == nullptr)) {
-                    mx_master = device;
-                }
+            print_revision(*device);
+            devices[num_devices] = device;
+            collectors[num_devices] = collector;
+            num_devices++;
+
+            // First MX present is the master
+            if ((dtype == DeviceType::Mx) && (mx_master == nullptr)) {
+                mx_master = device;
             }
-        } 
+        }
     }
     Debug.println();
 }
@@ -134,6 +151,15 @@ void clearPublishedDevices()
 #endif
 }
 
+// Detect the device on a port. Recorded as a Begin (detection) in the bus stats,
+// so an empty port counts as a failure.
+DeviceType scan_port(int port)
+{
+    DeviceType dtype = DeviceType::None;
+    BusStats::timed(port, TxnOp::Begin, [&] { dtype = mate_bus.scan(port); return dtype != DeviceType::None; });
+    return dtype;
+}
+
 // Scan the MateNET bus for new devices.
 void scan()
 {
@@ -141,6 +167,7 @@ void scan()
 
     num_devices = 0;
     mx_master = nullptr;
+    MateScheduler::clear();
     device_pool.deallocate_all(); // TODO: Call destructors
 
 #ifdef FAKE_MATE_DEVICES
@@ -156,7 +183,7 @@ void scan()
 
     // Port 0 must be either a hub or a device.
     // If nothing responds to this, we don't have a valid network
-    dtype = mate_bus.scan(0);
+    dtype = scan_port(0);
     if (dtype == DeviceType::None) {
         Debug.println("ERROR: No devices found!");
         return;
@@ -169,7 +196,7 @@ void scan()
         Debug.println();
 
         for (int i = 1; i < NUM_MATE_PORTS; i++) {
-            dtype = mate_bus.scan(i);
+            dtype = scan_port(i);
             if (dtype != DeviceType::None) {
                 create_device(i, dtype);
             }
@@ -187,50 +214,98 @@ void scan()
 #endif
 
     // Publish initial (retained) info to MQTT, such as device revision & port
-    for (int i = 0; i < num_devices; i++) {
+    for (size_t i = 0; i < num_devices; i++) {
         auto collector = collectors[i];
         assert(collector != nullptr);
         collector->publishInfo();
     }
 }
 
+// Synchronization is performed as a chain of transactions:
+// the battery temperature is queried from the MX master, and once it completes
+// the FX & DC devices are updated with the result.
+class SyncHandler : public MateTransactionHandler
+{
+public:
+    void onTransactionComplete(MateTransaction& txn, bool success) override
+    {
+        if (!success)
+            return;
+
+        uint16_t bat_temp = txn.value;
+        LOG_DEBUG("Bat Temp: %u", (unsigned)bat_temp);
+
+        for (size_t i = 0; i < num_devices; i++) {
+            auto device = devices[i];
+            if (device != mx_master) {
+                DeviceType dtype = device->deviceType();
+
+                // FX & DC devices want to know the battery temp reported by the MX master
+                if (dtype == DeviceType::Fx || dtype == DeviceType::Dc) {
+                    MateTransaction update = {};
+                    update.device   = device;
+                    update.op       = TxnOp::UpdateBatteryTemp;
+                    update.cls      = TxnClass::Sync;
+                    update.value    = bat_temp;
+                    MateScheduler::submit(update);
+                }
+            }
+        }
+    }
+};
+
+static SyncHandler sync_handler;
+
 void synchronize()
 {
     struct tm timeinfo;
-    uint16_t bat_temp = 0;
+    bool query_bat_temp = false;
 
     if (mx_master != nullptr) {
 
-        Debug.println("Synchronize...");
+        LOG_DEBUG("Synchronize...");
+
+        // Previous synchronization still in progress
+        if (MateScheduler::pending(TxnClass::Sync) > 0) {
+            LOG_WARN("Sync: Previous sync still pending");
+            return;
+        }
         
-        if (!getLocalTime(&timeinfo)) {
-            Debug.println("Sync: Error retrieving current time");
+        if (!getLocalTime(&timeinfo, 0)) {
+            LOG_ERROR("Sync: Cannot retrieve current time");
             return; // Cannot synchronize.
         }
 
-        Serial.println(&timeinfo, "Time: %Y-%m-%d %H:%M:%S");
+        LOG_DEBUG("Time: %04d-%02d-%02d %02d:%02d:%02d",
+            timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+            timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
 
-        for (int i = 0; i < num_devices; i++) {
+        for (size_t i = 0; i < num_devices; i++) {
             auto device = devices[i];
             if (device != mx_master) {
                 DeviceType dtype = device->deviceType();
 
                 // MX & DC devices want to know the current time for scheduling purposes
                 if (dtype == DeviceType::Mx || dtype == DeviceType::Dc) {
-                    device->update_time(&timeinfo);
+                    MateTransaction update = {};
+                    update.device   = device;
+                    update.op       = TxnOp::UpdateTime;
+                    update.cls      = TxnClass::Sync;
+                    update.time     = timeinfo;
+                    MateScheduler::submit(update);
                 }
 
                 // FX & DC devices want to know the battery temp reported by the MX master
                 if (dtype == DeviceType::Fx || dtype == DeviceType::Dc) {
-                    if (bat_temp == 0) {
-                        bat_temp = mx_master->query(0x4000);
-                        Debug.print("Bat Temp: ");
-                        Debug.println(bat_temp);
-                    }
-                    device->update_battery_temperature(bat_temp);
+                    query_bat_temp = true;
                 }
             }
         }
+
+        if (query_bat_temp) {
+            MateScheduler::submit(
+                MateScheduler::query(*mx_master, &sync_handler, 0x4000, TxnClass::Sync));
+        }
     }
 }
 
@@ -247,18 +322,48 @@ void loop()
     if (num_devices > 0) {
         uint32_t now = static_cast<uint32_t>(millis());
 
-        // Collect status / log information for each attached device
-        for (int i = 0; i < num_devices; i++) {
-            auto collector = collectors[i];
-            assert(collector != nullptr);
-            collector->process(now);
+        // Queue status / log transactions for each attached device,
+        // unless the broker isn't keeping up with what's already been published (MQTT_QOS1)
+        if (!Inflight::congested()) {
+            for (size_t i = 0; i < num_devices; i++) {
+                auto collector = collectors[i];
+                assert(collector != nullptr);
+                collector->process(now);
+            }
         }
 
+        // Raw status replays (MATE_ROLLUP)
+        Rollup::process(mate_context);
+
         // Synchronize devices
         if ((now - tPrevSync) >= syncIntervalMs) {
             tPrevSync = now;
             synchronize();
         }
+
+        // Publish bus diagnostics
+        if ((now - tPrevDiag) >= diagIntervalMs) {
+            tPrevDiag = now;
+            for (size_t i = 0; i < num_devices; i++) {
+                collectors[i]->publishDiagnostics();
+            }
+        }
+
+        // Issue at most one bus transaction per loop,
+        // so network processing is never held up for more than a single round-trip.
+        // Once the queue empties, every collector has finished its cycle.
+        if (MateScheduler::process(now)) {
+            if (!cycleActive) {
+                cycleActive = true;
+                tCycleStart = now;
+            }
+            if (MateScheduler::pending() == 0) {
+                cycleActive = false;
+                m_cycles.add();
+                m_cycle_ms.set(static_cast<uint32_t>(millis()) - tCycleStart);
+                mate_context.endCycle();
+            }
+        }
     }
 
 }
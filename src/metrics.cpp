@@ -0,0 +1,98 @@
+#include "metrics.h"
+#include "debug.h"
+
+#include <Arduino.h>
+
+#define METRICS_TOPIC_LEN (40)
+
+// Max payload per message, leaving room in the MQTT buffer for the header and topic
+#define METRICS_PAYLOAD_LEN (MQTT_MAX_PACKET_SIZE - METRICS_TOPIC_LEN - 8)
+
+Metric* Metric::head = nullptr;
+
+// Heap usage, sampled before each publish. A steady free heap and low fragmentation
+// over weeks of uptime show the gateway isn't allocating in the steady state.
+static Metric m_heap_free("heap_free");
+static Metric m_heap_min_free("heap_min_free");     // Low-water mark since boot
+static Metric m_heap_max_block("heap_max_block");   // Largest allocatable block
+static Metric m_heap_frag_pct("heap_frag_pct");     // Free heap not in the largest block
+
+char Metrics::topic[METRICS_TOPIC_LEN] = {0};
+uint32_t Metrics::tPrevPublish = 0;
+
+Metric::Metric(const char* name)
+    : name(name)
+    , value(0)
+    , next(head)
+{
+    head = this;
+}
+
+void Metrics::setup(const char* prefix)
+{
+    // Eg. 'mate/metrics'
+    snprintf(topic, sizeof(topic), "%s/metrics", prefix);
+}
+
+void Metrics::process(PubSubClient& client, uint32_t now)
+{
+    if ((now - tPrevPublish) >= METRICS_INTERVAL_MS) {
+        tPrevPublish = now;
+        if (client.connected()) {
+            publish(client);
+        }
+    }
+}
+
+static void sampleHeap()
+{
+    uint32_t free_heap = ESP.getFreeHeap();
+    uint32_t max_block = ESP.getMaxAllocHeap();
+
+    m_heap_free.set(free_heap);
+    m_heap_min_free.set(ESP.getMinFreeHeap());
+    m_heap_max_block.set(max_block);
+    m_heap_frag_pct.set((free_heap > 0) ? (100 - ((uint64_t)max_block * 100) / free_heap) : 0);
+}
+
+const Metric* Metrics::find(const char* name)
+{
+    for (Metric* m = Metric::head; m != nullptr; m = m->next) {
+        if (strcmp(m->name, name) == 0)
+            return m;
+    }
+    return nullptr;
+}
+
+void Metrics::publish(PubSubClient& client)
+{
+    char payload[METRICS_PAYLOAD_LEN];
+    size_t len = 0;
+
+    sampleHeap();
+
+    // Eg. {"conn_link_ms":1234,"conn_reconnects":2}
+    for (Metric* m = Metric::head; m != nullptr; m = m->next) {
+        char item[48];
+        int n = snprintf(item, sizeof(item), "\"%s\":%lu", m->name, (unsigned long)m->get());
+        if ((n <= 0) || (n >= (int)sizeof(item)))
+            continue;
+
+        // Flush if this item won't fit (+2 for separator and closing brace)
+        if ((len > 0) && ((len + n + 2) > sizeof(payload))) {
+            payload[len++] = '}';
+            client.publish(topic, reinterpret_cast<const uint8_t*>(payload), len, false);
+            len = 0;
+        }
+
+        payload[len] = (len == 0) ? '{' : ',';
+        len++;
+        memcpy(&payload[len], item, n);
+        len += n;
+    }
+
+    if (len > 0) {
+        payload[len++] = '}';
+        client.publish(topic, reinterpret_cast<const uint8_t*>(payload), len, false);
+    }
+}
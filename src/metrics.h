@@ -0,0 +1,46 @@
+#pragma once
+
+#include <PubSubClient.h>
+#include <atomic>
+
+// Period to publish metrics
+#define METRICS_INTERVAL_MS (60000)
+
+// A named counter/gauge that is periodically published to '<device>/metrics'.
+// Metrics register themselves on construction, so they should be declared
+// statically. Safe to update from any task.
+class Metric {
+public:
+    Metric(const char* name);
+
+    void add(uint32_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    void set(uint32_t n)     { value.store(n, std::memory_order_relaxed); }
+    uint32_t get() const     { return value.load(std::memory_order_relaxed); }
+
+    const char* name;
+
+private:
+    std::atomic<uint32_t> value;
+    Metric* next;
+
+    static Metric* head;
+    friend class Metrics;
+};
+
+class Metrics {
+public:
+    static void setup(const char* prefix);
+
+    // Publish all metrics if METRICS_INTERVAL_MS has elapsed
+    static void process(PubSubClient& client, uint32_t now);
+
+    // Publish all metrics as JSON objects (split across messages if needed)
+    static void publish(PubSubClient& client);
+
+    // Look up a metric by name (nullptr if not found)
+    static const Metric* find(const char* name);
+
+private:
+    static char topic[];
+    static uint32_t tPrevPublish;
+};
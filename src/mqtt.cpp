@@ -3,6 +3,7 @@
 #include "main.h"
 #include "secrets.h"
 #include "hacomponent.h"
+#include "rollup.h"
 
 #include <ESPmDNS.h>
 
@@ -100,101 +101,83 @@ void Mqtt::setup(const char* host, uint16_t port)
     client.setCallback(Mqtt::on_message_received);
 }
 
-void Mqtt::connect()
+// Make a single connection attempt.
+// Connection::process() takes care of retrying.
+bool Mqtt::tryConnect()
 {
-    // Loop until we're reconnected
-    while (!client.connected()) {
-        //SetAppStatus(AppStatus::ConnectingMqtt);
-        Debug.print("Attempting MQTT connection...");
-
-        // Attempt to connect
-        bool connected = false;
-        if (HAAvailabilityComponent::inst != nullptr)
-        {
-            String will_topic       = HAAvailabilityComponent::inst->getWillTopic();
-            const char* will_msg    = HAAvailabilityComponent::OFFLINE;
-            uint8_t will_qos        = 0;
-            bool will_retain        = true;
-
-            Debug.print("Last will: ");
-            Debug.print(will_topic);
-            Debug.print(" = ");
-            Debug.println(will_msg);
-
-            connected = client.connect(
-                secrets::device_name,
-                secrets::mqtt_username,
-                secrets::mqtt_password,
-                will_topic.c_str(), will_qos, will_retain, will_msg
-            );
-        }
-        else
-        {
-            connected = client.connect(
-                secrets::device_name,
-                secrets::mqtt_username,
-                secrets::mqtt_password
-            );
-        }
-
-        if (connected)
-        {
-            //SetAppStatus(AppStatus::Connected);
-            Debug.println("Connected");
+    //SetAppStatus(AppStatus::ConnectingMqtt);
+    Debug.print("Attempting MQTT connection...");
 
-            // Verify server's certificate
-            // TODO: Can we verify before passing the user/password?
-            /*if (!espClient.verifyCertChain(mqtt_server)) {
-            Debug.println("ERROR: Certificate verification failed!");
-            return;
-            }*/
+    // Attempt to connect
+    bool connected = false;
+    if (HAAvailabilityComponent::inst != nullptr)
+    {
+        const char* will_topic  = HAAvailabilityComponent::inst->getWillTopic();
+        const char* will_msg    = HAAvailabilityComponent::OFFLINE;
+        uint8_t will_qos        = 0;
+        bool will_retain        = true;
+
+        Debug.print("Last will: ");
+        Debug.print(will_topic);
+        Debug.print(" = ");
+        Debug.println(will_msg);
+
+        connected = client.connect(
+            secrets::device_name,
+            secrets::mqtt_username,
+            secrets::mqtt_password,
+            will_topic, will_qos, will_retain, will_msg
+        );
+    }
+    else
+    {
+        connected = client.connect(
+            secrets::device_name,
+            secrets::mqtt_username,
+            secrets::mqtt_password
+        );
+    }
 
-            //client.subscribe("homeassistant/#");
-            //publishSensors();
+    if (connected)
+    {
+        //SetAppStatus(AppStatus::Connected);
+        Debug.println("Connected");
 
-            // TODO: Report current sensor values immediately
+        // Verify server's certificate
+        // TODO: Can we verify before passing the user/password?
+        /*if (!espClient.verifyCertChain(mqtt_server)) {
+        Debug.println("ERROR: Certificate verification failed!");
+        return;
+        }*/
 
-            // Invalidate readings
-            /*lastPirState = false;
-            temp = 0.0;
-            hum = 0.0;*/
+        //client.subscribe("homeassistant/#");
+        //publishSensors();
 
-        }
-        else
-        {
-            Debug.print("Failed (");
-            Debug.print(client.state());
-            Debug.println(").");
-
-            // Wait 5 seconds before retrying
-            for (int i = 0; i < 5000; i++) {
-                delay(1);
-                idle_loop();
-            }
+        // TODO: Report current sensor values immediately
 
-            idle_loop();
-        }
+        // Invalidate readings
+        /*lastPirState = false;
+        temp = 0.0;
+        hum = 0.0;*/
     }
-}
-
-bool Mqtt::process()
-{
-    if (!client.connected()) {
-        // Lost connection, attempt to re-establish
-        connect();
-        
-        return true; // Reconnected
+    else
+    {
+        Debug.print("Failed (");
+        Debug.print(client.state());
+        Debug.println(").");
     }
-    client.loop();
-    return false;
+
+    return connected;
 }
 
-void Mqtt::on_message_received(char* topic, byte* payload, size_t len)
+void Mqtt::on_message_received(char* topic, byte* payload, unsigned int len)
 {
+    // Raw status replay request (MATE_ROLLUP)
+    if (Rollup::onMessage(topic))
+        return;
+
     payload[len] = '\0';
     Debug.println((char*)payload);
 
-    // String topic_s(topic);
-    // String payload_s((char*)payload);
-    // HAComponent<Component::Switch>::ProcessMqttTopic(topic_s, payload_s);
+    // HAComponent<Component::Switch>::ProcessMqttTopic(topic, (const char*)payload);
 }
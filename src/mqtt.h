@@ -10,13 +10,12 @@ public:
     static bool find_remote_broker(IPAddress* addr_out, uint16_t* port_out);
     static void setup(IPAddress addr, uint16_t port);
     static void setup(const char* host, uint16_t port);
-    static bool process();
-    static void connect();
+    static bool tryConnect();
 
     static PubSubClient client;
     static ComponentContext context;
 private:
-    static void on_message_received(char* topic, byte* payload, size_t len);
+    static void on_message_received(char* topic, byte* payload, unsigned int len);
     
 
 
@@ -0,0 +1,403 @@
+#ifdef MODE_BENCH
+// Host micro-benchmarks for the publish hot path (the 'bench' environment).
+//
+// Each benchmark runs the real gateway code against an in-memory MQTT broker,
+// and reports the average time per call. Results can be appended to a CSV file
+// (tagged with the build version, so one row per benchmark per commit), and
+// compared against the previous results in that file to catch regressions:
+//
+//   pio run -e bench
+//   .pio/build/bench/program --csv bench.csv --tolerance 10
+//
+// Exits with 1 if any benchmark is slower than the previous result by more than
+// the tolerance (%). Absolute numbers are for the build machine, not the ESP32,
+// so only compare results taken on the same machine.
+
+#include <Arduino.h>
+#include <SoftwareSerial.h>
+#include <PubSubClient.h>
+#include <hacomponent.h>
+#include <matenet-emulator.h>
+#include <matewire.h>
+#include <matestatus.h>
+#include <uMate.h>
+#include <chrono>
+#include <string>
+#include <map>
+#include <new>
+
+#include "main.h"
+#include "mqtt.h"
+#include "mate-collector.h"
+#include "outbox.h"
+#include "batcher.h"
+#include "log.h"
+
+#define BENCH_MIN_TIME_MS   (200)   // Run each benchmark for at least this long
+#define BENCH_WARMUP_ITERS  (100)
+
+extern const char* GEN_BUILD_VERSION;
+
+// Heap allocations made through operator new (includes String on the host)
+static uint64_t allocations = 0;
+
+void* operator new(size_t size)
+{
+    allocations++;
+    void* p = malloc(size);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+// Swallows debug output, so benchmarks measure CPU time rather than stdout
+class NullStream : public Stream {
+public:
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    size_t write(uint8_t c) override { return 1; }
+    size_t write(const uint8_t* buf, size_t size) override { return size; }
+};
+
+// Minimal in-memory MQTT broker: acknowledges CONNECT and discards everything else
+class NullBrokerClient : public Client {
+public:
+    NullBrokerClient() : m_connected(false), m_rxLen(0), m_rxPos(0), m_bytes(0) { }
+
+    int connect(IPAddress ip, uint16_t port) override { m_connected = true; return 1; }
+    int connect(const char* host, uint16_t port) override { m_connected = true; return 1; }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buf, size_t size) override
+    {
+        // CONNECT -> CONNACK (accepted)
+        if ((size > 0) && ((buf[0] & 0xF0) == 0x10)) {
+            static const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+            memcpy(m_rx, connack, sizeof(connack));
+            m_rxLen = sizeof(connack);
+            m_rxPos = 0;
+        }
+        m_bytes += size;
+        return size;
+    }
+
+    int available() override { return static_cast<int>(m_rxLen - m_rxPos); }
+    int read() override { return (m_rxPos < m_rxLen) ? m_rx[m_rxPos++] : -1; }
+    int read(uint8_t* buf, size_t size) override
+    {
+        size_t n = 0;
+        while ((n < size) && (m_rxPos < m_rxLen)) {
+            buf[n++] = m_rx[m_rxPos++];
+        }
+        return static_cast<int>(n);
+    }
+    int peek() override { return (m_rxPos < m_rxLen) ? m_rx[m_rxPos] : -1; }
+    void flush() override { }
+    void stop() override { m_connected = false; }
+    uint8_t connected() override { return m_connected ? 1 : 0; }
+    operator bool() override { return m_connected; }
+
+    uint64_t bytesWritten() const { return m_bytes; }
+
+private:
+    bool m_connected;
+    uint8_t m_rx[4];
+    size_t m_rxLen;
+    size_t m_rxPos;
+    uint64_t m_bytes;
+};
+
+static NullStream null_debug;
+Stream& Debug = null_debug;
+
+SoftwareSerial              Serial9b;
+static NullBrokerClient     net;
+PubSubClient                Mqtt::client(net);
+ComponentContext            Mqtt::context(Mqtt::client);
+MatePubContext              mate_context(Mqtt::client);
+
+static MateNetEmulator emulator;
+
+void fault()
+{
+    Serial.println("HALTED.");
+    exit(1);
+}
+
+void idle_loop()
+{
+    yield();
+}
+
+// Exposes the collector's publish path
+class BenchCollector : public MxCollector {
+public:
+    using MxCollector::MxCollector;
+    using MateCollector::publishTopic;
+    using MateCollector::publishStatusFrame;
+};
+
+struct BenchResult {
+    const char* name;
+    double ns_per_op;
+    double allocs_per_op;
+    uint32_t iterations;
+};
+
+typedef void (*BenchFn)(uint32_t iterations);
+
+// Time fn, doubling the iteration count until it runs for at least BENCH_MIN_TIME_MS
+static BenchResult run(const char* name, BenchFn fn)
+{
+    using clock = std::chrono::steady_clock;
+
+    fn(BENCH_WARMUP_ITERS);
+
+    uint32_t iterations = 1000;
+    while (true) {
+        uint64_t allocs_start = allocations;
+        clock::time_point tStart = clock::now();
+        fn(iterations);
+        double elapsed_ns = std::chrono::duration<double, std::nano>(clock::now() - tStart).count();
+        double allocs = static_cast<double>(allocations - allocs_start);
+
+        if ((elapsed_ns >= (BENCH_MIN_TIME_MS * 1e6)) || (iterations >= (1u << 30))) {
+            BenchResult result = { name, elapsed_ns / iterations, allocs / iterations, iterations };
+            return result;
+        }
+        iterations *= 2;
+    }
+}
+
+// Keeps the compiler from optimizing away benchmarked results
+static volatile uint64_t sink;
+
+static uint8_t status[STATUS_RESP_SIZE];
+static uint8_t frame[MAX_FRAME_PAYLOAD];
+static size_t frame_size;
+static BenchCollector* collector;
+static HAComponent<Component::Sensor>* sensor;
+
+static void benchTopicPublish(uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        collector->publishTopic(MateTopic::Availability, "online", true);
+    }
+}
+
+static void benchStatusPublish(uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        status[0] = static_cast<uint8_t>(i);    // Defeat MATE_STATUS_DELTA's unchanged check
+        collector->publishStatusFrame(1600000000000ull + i, status, sizeof(status));
+    }
+}
+
+static void benchFrameEncode(uint32_t n)
+{
+    MateWire::FrameHeader hdr = {};
+    hdr.type            = MateWire::FrameType::Status;
+    hdr.device_type     = static_cast<uint8_t>(MateWire::DeviceType::Mx);
+    hdr.port            = 1;
+
+    uint8_t buf[MAX_FRAME_PAYLOAD];
+    for (uint32_t i = 0; i < n; i++) {
+        hdr.seq = i;
+        hdr.timestamp_ms = 1600000000000ull + i;
+        sink += MateWire::encode(buf, sizeof(buf), hdr, status, sizeof(status));
+    }
+}
+
+static void benchFrameDecode(uint32_t n)
+{
+    MateWire::FrameHeader hdr;
+    const uint8_t* payload;
+    for (uint32_t i = 0; i < n; i++) {
+        sink += static_cast<uint64_t>(MateWire::decode(frame, frame_size, hdr, payload));
+        sink += hdr.seq;
+    }
+}
+
+static void benchStatusDecode(uint32_t n)
+{
+    const MateWire::StatusLayout* layout = MateWire::statusLayout(MateWire::DeviceType::Mx);
+    float values[MateWire::MAX_STATUS_FIELDS];
+    for (uint32_t i = 0; i < n; i++) {
+        status[0] = static_cast<uint8_t>(i);
+        MateWire::decodeStatus(*layout, status, sizeof(status), values);
+        sink += static_cast<uint64_t>(values[0]);
+    }
+}
+
+static void benchTimestamp(uint32_t n)
+{
+    uint64_t timestamp_ms;
+    for (uint32_t i = 0; i < n; i++) {
+        getTimestampMs(&timestamp_ms);
+        sink += timestamp_ms;
+    }
+}
+
+static void benchDiscoveryConfig(uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        sensor->PublishConfig();
+    }
+}
+
+// Per-sample cost of a sensor fed at bus poll rate (publishes a summary once per second)
+static void benchSensorSample(uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        sensor->Update(26.0f + static_cast<float>(i & 7) * 0.1f);
+    }
+}
+
+static void setup()
+{
+    Log::setup(null_debug);
+
+    MateNetEmulator::DeviceConfig config;
+    config.type         = MateWire::DeviceType::Mx;
+    config.latency_ms   = 0;
+    config.status_size  = STATUS_RESP_SIZE;
+    config.log_size     = LOG_RESP_SIZE;
+    emulator.addDevice(1, config);
+    Serial9b.attach(&emulator);
+
+    Mqtt::context.device_name   = "mate";
+    Mqtt::context.friendly_name = "MATE Gateway";
+    Mqtt::context.fw_version    = GEN_BUILD_VERSION;
+    Mqtt::context.manufacturer  = "ViscTronics";
+    Mqtt::context.model         = "ESP-MATE Gateway (bench)";
+
+    mate_context.device_name    = "mate";
+    mate_context.prefix         = "mate";
+
+    static HAComponent<Component::Sensor> bat_voltage(Mqtt::context, "bat_voltage", 1000);
+    sensor = &bat_voltage;
+    HACompItem::InitializeAll();
+
+    Outbox::setup();
+    Batcher::setup(mate_context.prefix);
+
+    Mqtt::client.setServer("bench", 1883);
+    if (!Mqtt::client.connect("bench", nullptr, nullptr)) {
+        Serial.println("ERROR: Could not connect to in-memory broker");
+        exit(1);
+    }
+
+    static MateControllerProtocol protocol(Serial9b);
+    static MateControllerDevice dev(protocol, DeviceType::Mx);
+    dev.begin(1);
+    static BenchCollector mx(dev, mate_context);
+    collector = &mx;
+
+    for (size_t i = 0; i < sizeof(status); i++) {
+        status[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    MateWire::FrameHeader hdr = {};
+    hdr.type            = MateWire::FrameType::Status;
+    hdr.device_type     = static_cast<uint8_t>(MateWire::DeviceType::Mx);
+    hdr.port            = 1;
+    hdr.timestamp_ms    = 1600000000000ull;
+    frame_size = MateWire::encode(frame, sizeof(frame), hdr, status, sizeof(status));
+}
+
+// Latest result for each benchmark in a results CSV (version,benchmark,ns_per_op,iterations,allocs_per_op)
+static std::map<std::string, double> loadResults(const char* path)
+{
+    std::map<std::string, double> results;
+    FILE* f = fopen(path, "r");
+    if (f == nullptr)
+        return results;
+
+    char line[256];
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        char version[96];
+        char name[64];
+        double ns;
+        if (sscanf(line, "%95[^,],%63[^,],%lf", version, name, &ns) == 3) {
+            results[name] = ns;
+        }
+    }
+    fclose(f);
+    return results;
+}
+
+int main(int argc, char** argv)
+{
+    const char* csv_path = nullptr;
+    double tolerance_pct = 10.0;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--csv") == 0) && ((i + 1) < argc)) {
+            csv_path = argv[++i];
+        } else if ((strcmp(argv[i], "--tolerance") == 0) && ((i + 1) < argc)) {
+            tolerance_pct = atof(argv[++i]);
+        } else {
+            Serial.println("Usage: program [--csv results.csv] [--tolerance pct]");
+            return 2;
+        }
+    }
+
+    setup();
+
+    const BenchResult results[] = {
+        run("topic_publish",        benchTopicPublish),
+        run("status_publish",       benchStatusPublish),
+        run("frame_encode",         benchFrameEncode),
+        run("frame_decode",         benchFrameDecode),
+        run("status_decode",        benchStatusDecode),
+        run("timestamp",            benchTimestamp),
+        run("discovery_config",     benchDiscoveryConfig),
+        run("sensor_sample",        benchSensorSample),
+    };
+
+    std::map<std::string, double> previous;
+    if (csv_path != nullptr) {
+        previous = loadResults(csv_path);
+    }
+
+    Serial.printf("Version: %s\r\n", GEN_BUILD_VERSION);
+    Serial.printf("%-20s %12s %12s %10s %10s\r\n", "benchmark", "ns/op", "previous", "allocs/op", "iterations");
+
+    int rc = 0;
+    for (const BenchResult& r : results) {
+        auto prev = previous.find(r.name);
+        bool regressed = (prev != previous.end()) &&
+                         (r.ns_per_op > (prev->second * (1.0 + (tolerance_pct / 100.0))));
+        if (regressed) {
+            rc = 1;
+        }
+
+        if (prev != previous.end()) {
+            Serial.printf("%-20s %12.1f %12.1f %10.2f %10u%s\r\n", r.name, r.ns_per_op, prev->second, r.allocs_per_op, r.iterations,
+                regressed ? "  REGRESSION" : "");
+        } else {
+            Serial.printf("%-20s %12.1f %12s %10.2f %10u\r\n", r.name, r.ns_per_op, "-", r.allocs_per_op, r.iterations);
+        }
+    }
+
+    if (csv_path != nullptr) {
+        FILE* f = fopen(csv_path, "a");
+        if (f == nullptr) {
+            Serial.printf("ERROR: Cannot write %s\r\n", csv_path);
+            return 2;
+        }
+        for (const BenchResult& r : results) {
+            fprintf(f, "%s,%s,%.1f,%u,%.2f\n", GEN_BUILD_VERSION, r.name, r.ns_per_op, r.iterations, r.allocs_per_op);
+        }
+        fclose(f);
+    }
+
+    Serial.printf("MQTT bytes written: %llu\r\n", (unsigned long long)net.bytesWritten());
+    return rc;
+}
+#endif
@@ -0,0 +1,324 @@
+#ifdef MODE_NATIVE
+// Host entry point for the 'native' environment.
+//
+// Runs the real MateAggregator against an emulated MATEnet bus (MateNetEmulator),
+// publishing to a local MQTT broker, and periodically reports cycle time &
+// publish latency (measured by subscribing to our own frames).
+//
+//   pio run -e native
+//   .pio/build/native/program [broker] [port] [seconds]
+//
+// Connects over plain TCP, or with -DHOST_TLS and MQTT_TLS=1 in the environment, over TLS
+// (verifying the broker against MQTT_CA_FILE if given).
+//
+// Bus faults can be injected through the environment:
+//   MATE_EMU_LATENCY_MS, MATE_EMU_TIMEOUT_PCT, MATE_EMU_CORRUPT_PCT, MATE_EMU_CHANGE_PCT
+
+#include <Arduino.h>
+#include <SoftwareSerial.h>
+#include <HostClient.h>
+#include <HostTlsClient.h>
+#include <PubSubClient.h>
+#include <hacomponent.h>
+#include <matenet-emulator.h>
+#include <matewire.h>
+#include <uMate.h>
+#include <random>
+#include <atomic>
+
+#include "main.h"
+#include "mate.h"
+#include "mqtt.h"
+#include "mate-collector.h"
+#include "outbox.h"
+#include "batcher.h"
+#include "connection.h"
+#include "network.h"
+#include "buffered-client.h"
+#include "topic-alias.h"
+#include "rollup.h"
+#include "energy.h"
+#include "metrics.h"
+#include "log.h"
+#include "secrets.h"
+
+#define REPORT_INTERVAL_MS (10000)
+
+static LogStream log_stream;
+Stream& Debug = log_stream;
+
+extern const char* GEN_BUILD_VERSION;
+
+// Heap allocations, reported per interval to check the steady state doesn't allocate.
+// With glibc, malloc itself is replaced, so everything is counted as on the ESP32
+// (operator new, String, strdup, ...). Otherwise only operator new is counted, which misses
+// plain malloc calls, and std::string too when it's short enough to be kept inline.
+static std::atomic<uint64_t> allocations(0);
+static uint64_t prev_allocations = 0;
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define HEAP_COUNT_NAME "allocs"
+
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+
+// Memory from these is still released by glibc's free()
+void* malloc(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(p, size);
+}
+
+};
+
+#else
+#define HEAP_COUNT_NAME "new_allocs"
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+#endif
+
+static HostClient           tcp;
+#ifdef HOST_TLS
+static HostTlsClient        tls;
+#endif
+
+static Client& hostNet()
+{
+#ifdef HOST_TLS
+    const char* use_tls = getenv("MQTT_TLS");
+    if ((use_tls != nullptr) && (atoi(use_tls) != 0)) {
+        tls.setCACertFile(getenv("MQTT_CA_FILE"));
+        return tls;
+    }
+#endif
+    return tcp;
+}
+
+SoftwareSerial              Serial9b;
+BufferedClient              net(hostNet());
+PubSubClient                Mqtt::client(net);
+ComponentContext            Mqtt::context(Mqtt::client);
+HAAvailabilityComponent     availability(Mqtt::context);
+MatePubContext              mate_context(Mqtt::client);
+
+static MateNetEmulator emulator;
+
+// Publish latency, from the frame timestamp to receiving it back from the broker
+static uint32_t latency_count = 0;
+static uint64_t latency_sum_ms = 0;
+static uint64_t latency_max_ms = 0;
+
+void fault()
+{
+    Debug.println("HALTED.");
+    Log::flush();
+    exit(1);
+}
+
+void idle_loop()
+{
+    yield();
+}
+
+static uint8_t envPct(const char* name, uint8_t def)
+{
+    const char* value = getenv(name);
+    return (value != nullptr) ? static_cast<uint8_t>(atoi(value)) : def;
+}
+
+static void setupEmulator()
+{
+    MateNetEmulator::DeviceConfig config;
+    config.latency_ms   = static_cast<uint32_t>(envPct("MATE_EMU_LATENCY_MS", 10));
+    config.timeout_pct  = envPct("MATE_EMU_TIMEOUT_PCT", 0);
+    config.corrupt_pct  = envPct("MATE_EMU_CORRUPT_PCT", 0);
+    config.change_pct   = envPct("MATE_EMU_CHANGE_PCT", 10);
+    config.status_size  = STATUS_RESP_SIZE;
+    config.log_size     = LOG_RESP_SIZE;
+
+    config.type = MateWire::DeviceType::Hub;
+    emulator.addDevice(0, config);
+    config.type = MateWire::DeviceType::Mx;
+    emulator.addDevice(1, config);
+    config.type = MateWire::DeviceType::Fx;
+    emulator.addDevice(2, config);
+    config.type = MateWire::DeviceType::Dc;
+    emulator.addDevice(3, config);
+
+    Serial9b.attach(&emulator);
+}
+
+static void recordLatency(const uint8_t* frame, size_t size)
+{
+    MateWire::FrameHeader hdr;
+    const uint8_t* payload;
+    if (MateWire::decode(frame, size, hdr, payload) != MateWire::DecodeResult::Ok)
+        return; // Not a frame (eg. port/rev topics)
+
+    uint64_t now_ms;
+    if (!getTimestampMs(&now_ms) || (now_ms < hdr.timestamp_ms))
+        return;
+
+    uint64_t latency_ms = now_ms - hdr.timestamp_ms;
+    latency_count++;
+    latency_sum_ms += latency_ms;
+    if (latency_ms > latency_max_ms)
+        latency_max_ms = latency_ms;
+}
+
+static void onMessage(char* topic, uint8_t* payload, unsigned int len)
+{
+    if (Rollup::onMessage(topic))
+        return;
+
+    if (MateWire::isBatch(payload, len)) {
+        MateWire::BatchReader batch(payload, len);
+        const uint8_t* frame;
+        size_t frame_size;
+        while (batch.next(frame, frame_size)) {
+            recordLatency(frame, frame_size);
+        }
+    } else {
+        recordLatency(payload, len);
+    }
+}
+
+// Our own frames, to measure publish latency
+static char subscribe_topic[MAX_TOPIC_LEN];
+
+static void onReconnect()
+{
+    Mqtt::client.subscribe(subscribe_topic);
+}
+
+static uint32_t metric(const char* name)
+{
+    const Metric* m = Metrics::find(name);
+    return (m != nullptr) ? m->get() : 0;
+}
+
+static void report()
+{
+    const MateNetEmulator::Stats& emu = emulator.stats();
+
+    Debug.printf("cycles=%u last_cycle=%ums bus_util=%u%% frames=%u latency_avg=%llums latency_max=%llums outbox=%u\r\n",
+        metric("mate_cycles"), metric("mate_cycle_ms"), metric("bus_util_pct"),
+        latency_count,
+        (unsigned long long)((latency_count > 0) ? (latency_sum_ms / latency_count) : 0),
+        (unsigned long long)latency_max_ms,
+        (unsigned)Outbox::pending());
+
+    Debug.printf("qos: inflight=%u acked=%u resent=%u full=%u ack_ms=%u\r\n",
+        metric("qos_inflight"), metric("qos_acked"), metric("qos_resent"), metric("qos_full"), metric("qos_ack_ms"));
+
+    Debug.printf("net: writes=%u records=%u bytes_saved=%u reconnect=%ums first_publish=%ums\r\n",
+        metric("net_writes"), metric("net_records"), metric("net_bytes_saved"),
+        metric("conn_last_reconnect_ms"), metric("conn_first_publish_ms"));
+#ifdef HOST_TLS
+    Debug.printf("tls: handshakes=%u resumed=%u\r\n", tls.handshakeCount(), tls.resumedCount());
+#endif
+
+    uint64_t total = allocations.load(std::memory_order_relaxed);
+    Debug.printf("heap: " HEAP_COUNT_NAME "=%llu (since last report) total=%llu\r\n",
+        (unsigned long long)(total - prev_allocations), (unsigned long long)total);
+    prev_allocations = total;
+
+    Debug.printf("emulator: requests=%u responses=%u timeouts=%u corrupted=%u bad=%u\r\n",
+        emu.requests, emu.responses, emu.timeouts, emu.corrupted, emu.bad_requests);
+}
+
+#ifndef PIO_UNIT_TESTING  // The host tests have their own main()
+int main(int argc, char** argv)
+{
+    const char* broker  = (argc > 1) ? argv[1] : "localhost";
+    uint16_t port       = (argc > 2) ? static_cast<uint16_t>(atoi(argv[2])) : 1883;
+    uint32_t run_s      = (argc > 3) ? static_cast<uint32_t>(atoi(argv[3])) : 0; // 0 = forever
+
+    Log::setup(Serial);
+    log_stream.begin(Serial);
+
+    Debug.print("FW Version: ");
+    Debug.println(GEN_BUILD_VERSION);
+
+    setupEmulator();
+
+    Mqtt::context.device_name   = secrets::device_name;
+    Mqtt::context.friendly_name = secrets::friendly_name;
+    Mqtt::context.fw_version    = GEN_BUILD_VERSION;
+    Mqtt::context.manufacturer  = "ViscTronics";
+    Mqtt::context.model         = "ESP-MATE Gateway (native)";
+
+    mate_context.device_name    = secrets::device_name;
+    mate_context.prefix         = secrets::device_name;
+    mate_context.boot           = static_cast<uint16_t>(std::random_device()());
+
+    HACompItem::InitializeAll();
+
+    Outbox::setup();
+    Batcher::setup(mate_context.prefix);
+    TopicAlias::setup(mate_context.prefix);
+    Rollup::setup(mate_context.prefix);
+    Energy::setup();
+
+    Mqtt::setup(broker, port);
+    Mqtt::client.setCallback(onMessage);
+    Connection::setup(net, broker, port);
+    Network::setup(net, availability, onReconnect);
+    Metrics::setup(secrets::device_name);
+
+    MateAggregator::setup();
+    Log::defer(true);
+
+    snprintf(subscribe_topic, sizeof(subscribe_topic), "%s/#", mate_context.prefix);
+
+    uint32_t tStart = static_cast<uint32_t>(millis());
+    uint32_t tPrevReport = tStart;
+    while ((run_s == 0) || ((static_cast<uint32_t>(millis()) - tStart) < (run_s * 1000))) {
+        uint32_t now = static_cast<uint32_t>(millis());
+
+        // Same order as loop() in main.cpp (single core)
+        Network::loop();
+        MateAggregator::loop();
+
+        if ((now - tPrevReport) >= REPORT_INTERVAL_MS) {
+            tPrevReport = now;
+            report();
+        }
+
+        delayMicroseconds(100);
+    }
+
+    report();
+    Log::flush();
+    return 0;
+}
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+#include "network.h"
+#include "mqtt.h"
+#include "mate-collector.h"
+#include "frame-queue.h"
+#include "outbox.h"
+#include "batcher.h"
+#include "connection.h"
+#include "inflight.h"
+#include "topic-alias.h"
+#include "mate-sensors.h"
+#include "rollup.h"
+#include "energy.h"
+#include "metrics.h"
+#include "debug.h"
+#include "log.h"
+
+extern MatePubContext mate_context;
+
+static BufferedClient*          m_net = nullptr;
+static HAAvailabilityComponent* m_availability = nullptr;
+static Network::Callback        m_onReconnect = nullptr;
+static Network::Callback        m_onNetworkUp = nullptr;
+
+static void publishEntities()
+{
+    // Publish entities to Home-Assistant, a few at a time from loop()
+    HACompItem::PublishAll();
+    m_availability->Connect();
+}
+
+namespace Network {
+
+void setup(BufferedClient& net, HAAvailabilityComponent& availability, Callback onReconnect, Callback onNetworkUp)
+{
+    m_net = &net;
+    m_availability = &availability;
+    m_onReconnect = onReconnect;
+    m_onNetworkUp = onNetworkUp;
+
+    net.onPuback(Inflight::onPuback);
+}
+
+void loop()
+{
+    uint32_t now = static_cast<uint32_t>(millis());
+
+    bool reconnected = Connection::process(now);
+    if (reconnected) {
+        TopicAlias::publish(Mqtt::client);  // Before anything is published with an aliased topic
+        Inflight::resend(Mqtt::client); // Anything not acknowledged before the connection dropped
+        Outbox::republish(); // Retained state (device port, revision, availability)
+        mate_context.session++; // Collectors resend full status (keyframes)
+        publishEntities(); // Re-publish entity config
+        Rollup::subscribe(Mqtt::client);
+        if (m_onReconnect != nullptr)
+            m_onReconnect();
+        Debug.println();
+    }
+
+    if (Connection::networkUp() && (m_onNetworkUp != nullptr)) {
+        m_onNetworkUp();
+    }
+
+    if (Connection::connected()) {
+        // Replay anything buffered while we were disconnected
+        Outbox::process(Mqtt::client, now);
+
+        Metrics::process(Mqtt::client, now);
+
+        // Entity config queued by publishEntities()
+        HACompItem::PublishPending();
+    }
+
+#ifdef MODE_DUAL_CORE
+    // Publish frames produced by the MATE bus task
+    FrameQueue::drain(Mqtt::client, NET_DRAIN_BATCH);
+#endif
+
+    // Don't hold batched frames indefinitely if a cycle doesn't complete
+    Batcher::process(Mqtt::client, now);
+    m_net->process(now);
+    Inflight::process(Mqtt::client, now);
+    TopicAlias::process(Mqtt::client);
+    MateSensors::process();
+    Energy::process();
+
+    // Write out buffered log output, as far as the UART can take it without blocking
+    Log::process();
+}
+
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <hacomponent.h>
+
+#include "buffered-client.h"
+
+#ifdef MODE_DUAL_CORE
+// Max frames published per network loop iteration
+#define NET_DRAIN_BATCH     (8)
+#endif
+
+// The network side of the gateway, shared by the ESP32 (main.cpp) and host (host-main.cpp) builds:
+// MQTT (re)connection, replaying what was buffered while offline, and everything else
+// published from the network task. Target-specific work is done through the callbacks.
+//
+// Never blocks waiting for the network, so MATE data keeps being collected while offline.
+namespace Network
+{
+    typedef void (*Callback)();
+
+    // onReconnect is called after each new MQTT session has been set up (eg. extra subscriptions),
+    // onNetworkUp on each loop while the network is up (eg. OTA). Either may be null.
+    void setup(BufferedClient& net, HAAvailabilityComponent& availability,
+        Callback onReconnect = nullptr, Callback onNetworkUp = nullptr);
+
+    // Called from the network task (or the Arduino loop, single core)
+    void loop();
+};
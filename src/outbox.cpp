@@ -0,0 +1,456 @@
+#include "outbox.h"
+#include "debug.h"
+#include "connection.h"
+#include "inflight.h"
+#include "batcher.h"
+
+#ifdef OUTBOX_FLASH
+#include <LittleFS.h>
+#endif
+
+// RAM tier: circular buffer of frames, oldest at ram_tail
+static MateFrame  ram_internal[OUTBOX_RAM_FRAMES];
+static MateFrame* ram = ram_internal;
+static size_t     ram_capacity = OUTBOX_RAM_FRAMES;
+static size_t     ram_tail = 0;
+static size_t     ram_count = 0;
+
+static Outbox::Stats m_stats = {0};
+
+// Replay rate limiting (token bucket)
+static uint32_t tPrevReplay = 0;
+static uint32_t replay_tokens = 0;
+
+// Latest payload of each retained topic, published again while dirty
+struct RetainedState {
+    char     topic[MAX_TOPIC_LEN];
+    uint8_t  payload[OUTBOX_RETAINED_SIZE];
+    uint8_t  size;
+    bool     dirty;
+};
+static RetainedState retained_state[OUTBOX_RETAINED_TOPICS];
+static size_t        retained_count = 0;
+
+#ifdef OUTBOX_FLASH
+// Flash tier: numbered segment files, each holding up to OUTBOX_SEGMENT_FRAMES frames.
+// Segments are written once and deleted once fully replayed, which keeps
+// flash wear spread evenly (LittleFS is itself wear-levelled).
+// Segments [seg_first, seg_next) exist on flash, seg_first being the oldest.
+static const char* OUTBOX_DIR = "/outbox";
+static bool     flash_ok = false;
+static uint32_t seg_first = 0;
+static uint32_t seg_next = 0;
+static size_t   seg_read_pos = 0;   // Frames already replayed from seg_first
+
+static void segmentPath(char* path, size_t len, uint32_t seg)
+{
+    snprintf(path, len, "%s/%08lu.seg", OUTBOX_DIR, (unsigned long)seg);
+}
+
+static size_t flashSegments()
+{
+    return seg_next - seg_first;
+}
+
+static void dropOldestSegment()
+{
+    char path[32];
+    segmentPath(path, sizeof(path), seg_first);
+
+    File f = LittleFS.open(path, "r");
+    if (f) {
+        size_t frames = f.size() / sizeof(MateFrame);
+        m_stats.dropped += frames - seg_read_pos;
+        f.close();
+    }
+
+    LittleFS.remove(path);
+    seg_first++;
+    seg_read_pos = 0;
+}
+
+static void setupFlash()
+{
+    if (!LittleFS.begin(true)) {
+        Debug.println("Outbox: Could not mount flash");
+        return;
+    }
+    if (!LittleFS.exists(OUTBOX_DIR)) {
+        LittleFS.mkdir(OUTBOX_DIR);
+    }
+
+    // Recover segments left over from before a reboot
+    bool found = false;
+    File dir = LittleFS.open(OUTBOX_DIR);
+    File f = dir.openNextFile();
+    while (f) {
+        uint32_t seg = strtoul(f.name(), nullptr, 10);
+        if (!found || (seg < seg_first))
+            seg_first = seg;
+        if (!found || (seg >= seg_next))
+            seg_next = seg + 1;
+        found = true;
+        f = dir.openNextFile();
+    }
+
+    flash_ok = true;
+
+    if (flashSegments() > 0) {
+        Debug.print("Outbox: Recovered ");
+        Debug.print(flashSegments());
+        Debug.println(" segments from flash");
+    }
+}
+
+// Move the oldest frames in RAM into a new flash segment
+static bool spillToFlash()
+{
+    if (!flash_ok)
+        return false;
+
+    if (flashSegments() >= OUTBOX_MAX_SEGMENTS) {
+        dropOldestSegment();
+    }
+
+    char path[32];
+    segmentPath(path, sizeof(path), seg_next);
+
+    File f = LittleFS.open(path, "w");
+    if (!f) {
+        Debug.println("Outbox: Could not create segment");
+        return false;
+    }
+
+    size_t n = 0;
+    while ((n < OUTBOX_SEGMENT_FRAMES) && (ram_count > 0)) {
+        f.write(reinterpret_cast<const uint8_t*>(&ram[ram_tail]), sizeof(MateFrame));
+        ram_tail = (ram_tail + 1) % ram_capacity;
+        ram_count--;
+        n++;
+    }
+    f.close();
+
+    seg_next++;
+    m_stats.spilled += n;
+    return true;
+}
+
+// Read up to max of the oldest frames stored on flash (all from the same segment)
+static size_t readFlash(MateFrame* frames, size_t max)
+{
+    while (flash_ok && (flashSegments() > 0)) {
+        char path[32];
+        segmentPath(path, sizeof(path), seg_first);
+
+        size_t n = 0;
+        File f = LittleFS.open(path, "r");
+        if (f && f.seek(seg_read_pos * sizeof(MateFrame))) {
+            while ((n < max) &&
+                   (f.read(reinterpret_cast<uint8_t*>(&frames[n]), sizeof(MateFrame)) == sizeof(MateFrame)))
+            {
+                n++;
+            }
+        }
+        if (f)
+            f.close();
+        if (n > 0)
+            return n;
+
+        // Segment exhausted (or unreadable), move on to the next one
+        LittleFS.remove(path);
+        seg_first++;
+        seg_read_pos = 0;
+    }
+    return 0;
+}
+
+// Read the oldest frame stored on flash
+static bool peekFlash(MateFrame& frame)
+{
+    return (readFlash(&frame, 1) == 1);
+}
+#endif
+
+#ifdef MATE_COMPRESS
+// Stored frames replayed together as one compressed batch
+static MateFrame replay_batch[BATCH_MAX_FRAMES];
+
+static bool batchable(const MateFrame& frame)
+{
+    return (frame.flags & FRAME_BATCHABLE) && !frame.retained;
+}
+
+// Collect the oldest run of batchable frames into replay_batch.
+// A batch never spans flash and RAM, so it can be consumed with consumeBatch().
+static size_t gatherBatch(bool& from_flash)
+{
+    size_t n = 0;
+#ifdef OUTBOX_FLASH
+    from_flash = true;
+    n = readFlash(replay_batch, BATCH_MAX_FRAMES);
+    if (n == 0)
+#endif
+    {
+        from_flash = false;
+        while ((n < BATCH_MAX_FRAMES) && (n < ram_count)) {
+            replay_batch[n] = ram[(ram_tail + n) % ram_capacity];
+            n++;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (!batchable(replay_batch[i]))
+            return i;
+    }
+    return n;
+}
+
+static void consumeBatch(bool from_flash, size_t n)
+{
+#ifdef OUTBOX_FLASH
+    if (from_flash) {
+        seg_read_pos += n;
+        return;
+    }
+#endif
+    ram_tail = (ram_tail + n) % ram_capacity;
+    ram_count -= n;
+}
+#endif
+
+static bool store(const MateFrame& frame)
+{
+    if (ram_count >= ram_capacity) {
+#ifdef OUTBOX_FLASH
+        if (!spillToFlash())
+#endif
+        {
+            // Out of space, discard the oldest frame
+            ram_tail = (ram_tail + 1) % ram_capacity;
+            ram_count--;
+            m_stats.dropped++;
+        }
+    }
+
+    ram[(ram_tail + ram_count) % ram_capacity] = frame;
+    ram_count++;
+    m_stats.stored++;
+    return true;
+}
+
+static RetainedState* findRetained(const char* topic)
+{
+    for (size_t i = 0; i < retained_count; i++) {
+        if (strcmp(retained_state[i].topic, topic) == 0)
+            return &retained_state[i];
+    }
+    if (retained_count >= OUTBOX_RETAINED_TOPICS)
+        return nullptr;
+
+    RetainedState* state = &retained_state[retained_count++];
+    strncpy(state->topic, topic, sizeof(state->topic) - 1);
+    state->topic[sizeof(state->topic) - 1] = '\0';
+    return state;
+}
+
+// Record the latest value of a retained topic, and publish it if possible.
+// Returns false if it can't be tracked (table full or payload too large).
+static bool publishRetained(PubSubClient& client, const char* topic, const uint8_t* payload, size_t size)
+{
+    RetainedState* state = (size <= OUTBOX_RETAINED_SIZE) ? findRetained(topic) : nullptr;
+    if (state == nullptr)
+        return false;
+
+    if (size > 0)
+        memcpy(state->payload, payload, size);
+    state->size = static_cast<uint8_t>(size);
+    state->dirty = !(client.connected() && Inflight::publish(client, state->topic, state->payload, state->size, true));
+    if (!state->dirty) {
+        Connection::framePublished();
+    }
+    return true;
+}
+
+namespace Outbox {
+
+void setup()
+{
+#ifdef BOARD_HAS_PSRAM
+    if (psramFound()) {
+        MateFrame* buffer = static_cast<MateFrame*>(ps_malloc(sizeof(MateFrame) * OUTBOX_PSRAM_FRAMES));
+        if (buffer != nullptr) {
+            ram = buffer;
+            ram_capacity = OUTBOX_PSRAM_FRAMES;
+        }
+    }
+#endif
+
+#ifdef OUTBOX_FLASH
+    setupFlash();
+#endif
+
+    Debug.print("Outbox:     ");
+    Debug.print(ram_capacity);
+    Debug.println(" frames");
+}
+
+bool publish(PubSubClient& client, const char* topic, const uint8_t* payload, size_t size, bool retained)
+{
+    if (retained && publishRetained(client, topic, payload, size))
+        return true;
+
+    if (client.connected() && Inflight::publish(client, topic, payload, size, retained)) {
+        Connection::framePublished();
+        return true;
+    }
+
+    MateFrame frame;
+    if (!frame.set(topic, payload, size, retained)) {
+        m_stats.dropped++;
+        return false;
+    }
+    return store(frame);
+}
+
+bool publish(PubSubClient& client, const MateFrame& frame)
+{
+    if (frame.retained && publishRetained(client, frame.topic, frame.payload, frame.size))
+        return true;
+
+    if (client.connected() && Inflight::publish(client, frame.topic, frame.payload, frame.size, frame.retained)) {
+        Connection::framePublished();
+        return true;
+    }
+    return store(frame);
+}
+
+bool publishFrame(PubSubClient& client, const char* topic, const MateWire::FrameHeader& hdr, const uint8_t* payload, size_t size)
+{
+    if (client.connected()) {
+        uint8_t header[MateWire::HEADER_SIZE];
+        uint8_t crc[MateWire::CRC_SIZE];
+        MateWire::encodeHeader(header, hdr, size);
+        MateWire::encodeCrc(crc, header, payload, size);
+
+        // A failure part way through leaves a truncated packet, which the broker will
+        // reject (dropping the connection), so the frame is stored for replay below.
+        if (Inflight::beginPublish(client, topic, MateWire::encodedSize(size), false) &&
+            (Inflight::write(client, header, sizeof(header)) == sizeof(header)) &&
+            (Inflight::write(client, payload, size) == size) &&
+            (Inflight::write(client, crc, sizeof(crc)) == sizeof(crc)) &&
+            Inflight::endPublish(client))
+        {
+            Connection::framePublished();
+            return true;
+        }
+    }
+
+    MateFrame frame;
+    if (!frame.setFrame(topic, hdr, payload, size, FRAME_BATCHABLE)) {
+        m_stats.dropped++;
+        return false;
+    }
+    return store(frame);
+}
+
+void republish()
+{
+    for (size_t i = 0; i < retained_count; i++) {
+        retained_state[i].dirty = true;
+    }
+}
+
+// BufferedClient reports a publish as written once it's buffered, and it's lost if the write fails later.
+// So a replayed frame is only removed once it has been sent. (At QoS 1, Inflight keeps it until acknowledged)
+static bool sent(PubSubClient& client)
+{
+#ifdef MQTT_QOS1
+    return true;
+#else
+    Connection::flush();
+    return client.connected();
+#endif
+}
+
+void process(PubSubClient& client, uint32_t now)
+{
+    // Retained state first, it's current (and small)
+    for (size_t i = 0; (i < retained_count) && client.connected(); i++) {
+        RetainedState& state = retained_state[i];
+        if (state.dirty) {
+            if (!Inflight::publish(client, state.topic, state.payload, state.size, true))
+                break;
+            state.dirty = false;
+            Connection::framePublished();
+        }
+    }
+
+    // Refill replay tokens
+    uint32_t elapsed = now - tPrevReplay;
+    if (elapsed >= (1000 / OUTBOX_REPLAY_PER_SEC)) {
+        uint32_t tokens = (elapsed * OUTBOX_REPLAY_PER_SEC) / 1000;
+        replay_tokens += tokens;
+        if (replay_tokens > OUTBOX_REPLAY_PER_SEC)
+            replay_tokens = OUTBOX_REPLAY_PER_SEC;
+        tPrevReplay = now;
+    }
+
+    // Replay oldest first: flash holds older frames than RAM
+    while ((replay_tokens > 0) && client.connected() && (pending() > 0)) {
+#ifdef MATE_COMPRESS
+        // Replay a run of frames as one batch message (using one token),
+        // otherwise fall back to replaying them one at a time
+        bool from_flash = false;
+        size_t n = gatherBatch(from_flash);
+        if ((n > 1) && Batcher::publishBatch(client, replay_batch, n) && sent(client)) {
+            consumeBatch(from_flash, n);
+            m_stats.replayed += n;
+            Connection::framePublished();
+            replay_tokens--;
+            continue;
+        }
+#endif
+#ifdef OUTBOX_FLASH
+        MateFrame frame;
+        if (peekFlash(frame)) {
+            if (!Inflight::publish(client, frame.topic, frame.payload, frame.size, frame.retained) || !sent(client))
+                break;
+            seg_read_pos++;
+            m_stats.replayed++;
+            Connection::framePublished();
+            replay_tokens--;
+            continue;
+        }
+#endif
+        if (ram_count == 0)
+            break;
+
+        MateFrame& oldest = ram[ram_tail];
+        if (!Inflight::publish(client, oldest.topic, oldest.payload, oldest.size, oldest.retained) || !sent(client))
+            break;
+
+        ram_tail = (ram_tail + 1) % ram_capacity;
+        ram_count--;
+        m_stats.replayed++;
+        Connection::framePublished();
+        replay_tokens--;
+    }
+}
+
+size_t pending()
+{
+    size_t n = ram_count;
+#ifdef OUTBOX_FLASH
+    if (flash_ok) {
+        n += (flashSegments() * OUTBOX_SEGMENT_FRAMES); // Approximate
+    }
+#endif
+    return n;
+}
+
+const Stats& stats()
+{
+    return m_stats;
+}
+
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <PubSubClient.h>
+
+#include "mate-frame.h"
+
+// Frames buffered in internal RAM while the broker is unreachable
+#define OUTBOX_RAM_FRAMES       (32)
+
+// Frames buffered in PSRAM, if available (replaces the internal RAM buffer)
+#define OUTBOX_PSRAM_FRAMES     (2048)
+
+// Flash tier (OUTBOX_FLASH): when RAM fills up, the oldest frames are
+// spilled to flash in segments of this many frames.
+#define OUTBOX_SEGMENT_FRAMES   (32)
+#define OUTBOX_MAX_SEGMENTS     (64)
+
+// Maximum rate at which buffered frames are replayed after reconnecting.
+// Live frames are always published immediately, so this only limits the backlog.
+// With MATE_COMPRESS, a compressed batch of up to BATCH_MAX_FRAMES frames counts as one.
+#define OUTBOX_REPLAY_PER_SEC   (10)
+
+// Retained topics (device port, revision, availability) tracked for republishing
+#define OUTBOX_RETAINED_TOPICS  (32)
+#define OUTBOX_RETAINED_SIZE    (16)    // Longest retained payload (bytes)
+
+// Store-and-forward buffer for frames produced while MQTT is disconnected.
+// Frames are replayed oldest-first once the connection is restored.
+//
+// Retained publishes are state rather than history, so they never go into the buffer
+// (where a stale 'offline' could be replayed after a newer 'online'). Only the latest
+// payload of each retained topic is kept, and it's republished on reconnect.
+namespace Outbox
+{
+    void setup();
+
+    // Publish a frame, or store it for later if the client is not connected
+    // (or the publish fails). Retained publishes update the retained state instead.
+    bool publish(PubSubClient& client, const char* topic, const uint8_t* payload, size_t size, bool retained);
+    bool publish(PubSubClient& client, const MateFrame& frame);
+
+    // Publish a MateWire frame, streaming the header, payload & CRC straight into the
+    // MQTT packet instead of assembling the frame in a buffer first.
+    // Only encoded into a MateFrame if it has to be stored.
+    bool publishFrame(PubSubClient& client, const char* topic, const MateWire::FrameHeader& hdr, const uint8_t* payload, size_t size);
+
+    // Republish the current retained state. Called once a new session is established.
+    void republish();
+
+    // Publish outstanding retained state, then replay stored frames,
+    // rate limited to OUTBOX_REPLAY_PER_SEC
+    void process(PubSubClient& client, uint32_t now);
+
+    size_t pending();
+
+    struct Stats {
+        uint32_t stored;
+        uint32_t replayed;
+        uint32_t dropped;
+        uint32_t spilled;   // Frames written to flash
+    };
+    const Stats& stats();
+};
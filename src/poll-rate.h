@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <string.h>
+#include <matewire.h>
+#include <matestatus.h>
+
+// Adaptive poll interval.
+// The interval is halved (down to min_ms) each time the polled data changes,
+// and grows by a quarter (up to max_ms) each time it stays the same.
+// This gives fast updates during transitions without polling static devices as often.
+//
+// With a status layout, the data is decoded and only counts as changed once a field has moved
+// by at least its StatusField::change from the last change, so noise in the low bits of a
+// current doesn't keep the interval at the floor, while a slow drift still gets through.
+// Without one (or if the data doesn't decode), any change to the raw bytes counts.
+class PollRate {
+public:
+    PollRate(uint32_t min_ms, uint32_t initial_ms, uint32_t max_ms, const MateWire::StatusLayout* layout = nullptr)
+        : m_min(min_ms)
+        , m_max(max_ms)
+        , m_interval(initial_ms)
+        , m_layout(layout)
+        , m_crc(0)
+        , m_valid(false)
+    { }
+
+    uint32_t interval() const { return m_interval; }
+
+    // Rollover-safe
+    bool due(uint32_t now, uint32_t tPrev) const {
+        return (now - tPrev) >= m_interval;
+    }
+
+    // Update the interval from the latest poll result.
+    // Returns true if the data changed since the previous poll (or this is the first poll).
+    bool update(const uint8_t* data, size_t size) {
+        bool first = !m_valid;
+        bool changed = compare(data, size);
+        m_valid = true;
+
+        if (first) {
+            // Nothing to compare against yet
+        }
+        else if (changed) {
+            m_interval /= 2;
+            if (m_interval < m_min)
+                m_interval = m_min;
+        } else {
+            m_interval += m_interval / 4;
+            if (m_interval > m_max)
+                m_interval = m_max;
+        }
+        return changed || first;
+    }
+
+private:
+    bool compare(const uint8_t* data, size_t size) {
+        float values[MateWire::MAX_STATUS_FIELDS];
+        if ((m_layout == nullptr) || !MateWire::decodeStatus(*m_layout, data, size, values)) {
+            uint16_t crc = MateWire::crc16(data, size);
+            bool changed = (crc != m_crc);
+            m_crc = crc;
+            return changed;
+        }
+
+        bool changed = !m_valid;
+        for (size_t i = 0; i < m_layout->count; i++) {
+            float threshold = m_layout->fields[i].change;
+            float delta = fabsf(values[i] - m_ref[i]);
+            if ((threshold > 0) ? (delta >= threshold) : (delta > 0))
+                changed = true;
+        }
+        if (changed) {
+            memcpy(m_ref, values, sizeof(m_ref));
+        }
+        return changed;
+    }
+
+    uint32_t m_min;
+    uint32_t m_max;
+    uint32_t m_interval;
+    const MateWire::StatusLayout* m_layout;
+    float    m_ref[MateWire::MAX_STATUS_FIELDS];    // Decoded fields at the last change
+    uint16_t m_crc;     // Of the previous poll result, without a layout
+    bool     m_valid;
+};
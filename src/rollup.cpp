@@ -0,0 +1,328 @@
+#include "rollup.h"
+#include "mate-collector.h"
+#include "metrics.h"
+#include "debug.h"
+
+#include <uMate.h>
+#include <matestatus.h>
+#include <math.h>
+#include <atomic>
+
+#ifdef MATE_ROLLUP
+
+// Each kept status read is stored as: u8 device, u8 status size, u32 sequence, u64 timestamp (ms), status.
+// It's only encoded into a frame when replayed, which saves the frame header and CRC of each one.
+#define RECORD_HEADER_SIZE (14)
+
+static constexpr uint32_t recordsPerHour(uint32_t interval_ms)
+{
+    return (static_cast<uint32_t>(ROLLUP_HISTORY_S) * 1000 + interval_ms - 1) / interval_ms;
+}
+
+// ROLLUP_HISTORY_S of status from one MX, FX and FLEXnet DC, read every mx_ms, fx_ms and dc_ms
+static constexpr size_t historySize(uint32_t mx_ms, uint32_t fx_ms, uint32_t dc_ms)
+{
+    return (recordsPerHour(mx_ms) * (RECORD_HEADER_SIZE + MateWire::MX_STATUS_SIZE)) +
+           (recordsPerHour(fx_ms) * (RECORD_HEADER_SIZE + MateWire::FX_STATUS_SIZE)) +
+           (recordsPerHour(dc_ms) * (RECORD_HEADER_SIZE + MateWire::DC_STATUS_SIZE));
+}
+
+// At their usual poll rates, or the fastest they poll at while their status is changing
+#define ROLLUP_HISTORY_SIZE \
+    historySize(MxCollector::statusIntervalMs, FxCollector::statusIntervalMs, DcCollector::statusIntervalMs)
+#define ROLLUP_PSRAM_HISTORY_SIZE \
+    historySize(MxCollector::statusMinIntervalMs, FxCollector::statusMinIntervalMs, DcCollector::statusMinIntervalMs)
+
+static_assert(MateWire::encodedSize(MateWire::ROLLUP_HEADER_SIZE + (MateWire::MAX_STATUS_FIELDS * MateWire::ROLLUP_FIELD_SIZE)) <= MAX_FRAME_PAYLOAD, "Rollup frame exceeds frame size");
+static_assert(MAX_STATUS_RESP_SIZE <= 255, "Kept status size must fit in a byte");
+static_assert(MateWire::encodedSize(MAX_STATUS_RESP_SIZE) <= MAX_FRAME_PAYLOAD, "Kept status frame exceeds frame size");
+
+static const uint16_t tier_periods[ROLLUP_TIERS] = { ROLLUP_TIER1_S, ROLLUP_TIER2_S };
+
+static Metric m_rollup_frames("rollup_frames");         // Rollup frames published
+static Metric m_rollup_kept("rollup_kept");             // Status frames kept instead of published
+static Metric m_rollup_replayed("rollup_replayed");
+
+// Accumulated fields for one tier, in tenths (MateWire::ROLLUP_SCALE)
+struct Window {
+    uint64_t index;     // timestamp_ms / period, valid once there are samples
+    uint16_t samples;
+    int32_t  min[MateWire::MAX_STATUS_FIELDS];
+    int32_t  max[MateWire::MAX_STATUS_FIELDS];
+    int64_t  sum[MateWire::MAX_STATUS_FIELDS];
+};
+
+struct DeviceRollup {
+    const MateWire::StatusLayout* layout;
+    uint8_t port;
+    const char* status_topic;
+    uint32_t kept_seq;      // Sequence number of the next kept frame
+    Window windows[ROLLUP_TIERS];
+};
+
+// Only used by the MATE bus task
+static DeviceRollup devices[NUM_MATE_PORTS];
+static int device_count = 0;
+
+// Kept frames, in a circular buffer of bytes. Positions only ever increase,
+// and are wrapped when indexing into history.
+static uint8_t  history_internal[ROLLUP_HISTORY_SIZE];
+static uint8_t* history = history_internal;
+static uint32_t history_capacity = ROLLUP_HISTORY_SIZE;
+static uint32_t history_head = 0;
+static uint32_t history_tail = 0;
+
+static bool     replaying = false;
+static uint32_t replay_pos = 0;
+static uint32_t replay_end = 0;
+static uint64_t replay_from_ms = 0;     // Frames older than this are skipped
+static uint32_t tPrevReplay = 0;
+
+static char request_topic[MAX_TOPIC_LEN];           // Eg. 'mate/raw/get'
+static std::atomic<bool> replay_requested(false);   // Set by the network task
+
+static void readHistory(uint32_t pos, uint8_t* out, size_t len)
+{
+    size_t offset = pos % history_capacity;
+    size_t first = history_capacity - offset;
+    if (first > len)
+        first = len;
+    memcpy(out, &history[offset], first);
+    memcpy(&out[first], history, len - first);
+}
+
+static void writeHistory(uint32_t pos, const uint8_t* in, size_t len)
+{
+    size_t offset = pos % history_capacity;
+    size_t first = history_capacity - offset;
+    if (first > len)
+        first = len;
+    memcpy(&history[offset], in, first);
+    memcpy(history, &in[first], len - first);
+}
+
+// Positions wrap after 4GB
+static bool before(uint32_t a, uint32_t b)
+{
+    return static_cast<int32_t>(a - b) < 0;
+}
+
+namespace Rollup {
+
+void setup(const char* prefix)
+{
+#ifdef BOARD_HAS_PSRAM
+    if (psramFound()) {
+        uint8_t* buffer = static_cast<uint8_t*>(ps_malloc(ROLLUP_PSRAM_HISTORY_SIZE));
+        if (buffer != nullptr) {
+            history = buffer;
+            history_capacity = ROLLUP_PSRAM_HISTORY_SIZE;
+        }
+    }
+#endif
+
+    snprintf(request_topic, sizeof(request_topic), "%s/raw/get", prefix);
+}
+
+int addDevice(MateWire::DeviceType type, uint8_t port, const char* status_topic)
+{
+    const MateWire::StatusLayout* layout = MateWire::statusLayout(type);
+    if ((layout == nullptr) || (device_count >= NUM_MATE_PORTS))
+        return -1;
+
+    DeviceRollup& dev = devices[device_count];
+    dev.layout = layout;
+    dev.port = port;
+    dev.status_topic = status_topic;
+    dev.kept_seq = 0;
+    return device_count++;
+}
+
+uint16_t period(size_t tier)
+{
+    return tier_periods[tier];
+}
+
+size_t roll(int device, size_t tier, uint64_t timestamp_ms, uint8_t* payload, size_t size, uint64_t& start_ms)
+{
+    if (device < 0)
+        return 0;
+
+    DeviceRollup& dev = devices[device];
+    Window& w = dev.windows[tier];
+    uint64_t period_ms = static_cast<uint64_t>(tier_periods[tier]) * 1000;
+    uint64_t index = timestamp_ms / period_ms;
+
+    if (w.samples == 0) {
+        w.index = index;
+        return 0;
+    }
+    if (index == w.index)
+        return 0;
+
+    size_t n = MateWire::encodeRollupHeader(payload, size, tier_periods[tier], w.samples, static_cast<uint8_t>(dev.layout->count));
+    for (size_t i = 0; (i < dev.layout->count) && (n > 0); i++) {
+        MateWire::RollupField field;
+        field.min  = static_cast<int16_t>(w.min[i]);
+        field.max  = static_cast<int16_t>(w.max[i]);
+        field.mean = static_cast<int16_t>((w.sum[i] + ((w.sum[i] >= 0) ? (w.samples / 2) : -(w.samples / 2))) / w.samples);
+
+        size_t len = MateWire::encodeRollupField(&payload[n], size - n, field);
+        n = (len > 0) ? (n + len) : 0;
+    }
+
+    start_ms = w.index * period_ms;
+    w.index = index;
+    w.samples = 0;
+
+    if (n > 0) {
+        m_rollup_frames.add();
+    }
+    return n;
+}
+
+void add(int device, const uint8_t* status, size_t size)
+{
+    if (device < 0)
+        return;
+
+    DeviceRollup& dev = devices[device];
+    float values[MateWire::MAX_STATUS_FIELDS];
+    if (!MateWire::decodeStatus(*dev.layout, status, size, values))
+        return;
+
+    // Saturated to fit the rollup fields, so the mean does too
+    int32_t x[MateWire::MAX_STATUS_FIELDS];
+    for (size_t i = 0; i < dev.layout->count; i++) {
+        long v = lroundf(values[i] * MateWire::ROLLUP_SCALE);
+        x[i] = (v < INT16_MIN) ? INT16_MIN : (v > INT16_MAX) ? INT16_MAX : static_cast<int32_t>(v);
+    }
+
+    for (Window& w : dev.windows) {
+        if (w.samples == UINT16_MAX)
+            continue;   // Window is much longer than it should be, the clock must have stopped
+
+        for (size_t i = 0; i < dev.layout->count; i++) {
+            if ((w.samples == 0) || (x[i] < w.min[i])) w.min[i] = x[i];
+            if ((w.samples == 0) || (x[i] > w.max[i])) w.max[i] = x[i];
+            w.sum[i] = (w.samples == 0) ? x[i] : (w.sum[i] + x[i]);
+        }
+        w.samples++;
+    }
+}
+
+void keep(int device, uint64_t timestamp_ms, const uint8_t* status, size_t size)
+{
+    if ((device < 0) || (size == 0) || (size > MAX_STATUS_RESP_SIZE))
+        return;
+
+    uint32_t len = RECORD_HEADER_SIZE + size;
+    if (len > history_capacity)
+        return;
+
+    // Overwrite the oldest records
+    while ((history_head - history_tail + len) > history_capacity) {
+        uint8_t hdr[RECORD_HEADER_SIZE];
+        readHistory(history_tail, hdr, sizeof(hdr));
+        history_tail += RECORD_HEADER_SIZE + hdr[1];
+    }
+    if (replaying && before(replay_pos, history_tail)) {
+        replay_pos = history_tail;
+    }
+
+    uint8_t hdr[RECORD_HEADER_SIZE];
+    hdr[0] = static_cast<uint8_t>(device);
+    hdr[1] = static_cast<uint8_t>(size);
+    MateWire::put_u32(&hdr[2], devices[device].kept_seq++);
+    MateWire::put_u64(&hdr[6], timestamp_ms);
+    writeHistory(history_head, hdr, sizeof(hdr));
+    writeHistory(history_head + RECORD_HEADER_SIZE, status, size);
+    history_head += len;
+
+    m_rollup_kept.add();
+}
+
+void process(MatePubContext& context)
+{
+    if (replay_requested.exchange(false)) {
+        uint64_t now_ms;
+        replay_from_ms = getTimestampMs(&now_ms) ? (now_ms - (static_cast<uint64_t>(ROLLUP_HISTORY_S) * 1000)) : 0;
+        replay_pos = history_tail;
+        replay_end = history_head;
+        replaying = true;
+        LOG_INFO("Replaying raw status (%u bytes kept)", (unsigned)(history_head - history_tail));
+    }
+
+    if (!replaying)
+        return;
+
+    uint32_t now = static_cast<uint32_t>(millis());
+    if ((now - tPrevReplay) < ROLLUP_REPLAY_INTERVAL_MS)
+        return;
+    tPrevReplay = now;
+
+    // Skip over anything too old, and publish the next frame
+    while (before(replay_pos, replay_end)) {
+        uint8_t hdr[RECORD_HEADER_SIZE];
+        uint8_t status[MAX_STATUS_RESP_SIZE];
+        readHistory(replay_pos, hdr, sizeof(hdr));
+
+        MateWire::FrameHeader fh = {};
+        fh.type         = MateWire::FrameType::Status;
+        fh.flags        = MateWire::FLAG_NONE;
+        fh.seq          = MateWire::get_u32(&hdr[2]);
+        fh.timestamp_ms = MateWire::get_u64(&hdr[6]);
+        fh.boot         = context.boot;
+
+        if ((hdr[0] < device_count) && (fh.timestamp_ms >= replay_from_ms)) {
+            const DeviceRollup& dev = devices[hdr[0]];
+            fh.device_type = static_cast<uint8_t>(dev.layout->type);
+            fh.port = dev.port;
+
+            readHistory(replay_pos + RECORD_HEADER_SIZE, status, hdr[1]);
+            if (!context.publishFrame(dev.status_topic, fh, status, hdr[1]))
+                return; // Try again later
+            m_rollup_replayed.add();
+            replay_pos += RECORD_HEADER_SIZE + hdr[1];
+            return;
+        }
+        replay_pos += RECORD_HEADER_SIZE + hdr[1];
+    }
+
+    replaying = false;
+    LOG_INFO("Raw status replay done");
+}
+
+void subscribe(PubSubClient& client)
+{
+    client.subscribe(request_topic);
+}
+
+bool onMessage(const char* topic)
+{
+    if (strcmp(topic, request_topic) != 0)
+        return false;
+
+    replay_requested.store(true);
+    return true;
+}
+
+};
+
+#else
+
+namespace Rollup {
+
+void setup(const char* prefix) { }
+int addDevice(MateWire::DeviceType type, uint8_t port, const char* status_topic) { return -1; }
+uint16_t period(size_t tier) { return 0; }
+size_t roll(int device, size_t tier, uint64_t timestamp_ms, uint8_t* payload, size_t size, uint64_t& start_ms) { return 0; }
+void add(int device, const uint8_t* status, size_t size) { }
+void keep(int device, uint64_t timestamp_ms, const uint8_t* status, size_t size) { }
+void process(MatePubContext& context) { }
+void subscribe(PubSubClient& client) { }
+bool onMessage(const char* topic) { return false; }
+
+};
+
+#endif
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <PubSubClient.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <matewire.h>
+
+class MatePubContext;
+
+// Rollup windows (s). Each status field's min/max/mean is published once per window, per tier.
+#define ROLLUP_TIER1_S          (60)        // <prefix>/mx-1/rollup-1m
+#define ROLLUP_TIER2_S          (900)       // <prefix>/mx-1/rollup-15m
+#define ROLLUP_TIERS            (2)
+
+// How far back raw status is kept on the gateway, and replayed.
+// The history holds this long of status from one MX, FX and FLEXnet DC at their usual poll rates
+// (about 44KB of RAM), or at their fastest poll rates if PSRAM is available (about 124KB).
+#define ROLLUP_HISTORY_S            (3600)
+
+// Raw frames are replayed one at a time, at most this often
+#define ROLLUP_REPLAY_INTERVAL_MS   (50)
+
+// Downsampled status (MATE_ROLLUP).
+//
+// Long-term storage doesn't need every status read, but the collectors poll every few seconds.
+// With MATE_ROLLUP, status frames are kept on the gateway instead of being published, and each
+// device publishes the min/max/mean of its decoded status fields (see matestatus.h) over
+// 1 and 15 minute windows instead, as rollup frames (MateWire::FrameType::Rollup).
+// Windows are aligned to the wall clock, and a window is published when the first status
+// of the next one is read, so peaks are kept even though individual reads are not.
+//
+// The raw status from the last hour (or as much as fits) is replayed as status frames on the
+// usual status topics when anything is published to '<prefix>/raw/get', with the original
+// timestamps. Kept frames are numbered in a sequence of their own (per device), so the rollup
+// frames' sequence numbers have no gaps, and a replay can be checked for gaps on its own.
+//
+// Status is accumulated and replayed on the MATE bus task. subscribe() and onMessage()
+// are called from the network task.
+namespace Rollup
+{
+    void setup(const char* prefix);
+
+    // Add a device. Returns a handle for the functions below, or -1 if it has no status layout.
+    int addDevice(MateWire::DeviceType type, uint8_t port, const char* status_topic);
+
+    // Window length of a tier (s)
+    uint16_t period(size_t tier);
+
+    // If timestamp_ms is past the current window of a tier, encode the completed window into
+    // payload, start a new one and return the payload size. Returns 0 otherwise.
+    // start_ms is set to the start of the completed window.
+    size_t roll(int device, size_t tier, uint64_t timestamp_ms, uint8_t* payload, size_t size, uint64_t& start_ms);
+
+    // Accumulate a status read into the current window of every tier
+    void add(int device, const uint8_t* status, size_t size);
+
+    // Keep a status read for replay
+    void keep(int device, uint64_t timestamp_ms, const uint8_t* status, size_t size);
+
+    // Replay kept frames if requested
+    void process(MatePubContext& context);
+
+    // Subscribe to replay requests. Called once a new session is established.
+    void subscribe(PubSubClient& client);
+
+    // Returns true if the message was a replay request
+    bool onMessage(const char* topic);
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+// Thin wrapper over the few RTOS primitives used by the gateway.
+// On the ESP32 these map directly onto FreeRTOS. On a host build (no ARDUINO)
+// they are backed by std::thread, so code using them can be exercised on Linux.
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <chrono>
+#include <thread>
+#endif
+
+namespace rtos
+{
+    typedef void (*TaskFunction)(void* arg);
+
+#ifdef ARDUINO
+    static const int CORE_PRO = PRO_CPU_NUM;    // Core 0, shared with the WiFi/lwIP stack
+    static const int CORE_APP = APP_CPU_NUM;    // Core 1
+
+    inline bool createPinnedTask(TaskFunction fn, const char* name, uint32_t stack_size, void* arg, unsigned priority, int core)
+    {
+        return xTaskCreatePinnedToCore(fn, name, stack_size, arg, priority, nullptr, core) == pdPASS;
+    }
+
+    inline void delayMs(uint32_t ms)
+    {
+        vTaskDelay(pdMS_TO_TICKS(ms));
+    }
+
+    // Delete the calling task
+    inline void exitTask()
+    {
+        vTaskDelete(nullptr);
+    }
+#else
+    static const int CORE_PRO = 0;
+    static const int CORE_APP = 1;
+
+    // Host stand-in: core affinity and priority are ignored
+    inline bool createPinnedTask(TaskFunction fn, const char* name, uint32_t stack_size, void* arg, unsigned priority, int core)
+    {
+        std::thread(fn, arg).detach();
+        return true;
+    }
+
+    inline void delayMs(uint32_t ms)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    }
+
+    inline void exitTask()
+    {
+        // Threads cannot be terminated from the inside, so just park forever
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    }
+#endif
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Lock-free single-producer / single-consumer ring of fixed-size records.
+//
+// One task may call reserve()/commit()/push(), and one other task may call
+// front()/release()/pop(). Records are stored in place, so no allocation
+// happens after construction.
+//
+// N must be a power of two. The indices are free-running and only masked
+// when accessing the storage, so all N slots are usable.
+template <typename T, size_t N>
+class SpscRing {
+    static_assert((N > 0) && ((N & (N - 1)) == 0), "SpscRing size must be a power of two");
+
+public:
+    SpscRing()
+        : head(0)
+        , tail(0)
+        , dropped(0)
+    { }
+
+    // Producer: get a slot to fill in, or nullptr if the ring is full.
+    // The slot is not visible to the consumer until commit() is called.
+    T* reserve() {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        if ((h - t) >= N) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &slots[h & (N - 1)];
+    }
+
+    // Producer: publish the slot returned by reserve()
+    void commit() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool push(const T& item) {
+        T* slot = reserve();
+        if (slot == nullptr)
+            return false;
+        *slot = item;
+        commit();
+        return true;
+    }
+
+    // Consumer: get the oldest record, or nullptr if the ring is empty.
+    // The slot remains owned by the consumer until release() is called.
+    T* front() {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        if (h == t)
+            return nullptr;
+        return &slots[t & (N - 1)];
+    }
+
+    // Consumer: return the slot returned by front() to the producer
+    void release() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool pop(T& item) {
+        T* slot = front();
+        if (slot == nullptr)
+            return false;
+        item = *slot;
+        release();
+        return true;
+    }
+
+    // Approximate when called concurrently with the other side
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    bool empty() const { return size() == 0; }
+
+    static constexpr size_t capacity() { return N; }
+
+    // Number of records rejected because the ring was full
+    uint32_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    // Keep producer and consumer indices on separate cache lines
+    alignas(32) std::atomic<size_t> head;   // Written by producer
+    alignas(32) std::atomic<size_t> tail;   // Written by consumer
+    std::atomic<uint32_t> dropped;
+    T slots[N];
+};
@@ -0,0 +1,523 @@
+#ifndef MODE_NATIVE
+
+#include "tls-client.h"
+#include "metrics.h"
+#include "debug.h"
+
+#include <esp_attr.h>
+#include <mbedtls/error.h>
+#include <mbedtls/version.h>
+#include <lwip/sockets.h>
+#include <lwip/netdb.h>
+#include <errno.h>
+#include <matewire.h>
+
+// Longest a write may wait for the socket
+static const uint32_t writeTimeoutMs = 5000;
+
+// How long each wait for the socket lasts during the handshake
+static const uint32_t pollIntervalMs = 100;
+
+#define SAVED_SESSION_MAGIC (0x544C5331) // 'TLS1'
+
+static Metric m_tls_handshakes("tls_handshakes");       // Successful handshakes (full + resumed)
+static Metric m_tls_resumed("tls_resumed");             // Handshakes that resumed the previous session
+static Metric m_tls_handshake_ms("tls_handshake_ms");   // Duration of the last handshake
+static Metric m_tls_failures("tls_failures");
+
+// Session of the last handshake, kept across soft reboots (RTC memory is not
+// initialized on boot, so it is only trusted if the magic and CRC match)
+struct SavedSession {
+    uint32_t magic;
+    uint16_t port;
+    uint16_t size;
+    uint16_t crc;   // Over host, port & data
+    char     host[64];
+    uint8_t  data[TLS_SAVED_SESSION_SIZE];
+};
+static RTC_NOINIT_ATTR SavedSession saved;
+
+static uint16_t savedCrc()
+{
+    uint16_t crc = MateWire::crc16(reinterpret_cast<const uint8_t*>(saved.host), sizeof(saved.host));
+    crc = MateWire::crc16(reinterpret_cast<const uint8_t*>(&saved.port), sizeof(saved.port), crc);
+    return MateWire::crc16(saved.data, saved.size, crc);
+}
+
+#ifdef MBEDTLS_TLS_DEFAULT_ALLOW_SHA1_IN_CERTIFICATES
+static mbedtls_x509_crt_profile cert_profile;
+#endif
+
+static void logFailure(int rc)
+{
+    char err[64];
+    mbedtls_strerror(rc, err, sizeof(err));
+    LOG_ERROR("TLS handshake failed: %s (-0x%04x)", err, -rc);
+    m_tls_failures.add();
+}
+
+TlsClient::TlsClient()
+    : m_caPem(nullptr)
+    , m_host(nullptr)
+    , m_port(0)
+    , m_phase(Phase::Idle)
+    , m_resuming(false)
+    , m_pollFlags(0)
+    , m_tStart(0)
+    , m_configured(false)
+    , m_connected(false)
+    , m_resumed(false)
+    , m_haveSession(false)
+    , m_peeked(-1)
+    , m_helloSent(false)
+    , m_offeredIdLen(0)
+{
+    mbedtls_net_init(&m_net);
+    mbedtls_ssl_init(&m_ssl);
+    mbedtls_ssl_config_init(&m_conf);
+    mbedtls_x509_crt_init(&m_ca);
+    mbedtls_entropy_init(&m_entropy);
+    mbedtls_ctr_drbg_init(&m_drbg);
+    mbedtls_ssl_session_init(&m_session);
+}
+
+TlsClient::~TlsClient()
+{
+    stop();
+    mbedtls_ssl_session_free(&m_session);
+    mbedtls_ctr_drbg_free(&m_drbg);
+    mbedtls_entropy_free(&m_entropy);
+    mbedtls_x509_crt_free(&m_ca);
+    mbedtls_ssl_config_free(&m_conf);
+}
+
+bool TlsClient::configure()
+{
+    if (mbedtls_ctr_drbg_seed(&m_drbg, mbedtls_entropy_func, &m_entropy, nullptr, 0) != 0)
+        return false;
+
+    if (mbedtls_ssl_config_defaults(&m_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0)
+        return false;
+
+    mbedtls_ssl_conf_rng(&m_conf, mbedtls_ctr_drbg_random, &m_drbg);
+
+    if (m_caPem != nullptr) {
+        if (mbedtls_x509_crt_parse(&m_ca, reinterpret_cast<const unsigned char*>(m_caPem), strlen(m_caPem) + 1) != 0)
+            return false;
+
+        mbedtls_ssl_conf_ca_chain(&m_conf, &m_ca, nullptr);
+        mbedtls_ssl_conf_authmode(&m_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    }
+    else {
+        mbedtls_ssl_conf_authmode(&m_conf, MBEDTLS_SSL_VERIFY_NONE);
+    }
+
+#ifdef MBEDTLS_TLS_DEFAULT_ALLOW_SHA1_IN_CERTIFICATES
+    cert_profile = mbedtls_x509_crt_profile_default;
+    cert_profile.allowed_mds |= MBEDTLS_X509_ID_FLAG(MBEDTLS_MD_SHA1);
+    mbedtls_ssl_conf_cert_profile(&m_conf, &cert_profile);
+#endif
+
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+    mbedtls_ssl_conf_session_tickets(&m_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
+#ifdef MBEDTLS_SSL_PROTO_TLS1_3
+    // Sessions are resumed (and resumption detected) the TLS 1.2 way, by session ID or ticket.
+    // (A TLS 1.3 broker echoes the session ID whether or not it resumes)
+    mbedtls_ssl_conf_max_tls_version(&m_conf, MBEDTLS_SSL_VERSION_TLS1_2);
+#endif
+
+    m_configured = true;
+    return true;
+}
+
+int TlsClient::connect(IPAddress ip, uint16_t port)
+{
+    char host[16];
+    snprintf(host, sizeof(host), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+    return connect(host, port);
+}
+
+int TlsClient::connect(const char* host, uint16_t port)
+{
+    if (!connectBegin(host, port))
+        return 0;
+
+    int rc;
+    while ((rc = connectStep()) == 0) {
+        mbedtls_net_poll(&m_net, m_pollFlags, pollIntervalMs);
+    }
+    return (rc > 0) ? 1 : 0;
+}
+
+bool TlsClient::connectBegin(const char* host, uint16_t port)
+{
+    stop();
+
+    if (!m_configured && !configure()) {
+        LOG_ERROR("TLS setup failed");
+        m_tls_failures.add();
+        return false;
+    }
+
+    if (!m_haveSession) {
+        m_haveSession = loadSession(host, port);
+    }
+
+    m_host = host;
+    m_port = port;
+    int rc = open(m_haveSession);
+    if (rc != 0) {
+        logFailure(rc);
+        return false;
+    }
+    return true;
+}
+
+int TlsClient::connectStep()
+{
+    int rc = 0;
+    switch (m_phase) {
+        case Phase::Tcp: {
+            int ready = mbedtls_net_poll(&m_net, MBEDTLS_NET_POLL_WRITE, 0);
+            if (ready == 0) {
+                if ((static_cast<uint32_t>(millis()) - m_tStart) < TLS_HANDSHAKE_TIMEOUT_MS)
+                    return 0;
+                rc = MBEDTLS_ERR_SSL_TIMEOUT;
+            }
+            else if (ready < 0) {
+                rc = ready;
+            }
+            else {
+                // Writable once the connection has been made, or has failed
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if ((getsockopt(m_net.fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0) || (err != 0)) {
+                    rc = MBEDTLS_ERR_NET_CONNECT_FAILED;
+                }
+                else if ((rc = startHandshake()) == 0) {
+                    return 0;
+                }
+            }
+            break;
+        }
+
+        case Phase::Handshake:
+            rc = mbedtls_ssl_handshake(&m_ssl);
+            if (rc == 0) {
+                finishHandshake();
+                return 1;
+            }
+            if ((rc == MBEDTLS_ERR_SSL_WANT_READ) || (rc == MBEDTLS_ERR_SSL_WANT_WRITE)) {
+                m_pollFlags = (rc == MBEDTLS_ERR_SSL_WANT_READ) ? MBEDTLS_NET_POLL_READ : MBEDTLS_NET_POLL_WRITE;
+                if ((static_cast<uint32_t>(millis()) - m_tStart) < TLS_HANDSHAKE_TIMEOUT_MS)
+                    return 0;
+                rc = MBEDTLS_ERR_SSL_TIMEOUT;
+            }
+            break;
+
+        default:
+            return m_connected ? 1 : -1;
+    }
+
+    stop();
+
+    // A stale or corrupt session must never stop us connecting, so fall back to a full
+    // handshake (unless the broker couldn't be reached at all)
+    if (m_resuming &&
+        (rc != MBEDTLS_ERR_NET_UNKNOWN_HOST) && (rc != MBEDTLS_ERR_NET_CONNECT_FAILED) && (rc != MBEDTLS_ERR_SSL_TIMEOUT))
+    {
+        LOG_WARN("TLS resumption failed (-0x%04x), trying a full handshake", -rc);
+        clearSession();
+        rc = open(false);
+        if (rc == 0)
+            return 0;
+    }
+
+    logFailure(rc);
+    return -1;
+}
+
+// Start opening the TCP connection for a handshake, offering the cached session if resume is set.
+// Only the first address the host resolves to is tried.
+// Returns 0 or an mbedTLS error.
+int TlsClient::open(bool resume)
+{
+    char port_str[6];
+    snprintf(port_str, sizeof(port_str), "%u", m_port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    struct addrinfo* addr = nullptr;
+    if ((getaddrinfo(m_host, port_str, &hints, &addr) != 0) || (addr == nullptr))
+        return MBEDTLS_ERR_NET_UNKNOWN_HOST;
+
+    int rc = 0;
+    m_net.fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (m_net.fd < 0) {
+        rc = MBEDTLS_ERR_NET_SOCKET_FAILED;
+    }
+    else {
+        // Reads & writes must never block the network loop, and neither must connecting
+        mbedtls_net_set_nonblock(&m_net);
+        if ((::connect(m_net.fd, addr->ai_addr, addr->ai_addrlen) != 0) && (errno != EINPROGRESS)) {
+            rc = MBEDTLS_ERR_NET_CONNECT_FAILED;
+        }
+    }
+    freeaddrinfo(addr);
+
+    if (rc != 0) {
+        stop();
+        return rc;
+    }
+
+    m_resuming = resume;
+    m_phase = Phase::Tcp;
+    m_pollFlags = MBEDTLS_NET_POLL_WRITE;
+    m_tStart = static_cast<uint32_t>(millis());
+    return 0;
+}
+
+// Returns 0 or an mbedTLS error
+int TlsClient::startHandshake()
+{
+    int rc;
+    if (((rc = mbedtls_ssl_setup(&m_ssl, &m_conf)) != 0) ||
+        ((rc = mbedtls_ssl_set_hostname(&m_ssl, m_host)) != 0) ||
+        (m_resuming && ((rc = mbedtls_ssl_set_session(&m_ssl, &m_session)) != 0)))
+    {
+        return rc;
+    }
+    mbedtls_ssl_set_bio(&m_ssl, this, bioSend, bioRecv, nullptr);
+    m_offeredIdLen = 0;
+    m_helloSent = false;
+
+    m_phase = Phase::Handshake;
+    m_pollFlags = MBEDTLS_NET_POLL_WRITE;
+    m_tStart = static_cast<uint32_t>(millis());
+    return 0;
+}
+
+// The session ID offered in a ClientHello record (if buf is one). Returns its length.
+static size_t clientHelloSessionId(const unsigned char* buf, size_t len, unsigned char* id)
+{
+    const size_t offset = 5 + 4 + 2 + 32;   // Record header, handshake header, version, random
+    if ((len <= offset) || (buf[0] != MBEDTLS_SSL_MSG_HANDSHAKE) || (buf[5] != MBEDTLS_SSL_HS_CLIENT_HELLO))
+        return 0;
+
+    size_t id_len = buf[offset];
+    if ((id_len > TLS_SESSION_ID_SIZE) || (len < (offset + 1 + id_len)))
+        return 0;
+    memcpy(id, &buf[offset + 1], id_len);
+    return id_len;
+}
+
+// ID of a session. mbedTLS 3 makes the struct members private, and only has accessors from 3.4.
+static size_t sessionId(const mbedtls_ssl_session& session, const unsigned char*& id)
+{
+#if MBEDTLS_VERSION_NUMBER >= 0x03040000
+    id = *mbedtls_ssl_session_get_id(&session);
+    return mbedtls_ssl_session_get_id_len(&session);
+#elif MBEDTLS_VERSION_NUMBER < 0x03000000
+    id = session.id;
+    return session.id_len;
+#else
+    // Resumption isn't detected, so is counted as a full handshake
+    id = nullptr;
+    return 0;
+#endif
+}
+
+// Sends on m_net, noting the session ID offered in the ClientHello
+int TlsClient::bioSend(void* ctx, const unsigned char* buf, size_t len)
+{
+    TlsClient* tls = static_cast<TlsClient*>(ctx);
+    if (!tls->m_helloSent) {
+        // The first record written is the ClientHello, in full (even if it's not all sent at once)
+        tls->m_helloSent = true;
+        tls->m_offeredIdLen = clientHelloSessionId(buf, len, tls->m_offeredId);
+    }
+    return mbedtls_net_send(&tls->m_net, buf, len);
+}
+
+int TlsClient::bioRecv(void* ctx, unsigned char* buf, size_t len)
+{
+    return mbedtls_net_recv(&static_cast<TlsClient*>(ctx)->m_net, buf, len);
+}
+
+void TlsClient::finishHandshake()
+{
+    uint32_t elapsed = static_cast<uint32_t>(millis()) - m_tStart;
+
+    mbedtls_ssl_session_free(&m_session);
+    mbedtls_ssl_session_init(&m_session);
+    m_haveSession = (mbedtls_ssl_get_session(&m_ssl, &m_session) == 0);
+
+    // The broker resumes a session by echoing the session ID offered (which is random when
+    // offering a ticket), a full handshake gets a new one
+    const unsigned char* id = nullptr;
+    size_t id_len = m_haveSession ? sessionId(m_session, id) : 0;
+    m_resumed = m_resuming && (m_offeredIdLen > 0) && (id_len == m_offeredIdLen) &&
+                (memcmp(id, m_offeredId, id_len) == 0);
+
+    m_phase = Phase::Idle;
+    m_connected = true;
+    m_tls_handshakes.add();
+    m_tls_handshake_ms.set(elapsed);
+    if (m_resumed) {
+        m_tls_resumed.add();
+    }
+    LOG_INFO("TLS %s handshake: %ums", m_resumed ? "resumed" : "full", elapsed);
+
+    saveSession(m_host, m_port);
+}
+
+void TlsClient::clearSession()
+{
+    mbedtls_ssl_session_free(&m_session);
+    mbedtls_ssl_session_init(&m_session);
+    m_haveSession = false;
+    saved.magic = 0;
+}
+
+void TlsClient::saveSession(const char* host, uint16_t port)
+{
+    if (!m_haveSession)
+        return;
+
+    size_t len = 0;
+    saved.magic = 0;
+    if ((strlen(host) >= sizeof(saved.host)) ||
+        (mbedtls_ssl_session_save(&m_session, saved.data, sizeof(saved.data), &len) != 0))
+    {
+        return; // Too large, only kept in RAM
+    }
+
+    memset(saved.host, 0, sizeof(saved.host));
+    strncpy(saved.host, host, sizeof(saved.host) - 1);
+    saved.port = port;
+    saved.size = static_cast<uint16_t>(len);
+    saved.crc = savedCrc();
+    saved.magic = SAVED_SESSION_MAGIC;
+}
+
+bool TlsClient::loadSession(const char* host, uint16_t port)
+{
+    if ((saved.magic != SAVED_SESSION_MAGIC) || (saved.size > sizeof(saved.data)) || (saved.crc != savedCrc()))
+        return false;
+
+    if ((saved.port != port) || (strncmp(saved.host, host, sizeof(saved.host)) != 0))
+        return false;
+
+    mbedtls_ssl_session_free(&m_session);
+    mbedtls_ssl_session_init(&m_session);
+    if (mbedtls_ssl_session_load(&m_session, saved.data, saved.size) != 0) {
+        clearSession();
+        return false;
+    }
+    return true;
+}
+
+size_t TlsClient::write(const uint8_t* buf, size_t size)
+{
+    if (!m_connected)
+        return 0;
+
+    size_t n = 0;
+    uint32_t tStart = static_cast<uint32_t>(millis());
+    while (n < size) {
+        int rc = mbedtls_ssl_write(&m_ssl, buf + n, size - n);
+        if (rc > 0) {
+            n += rc;
+        }
+        else if (((rc == MBEDTLS_ERR_SSL_WANT_WRITE) || (rc == MBEDTLS_ERR_SSL_WANT_READ)) &&
+                 ((static_cast<uint32_t>(millis()) - tStart) < writeTimeoutMs))
+        {
+            // Socket buffer full, wait briefly for it to drain
+            mbedtls_net_poll(&m_net, (rc == MBEDTLS_ERR_SSL_WANT_READ) ? MBEDTLS_NET_POLL_READ : MBEDTLS_NET_POLL_WRITE, pollIntervalMs);
+        }
+        else {
+            stop();
+            break;
+        }
+    }
+    return n;
+}
+
+int TlsClient::available()
+{
+    if (!m_connected)
+        return 0;
+
+    // Only decrypted data is counted, so read ahead one byte to find out if a record has arrived
+    peek();
+    return (m_connected ? static_cast<int>(mbedtls_ssl_get_bytes_avail(&m_ssl)) : 0) + ((m_peeked >= 0) ? 1 : 0);
+}
+
+int TlsClient::read()
+{
+    uint8_t c;
+    return (read(&c, 1) == 1) ? c : -1;
+}
+
+int TlsClient::read(uint8_t* buf, size_t size)
+{
+    if (!m_connected || (size == 0))
+        return -1;
+
+    size_t n = 0;
+    if (m_peeked >= 0) {
+        buf[n++] = static_cast<uint8_t>(m_peeked);
+        m_peeked = -1;
+    }
+
+    if (n < size) {
+        int rc = mbedtls_ssl_read(&m_ssl, buf + n, size - n);
+        if (rc > 0) {
+            n += rc;
+        }
+        else if ((rc != MBEDTLS_ERR_SSL_WANT_READ) && (rc != MBEDTLS_ERR_SSL_WANT_WRITE)) {
+            stop(); // Closed by the peer
+        }
+    }
+    return (n > 0) ? static_cast<int>(n) : -1;
+}
+
+int TlsClient::peek()
+{
+    if ((m_peeked < 0) && m_connected) {
+        uint8_t c;
+        if (read(&c, 1) == 1)
+            m_peeked = c;
+    }
+    return m_peeked;
+}
+
+void TlsClient::stop()
+{
+    if (m_connected) {
+        mbedtls_ssl_close_notify(&m_ssl);
+    }
+    mbedtls_ssl_free(&m_ssl);
+    mbedtls_ssl_init(&m_ssl);
+    mbedtls_net_free(&m_net);
+    m_phase = Phase::Idle;
+    m_connected = false;
+    m_peeked = -1;
+}
+
+uint8_t TlsClient::connected()
+{
+    // Detects a connection closed by the peer
+    if (m_connected && (m_peeked < 0)) {
+        peek();
+    }
+    return m_connected ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#pragma once
+
+#ifndef MODE_NATIVE
+
+#include <Arduino.h>
+#include <Client.h>
+
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/x509_crt.h>
+
+// Longest the TCP connection, and then the TLS handshake, may each take
+#define TLS_HANDSHAKE_TIMEOUT_MS (15000)
+
+// Space for the saved session (including the session ticket and peer certificate)
+// that survives a soft reboot. Sessions that don't fit are only kept in RAM.
+#define TLS_SAVED_SESSION_SIZE (2048)
+
+// Longest TLS session ID
+#define TLS_SESSION_ID_SIZE (32)
+
+// TLS client (mbedTLS) that resumes the previous session when reconnecting,
+// replacing WiFiClientSecure, which always performs a full handshake.
+//
+// The session (ticket or session ID) of the last successful handshake is offered to the
+// broker on the next connect. Resumption skips certificate verification and key exchange,
+// which take seconds of CPU on the ESP32. If the broker doesn't accept it, mbedTLS falls
+// back to a full handshake; if the resumed handshake fails, the session is discarded and
+// a full handshake is made straight away.
+//
+// The session is also kept in RTC memory, so it survives a soft reboot (eg. OTA update or
+// watchdog reset), but not a power cycle.
+//
+// connect() blocks until the handshake is done. The connection manager uses connectBegin()
+// and connectStep() instead, which never wait on the network: the TCP connection is opened
+// without blocking (only the DNS lookup may), and each step makes one non-blocking call to
+// mbedtls_ssl_handshake(). The CPU-bound parts of a full handshake (key exchange,
+// certificate verification) still run within a single step.
+class TlsClient : public Client {
+public:
+    TlsClient();
+    ~TlsClient();
+
+    // PEM CA certificate used to verify the broker (must remain valid)
+    void setCACert(const char* pem) { m_caPem = pem; }
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char* host, uint16_t port) override;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buf, size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t* buf, size_t size) override;
+    int peek() override;
+    void flush() override { }
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return m_connected; }
+    using Print::write;
+
+    // Start connecting without blocking. Returns false if it failed straight away.
+    bool connectBegin(const char* host, uint16_t port);
+
+    // Advance the connection started by connectBegin().
+    // Returns 1 once connected, 0 while in progress, or -1 if it failed.
+    int connectStep();
+
+    // Whether the current connection resumed a previous session
+    bool resumed() const { return m_resumed; }
+
+    // Forget the cached session, so the next connect makes a full handshake
+    void clearSession();
+
+private:
+    enum class Phase : uint8_t {
+        Idle,
+        Tcp,        // Waiting for the TCP connection
+        Handshake,
+    };
+
+    bool configure();
+    int open(bool resume);
+    int startHandshake();
+    void finishHandshake();
+    void saveSession(const char* host, uint16_t port);
+    bool loadSession(const char* host, uint16_t port);
+    static int bioSend(void* ctx, const unsigned char* buf, size_t len);
+    static int bioRecv(void* ctx, unsigned char* buf, size_t len);
+
+    const char* m_caPem;
+    const char* m_host;
+    uint16_t m_port;
+    Phase m_phase;
+    bool m_resuming;    // Offering the cached session
+    uint32_t m_pollFlags;   // What the current step is waiting on (MBEDTLS_NET_POLL_...)
+    uint32_t m_tStart;  // Of the current phase
+    bool m_configured;
+    bool m_connected;
+    bool m_resumed;
+    bool m_haveSession;
+    int m_peeked;
+    bool m_helloSent;
+    uint8_t m_offeredId[TLS_SESSION_ID_SIZE];   // Session ID sent in the ClientHello
+    size_t m_offeredIdLen;
+
+    mbedtls_net_context m_net;
+    mbedtls_ssl_context m_ssl;
+    mbedtls_ssl_config m_conf;
+    mbedtls_x509_crt m_ca;
+    mbedtls_entropy_context m_entropy;
+    mbedtls_ctr_drbg_context m_drbg;
+    mbedtls_ssl_session m_session;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "topic-alias.h"
+#include "debug.h"
+
+#include <atomic>
+
+#ifdef MQTT_SHORT_TOPICS
+
+static char topic[MAX_TOPIC_LEN + sizeof("/topics")];    // Eg. 'mate/topics'
+static char prefix[MAX_TOPIC_LEN];
+static char keys[TOPIC_ALIAS_MAX][TOPIC_ALIAS_KEY_LEN];  // Eg. 'mx3s'
+static char topics[TOPIC_ALIAS_MAX][MAX_TOPIC_LEN];     // Full topic for each key
+static std::atomic<size_t> count(0);                    // Written by the MATE bus task, read by the network task
+static size_t published = 0;                            // Aliases in the last published table
+
+namespace TopicAlias {
+
+void setup(const char* p)
+{
+    strncpy(prefix, p, sizeof(prefix) - 1);
+    snprintf(topic, sizeof(topic), "%s/topics", prefix);
+}
+
+bool add(const char* full, const char* key, char* alias, size_t alias_size)
+{
+    size_t n = count.load(std::memory_order_relaxed);
+    if (strlen(key) >= TOPIC_ALIAS_KEY_LEN)
+        return false;
+
+    // Collectors are only created once, but don't add a key twice if one is re-created
+    size_t i = 0;
+    while ((i < n) && (strcmp(keys[i], key) != 0)) {
+        i++;
+    }
+    if ((i < n) && (strcmp(topics[i], full) != 0))
+        return false;   // Eg. two devices reporting the same port
+    if (i == TOPIC_ALIAS_MAX)
+        return false;
+
+    int len = snprintf(alias, alias_size, "%s/%s", prefix, key);
+    if ((len < 0) || (static_cast<size_t>(len) >= strlen(full)))
+        return false;
+
+    if (i == n) {
+        strncpy(keys[i], key, TOPIC_ALIAS_KEY_LEN - 1);
+        strncpy(topics[i], full, MAX_TOPIC_LEN - 1);
+        count.store(n + 1, std::memory_order_release);
+    }
+
+    LOG_INFO("Topic alias: %s = %s (saves %u bytes per message)", alias, full, (unsigned)(strlen(full) - len));
+    return true;
+}
+
+void publish(PubSubClient& client)
+{
+    size_t n = count.load(std::memory_order_acquire);
+    published = 0;  // Retried by process() if this fails
+    if (n == 0)
+        return;
+
+    // Streamed, as the table may not fit in PubSubClient's buffer
+    size_t len = 2; // {}
+    for (size_t i = 0; i < n; i++) {
+        len += 1 + strlen(keys[i]) + 3 + strlen(topics[i]) + 1 + ((i > 0) ? 1 : 0);   // "key":"topic"
+    }
+
+    if (!client.beginPublish(topic, len, true))
+        return;
+
+    client.write('{');
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0) {
+            client.write(',');
+        }
+        client.write('"');
+        client.write(reinterpret_cast<const uint8_t*>(keys[i]), strlen(keys[i]));
+        client.write(reinterpret_cast<const uint8_t*>("\":\""), 3);
+        client.write(reinterpret_cast<const uint8_t*>(topics[i]), strlen(topics[i]));
+        client.write('"');
+    }
+    client.write('}');
+
+    if (client.endPublish()) {
+        published = n;
+    }
+}
+
+void process(PubSubClient& client)
+{
+    if ((published != count.load(std::memory_order_acquire)) && client.connected()) {
+        publish(client);
+    }
+}
+
+};
+
+#else
+
+namespace TopicAlias {
+
+void setup(const char* prefix) { }
+bool add(const char* topic, const char* key, char* alias, size_t alias_size) { return false; }
+void publish(PubSubClient& client) { }
+void process(PubSubClient& client) { }
+
+};
+
+#endif
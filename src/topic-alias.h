@@ -0,0 +1,42 @@
+#pragma once
+
+#include <PubSubClient.h>
+
+#include "mate-frame.h"
+
+// Maximum number of aliased topics (3 per device)
+#define TOPIC_ALIAS_MAX (32)
+
+// Longest alias key, eg. 'mx10s' (plus the terminator)
+#define TOPIC_ALIAS_KEY_LEN (8)
+
+// Short topics (MQTT_SHORT_TOPICS).
+//
+// Frame topics like 'mate/mx-1/mx-status' are often as long as the payload itself, and
+// are sent with every message. With MQTT_SHORT_TOPICS, the frequently published topics
+// (status, logpage & diagnostics) are replaced by a short alias named after the device type,
+// port and topic, eg. 'mate/mx3s' for the status of the MX on hub port 3.
+// Aliases don't depend on the order devices are found in, so frames buffered before a reboot
+// (and replayed after it) are still on the right alias.
+// The alias table is published (retained) to '<prefix>/topics' at the start of
+// each session, and whenever an alias is added, as a JSON object:
+//   {"mx3s":"mate/mx-1/mx-status","mx3l":"mate/mx-1/mx-logpage",...}
+// so the aggregator can map aliased messages back to their full topic.
+//
+// This is the MQTT 3.1.1 equivalent of MQTT 5 topic aliases (which PubSubClient doesn't support),
+// except that the mapping is sent once per session on its own topic, rather than with the first message.
+namespace TopicAlias
+{
+    void setup(const char* prefix);
+
+    // Get the short topic ('<prefix>/<key>') to publish instead of topic.
+    // Returns false (leaving topic to be used as is) if the table is full, the key is already
+    // used for another topic, or the alias is no shorter.
+    bool add(const char* topic, const char* key, char* alias, size_t alias_size);
+
+    // Publish the alias table. Called once a new session is established.
+    void publish(PubSubClient& client);
+
+    // Publish the alias table again if aliases were added since
+    void process(PubSubClient& client);
+};
@@ -0,0 +1,273 @@
+// Host tests for the QoS 1 in-flight window (MQTT_QOS1), against a fake broker.
+// Run with `pio test -e native_features`.
+
+#include <unity.h>
+#include <vector>
+
+#include <PubSubClient.h>
+#include "inflight.h"
+
+#define MQTT_CONNECT    (0x10)
+#define MQTT_PUBLISH    (0x30)
+#define MQTT_FLAG_DUP   (0x08)
+
+struct Publish {
+    uint8_t  flags;
+    uint16_t id;
+    std::vector<uint8_t> payload;
+};
+
+// Accepts CONNECT, and records everything else written to it. PUBACKs are sent by the test.
+class FakeBroker : public Client {
+public:
+    std::vector<uint8_t> written;
+
+    int connect(IPAddress ip, uint16_t port) override { m_connected = true; return 1; }
+    int connect(const char* host, uint16_t port) override { m_connected = true; return 1; }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buf, size_t size) override
+    {
+        if (!m_connected)
+            return 0;
+
+        if ((size > 0) && ((buf[0] & 0xF0) == MQTT_CONNECT)) {
+            static const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+            m_rx.assign(connack, connack + sizeof(connack));
+            return size;
+        }
+        written.insert(written.end(), buf, buf + size);
+        return size;
+    }
+
+    int available() override { return static_cast<int>(m_rx.size()); }
+    int read() override
+    {
+        if (m_rx.empty())
+            return -1;
+        uint8_t c = m_rx.front();
+        m_rx.erase(m_rx.begin());
+        return c;
+    }
+    int read(uint8_t* buf, size_t size) override
+    {
+        size_t n = 0;
+        while ((n < size) && !m_rx.empty()) {
+            buf[n++] = static_cast<uint8_t>(read());
+        }
+        return static_cast<int>(n);
+    }
+    int peek() override { return m_rx.empty() ? -1 : m_rx.front(); }
+    void flush() override { }
+    void stop() override { m_connected = false; }
+    uint8_t connected() override { return m_connected ? 1 : 0; }
+    operator bool() override { return m_connected; }
+
+    // PUBLISH packets written since the last call
+    std::vector<Publish> publishes()
+    {
+        std::vector<Publish> result;
+        size_t pos = 0;
+        while (pos < written.size()) {
+            uint8_t header = written[pos++];
+            size_t len = 0;
+            for (int shift = 0; ; shift += 7) {
+                uint8_t b = written[pos++];
+                len |= static_cast<size_t>(b & 0x7F) << shift;
+                if (!(b & 0x80))
+                    break;
+            }
+
+            if ((header & 0xF0) == MQTT_PUBLISH) {
+                size_t topic_len = (written[pos] << 8) | written[pos + 1];
+                size_t id_pos = pos + 2 + topic_len;
+
+                Publish p;
+                p.flags = header & 0x0F;
+                p.id = static_cast<uint16_t>((written[id_pos] << 8) | written[id_pos + 1]);
+                p.payload.assign(written.begin() + id_pos + 2, written.begin() + pos + len);
+                result.push_back(p);
+            }
+            pos += len;
+        }
+        written.clear();
+        return result;
+    }
+
+private:
+    bool m_connected = false;
+    std::vector<uint8_t> m_rx;
+};
+
+static FakeBroker broker;
+static PubSubClient client(broker);
+
+static void connect()
+{
+    TEST_ASSERT_TRUE(client.connect("test", nullptr, nullptr));
+    broker.written.clear();
+}
+
+static bool publish(uint8_t value)
+{
+    return Inflight::publish(client, "mate/mx-1/status", &value, 1, false);
+}
+
+void setUp()
+{
+    client.setServer("broker", 1883);
+    if (!client.connected()) {
+        connect();
+    }
+
+    // Acknowledge anything left over from the previous test
+    broker.written.clear();
+    Inflight::resend(client);
+    for (const Publish& p : broker.publishes()) {
+        Inflight::onPuback(p.id);
+    }
+    Inflight::process(client, static_cast<uint32_t>(millis()));
+    TEST_ASSERT_EQUAL(0, Inflight::pending());
+}
+
+void tearDown() { }
+
+void test_window_full()
+{
+    for (uint8_t i = 0; i < INFLIGHT_WINDOW; i++) {
+        TEST_ASSERT_TRUE(publish(i));
+    }
+    TEST_ASSERT_FALSE(publish(0xFF));
+    TEST_ASSERT_EQUAL(INFLIGHT_WINDOW, Inflight::pending());
+
+    Inflight::process(client, static_cast<uint32_t>(millis()));
+    TEST_ASSERT_TRUE(Inflight::congested());
+
+    std::vector<Publish> sent = broker.publishes();
+    TEST_ASSERT_EQUAL(INFLIGHT_WINDOW, sent.size());
+    Inflight::onPuback(sent[0].id);
+    TEST_ASSERT_FALSE(Inflight::congested());
+    TEST_ASSERT_EQUAL(INFLIGHT_WINDOW - 1, Inflight::pending());
+    TEST_ASSERT_TRUE(publish(0xFF));
+}
+
+void test_out_of_order_acks()
+{
+    publish(1);
+    publish(2);
+    publish(3);
+    std::vector<Publish> sent = broker.publishes();
+    TEST_ASSERT_EQUAL(3, sent.size());
+
+    // Slots are only released once everything before them is acknowledged
+    Inflight::onPuback(sent[2].id);
+    Inflight::onPuback(sent[1].id);
+    TEST_ASSERT_EQUAL(3, Inflight::pending());
+
+    Inflight::onPuback(sent[0].id);
+    TEST_ASSERT_EQUAL(0, Inflight::pending());
+}
+
+void test_unknown_puback_ignored()
+{
+    publish(1);
+    std::vector<Publish> sent = broker.publishes();
+
+    Inflight::onPuback(static_cast<uint16_t>(sent[0].id + 100));
+    TEST_ASSERT_EQUAL(1, Inflight::pending());
+}
+
+void test_resend_after_reconnect()
+{
+    publish(1);
+    publish(2);
+    publish(3);
+    std::vector<Publish> sent = broker.publishes();
+    Inflight::onPuback(sent[1].id);
+
+    broker.stop();
+    connect();
+    Inflight::resend(client);
+
+    // Unacknowledged packets only, in their original order, with DUP set
+    std::vector<Publish> resent = broker.publishes();
+    TEST_ASSERT_EQUAL(2, resent.size());
+    TEST_ASSERT_EQUAL(sent[0].id, resent[0].id);
+    TEST_ASSERT_EQUAL(sent[2].id, resent[1].id);
+    TEST_ASSERT_EQUAL(1, resent[0].payload[0]);
+    TEST_ASSERT_EQUAL(3, resent[1].payload[0]);
+    TEST_ASSERT_TRUE(resent[0].flags & MQTT_FLAG_DUP);
+    TEST_ASSERT_FALSE(sent[0].flags & MQTT_FLAG_DUP);
+}
+
+void test_lost_puback_reconnects()
+{
+    uint32_t tBefore = static_cast<uint32_t>(millis());
+    publish(1);
+    publish(2);
+    uint32_t tAfter = static_cast<uint32_t>(millis());
+    std::vector<Publish> sent = broker.publishes();
+
+    // The second PUBACK arrives, the first is lost
+    Inflight::onPuback(sent[1].id);
+
+    Inflight::process(client, tBefore + INFLIGHT_ACK_TIMEOUT_MS - 1);
+    TEST_ASSERT_TRUE(client.connected());
+
+    Inflight::process(client, tAfter + INFLIGHT_ACK_TIMEOUT_MS);
+    TEST_ASSERT_FALSE(client.connected());
+    TEST_ASSERT_FALSE(Inflight::congested());
+    TEST_ASSERT_EQUAL(2, Inflight::pending());
+
+    // The new session gets the lost publish again, and the window drains
+    connect();
+    Inflight::resend(client);
+    std::vector<Publish> resent = broker.publishes();
+    TEST_ASSERT_EQUAL(1, resent.size());
+    TEST_ASSERT_EQUAL(sent[0].id, resent[0].id);
+
+    Inflight::onPuback(resent[0].id);
+    TEST_ASSERT_EQUAL(0, Inflight::pending());
+}
+
+void test_full_window_unblocks_after_timeout()
+{
+    for (uint8_t i = 0; i < INFLIGHT_WINDOW; i++) {
+        publish(i);
+    }
+    uint32_t tAfter = static_cast<uint32_t>(millis());
+    Inflight::process(client, tAfter);
+    TEST_ASSERT_TRUE(Inflight::congested());
+
+    // No PUBACKs at all: polling mustn't stay stopped
+    Inflight::process(client, tAfter + INFLIGHT_ACK_TIMEOUT_MS);
+    TEST_ASSERT_FALSE(Inflight::congested());
+    TEST_ASSERT_FALSE(client.connected());
+}
+
+void test_no_timeout_once_acked()
+{
+    publish(1);
+    uint32_t tAfter = static_cast<uint32_t>(millis());
+    for (const Publish& p : broker.publishes()) {
+        Inflight::onPuback(p.id);
+    }
+
+    Inflight::process(client, tAfter + (10 * INFLIGHT_ACK_TIMEOUT_MS));
+    TEST_ASSERT_TRUE(client.connected());
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+#ifdef MQTT_QOS1
+    RUN_TEST(test_window_full);
+    RUN_TEST(test_out_of_order_acks);
+    RUN_TEST(test_unknown_puback_ignored);
+    RUN_TEST(test_resend_after_reconnect);
+    RUN_TEST(test_lost_puback_reconnects);
+    RUN_TEST(test_full_window_unblocks_after_timeout);
+    RUN_TEST(test_no_timeout_once_acked);
+#endif
+    return UNITY_END();
+}
@@ -0,0 +1,128 @@
+// Host tests for the adaptive status poll interval.
+// Run with `pio test -e native`.
+
+#include <unity.h>
+#include <string.h>
+
+#include "poll-rate.h"
+
+using MateWire::DeviceType;
+
+static uint8_t status[MateWire::MX_STATUS_SIZE];
+
+// MX status with charge current a + tenths/10 (A) and battery voltage v10/10 (V)
+static void setMx(uint8_t a, uint8_t tenths, uint16_t v10)
+{
+    memset(status, 0, sizeof(status));
+    status[0] = tenths;
+    status[1] = 0x80 + a;   // Offset by 128
+    status[2] = 0x80;
+    status[9] = v10 >> 8;
+    status[10] = v10 & 0xFF;
+}
+
+void setUp() { }
+void tearDown() { }
+
+void test_first_poll_counts_as_changed()
+{
+    PollRate rate(2000, 8000, 60000, MateWire::statusLayout(DeviceType::Mx));
+    setMx(10, 0, 520);
+    TEST_ASSERT_TRUE(rate.update(status, sizeof(status)));
+    TEST_ASSERT_EQUAL_UINT32(8000, rate.interval());
+}
+
+void test_noise_backs_off()
+{
+    PollRate rate(2000, 8000, 60000, MateWire::statusLayout(DeviceType::Mx));
+    setMx(10, 0, 520);
+    rate.update(status, sizeof(status));
+
+    // Tenths of an amp and a tenth of a volt either way: the raw bytes change every time
+    for (int i = 0; i < 20; i++) {
+        setMx(10, (i & 1) ? 3 : 0, 520 + (i & 1));
+        TEST_ASSERT_FALSE(rate.update(status, sizeof(status)));
+    }
+    TEST_ASSERT_EQUAL_UINT32(60000, rate.interval());
+}
+
+void test_step_speeds_up()
+{
+    PollRate rate(2000, 8000, 60000, MateWire::statusLayout(DeviceType::Mx));
+    setMx(10, 0, 520);
+    rate.update(status, sizeof(status));
+
+    setMx(12, 0, 520);
+    TEST_ASSERT_TRUE(rate.update(status, sizeof(status)));
+    TEST_ASSERT_EQUAL_UINT32(4000, rate.interval());
+
+    setMx(12, 0, 523);
+    TEST_ASSERT_TRUE(rate.update(status, sizeof(status)));
+    TEST_ASSERT_EQUAL_UINT32(2000, rate.interval());
+}
+
+void test_drift_is_detected()
+{
+    PollRate rate(2000, 8000, 60000, MateWire::statusLayout(DeviceType::Mx));
+    setMx(10, 0, 520);
+    rate.update(status, sizeof(status));
+
+    // 0.3A per poll is under the threshold each time, but not in total
+    setMx(10, 3, 520);
+    TEST_ASSERT_FALSE(rate.update(status, sizeof(status)));
+    setMx(10, 6, 520);
+    TEST_ASSERT_FALSE(rate.update(status, sizeof(status)));
+    setMx(10, 9, 520);
+    TEST_ASSERT_FALSE(rate.update(status, sizeof(status)));
+    setMx(11, 2, 520);
+    TEST_ASSERT_TRUE(rate.update(status, sizeof(status)));
+
+    // Compared against the new reference from here on
+    setMx(11, 5, 520);
+    TEST_ASSERT_FALSE(rate.update(status, sizeof(status)));
+}
+
+void test_state_change_counts()
+{
+    PollRate rate(2000, 8000, 60000, MateWire::statusLayout(DeviceType::Mx));
+    setMx(10, 0, 520);
+    rate.update(status, sizeof(status));
+
+    status[7] = 2;  // charge_state
+    TEST_ASSERT_TRUE(rate.update(status, sizeof(status)));
+}
+
+void test_raw_without_layout()
+{
+    PollRate rate(2000, 8000, 60000);
+    setMx(10, 0, 520);
+    rate.update(status, sizeof(status));
+
+    setMx(10, 1, 520);
+    TEST_ASSERT_TRUE(rate.update(status, sizeof(status)));
+    TEST_ASSERT_FALSE(rate.update(status, sizeof(status)));
+}
+
+void test_short_status_falls_back_to_raw()
+{
+    PollRate rate(2000, 8000, 60000, MateWire::statusLayout(DeviceType::Mx));
+    setMx(10, 0, 520);
+    rate.update(status, 4);
+
+    status[0] = 1;
+    TEST_ASSERT_TRUE(rate.update(status, 4));
+    TEST_ASSERT_FALSE(rate.update(status, 4));
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_first_poll_counts_as_changed);
+    RUN_TEST(test_noise_backs_off);
+    RUN_TEST(test_step_speeds_up);
+    RUN_TEST(test_drift_is_detected);
+    RUN_TEST(test_state_change_counts);
+    RUN_TEST(test_raw_without_layout);
+    RUN_TEST(test_short_status_falls_back_to_raw);
+    return UNITY_END();
+}
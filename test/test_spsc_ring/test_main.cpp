@@ -0,0 +1,173 @@
+// Host tests for the bus task -> network task frame queue (MODE_DUAL_CORE).
+// Run with `pio test -e native`.
+
+#include <unity.h>
+#include <thread>
+#include <atomic>
+
+#include "spsc-ring.h"
+#include "frame-queue.h"
+
+#define STRESS_FRAMES   (200000)
+
+typedef SpscRing<MateFrame, FRAME_QUEUE_SIZE> FrameRing;
+
+// Payload bytes are derived from the sequence number, so a torn or reordered frame is detected
+static void fillStatus(uint32_t seq, uint8_t* status, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        status[i] = static_cast<uint8_t>((seq * 31) + i);
+    }
+}
+
+void setUp() { }
+void tearDown() { }
+
+void test_fill_and_drain()
+{
+    SpscRing<uint32_t, 4> ring;
+    uint32_t x = 0;
+
+    TEST_ASSERT_TRUE(ring.empty());
+    TEST_ASSERT_FALSE(ring.pop(x));
+
+    for (uint32_t i = 0; i < 4; i++) {
+        TEST_ASSERT_TRUE(ring.push(i));
+    }
+    TEST_ASSERT_EQUAL(4, ring.size());
+    TEST_ASSERT_FALSE(ring.push(4));
+    TEST_ASSERT_NULL(ring.reserve());
+    TEST_ASSERT_EQUAL(2, ring.droppedCount());
+
+    for (uint32_t i = 0; i < 4; i++) {
+        TEST_ASSERT_TRUE(ring.pop(x));
+        TEST_ASSERT_EQUAL(i, x);
+    }
+    TEST_ASSERT_TRUE(ring.empty());
+    TEST_ASSERT_NULL(ring.front());
+}
+
+// Indices are free-running, so keep wrapping the storage
+void test_wraparound()
+{
+    SpscRing<uint32_t, 4> ring;
+    uint32_t x = 0;
+
+    for (uint32_t i = 0; i < 1000; i++) {
+        TEST_ASSERT_TRUE(ring.push(i));
+        TEST_ASSERT_TRUE(ring.push(i + 1));
+        TEST_ASSERT_TRUE(ring.pop(x));
+        TEST_ASSERT_EQUAL(i, x);
+        TEST_ASSERT_TRUE(ring.pop(x));
+        TEST_ASSERT_EQUAL(i + 1, x);
+    }
+    TEST_ASSERT_EQUAL(0, ring.droppedCount());
+}
+
+void test_threads_in_order()
+{
+    static SpscRing<uint32_t, 8> ring;
+
+    std::thread producer([] {
+        for (uint32_t i = 0; i < STRESS_FRAMES; ) {
+            if (ring.push(i)) {
+                i++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    uint32_t expected = 0;
+    uint32_t x = 0;
+    while (expected < STRESS_FRAMES) {
+        if (ring.pop(x)) {
+            if (x != expected)
+                break;
+            expected++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+
+    TEST_ASSERT_EQUAL(STRESS_FRAMES, expected);
+    TEST_ASSERT_TRUE(ring.empty());
+}
+
+// As the collectors and FrameQueue::drain(): MateWire frames encoded in place by
+// one thread, and decoded in place by another.
+void test_threads_frames()
+{
+    static FrameRing ring;
+    static const char* topics[] = { "mate/mx-1/stat", "mate/fx-2/stat", "mate/dc-3/stat" };
+
+    std::thread producer([] {
+        for (uint32_t seq = 0; seq < STRESS_FRAMES; ) {
+            MateFrame* frame = ring.reserve();
+            if (frame == nullptr) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            uint8_t status[64];
+            size_t len = 1 + (seq % sizeof(status));
+            fillStatus(seq, status, len);
+
+            MateWire::FrameHeader hdr = {};
+            hdr.type = MateWire::FrameType::Status;
+            hdr.device_type = static_cast<uint8_t>(MateWire::DeviceType::Mx);
+            hdr.port = static_cast<uint8_t>(seq % 3);
+            hdr.seq = seq;
+            hdr.timestamp_ms = 1600000000000ULL + seq;
+            frame->setFrame(topics[seq % 3], hdr, status, len, FRAME_BATCHABLE);
+            ring.commit();
+            seq++;
+        }
+    });
+
+    uint32_t expected = 0;
+    uint32_t errors = 0;
+    while (expected < STRESS_FRAMES) {
+        MateFrame* frame = ring.front();
+        if (frame == nullptr) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        MateWire::FrameHeader hdr;
+        const uint8_t* payload;
+        uint8_t status[64];
+        size_t len = 1 + (expected % sizeof(status));
+        fillStatus(expected, status, len);
+
+        if ((MateWire::decode(frame->payload, frame->size, hdr, payload) != MateWire::DecodeResult::Ok) ||
+            (hdr.seq != expected) ||
+            (hdr.port != (expected % 3)) ||
+            (hdr.timestamp_ms != (1600000000000ULL + expected)) ||
+            (hdr.length != len) ||
+            (memcmp(payload, status, len) != 0) ||
+            (strcmp(frame->topic, topics[expected % 3]) != 0) ||
+            (frame->flags != FRAME_BATCHABLE))
+        {
+            errors++;
+        }
+        ring.release();
+        expected++;
+    }
+    producer.join();
+
+    TEST_ASSERT_EQUAL(0, errors);
+    TEST_ASSERT_EQUAL(STRESS_FRAMES, expected);
+    TEST_ASSERT_TRUE(ring.empty());
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_fill_and_drain);
+    RUN_TEST(test_wraparound);
+    RUN_TEST(test_threads_in_order);
+    RUN_TEST(test_threads_frames);
+    return UNITY_END();
+}
@@ -0,0 +1,181 @@
+// Host tests for the MX, FX and FLEXnet DC status decoders, against known status payloads.
+// Run with `pio test -e native`.
+
+#include <unity.h>
+#include <string.h>
+
+#include <matestatus.h>
+
+using MateWire::DeviceType;
+
+// Status payloads as published in Status frames, with the values they should decode to.
+// (Laid out by hand from pyMATE's packet decoders, not read off a bus.)
+
+// MX: bulk charging at 12.5A from 14A of PV, battery 52.2V, PV 76.0V
+static const uint8_t MX_STATUS[] = {
+    0x05,           // Charge current tenths (low nibble)
+    0x8C,           // Charge current + 128
+    0x8E,           // PV current + 128
+    0x00,           // PV input
+    0x00, 0x2A,     // Daily kWh
+    0x00,           // Errors
+    0x02,           // Charge state (bulk)
+    0x00,           // Aux mode
+    0x02, 0x0A,     // Battery voltage (0.1V)
+    0x02, 0xF8,     // PV voltage (0.1V)
+};
+
+// MX: low battery, float, an error flagged
+static const uint8_t MX_STATUS_FLOAT[] = {
+    0x00, 0x80, 0x80, 0x00, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0xF4, 0x00, 0x00,
+};
+
+// FX (120V model): inverting 6A, AC out 121V, battery 25.4V
+static const uint8_t FX_STATUS_120V[] = {
+    0x06,           // Inverter current
+    0x00,           // Charge current
+    0x00,           // Buy current
+    0x00,           // AC in voltage
+    0x79,           // AC out voltage
+    0x00,           // Sell current
+    0x02,           // Operating mode (inverting)
+    0x00,           // Errors
+    0x00,           // AC mode
+    0x00, 0xFE,     // Battery voltage (0.1V)
+    0x00,           // Misc (model flags)
+    0x00,           // Warnings
+};
+
+// FX (230V model): charging 4A while buying 8A from 230V AC in, battery 26.8V
+static const uint8_t FX_STATUS_230V[] = {
+    0x00, 0x08, 0x10, 0x73, 0x74, 0x00, 0x03, 0x00, 0x02, 0x01, 0x0C, 0x01, 0x00,
+};
+
+// FLEXnet DC: shunt A charging 12.3A, shunt B discharging 12.3A, battery 52.2V at 95%.
+// Only page 0x0A is decoded; the rest of the pages are left as zeros.
+static const uint8_t DC_STATUS[MateWire::DC_STATUS_SIZE] = {
+    0x00, 0x7B,     // Shunt A current (0.1A)
+    0xFF, 0x85,     // Shunt B current (0.1A)
+    0x00, 0x00,     // Shunt C current (0.1A)
+    0x02, 0x0A,     // Battery voltage (0.1V)
+    0x5F,           // State of charge
+};
+
+static float values[MateWire::MAX_STATUS_FIELDS];
+
+static const MateWire::StatusLayout& layout(DeviceType type)
+{
+    const MateWire::StatusLayout* layout = MateWire::statusLayout(type);
+    TEST_ASSERT_NOT_NULL(layout);
+    return *layout;
+}
+
+// Value of a field, by name
+static float field(const MateWire::StatusLayout& layout, const char* name)
+{
+    for (size_t i = 0; i < layout.count; i++) {
+        if (strcmp(layout.fields[i].name, name) == 0)
+            return values[i];
+    }
+    TEST_FAIL_MESSAGE(name);
+    return 0;
+}
+
+void setUp() { }
+void tearDown() { }
+
+void test_mx()
+{
+    const MateWire::StatusLayout& mx = layout(DeviceType::Mx);
+    TEST_ASSERT_TRUE(MateWire::decodeStatus(mx, MX_STATUS, sizeof(MX_STATUS), values));
+
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 12.5f, field(mx, "charge_current"));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 14.0f, field(mx, "pv_current"));
+    TEST_ASSERT_EQUAL_FLOAT(0, field(mx, "errors"));
+    TEST_ASSERT_EQUAL_FLOAT(2, field(mx, "charge_state"));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 52.2f, field(mx, "bat_voltage"));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 76.0f, field(mx, "pv_voltage"));
+}
+
+void test_mx_float()
+{
+    const MateWire::StatusLayout& mx = layout(DeviceType::Mx);
+    TEST_ASSERT_TRUE(MateWire::decodeStatus(mx, MX_STATUS_FLOAT, sizeof(MX_STATUS_FLOAT), values));
+
+    TEST_ASSERT_EQUAL_FLOAT(0, field(mx, "charge_current"));
+    TEST_ASSERT_EQUAL_FLOAT(0, field(mx, "pv_current"));
+    TEST_ASSERT_EQUAL_FLOAT(4, field(mx, "errors"));
+    TEST_ASSERT_EQUAL_FLOAT(1, field(mx, "charge_state"));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 24.4f, field(mx, "bat_voltage"));
+    TEST_ASSERT_EQUAL_FLOAT(0, field(mx, "pv_voltage"));
+}
+
+void test_fx_120v()
+{
+    const MateWire::StatusLayout& fx = layout(DeviceType::Fx);
+    TEST_ASSERT_TRUE(MateWire::decodeStatus(fx, FX_STATUS_120V, sizeof(FX_STATUS_120V), values));
+
+    TEST_ASSERT_EQUAL_FLOAT(6, field(fx, "inv_current"));
+    TEST_ASSERT_EQUAL_FLOAT(0, field(fx, "charge_current"));
+    TEST_ASSERT_EQUAL_FLOAT(0, field(fx, "buy_current"));
+    TEST_ASSERT_EQUAL_FLOAT(0, field(fx, "ac_in_voltage"));
+    TEST_ASSERT_EQUAL_FLOAT(121, field(fx, "ac_out_voltage"));
+    TEST_ASSERT_EQUAL_FLOAT(0, field(fx, "sell_current"));
+    TEST_ASSERT_EQUAL_FLOAT(2, field(fx, "op_mode"));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 25.4f, field(fx, "bat_voltage"));
+}
+
+void test_fx_230v_scaled()
+{
+    const MateWire::StatusLayout& fx = layout(DeviceType::Fx);
+    TEST_ASSERT_TRUE(MateWire::decodeStatus(fx, FX_STATUS_230V, sizeof(FX_STATUS_230V), values));
+
+    // Currents are halved and voltages doubled, the rest are as read
+    TEST_ASSERT_EQUAL_FLOAT(0, field(fx, "inv_current"));
+    TEST_ASSERT_EQUAL_FLOAT(4, field(fx, "charge_current"));
+    TEST_ASSERT_EQUAL_FLOAT(8, field(fx, "buy_current"));
+    TEST_ASSERT_EQUAL_FLOAT(230, field(fx, "ac_in_voltage"));
+    TEST_ASSERT_EQUAL_FLOAT(232, field(fx, "ac_out_voltage"));
+    TEST_ASSERT_EQUAL_FLOAT(3, field(fx, "op_mode"));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 26.8f, field(fx, "bat_voltage"));
+}
+
+void test_dc()
+{
+    const MateWire::StatusLayout& dc = layout(DeviceType::Dc);
+    TEST_ASSERT_TRUE(MateWire::decodeStatus(dc, DC_STATUS, sizeof(DC_STATUS), values));
+
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 12.3f, field(dc, "shunt_a_current"));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, -12.3f, field(dc, "shunt_b_current"));
+    TEST_ASSERT_EQUAL_FLOAT(0, field(dc, "shunt_c_current"));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 52.2f, field(dc, "bat_voltage"));
+    TEST_ASSERT_EQUAL_FLOAT(95, field(dc, "soc"));
+}
+
+void test_short_status_rejected()
+{
+    TEST_ASSERT_FALSE(MateWire::decodeStatus(layout(DeviceType::Mx), MX_STATUS, sizeof(MX_STATUS) - 1, values));
+    TEST_ASSERT_FALSE(MateWire::decodeStatus(layout(DeviceType::Fx), FX_STATUS_120V, sizeof(FX_STATUS_120V) - 1, values));
+
+    // A single DC status page isn't enough
+    TEST_ASSERT_FALSE(MateWire::decodeStatus(layout(DeviceType::Dc), DC_STATUS, 13, values));
+}
+
+void test_no_layout()
+{
+    TEST_ASSERT_NULL(MateWire::statusLayout(DeviceType::Hub));
+    TEST_ASSERT_NULL(MateWire::statusLayout(DeviceType::None));
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_mx);
+    RUN_TEST(test_mx_float);
+    RUN_TEST(test_fx_120v);
+    RUN_TEST(test_fx_230v_scaled);
+    RUN_TEST(test_dc);
+    RUN_TEST(test_short_status_rejected);
+    RUN_TEST(test_no_layout);
+    return UNITY_END();
+}
@@ -0,0 +1,378 @@
+// Host tests for status deltas (MATE_STATUS_DELTA) and their reconstruction.
+// Run with `pio test -e native`.
+
+#include <unity.h>
+#include <vector>
+
+#include <matewire.h>
+#include "mate-collector.h"
+
+using MateWire::FrameHeader;
+using MateWire::StatusReconstructor;
+
+static uint32_t rng_state;
+
+static uint32_t rnd()
+{
+    // xorshift32, so failures are reproducible
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+struct Frame {
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> status;    // What it should reconstruct to
+};
+
+// Publishes status as MateCollector::publishStatusFrame() does with MATE_STATUS_DELTA
+struct Publisher {
+    uint16_t boot;
+    uint32_t seq;
+    uint32_t session;
+    uint32_t keyframe_session;
+    uint32_t keyframe_seq;
+    size_t   cycles;
+    std::vector<uint8_t> keyframe;
+
+    Publisher(uint16_t boot)
+        : boot(boot), seq(0), session(0), keyframe_session(0), keyframe_seq(0), cycles(0)
+    { }
+
+    // Returns false if the status was unchanged (nothing published)
+    bool publish(const std::vector<uint8_t>& status, const std::vector<uint8_t>& last, Frame& frame) {
+        uint8_t payload[MAX_STATUS_RESP_SIZE];
+        size_t size = status.size();
+        uint8_t flags = MateWire::FLAG_NONE;
+
+        bool key = keyframe.empty() || (keyframe.size() != size) ||
+                   (cycles >= STATUS_KEYFRAME_INTERVAL) || (keyframe_session != session);
+        if (!key) {
+            cycles++;
+            if (status == last)
+                return false;
+
+            size = MateWire::encodeDelta(payload, sizeof(payload), keyframe_seq, keyframe.data(), status.data(), status.size());
+            key = (size == 0) || (size >= status.size());
+            flags = MateWire::FLAG_DELTA;
+        }
+        if (key) {
+            keyframe = status;
+            keyframe_seq = seq;
+            keyframe_session = session;
+            cycles = 0;
+            memcpy(payload, status.data(), status.size());
+            size = status.size();
+            flags = MateWire::FLAG_NONE;
+        }
+
+        FrameHeader hdr = {};
+        hdr.type = MateWire::FrameType::Status;
+        hdr.device_type = static_cast<uint8_t>(MateWire::DeviceType::Mx);
+        hdr.port = 1;
+        hdr.flags = flags;
+        hdr.seq = seq++;
+        hdr.timestamp_ms = 1600000000000ULL + (hdr.seq * 1000);
+        hdr.boot = boot;
+
+        frame.data.resize(MateWire::encodedSize(size));
+        TEST_ASSERT_EQUAL(frame.data.size(), MateWire::encode(frame.data.data(), frame.data.size(), hdr, payload, size));
+        frame.status = status;
+        return true;
+    }
+};
+
+// A status that drifts: one of the first few bytes (eg. a current) changes most cycles
+static void mutate(std::vector<uint8_t>& status)
+{
+    if ((rnd() % 4) != 0) {
+        status[rnd() % ((status.size() < 4) ? status.size() : 4)] = static_cast<uint8_t>(rnd());
+    }
+}
+
+// Generate n cycles of frames
+static std::vector<Frame> run(Publisher& pub, std::vector<uint8_t>& status, size_t n, size_t session_every = 0)
+{
+    std::vector<Frame> frames;
+    for (size_t i = 0; i < n; i++) {
+        if ((session_every > 0) && (i > 0) && ((i % session_every) == 0)) {
+            pub.session++;  // Reconnected
+        }
+        std::vector<uint8_t> last = status;
+        mutate(status);
+
+        Frame frame;
+        if (pub.publish(status, last, frame)) {
+            frames.push_back(frame);
+        }
+    }
+    return frames;
+}
+
+// Returns true if the frame reconstructs to exactly its original status
+static bool reconstruct(StatusReconstructor& rec, const Frame& frame)
+{
+    FrameHeader hdr;
+    const uint8_t* payload;
+    TEST_ASSERT_TRUE(MateWire::decode(frame.data.data(), frame.data.size(), hdr, payload) == MateWire::DecodeResult::Ok);
+
+    uint8_t out[StatusReconstructor::MAX_STATUS_SIZE];
+    size_t out_len = 0;
+    if (!rec.update(hdr, payload, out, sizeof(out), out_len))
+        return false;
+
+    TEST_ASSERT_EQUAL(frame.status.size(), out_len);
+    TEST_ASSERT_EQUAL_MEMORY(frame.status.data(), out, out_len);
+    return true;
+}
+
+static bool isDelta(const Frame& frame)
+{
+    return (frame.data[5] & MateWire::FLAG_DELTA) != 0;
+}
+
+void setUp()
+{
+    rng_state = 0x12345678;
+}
+
+void tearDown() { }
+
+void test_delta_roundtrip()
+{
+    for (size_t iter = 0; iter < 2000; iter++) {
+        size_t len = 1 + (rnd() % StatusReconstructor::MAX_STATUS_SIZE);
+        std::vector<uint8_t> base(len), cur(len);
+        for (size_t i = 0; i < len; i++) {
+            base[i] = static_cast<uint8_t>(rnd());
+        }
+        cur = base;
+
+        // Sparse changes, dense runs, everything, or nothing
+        switch (iter % 4) {
+            case 0: for (size_t i = 0; i < 3; i++) cur[rnd() % len] ^= 0x5A; break;
+            case 1: for (size_t i = rnd() % len; i < len; i += 1 + (rnd() % 3)) cur[i] ^= 0xFF; break;
+            case 2: for (size_t i = 0; i < len; i++) cur[i] = static_cast<uint8_t>(~base[i]); break;
+            default: break;
+        }
+
+        uint8_t delta[1024];
+        size_t n = MateWire::encodeDelta(delta, sizeof(delta), 42, base.data(), cur.data(), len);
+        TEST_ASSERT_GREATER_THAN(0, n);
+        TEST_ASSERT_EQUAL(42, MateWire::deltaBaseSeq(delta, n));
+
+        std::vector<uint8_t> out = base;
+        TEST_ASSERT_TRUE(MateWire::applyDelta(out.data(), len, delta, n));
+        TEST_ASSERT_EQUAL_MEMORY(cur.data(), out.data(), len);
+    }
+}
+
+void test_delta_too_large()
+{
+    uint8_t base[64] = {0};
+    uint8_t cur[64];
+    memset(cur, 0xFF, sizeof(cur));
+
+    uint8_t delta[32];
+    TEST_ASSERT_EQUAL(0, MateWire::encodeDelta(delta, sizeof(delta), 1, base, cur, sizeof(cur)));
+}
+
+void test_delta_malformed()
+{
+    uint8_t base[16] = {0};
+    uint8_t cur[16] = {0};
+    cur[3] = 1;
+    cur[12] = 2;
+
+    uint8_t delta[64];
+    size_t n = MateWire::encodeDelta(delta, sizeof(delta), 1, base, cur, sizeof(cur));
+
+    // Every truncation either fails, or applies fewer runs (never writes out of bounds)
+    for (size_t len = 0; len < n; len++) {
+        uint8_t out[16] = {0};
+        bool ok = MateWire::applyDelta(out, sizeof(out), delta, len);
+        TEST_ASSERT_TRUE(!ok || (len >= MateWire::DELTA_HEADER_SIZE));
+    }
+
+    // Runs past the end of the status
+    uint8_t out[8] = {0};
+    TEST_ASSERT_FALSE(MateWire::applyDelta(out, sizeof(out), delta, n));
+}
+
+void test_keyframe_interval()
+{
+    Publisher pub(0x1111);
+    std::vector<uint8_t> status(STATUS_RESP_SIZE, 0);
+    std::vector<Frame> frames = run(pub, status, 10 * STATUS_KEYFRAME_INTERVAL);
+
+    StatusReconstructor rec;
+    size_t deltas = 0;
+    for (const Frame& frame : frames) {
+        TEST_ASSERT_TRUE(reconstruct(rec, frame));
+        deltas += isDelta(frame) ? 1 : 0;
+    }
+    TEST_ASSERT_GREATER_THAN(frames.size() / 2, deltas);
+    TEST_ASSERT_LESS_THAN(frames.size(), deltas);
+    TEST_ASSERT_EQUAL(0, rec.missingKeyframeCount());
+}
+
+void test_session_bump()
+{
+    Publisher pub(0x1111);
+    std::vector<uint8_t> status(DC_STATUS_RESP_SIZE, 0);
+    std::vector<Frame> frames = run(pub, status, 200, 7);
+
+    // A new session always starts with a keyframe, so a server that only
+    // sees frames from then on can reconstruct everything
+    StatusReconstructor rec;
+    size_t from = 0;
+    uint32_t session_seq = pub.keyframe_seq;
+    for (size_t i = 0; i < frames.size(); i++) {
+        FrameHeader hdr;
+        const uint8_t* payload;
+        MateWire::decode(frames[i].data.data(), frames[i].data.size(), hdr, payload);
+        if (hdr.seq == session_seq) {
+            from = i;
+        }
+    }
+    TEST_ASSERT_FALSE(isDelta(frames[from]));
+    for (size_t i = from; i < frames.size(); i++) {
+        TEST_ASSERT_TRUE(reconstruct(rec, frames[i]));
+    }
+    TEST_ASSERT_EQUAL(0, rec.missingKeyframeCount());
+}
+
+void test_dropped_frames()
+{
+    Publisher pub(0x1111);
+    std::vector<uint8_t> status(DC_STATUS_RESP_SIZE, 0);
+    std::vector<Frame> frames = run(pub, status, 10 * STATUS_KEYFRAME_INTERVAL);
+
+    // Lost deltas don't matter, every delta is against the keyframe
+    StatusReconstructor rec;
+    bool dropped_key = false;
+    size_t missed = 0;
+    for (size_t i = 0; i < frames.size(); i++) {
+        if (isDelta(frames[i]) && ((rnd() % 3) == 0))
+            continue;
+
+        // Drop one keyframe part way through, its deltas can't be reconstructed
+        if (!isDelta(frames[i]) && (i > frames.size() / 2) && !dropped_key) {
+            dropped_key = true;
+            continue;
+        }
+
+        if (!reconstruct(rec, frames[i])) {
+            TEST_ASSERT_TRUE(dropped_key);
+            TEST_ASSERT_TRUE(isDelta(frames[i]));
+            missed++;
+        }
+    }
+    TEST_ASSERT_TRUE(dropped_key);
+    TEST_ASSERT_GREATER_THAN(0, missed);
+    TEST_ASSERT_EQUAL(missed, rec.missingKeyframeCount());
+
+    // Everything after the next keyframe reconstructs again
+    Frame frame;
+    std::vector<uint8_t> last = status;
+    pub.cycles = STATUS_KEYFRAME_INTERVAL;
+    mutate(status);
+    status[0] ^= 1;
+    TEST_ASSERT_TRUE(pub.publish(status, last, frame));
+    TEST_ASSERT_FALSE(isDelta(frame));
+    TEST_ASSERT_TRUE(reconstruct(rec, frame));
+}
+
+// Frames replayed from the outage buffer arrive after newer live frames
+void test_replayed_late()
+{
+    Publisher pub(0x1111);
+    std::vector<uint8_t> status(STATUS_RESP_SIZE, 0);
+    std::vector<Frame> buffered = run(pub, status, STATUS_KEYFRAME_INTERVAL / 2, 0);
+    pub.session++;
+    std::vector<Frame> live = run(pub, status, STATUS_KEYFRAME_INTERVAL * 2, 0);
+
+    StatusReconstructor rec;
+    for (const Frame& frame : live) {
+        TEST_ASSERT_TRUE(reconstruct(rec, frame));
+    }
+    for (const Frame& frame : buffered) {
+        TEST_ASSERT_TRUE(reconstruct(rec, frame));
+    }
+}
+
+// After a reboot, sequence numbers restart: deltas from before it (replayed from flash)
+// must not be applied to the new keyframe with the same sequence number
+void test_reboot()
+{
+    std::vector<uint8_t> status(STATUS_RESP_SIZE, 0);
+    Publisher before(0x1111);
+    std::vector<Frame> old_frames = run(before, status, STATUS_KEYFRAME_INTERVAL / 2);
+
+    std::vector<uint8_t> rebooted(STATUS_RESP_SIZE, 0xAA);
+    Publisher after(0x2222);
+    std::vector<Frame> new_frames = run(after, rebooted, STATUS_KEYFRAME_INTERVAL / 2);
+
+    // Both start with keyframe 0
+    TEST_ASSERT_FALSE(isDelta(old_frames[0]));
+    TEST_ASSERT_FALSE(isDelta(new_frames[0]));
+
+    StatusReconstructor rec;
+    TEST_ASSERT_TRUE(reconstruct(rec, old_frames[0]));
+    TEST_ASSERT_TRUE(reconstruct(rec, new_frames[0]));
+    for (size_t i = 1; i < old_frames.size(); i++) {
+        TEST_ASSERT_TRUE(reconstruct(rec, old_frames[i]));
+    }
+    for (size_t i = 1; i < new_frames.size(); i++) {
+        TEST_ASSERT_TRUE(reconstruct(rec, new_frames[i]));
+    }
+
+    // Without the old keyframe, old deltas are rejected rather than misapplied
+    StatusReconstructor fresh;
+    TEST_ASSERT_TRUE(reconstruct(fresh, new_frames[0]));
+    for (size_t i = 1; i < old_frames.size(); i++) {
+        if (isDelta(old_frames[i])) {
+            TEST_ASSERT_FALSE(reconstruct(fresh, old_frames[i]));
+        }
+    }
+}
+
+void test_sequence_tracker()
+{
+    MateWire::SequenceTracker tracker;
+    for (uint32_t seq = 100; seq < 110; seq++) {
+        TEST_ASSERT_EQUAL(0, tracker.update(0x1111, seq));
+    }
+    TEST_ASSERT_EQUAL(2, tracker.update(0x1111, 112));
+    TEST_ASSERT_EQUAL(2, tracker.lostCount());
+
+    // Rebooted: a new sequence, not late frames
+    TEST_ASSERT_EQUAL(0, tracker.update(0x2222, 0));
+    TEST_ASSERT_EQUAL(0, tracker.update(0x2222, 1));
+    TEST_ASSERT_EQUAL(0, tracker.recoveredCount());
+
+    // Frames from before the reboot, replayed from flash
+    TEST_ASSERT_EQUAL(0, tracker.update(0x1111, 110));
+    TEST_ASSERT_EQUAL(1, tracker.recoveredCount());
+    TEST_ASSERT_EQUAL(1, tracker.lostCount());
+
+    TEST_ASSERT_EQUAL(0, tracker.update(0x2222, 2));
+    TEST_ASSERT_EQUAL(1, tracker.update(0x2222, 4));
+    TEST_ASSERT_EQUAL(2, tracker.lostCount());
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_delta_roundtrip);
+    RUN_TEST(test_delta_too_large);
+    RUN_TEST(test_delta_malformed);
+    RUN_TEST(test_keyframe_interval);
+    RUN_TEST(test_session_bump);
+    RUN_TEST(test_dropped_frames);
+    RUN_TEST(test_replayed_late);
+    RUN_TEST(test_reboot);
+    RUN_TEST(test_sequence_tracker);
+    return UNITY_END();
+}
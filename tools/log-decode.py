@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+#
+# Binary Log Decoder
+#
+# Decodes the serial output of firmware built with LOG_BINARY, where LOG_* calls
+# send a hash of their format string plus the raw arguments instead of text
+# (see src/log.h). The format strings are recovered by scanning the source.
+# Plain text output is passed through unchanged.
+#
+# Example Usage:
+# pio device monitor --raw | python tools/log-decode.py src
+#
+
+import re
+import struct
+import sys
+from pathlib import Path
+
+LOG_BINARY_MARKER = 0x1E
+
+LEVEL_PREFIX = {
+    'ERROR':    'ERROR: ',
+    'WARN':     'WARNING: ',
+    'INFO':     '',
+    'DEBUG':    '',
+}
+
+# LOG_xxx("format" "continued", ...)
+LOG_CALL = re.compile(r'\bLOG_(ERROR|WARN|INFO|DEBUG)\(\s*((?:"(?:[^"\\]|\\.)*"\s*)+)')
+LITERAL = re.compile(r'"((?:[^"\\]|\\.)*)"')
+
+# printf conversion, with the C length modifiers Python doesn't accept
+CONVERSION = re.compile(r'%([-+ #0]*\d*(?:\.\d+)?)(?:hh|h|ll|l|z|j|t|L)?([diouxXeEfgGcs%])')
+
+def fnv1a(data):
+    h = 2166136261
+    for b in data:
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+def unescape(s):
+    return s.encode('latin-1').decode('unicode_escape').encode('latin-1')
+
+def scan_formats(dirs):
+    """
+    Map format id -> format string, for every LOG_* call in the source
+    """
+    formats = {}
+    for d in dirs:
+        for path in Path(d).rglob('*'):
+            if path.suffix not in ('.c', '.cpp', '.h'):
+                continue
+            text = path.read_text(errors='ignore')
+            for m in LOG_CALL.finditer(text):
+                fmt = LEVEL_PREFIX[m.group(1)].encode() + b''.join(unescape(s) for s in LITERAL.findall(m.group(2)))
+                formats[fnv1a(fmt)] = fmt.decode('latin-1')
+    return formats
+
+def decode_args(data):
+    args = []
+    pos = 0
+    while pos < len(data):
+        tag = chr(data[pos])
+        pos += 1
+        if tag == 'i':
+            args.append(struct.unpack_from('<i', data, pos)[0]); pos += 4
+        elif tag == 'u':
+            args.append(struct.unpack_from('<I', data, pos)[0]); pos += 4
+        elif tag == 'q':
+            args.append(struct.unpack_from('<q', data, pos)[0]); pos += 8
+        elif tag == 'Q':
+            args.append(struct.unpack_from('<Q', data, pos)[0]); pos += 8
+        elif tag == 'f':
+            args.append(struct.unpack_from('<f', data, pos)[0]); pos += 4
+        elif tag == 'c':
+            args.append(chr(data[pos])); pos += 1
+        elif tag == 's':
+            n = data[pos]
+            args.append(data[pos + 1:pos + 1 + n].decode('latin-1')); pos += 1 + n
+        else:
+            raise ValueError(f'Unknown argument type {tag!r}')
+    return args
+
+def format_record(formats, record):
+    (fmt_id,) = struct.unpack_from('<I', record, 0)
+    fmt = formats.get(fmt_id)
+    try:
+        args = decode_args(record[4:])
+    except (ValueError, struct.error) as e:
+        return f'<bad log record {fmt_id:08X}: {e}>'
+    if fmt is None:
+        return f'<unknown format {fmt_id:08X}> {args}'
+    try:
+        return CONVERSION.sub(r'%\1\2', fmt) % tuple(args)
+    except (TypeError, ValueError):
+        return f'{fmt} {args}'
+
+def main():
+    dirs = sys.argv[1:] or ['src']
+    formats = scan_formats(dirs)
+
+    stream = sys.stdin.buffer
+    out = sys.stdout
+    while True:
+        c = stream.read(1)
+        if not c:
+            break
+        if c[0] != LOG_BINARY_MARKER:
+            out.write(c.decode('latin-1'))
+            continue
+
+        length = stream.read(1)
+        if not length:
+            break
+        record = stream.read(length[0])
+        out.write(format_record(formats, record) + '\n')
+        out.flush()
+
+if __name__ == '__main__':
+    main()